@@ -0,0 +1,304 @@
+// Two tables.
+//
+// The first one is a stage-only micro-benchmark. It times the stage every filter runs after
+// it has moved its particles: normalizing the weights, the log-likelihood, the expectations
+// and resampling. "baseline" imitates the way the filters used to do it (one max/sum-exp pass
+// for the likelihood, another exp pass per functional, and a resampler that exponentiates
+// the log weights again), but it resamples with today's mn_resampler. "candidate" is FilterCore,
+// which all filters use now. Propagation isn't timed, so this table alone doesn't show that
+// any filter got faster or slower.
+//
+// The second one times whole BSFilter::filter() calls on an AR(1) model. "baseline" is a copy
+// of the bootstrap filter loop (and the multinomial resampler) from before FilterCore, and
+// "candidate" is BSFilter itself, with the same model and the same number of particles.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/bootstrap_filter.h>
+#include <pf/filter_core.h>
+#include <pf/resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+
+using ssv       = Eigen::Matrix<FLOATTYPE, 1, 1>;
+using Mat       = Eigen::Matrix<FLOATTYPE, Eigen::Dynamic, Eigen::Dynamic>;
+using arrayVec  = part_array<ssv, dynamic_parts>;
+using arrayFloat= part_array<FLOATTYPE, dynamic_parts>;
+using Funcs     = std::vector<std::function<const Mat(const ssv&)>>;
+using resamp_t  = mn_resampler<dynamic_parts, 1, FLOATTYPE>;
+
+
+// the post-propagation stage as it was written in each filter before FilterCore
+FLOATTYPE baseline_stage(arrayVec &parts, arrayFloat &logWts, const Funcs &fs, std::vector<Mat> &expectations, resamp_t &resampler)
+{
+    const size_t N = logWts.size();
+
+    FLOATTYPE m = *std::max_element(logWts.begin(), logWts.end());
+    FLOATTYPE sumExp(0.0);
+    for(size_t i = 0; i < N; ++i)
+        sumExp += std::exp(logWts[i] - m);
+    FLOATTYPE lse = m + std::log(sumExp);
+
+    expectations.resize(fs.size());
+    for(size_t k = 0; k < fs.size(); ++k){
+        Mat numer = Mat::Zero(fs[k](parts[0]).rows(), fs[k](parts[0]).cols());
+        FLOATTYPE denom(0.0);
+        for(size_t i = 0; i < N; ++i){
+            numer += fs[k](parts[i]) * std::exp(logWts[i] - m);
+            denom += std::exp(logWts[i] - m);
+        }
+        expectations[k] = numer/denom;
+    }
+
+    resampler.resampLogWts(parts, logWts);
+    return lse;
+}
+
+
+// the same stage through FilterCore
+FLOATTYPE core_stage(arrayVec &parts, arrayFloat &logWts, const Funcs &fs, FilterCore<dynamic_parts, ssv, FLOATTYPE> &core, resamp_t &resampler)
+{
+    FLOATTYPE lse = core.weigh(logWts).logSumExp();
+    core.expect(fs, [&](const auto &h, size_t i) { return h(parts[i]); });
+    resampler.resampNormWts(parts, logWts, core.normWeights());
+    return lse;
+}
+
+
+// AR(1) state, observed with N(0, 1) noise
+struct ar1
+{
+    std::mt19937 gen;
+    std::normal_distribution<FLOATTYPE> z;
+
+    ar1() : gen(1) {}
+
+    static FLOATTYPE logNorm(FLOATTYPE x, FLOATTYPE mean, FLOATTYPE var) { return -.5*(x - mean)*(x - mean)/var - .5*std::log(2*M_PI*var); }
+
+    FLOATTYPE logMuEv(const ssv &x1) { return logNorm(x1(0), 0.0, 1.0/.19); }
+    ssv q1Samp(const ssv &) { return ssv::Constant(z(gen)/std::sqrt(.19)); }
+    FLOATTYPE logQ1Ev(const ssv &x1, const ssv &) { return logMuEv(x1); }
+    FLOATTYPE logGEv(const ssv &yt, const ssv &xt) { return logNorm(yt(0), xt(0), 1.0); }
+    ssv fSamp(const ssv &xtm1) { return ssv::Constant(.9*xtm1(0) + z(gen)); }
+};
+
+
+// BSFilter and the multinomial resampler as they were before FilterCore
+// (compile-time nparts only, and the debug printing taken out)
+template<size_t nparts>
+class legacy_bs
+{
+public:
+    using arrayVec = std::array<ssv, nparts>;
+    using arrayFloat = std::array<FLOATTYPE, nparts>;
+
+    legacy_bs() : m_now(0), m_logLastCondLike(0.0), m_resampSched(1), m_gen(1)
+    {
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+
+    FLOATTYPE getLogCondLike() const { return m_logLastCondLike; }
+
+    void filter(const ssv &dat, const Funcs &fs)
+    {
+        if(m_now > 0)
+        {
+            ssv newSamp;
+            FLOATTYPE maxOldLogUnNormWts(-1.0/0.0);
+            arrayFloat oldLogUnNormWts = m_logUnNormWeights;
+            for(size_t ii = 0; ii < nparts; ++ii)
+            {
+                if (m_logUnNormWeights[ii] > maxOldLogUnNormWts)
+                    maxOldLogUnNormWts = m_logUnNormWeights[ii];
+                newSamp = m_model.fSamp(m_particles[ii]);
+                m_logUnNormWeights[ii] = m_model.logGEv(dat, newSamp);
+                m_particles[ii] = newSamp;
+            }
+
+            FLOATTYPE maxNumer = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
+            FLOATTYPE sumExp1(0.0);
+            FLOATTYPE sumExp2(0.0);
+            for(size_t i = 0; i < nparts; ++i){
+                sumExp1 += std::exp(m_logUnNormWeights[i] - maxNumer);
+                sumExp2 += std::exp(oldLogUnNormWts[i] - maxOldLogUnNormWts);
+            }
+            m_logLastCondLike = maxNumer + std::log(sumExp1) - maxOldLogUnNormWts - std::log(sumExp2);
+
+            int fId(0);
+            for(auto & h : fs){
+                Mat testOutput = h(m_particles[0]);
+                Mat numer = Mat::Zero(testOutput.rows(), testOutput.cols());
+                FLOATTYPE weightNormConst (0.0);
+                for(size_t prtcl = 0; prtcl < nparts; ++prtcl){
+                    numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - maxNumer);
+                    weightNormConst += std::exp(m_logUnNormWeights[prtcl] - maxNumer);
+                }
+                m_expectations[fId] = numer/weightNormConst;
+                fId++;
+            }
+
+            if ( (m_now+1) % m_resampSched == 0)
+                resampLogWts(m_particles, m_logUnNormWeights);
+            m_now += 1;
+        }
+        else
+        {
+            for(size_t ii = 0; ii < nparts; ++ii)
+            {
+                m_particles[ii] = m_model.q1Samp(dat);
+                m_logUnNormWeights[ii] = m_model.logMuEv(m_particles[ii]);
+                m_logUnNormWeights[ii] += m_model.logGEv(dat, m_particles[ii]);
+                m_logUnNormWeights[ii] -= m_model.logQ1Ev(m_particles[ii], dat);
+            }
+
+            FLOATTYPE max = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
+            FLOATTYPE sumExp(0.0);
+            for(size_t i = 0; i < nparts; ++i)
+                sumExp += std::exp(m_logUnNormWeights[i] - max);
+            m_logLastCondLike = -std::log(nparts) + (max) + std::log(sumExp);
+
+            m_expectations.resize(fs.size());
+            unsigned int fId(0);
+            for(auto & h : fs){
+                Mat testOutput = h(m_particles[0]);
+                Mat numer = Mat::Zero(testOutput.rows(), testOutput.cols());
+                FLOATTYPE weightNormConst (0.0);
+                for(size_t prtcl = 0; prtcl < nparts; ++prtcl){
+                    numer += h(m_particles[prtcl]) * std::exp( m_logUnNormWeights[prtcl] - (max) );
+                    weightNormConst += std::exp( m_logUnNormWeights[prtcl] - (max) );
+                }
+                m_expectations[fId] = numer/weightNormConst;
+                fId++;
+            }
+
+            if ( (m_now+1) % m_resampSched == 0)
+                resampLogWts(m_particles, m_logUnNormWeights);
+            m_now += 1;
+        }
+    }
+
+private:
+    ar1 m_model;
+    arrayVec m_particles;
+    arrayFloat m_logUnNormWeights;
+    unsigned int m_now;
+    FLOATTYPE m_logLastCondLike;
+    unsigned int m_resampSched;
+    std::vector<Mat> m_expectations;
+    std::mt19937 m_gen;
+
+    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
+    {
+        arrayFloat w;
+        FLOATTYPE m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
+        std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(),
+                        [&m](FLOATTYPE& d) -> FLOATTYPE { return std::exp( d - m ); } );
+        std::discrete_distribution<> idxSampler(w.begin(), w.end());
+        arrayVec tmpPartics = oldParts;
+        unsigned int whichPart;
+        for(size_t part = 0; part < nparts; ++part)
+        {
+            whichPart = idxSampler(m_gen);
+            tmpPartics[part] = oldParts[whichPart];
+        }
+        oldParts = std::move(tmpPartics);
+        std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+    }
+};
+
+
+// the same model through today's BSFilter
+template<size_t nparts>
+class ar1_bs : public BSFilter<nparts, 1, 1, mn_resampler<nparts, 1, FLOATTYPE>, FLOATTYPE>
+{
+public:
+    ar1 m_model;
+
+    FLOATTYPE logMuEv(const ssv &x1) override { return m_model.logMuEv(x1); }
+    ssv q1Samp(const ssv &y1) override { return m_model.q1Samp(y1); }
+    FLOATTYPE logQ1Ev(const ssv &x1, const ssv &y1) override { return m_model.logQ1Ev(x1, y1); }
+    FLOATTYPE logGEv(const ssv &yt, const ssv &xt) override { return m_model.logGEv(yt, xt); }
+    ssv fSamp(const ssv &xtm1) override { return m_model.fSamp(xtm1); }
+};
+
+
+// times one filter() call (the filters run on, so every call after the first resamples and propagates)
+template<size_t nparts>
+void time_filters(const Funcs &fs)
+{
+    // both are big with a compile-time nparts, so they go on the heap
+    auto legacy = std::make_unique<legacy_bs<nparts>>();
+    auto current = std::make_unique<ar1_bs<nparts>>();
+    ssv y;
+    int t(0);
+    double baseline = median_usec([&]{
+        y(0) = std::sin(t++);
+        legacy->filter(y, fs);
+        bench_sink = bench_sink + legacy->getLogCondLike();
+    });
+    t = 0;
+    double candidate = median_usec([&]{
+        y(0) = std::sin(t++);
+        current->filter(y, fs);
+        bench_sink = bench_sink + current->getLogCondLike();
+    });
+    print_row("BSFilter::filter()", nparts, baseline, candidate);
+}
+
+
+int main()
+{
+    Funcs fs;
+    fs.push_back([](const ssv &x) -> const Mat { return x; });
+    fs.push_back([](const ssv &x) -> const Mat { return x*x; });
+
+    print_header("weights + likelihood + 2 expectations + multinomial resampling");
+    for(size_t N : {1000, 10000, 100000}){
+
+        std::mt19937 gen(1);
+        std::normal_distribution<FLOATTYPE> z;
+        arrayVec srcParts = part_storage<ssv, dynamic_parts>::make(N);
+        arrayFloat srcWts = part_storage<FLOATTYPE, dynamic_parts>::make(N);
+        for(size_t i = 0; i < N; ++i){
+            srcParts[i] = ssv::Constant(z(gen));
+            srcWts[i] = -.5*z(gen)*z(gen);
+        }
+
+        arrayVec parts;
+        arrayFloat logWts;
+        std::vector<Mat> expectations;
+        resamp_t resampler;
+        resampler.setSeed(1);
+        double baseline = median_usec([&]{
+            parts = srcParts;
+            logWts = srcWts;
+            bench_sink = bench_sink + baseline_stage(parts, logWts, fs, expectations, resampler);
+        });
+
+        for(unsigned int nthreads : {1u, 4u}){
+            FilterCore<dynamic_parts, ssv, FLOATTYPE> core(1, nthreads, N);
+            double candidate = median_usec([&]{
+                parts = srcParts;
+                logWts = srcWts;
+                bench_sink = bench_sink + core_stage(parts, logWts, fs, core, resampler);
+            });
+            print_row(nthreads == 1 ? "FilterCore (1 thread)" : "FilterCore (4 threads)", N, baseline, candidate);
+        }
+    }
+
+    print_header("BSFilter::filter() end to end, pre-FilterCore loop vs now (1 thread)");
+    time_filters<1000>(fs);
+    time_filters<10000>(fs);
+    time_filters<100000>(fs);
+
+    return 0;
+}
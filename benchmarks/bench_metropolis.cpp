@@ -0,0 +1,86 @@
+// Compares the Metropolis and rejection resamplers with multinomial and systematic
+// resampling at 1M particles, for mildly and strongly uneven weights.
+// Besides the time, it reports the bias: how far the resampled mean of the log
+// weights lands from their weighted mean, averaged over a few runs. Metropolis
+// resampling trades this bias for fewer steps; the others are unbiased, so their
+// column only shows the Monte Carlo error. Rejection resampling needs about
+// N max_i w_i / sum_i w_i tries per particle, so it is kept to fairly even weights here.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/resamplers.h>
+#include <pf/parallel_resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+#define DIMSTATE  1
+#define NUMREPS   3
+
+
+template<typename resamp_t, typename... ctor_args>
+void time_and_bias(const char *name, const std::vector<FLOATTYPE> &srcLogWts, FLOATTYPE target, ctor_args... args)
+{
+    using ssv = typename resamp_t::ssv;
+    const size_t N = srcLogWts.size();
+    typename resamp_t::arrayVec parts(N);
+    typename resamp_t::arrayFloat logWts(N);
+    resamp_t r(args...);
+    r.setSeed(1);
+
+    // each particle's state is its own log weight
+    double bias(0.0);
+    double usec = median_usec([&]{
+        for(size_t i = 0; i < N; ++i)
+            parts[i] = ssv::Constant(srcLogWts[i]);
+        std::copy(srcLogWts.begin(), srcLogWts.end(), logWts.begin());
+        r.resampLogWts(parts, logWts);
+        double mean(0.0);
+        for(const auto &p : parts)
+            mean += p(0) / N;
+        bias += (mean - target) / NUMREPS;
+    }, NUMREPS);
+    std::printf("%-28s %10zu %14.1f %12.1f %+14.2e\n", name, N, usec, N / usec, bias);
+}
+
+
+int main()
+{
+    const size_t N = 1000000;
+    std::mt19937 gen(1);
+    std::normal_distribution<FLOATTYPE> z;
+    for(FLOATTYPE sigma : {0.5, 1.0}){
+
+        std::vector<FLOATTYPE> logWts(N);
+        for(auto &lw : logWts)
+            lw = sigma * z(gen);
+        FLOATTYPE maxLw = *std::max_element(logWts.begin(), logWts.end());
+        double sumW(0.0), sumWX(0.0);
+        for(auto lw : logWts){
+            sumW += std::exp(lw - maxLw);
+            sumWX += std::exp(lw - maxLw) * lw;
+        }
+        const FLOATTYPE target = sumWX / sumW;
+
+        std::printf("\nlog weights ~ N(0, %.2f)\n", sigma*sigma);
+        std::printf("%-28s %10s %14s %12s %14s\n", "resampler", "N", "time(us)", "parts/us", "bias");
+        time_and_bias<mn_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>("multinomial", logWts, target);
+        time_and_bias<systematic_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>("systematic", logWts, target);
+        for(unsigned int nthreads : {1u, 4u}){
+            char name[64];
+            std::snprintf(name, sizeof(name), "rejection (%u threads)", nthreads);
+            time_and_bias<par_rejection_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(name, logWts, target, nthreads);
+            for(unsigned int steps : {5u, 20u, 50u}){
+                std::snprintf(name, sizeof(name), "metropolis B=%u (%u threads)", steps, nthreads);
+                time_and_bias<par_metropolis_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(name, logWts, target, steps, nthreads);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Compares drawing normals one at a time (sample(), through std::normal_distribution)
+// with the bulk Box-Muller path (fill() and sampleMany(), through fill_std_normal()).
+//
+// 1. UnivNormSampler: nanoseconds per draw for float and double, on mt19937 and philox4x32,
+// 2. MVNSampler: nanoseconds per vector for a few dimensions, one sample() per vector
+//    against one sampleMany() for the whole batch, with the covariance set by setCovar()
+//    (a full eigenvector scale matrix) and by setCovarChol() (a triangular factor),
+// 3. the cost of changing the covariance by a rank one term: setCovar() and setCovarChol()
+//    on the new matrix, against rankUpdate() on the old factor.
+
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/rv_samp.h>
+
+#include "bench_utils.h"
+
+#define NUMDRAWS 1000000
+#define NUMVECS  100000
+
+
+template<typename float_t, typename rng_t>
+void univ(const char *name)
+{
+    rvsamp::UnivNormSampler<float_t, rng_t> s(1.0, 2.0);
+    s.setSeed(1);
+    std::vector<float_t> out(NUMDRAWS);
+
+    double one = median_usec([&]{
+        for(auto &x : out)
+            x = s.sample();
+        bench_sink = bench_sink + out[NUMDRAWS/2];
+    }, 11);
+    double bulk = median_usec([&]{
+        s.fill(out.data(), out.size());
+        bench_sink = bench_sink + out[NUMDRAWS/2];
+    }, 11);
+    std::printf("%-28s %12.2f %12.2f %9.2fx\n", name, 1e3*one/NUMDRAWS, 1e3*bulk/NUMDRAWS, one/bulk);
+}
+
+
+template<size_t dim>
+void mvn(bool chol)
+{
+    using samp_t = rvsamp::MVNSampler<dim, double>;
+    typename samp_t::Mat cov = samp_t::Mat::Identity() + samp_t::Mat::Constant(.5);
+    samp_t s;
+    if(chol)
+        s.setCovarChol(cov);
+    else
+        s.setCovar(cov);
+    s.setSeed(1);
+    typename samp_t::Mats out(dim, NUMVECS);
+
+    double one = median_usec([&]{
+        for(Eigen::Index j = 0; j < out.cols(); ++j)
+            out.col(j) = s.sample();
+        bench_sink = bench_sink + out(0, NUMVECS/2);
+    }, 11);
+    double bulk = median_usec([&]{
+        s.sampleMany(out);
+        bench_sink = bench_sink + out(0, NUMVECS/2);
+    }, 11);
+    std::printf("MVNSampler<%2zu> %-13s %12.2f %12.2f %9.2fx\n", dim, chol ? "setCovarChol" : "setCovar", 1e3*one/NUMVECS, 1e3*bulk/NUMVECS, one/bulk);
+}
+
+
+template<size_t dim>
+void update()
+{
+    using samp_t = rvsamp::MVNSampler<dim, double>;
+    typename samp_t::Mat cov = samp_t::Mat::Identity() + samp_t::Mat::Constant(.5);
+    typename samp_t::Vec v = samp_t::Vec::Constant(.01);
+    samp_t s;
+    const int reps = 10000;
+
+    double eig = median_usec([&]{ for(int i = 0; i < reps; ++i){ cov += v * v.transpose(); s.setCovar(cov); } }, 11);
+    double llt = median_usec([&]{ for(int i = 0; i < reps; ++i){ cov += v * v.transpose(); s.setCovarChol(cov); } }, 11);
+    double rank = median_usec([&]{ for(int i = 0; i < reps; ++i) s.rankUpdate(v); }, 11);
+    std::printf("MVNSampler<%2zu> %14.3f %14.3f %14.3f\n", dim, eig/reps, llt/reps, rank/reps);
+}
+
+
+int main()
+{
+    std::printf("%-28s %12s %12s %10s\n", "sampler (ns per draw)", "sample()", "bulk", "speedup");
+    univ<double, std::mt19937>("UnivNorm<double, mt19937>");
+    univ<float,  std::mt19937>("UnivNorm<float, mt19937>");
+    univ<double, rvsamp::philox4x32>("UnivNorm<double, philox>");
+    univ<float,  rvsamp::philox4x32>("UnivNorm<float, philox>");
+    for(bool chol : {false, true}){
+        mvn<1>(chol);
+        mvn<4>(chol);
+        mvn<16>(chol);
+    }
+
+    std::printf("\n%-14s %14s %14s %14s\n", "rank one (us)", "setCovar", "setCovarChol", "rankUpdate");
+    update<4>();
+    update<16>();
+    update<64>();
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Draws one variate per particle when every particle has its own parameters, in nanoseconds per draw.
+//
+// "one at a time" is what a model has to do with the scalar interface: set the parameter, then
+// call sample(). UnivGammaSampler has no setters, so there it calls a std::gamma_distribution
+// with a fresh param_type. "array" is the sample(params..., out, n) overload.
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <pf/rv_samp.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+#define NUMPARTS  100000
+#define NUMREPS   11
+
+
+void report(const char *name, double one, double bulk)
+{
+    std::printf("%-30s %14.1f %12.1f %9.2fx\n", name, 1e3*one/NUMPARTS, 1e3*bulk/NUMPARTS, one/bulk);
+}
+
+
+// parameters spread over [lo, hi), shuffled so that neighbours differ
+std::vector<FLOATTYPE> params(FLOATTYPE lo, FLOATTYPE hi)
+{
+    std::mt19937 g(2);
+    std::uniform_real_distribution<FLOATTYPE> u(lo, hi);
+    std::vector<FLOATTYPE> p(NUMPARTS);
+    for(auto &x : p)
+        x = u(g);
+    return p;
+}
+
+
+void poisson(const char *name, FLOATTYPE lo, FLOATTYPE hi)
+{
+    auto lambda = params(lo, hi);
+    std::vector<int> out(NUMPARTS);
+    rvsamp::PoissonSampler<FLOATTYPE, int> s;
+    s.setSeed(1);
+    double one = median_usec([&]{
+        for(size_t i = 0; i < NUMPARTS; ++i){
+            s.setLambda(lambda[i]);
+            out[i] = s.sample();
+        }
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    double bulk = median_usec([&]{
+        s.sample(lambda.data(), out.data(), NUMPARTS);
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    report(name, one, bulk);
+}
+
+
+void gamma(const char *name, FLOATTYPE lo, FLOATTYPE hi)
+{
+    auto alpha = params(lo, hi);
+    auto beta = params(.5, 2.0);
+    std::vector<FLOATTYPE> out(NUMPARTS);
+    std::mt19937 g(1);
+    std::gamma_distribution<FLOATTYPE> gd;
+    double one = median_usec([&]{
+        for(size_t i = 0; i < NUMPARTS; ++i)
+            out[i] = gd(g, std::gamma_distribution<FLOATTYPE>::param_type(alpha[i], beta[i]));
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    rvsamp::UnivGammaSampler<FLOATTYPE> s;
+    s.setSeed(1);
+    double bulk = median_usec([&]{
+        s.sample(alpha.data(), beta.data(), out.data(), NUMPARTS);
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    report(name, one, bulk);
+}
+
+
+void normals()
+{
+    auto mu = params(-1.0, 1.0);
+    auto sigma = params(.5, 2.0);
+    std::vector<FLOATTYPE> out(NUMPARTS);
+
+    rvsamp::UnivNormSampler<FLOATTYPE> s;
+    s.setSeed(1);
+    double one = median_usec([&]{
+        for(size_t i = 0; i < NUMPARTS; ++i){
+            s.setMean(mu[i]);
+            s.setStdDev(sigma[i]);
+            out[i] = s.sample();
+        }
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    double bulk = median_usec([&]{
+        s.sample(mu.data(), sigma.data(), out.data(), NUMPARTS);
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    report("UnivNormSampler", one, bulk);
+
+    rvsamp::UnivLogNormSampler<FLOATTYPE> ls;
+    ls.setSeed(1);
+    one = median_usec([&]{
+        for(size_t i = 0; i < NUMPARTS; ++i){
+            ls.setMu(mu[i]);
+            ls.setSigma(sigma[i]);
+            out[i] = ls.sample();
+        }
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    bulk = median_usec([&]{
+        ls.sample(mu.data(), sigma.data(), out.data(), NUMPARTS);
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    report("UnivLogNormSampler", one, bulk);
+}
+
+
+void bernoulli()
+{
+    auto p = params(0.0, 1.0);
+    std::vector<int> out(NUMPARTS);
+    rvsamp::BernSampler<FLOATTYPE, int> s;
+    s.setSeed(1);
+    double one = median_usec([&]{
+        for(size_t i = 0; i < NUMPARTS; ++i){
+            s.setP(p[i]);
+            out[i] = s.sample();
+        }
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    double bulk = median_usec([&]{
+        s.sample(p.data(), out.data(), NUMPARTS);
+        bench_sink = bench_sink + out[0];
+    }, NUMREPS);
+    report("BernSampler", one, bulk);
+}
+
+
+int main()
+{
+    std::printf("%zu particles, ns per draw\n", static_cast<size_t>(NUMPARTS));
+    std::printf("%-30s %14s %12s %10s\n", "sampler", "one at a time", "array", "speedup");
+    poisson("Poisson, lambda in [0, 10)", 0.0, 10.0);
+    poisson("Poisson, lambda in [10, 100)", 10.0, 100.0);
+    poisson("Poisson, lambda in [1e3, 1e4)", 1e3, 1e4);
+    gamma("Gamma, alpha in [0.1, 1)", .1, 1.0);
+    gamma("Gamma, alpha in [1, 20)", 1.0, 20.0);
+    normals();
+    bernoulli();
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Weighs RBPF resampling against the Kalman updates it sits between.
+//
+// Every step runs one Kalman predict-and-update per particle, then resamples the models and
+// samples with mn_resampler_rbpf or sys_resampler_rbpf. The table gives the median time of
+// each half for several inner state dimensions, and the share of the step spent resampling.
+// The last column resamples while shrinking the population to N/2, which is the only path
+// where whole models get moved into a back buffer.
+
+#include <cstdio>
+#include <random>
+#include <Eigen/Dense>
+
+#include <pf/cf_filters.h>
+#include <pf/resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE  double
+#define NUMPARTS   10000
+#define NUMREPS    21
+
+
+template<size_t dimnss, typename resamp_t>
+void time_step(const char *name)
+{
+    using kalman_t = kalman<dimnss, 1, 0, FLOATTYPE>;
+    using ssMat = Eigen::Matrix<FLOATTYPE, dimnss, dimnss>;
+    using ssv = Eigen::Matrix<FLOATTYPE, dimnss, 1>;
+
+    // a random walk in every coordinate, and the sum of the coordinates is observed
+    const ssMat A = .9*ssMat::Identity();
+    const ssMat cholQ = ssMat::Identity();
+    const Eigen::Matrix<FLOATTYPE, dimnss, 0> B;
+    const Eigen::Matrix<FLOATTYPE, 0, 1> u;
+    const Eigen::Matrix<FLOATTYPE, 1, dimnss> C = Eigen::Matrix<FLOATTYPE, 1, dimnss>::Ones();
+    const Eigen::Matrix<FLOATTYPE, 1, 0> D;
+    const Eigen::Matrix<FLOATTYPE, 1, 1> cholR = Eigen::Matrix<FLOATTYPE, 1, 1>::Ones();
+
+    std::mt19937 gen(1);
+    std::normal_distribution<FLOATTYPE> z;
+    typename resamp_t::arrayMod mods(NUMPARTS, kalman_t(ssv::Zero(), ssMat::Identity()));
+    typename resamp_t::arrayVec samps(NUMPARTS);
+    typename resamp_t::arrayFloat logWts(NUMPARTS);
+    resamp_t r;
+    r.setSeed(1);
+
+    auto update = [&]{
+        Eigen::Matrix<FLOATTYPE, 1, 1> y;
+        for(size_t i = 0; i < mods.size(); ++i){
+            y(0) = z(gen);
+            mods[i].update(y, A, cholQ, B, u, C, D, cholR);
+            logWts[i] = mods[i].getLogCondLike();
+        }
+    };
+    update();
+
+    auto regrow = [&]{
+        mods.resize(NUMPARTS, kalman_t(ssv::Zero(), ssMat::Identity()));
+        samps.resize(NUMPARTS);
+        logWts.resize(NUMPARTS);
+        update();
+    };
+    double updateUsec = median_usec(update, NUMREPS);
+    double resampUsec = percentile(sorted_usec([&]{ r.resampLogWts(mods, samps, logWts); }, update, []{}, NUMREPS), 50);
+    double shrinkUsec = percentile(sorted_usec([&]{ r.resampLogWts(mods, samps, logWts, NUMPARTS/2); }, regrow, []{}, NUMREPS), 50);
+    std::printf("%-20s %6zu %12.1f %12.1f %9.1f%% %14.1f\n", name, dimnss, updateUsec, resampUsec,
+                100.0*resampUsec/(updateUsec + resampUsec), shrinkUsec);
+}
+
+
+template<size_t dimnss>
+void time_both()
+{
+    time_step<dimnss, mn_resampler_rbpf <dynamic_parts, 1, kalman<dimnss, 1, 0, FLOATTYPE>, FLOATTYPE>>("mn_resampler_rbpf");
+    time_step<dimnss, sys_resampler_rbpf<dynamic_parts, 1, kalman<dimnss, 1, 0, FLOATTYPE>, FLOATTYPE>>("sys_resampler_rbpf");
+}
+
+
+int main()
+{
+    std::printf("%zu particles, times in microseconds\n", static_cast<size_t>(NUMPARTS));
+    std::printf("%-20s %6s %12s %12s %10s %14s\n", "resampler", "dimnss", "updates", "resampling", "share", "shrink to N/2");
+    time_both<1>();
+    time_both<2>();
+    time_both<4>();
+    time_both<8>();
+    time_both<16>();
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Times resampLogWts for every resampler in resamplers.h and reports how noisy each one is.
+//
+// There are three sweeps:
+//   1. the number of particles, from 1e2 up to 1e7 (dimx = 1, log weights ~ N(0, 1)),
+//   2. the state dimension, from 1 to 64 (N = 1e5), which shows the cost of gathering,
+//   3. the skewness of the weights: the log weights are sigma * N(0,1) for several sigmas (N = 1e5).
+//
+// Each row gives the 10th, 50th and 90th percentile of the time for one call, the median
+// time per particle, and the offspring variance, i.e. the average over particles of
+// (number of children - N w_i)^2. For multinomial resampling it is about 1 - sum_i w_i^2;
+// residual, stratified and systematic resampling should come out below that.
+//
+// Usage: pf_bench_resampler_suite [largest N]   (defaults to 1e7)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+
+
+/**
+ * @brief times one resampler on one set of log weights and prints a row
+ * @param name the resampler's name
+ * @param srcLogWts the log weights (copied before every call)
+ * @param sigma the skewness parameter the weights were drawn with
+ */
+template<typename resamp_t>
+void report(const char *name, const std::vector<FLOATTYPE> &srcLogWts, FLOATTYPE sigma)
+{
+    using ssv = typename resamp_t::ssv;
+    const size_t N = srcLogWts.size();
+    const size_t reps = N >= 1000000 ? 5 : N >= 100000 ? 21 : 101;
+
+    // normalized weights, to compare the offspring counts against
+    std::vector<double> w(N);
+    FLOATTYPE m = *std::max_element(srcLogWts.begin(), srcLogWts.end());
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        w[i] = std::exp(srcLogWts[i] - m);
+        sum += w[i];
+    }
+
+    // each particle's first coordinate is its own index, so the children can be counted afterwards
+    typename resamp_t::arrayVec parts(N);
+    typename resamp_t::arrayFloat logWts(N);
+    std::vector<unsigned int> counts(N);
+    double offspringVar(0.0);
+    resamp_t r;
+    r.setSeed(1);
+    auto setup = [&]{
+        for(size_t i = 0; i < N; ++i)
+            parts[i] = ssv::Constant(i);
+        std::copy(srcLogWts.begin(), srcLogWts.end(), logWts.begin());
+    };
+    auto countChildren = [&]{
+        std::fill(counts.begin(), counts.end(), 0);
+        for(const auto &p : parts)
+            counts[static_cast<size_t>(p(0))]++;
+        double sq(0.0);
+        for(size_t i = 0; i < N; ++i)
+            sq += (counts[i] - N*w[i]/sum) * (counts[i] - N*w[i]/sum);
+        offspringVar += sq / N / reps;
+    };
+    auto times = sorted_usec([&]{ r.resampLogWts(parts, logWts); }, setup, countChildren, reps);
+
+    std::printf("%-22s %9zu %5d %6.2f %13.1f %13.1f %13.1f %10.2f %12.4f\n",
+                name, N, static_cast<int>(ssv::RowsAtCompileTime), sigma,
+                percentile(times, 10), percentile(times, 50), percentile(times, 90),
+                1e3*percentile(times, 50)/N, offspringVar);
+    bench_sink = bench_sink + parts[N/2](0);
+}
+
+
+/**
+ * @brief runs every resampler in resamplers.h on one set of log weights
+ * @param srcLogWts the log weights
+ * @param sigma the skewness parameter the weights were drawn with
+ */
+template<size_t dimx>
+void report_all(const std::vector<FLOATTYPE> &srcLogWts, FLOATTYPE sigma)
+{
+    report<mn_resampler        <dynamic_parts, dimx, FLOATTYPE>>("mn_resampler",         srcLogWts, sigma);
+    report<mn_alias_resampler  <dynamic_parts, dimx, FLOATTYPE>>("mn_alias_resampler",   srcLogWts, sigma);
+    report<mn_sorted_resampler <dynamic_parts, dimx, FLOATTYPE>>("mn_sorted_resampler",  srcLogWts, sigma);
+    report<mn_resamp_fast1     <dynamic_parts, dimx, FLOATTYPE>>("mn_resamp_fast1",      srcLogWts, sigma);
+    report<resid_resampler     <dynamic_parts, dimx, FLOATTYPE>>("resid_resampler",      srcLogWts, sigma);
+    report<stratif_resampler   <dynamic_parts, dimx, FLOATTYPE>>("stratif_resampler",    srcLogWts, sigma);
+    report<systematic_resampler<dynamic_parts, dimx, FLOATTYPE>>("systematic_resampler", srcLogWts, sigma);
+}
+
+
+/**
+ * @brief draws log weights
+ * @param N the number of particles
+ * @param sigma the standard deviation of the log weights
+ * @return the log weights
+ */
+std::vector<FLOATTYPE> make_log_weights(size_t N, FLOATTYPE sigma)
+{
+    std::mt19937 gen(N);
+    std::normal_distribution<FLOATTYPE> z;
+    std::vector<FLOATTYPE> logWts(N);
+    for(auto &lw : logWts)
+        lw = sigma * z(gen);
+    return logWts;
+}
+
+
+/**
+ * @brief prints the header of a results table
+ * @param what which sweep the table is for
+ */
+void print_table_header(const char *what)
+{
+    std::printf("\n%s\n", what);
+    std::printf("%-22s %9s %5s %6s %13s %13s %13s %10s %12s\n",
+                "resampler", "N", "dimx", "sigma", "p10(us)", "p50(us)", "p90(us)", "ns/part", "offspr. var");
+}
+
+
+int main(int argc, char **argv)
+{
+    const size_t maxN = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+    print_table_header("1. number of particles");
+    for(size_t N = 100; N <= maxN; N *= 10)
+        report_all<1>(make_log_weights(N, 1.0), 1.0);
+
+    const size_t midN = std::min<size_t>(100000, maxN);
+    print_table_header("2. state dimension");
+    std::vector<FLOATTYPE> logWts = make_log_weights(midN, 1.0);
+    report_all<1>(logWts, 1.0);
+    report_all<4>(logWts, 1.0);
+    report_all<16>(logWts, 1.0);
+    report_all<64>(logWts, 1.0);
+
+    print_table_header("3. weight skewness");
+    for(FLOATTYPE sigma : {0.1, 0.5, 1.0, 2.0, 4.0})
+        report_all<1>(make_log_weights(midN, sigma), sigma);
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Times the stratified and systematic resamplers from 1k to 1M particles.
+// Both walk the cumulative weights once, so the time per particle should stay flat.
+// Up to 10k particles they are also compared against the old search, which 
+// scanned the cumulative sums from the start for every output particle.
+// Then the multi-threaded resamplers are compared with the serial ones.
+// Finally multinomial resampling with std::discrete_distribution is compared with
+// the alias table, both in the resampler and in the APF's index sampler, and
+// with the two resamplers that merge sorted uniforms with the cumulative weights.
+
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/resamplers.h>
+#include <pf/parallel_resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+#define DIMSTATE  1
+
+
+// the old O(N^2) ancestor search (the stratified version, with its U_i fixed)
+void quadratic_ancestors(const std::vector<FLOATTYPE> &w, std::vector<unsigned int> &ancestors, std::mt19937 &gen)
+{
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    std::vector<FLOATTYPE> cumsums(numIn);
+    std::partial_sum(w.begin(), w.end(), cumsums.begin());
+    std::uniform_real_distribution<FLOATTYPE> u_sampler(0.0, 1.0);
+    for(size_t i = 0; i < numOut; ++i){
+        FLOATTYPE u = (i + u_sampler(gen)) / numOut;
+        unsigned int idx = numIn - 1;
+        for(unsigned int j = 0; j < numIn; ++j){
+            if(cumsums[j] >= u){
+                idx = j;
+                break;
+            }
+        }
+        ancestors[i] = idx;
+    }
+}
+
+
+template<typename resamp_t, typename... ctor_args>
+double time_resampler(const std::vector<FLOATTYPE> &srcLogWts, ctor_args... args)
+{
+    using ssv = typename resamp_t::ssv;
+    const size_t N = srcLogWts.size();
+    typename resamp_t::arrayVec parts(N, ssv::Zero());
+    typename resamp_t::arrayFloat logWts(N);
+    resamp_t r(args...);
+    r.setSeed(1);
+    return median_usec([&]{
+        std::copy(srcLogWts.begin(), srcLogWts.end(), logWts.begin());
+        r.resampLogWts(parts, logWts);
+        bench_sink = bench_sink + parts[N/2](0);
+    }, N > 100000 ? 5 : 21);
+}
+
+
+int main()
+{
+    using stratifR    = stratif_resampler   <dynamic_parts, DIMSTATE, FLOATTYPE>;
+    using systematicR = systematic_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>;
+
+    std::printf("\nresampLogWts scaling (time per particle should stay flat)\n");
+    std::printf("%10s %16s %16s %18s %18s\n", "N", "stratified(us)", "systematic(us)", "stratif(ns/part)", "system(ns/part)");
+    std::mt19937 gen(1);
+    std::normal_distribution<FLOATTYPE> z;
+    for(size_t N = 1000; N <= 1000000; N *= 10){
+        std::vector<FLOATTYPE> logWts(N);
+        for(auto &lw : logWts)
+            lw = z(gen);
+        double st = time_resampler<stratifR>(logWts);
+        double sy = time_resampler<systematicR>(logWts);
+        std::printf("%10zu %16.1f %16.1f %18.2f %18.2f\n", N, st, sy, 1e3*st/N, 1e3*sy/N);
+    }
+
+    print_header("ancestor search only: old linear scan vs merge walk (stratified)");
+    for(size_t N : {1000, 10000}){
+        std::vector<FLOATTYPE> w(N);
+        for(auto &wi : w)
+            wi = std::exp(z(gen));
+        FLOATTYPE sum = std::accumulate(w.begin(), w.end(), 0.0);
+        for(auto &wi : w)
+            wi /= sum;
+        std::vector<FLOATTYPE> logWts(N);
+        for(size_t i = 0; i < N; ++i)
+            logWts[i] = std::log(w[i]);
+
+        std::vector<unsigned int> ancestors(N);
+        std::mt19937 g(1);
+        double baseline = median_usec([&]{
+            quadratic_ancestors(w, ancestors, g);
+            bench_sink = bench_sink + ancestors[N/2];
+        });
+        // the new search is timed inside a whole resampLogWts call, so it pays for more work
+        print_row("stratified resampLogWts", N, baseline, time_resampler<stratifR>(logWts));
+    }
+
+    print_header("serial vs multi-threaded resampLogWts");
+    for(size_t N : {100000, 1000000}){
+        std::vector<FLOATTYPE> logWts(N);
+        for(auto &lw : logWts)
+            lw = z(gen);
+        double sy = time_resampler<systematicR>(logWts);
+        double st = time_resampler<stratifR>(logWts);
+        for(unsigned int nthreads : {1u, 2u, 4u}){
+            char name[64];
+            std::snprintf(name, sizeof(name), "par systematic (%u threads)", nthreads);
+            print_row(name, N, sy, time_resampler<par_systematic_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts, nthreads));
+            std::snprintf(name, sizeof(name), "par stratified (%u threads)", nthreads);
+            print_row(name, N, st, time_resampler<par_stratif_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts, nthreads));
+        }
+    }
+
+    print_header("multinomial: discrete_distribution vs alias table");
+    for(size_t N : {1000, 100000, 1000000}){
+        std::vector<FLOATTYPE> logWts(N);
+        for(auto &lw : logWts)
+            lw = z(gen);
+        print_row("mn_alias_resampler", N,
+                  time_resampler<mn_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts),
+                  time_resampler<mn_alias_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts));
+
+        rvsamp::k_gen<dynamic_parts, FLOATTYPE> plain, alias(true);
+        part_array<FLOATTYPE, dynamic_parts> kLogWts(logWts.begin(), logWts.end());
+        part_array<unsigned int, dynamic_parts> ks(N);
+        auto time_kgen = [&](rvsamp::k_gen<dynamic_parts, FLOATTYPE> &kGen){
+            return median_usec([&]{
+                kGen.sample(kLogWts, ks);
+                bench_sink = bench_sink + ks[N/2];
+            }, N > 100000 ? 5 : 21);
+        };
+        print_row("k_gen (alias backend)", N, time_kgen(plain), time_kgen(alias));
+    }
+
+    print_header("multinomial: discrete_distribution vs sorted uniforms");
+    for(size_t N : {1000, 100000, 1000000}){
+        std::vector<FLOATTYPE> logWts(N);
+        for(auto &lw : logWts)
+            lw = z(gen);
+        double mn = time_resampler<mn_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts);
+        print_row("mn_resamp_fast1", N, mn, time_resampler<mn_resamp_fast1<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts));
+        print_row("mn_sorted_resampler", N, mn, time_resampler<mn_sorted_resampler<dynamic_parts, DIMSTATE, FLOATTYPE>>(logWts));
+    }
+
+    return 0;
+}
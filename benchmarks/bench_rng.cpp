@@ -0,0 +1,95 @@
+// Compares std::mt19937 with the counter-based rvsamp::philox4x32.
+//
+// 1. raw throughput: 32 bit words, uniforms and normals per microsecond,
+// 2. the cost of setting up a generator on a (seed, stream) pair, which parallel code
+//    does once per worker (or per particle) and call,
+// 3. the resamplers that hand every worker its own stream on every call
+//    (par_metropolis_resampler and par_rejection_resampler), at 1e4 particles.
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <pf/rng.h>
+#include <pf/parallel_resamplers.h>
+
+#include "bench_utils.h"
+
+#define FLOATTYPE double
+#define NUMDRAWS  10000000
+#define NUMSTREAMS 10000
+
+
+template<typename rng_t>
+void throughput(const char *name)
+{
+    rng_t gen;
+    rvsamp::seed_stream(gen, 1, 0);
+    std::uniform_real_distribution<FLOATTYPE> u;
+    std::normal_distribution<FLOATTYPE> z;
+
+    double bits = median_usec([&]{
+        std::uint32_t x(0);
+        for(size_t i = 0; i < NUMDRAWS; ++i)
+            x ^= gen();
+        bench_sink = bench_sink + x;
+    }, 5);
+    double unifs = median_usec([&]{
+        FLOATTYPE x(0);
+        for(size_t i = 0; i < NUMDRAWS; ++i)
+            x += u(gen);
+        bench_sink = bench_sink + x;
+    }, 5);
+    double normals = median_usec([&]{
+        FLOATTYPE x(0);
+        for(size_t i = 0; i < NUMDRAWS; ++i)
+            x += z(gen);
+        bench_sink = bench_sink + x;
+    }, 5);
+    double setup = median_usec([&]{
+        rng_t g;
+        for(size_t s = 0; s < NUMSTREAMS; ++s){
+            rvsamp::seed_stream(g, 7, s);
+            bench_sink = bench_sink + g();
+        }
+    }, 5);
+
+    std::printf("%-12s %6zu %14.1f %14.1f %14.1f %16.3f\n", name, sizeof(rng_t),
+                NUMDRAWS/bits, NUMDRAWS/unifs, NUMDRAWS/normals, setup/NUMSTREAMS);
+}
+
+
+template<typename resamp_t>
+void resample(const char *name, unsigned int nthreads)
+{
+    const size_t N = 10000;
+    std::mt19937 g(1);
+    std::normal_distribution<FLOATTYPE> z;
+    typename resamp_t::arrayFloat logWts(N);
+    for(auto &lw : logWts)
+        lw = .5*z(g);
+    typename resamp_t::arrayInt ancestors(N);
+    resamp_t r(nthreads);
+    r.setSeed(1);
+    double usec = median_usec([&]{ r.resampIndices(logWts, ancestors); }, 51);
+    std::printf("%-44s %8u %12.1f\n", name, nthreads, usec);
+}
+
+
+int main()
+{
+    std::printf("%-12s %6s %14s %14s %14s %16s\n", "generator", "bytes", "words/us", "uniforms/us", "normals/us", "us per stream");
+    throughput<std::mt19937>("mt19937");
+    throughput<rvsamp::philox4x32>("philox4x32");
+
+    std::printf("\n%-44s %8s %12s\n", "resampler (N = 1e4)", "threads", "time(us)");
+    for(unsigned int nthreads : {1u, 4u}){
+        resample<par_metropolis_resampler<dynamic_parts, 1, FLOATTYPE>>("par_metropolis_resampler (mt19937)", nthreads);
+        resample<par_metropolis_resampler<dynamic_parts, 1, FLOATTYPE, rvsamp::philox4x32>>("par_metropolis_resampler (philox4x32)", nthreads);
+        resample<par_rejection_resampler<dynamic_parts, 1, FLOATTYPE>>("par_rejection_resampler (mt19937)", nthreads);
+        resample<par_rejection_resampler<dynamic_parts, 1, FLOATTYPE, rvsamp::philox4x32>>("par_rejection_resampler (philox4x32)", nthreads);
+    }
+    return 0;
+}
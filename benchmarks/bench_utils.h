@@ -0,0 +1,97 @@
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+
+/**
+ * @brief times a piece of code
+ * @param f the code to time (called with no arguments)
+ * @param reps how many times to run it
+ * @return the median wall clock time of one run, in microseconds
+ */
+template<typename F>
+double median_usec(F &&f, size_t reps = 21)
+{
+    std::vector<double> times(reps);
+    for(size_t r = 0; r < reps; ++r){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto stop = std::chrono::steady_clock::now();
+        times[r] = std::chrono::duration<double, std::micro>(stop - start).count();
+    }
+    std::nth_element(times.begin(), times.begin() + reps/2, times.end());
+    return times[reps/2];
+}
+
+
+/**
+ * @brief times a piece of code, with some untimed work before and after every run
+ * @param f the code to time (called with no arguments)
+ * @param setup the code that runs before every timed run (called with no arguments)
+ * @param check the code that runs after every timed run, e.g. to look at its output (called with no arguments)
+ * @param reps how many times to run it
+ * @return the wall clock time of every run, in microseconds, sorted
+ */
+template<typename F, typename S, typename C>
+std::vector<double> sorted_usec(F &&f, S &&setup, C &&check, size_t reps)
+{
+    std::vector<double> times(reps);
+    for(size_t r = 0; r < reps; ++r){
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto stop = std::chrono::steady_clock::now();
+        times[r] = std::chrono::duration<double, std::micro>(stop - start).count();
+        check();
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+
+/**
+ * @brief reads a percentile off sorted times (nearest rank)
+ * @param sorted the sorted times
+ * @param p the percentile (between 0 and 100)
+ * @return the time at that percentile
+ */
+inline double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t rank = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + .5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+
+/**
+ * @brief prints the header of a results table
+ * @param what a description of what is being timed
+ */
+inline void print_header(const char *what)
+{
+    std::printf("\n%s\n", what);
+    std::printf("%-28s %10s %14s %14s %9s\n", "case", "N", "baseline(us)", "candidate(us)", "speedup");
+}
+
+
+/**
+ * @brief prints one row of a results table
+ * @param name the name of the case
+ * @param n the number of particles
+ * @param baseline the baseline time (microseconds)
+ * @param candidate the time of the code being compared (microseconds)
+ */
+inline void print_row(const char *name, size_t n, double baseline, double candidate)
+{
+    std::printf("%-28s %10zu %14.1f %14.1f %8.2fx\n", name, n, baseline, candidate, baseline / candidate);
+}
+
+
+/** @brief sink that keeps the compiler from throwing away results */
+inline volatile double bench_sink = 0.0;
+
+
+#endif // BENCH_UTILS_H
@@ -6,26 +6,32 @@
 #include <functional> // function
 #include <Eigen/Dense>
 #include <cmath>
+#include <iostream> // debug printing
 
 #include "pf_base.h"
+#include "filter_core.h"
+#include "part_storage.h"
 #include "rv_samp.h" // for k_generator
+#include "thread_pool.h"
 
 
-//! A base-class for Auxiliary Particle Filtering. Filtering only, no smoothing.
- /**
-  * @class APF
-  * @author taylor
+//! The auxiliary particle filter engine with compile-time (CRTP) dispatch to the model.
+/**
+  * @class APFStatic
+  * @author t
   * @file auxiliary_pf.h
-  * @brief A base class for Auxiliary Particle Filtering.
-  * Inherit from this if you want to use an APF for your state space model. 
-  * Filtering only, no smoothing. 
-  * @tparam nparts the number of particles
+  * @brief auxiliary particle filter that calls the model methods of Derived directly, 
+  * so they can be inlined into the particle loops. Derived inherits from 
+  * APFStatic<Derived, ...> and provides (public, non-virtual) versions of APF's model 
+  * methods. Any of the "...Batch" methods can be redefined in Derived as well.
+  * @tparam Derived the model class
+  * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
   * @tparam dimx the dimension of the state
   * @tparam dimy the dimension of the observations
   * @tparam resamp_t the resampler type
   */
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
-class APF : public pf_base<float_t, dimy, dimx>
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class APFStatic : public pf_base<float_t, dimy, dimx>
 {
 public:
 
@@ -35,13 +41,15 @@ public:
     using osv = Eigen::Matrix<float_t,dimy,1>;
     /** type alias for linear algebra stuff (dimension of the state ^2) */
     using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    /** type alias for functionals that write into a preallocated output */
+    using outFunc = typename expectation_engine<ssv, float_t>::func_t;
     /** type alias for array of float_ts */
-    using arrayfloat_t = std::array<float_t, nparts>;
+    using arrayfloat_t = part_array<float_t, nparts>;
     /** type alias for array of state vectors */
-    using arrayVec = std::array<ssv, nparts>;
+    using arrayVec = part_array<ssv, nparts>;
     /** type alias for array of unsigned ints */
-    using arrayUInt = std::array<unsigned int, nparts>;
-    /** the number of particles */
+    using arrayUInt = part_array<unsigned int, nparts>;
+    /** the number of particles (0 if it is chosen at run time) */
     static constexpr unsigned int num_particles = nparts;
 
 public:
@@ -49,20 +57,60 @@ public:
      /**
       * @brief The constructor.
       * @param rs resampling schedule (e.g. resample every rs time points).
+      * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+      * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
       */
-    APF(const unsigned int &rs=1);
+    APFStatic(const unsigned int &rs=1, const unsigned int &num_threads=1, const size_t &num_parts=nparts);
     
     
     /**
      * @brief The (virtual) destructor
      */
-    virtual ~APF();
+    virtual ~APFStatic();
     
      /**
       * @brief Get the latest log conditional likelihood.
       * @return a float_t of the most recent conditional likelihood.
       */
     float_t getLogCondLike () const; 
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the number of worker threads (including the calling thread).
+     * @return the number of threads particles are split across
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
     
     
     /**
@@ -70,6 +118,26 @@ public:
      * @return return a std::vector<Mat> of expectations. How many depends on how many callbacks you gave to 
      */
     std::vector<Mat> getExpectations () const;
+
+
+    /**
+     * @brief Registers a functional h that writes h(x_t) into a preallocated rows x cols slot.
+     * Its expectation is computed on every time step (before resampling) along with the other 
+     * registered functionals, in one sweep over the particles and without allocating. 
+     * It gets called from all the worker threads.
+     * @param h the functional
+     * @param rows the number of rows of h(x_t)
+     * @param cols the number of columns of h(x_t)
+     * @return the index of its expectation in getFunctionalExpectations()
+     */
+    size_t addFunctional(const outFunc &h, size_t rows, size_t cols = 1);
+
+
+    /**
+     * @brief return the expectations of the registered functionals
+     * @return one matrix for each registered functional, in the order they were added
+     */
+    const std::vector<Mat>& getFunctionalExpectations() const;
     
 
      /**
@@ -78,64 +146,64 @@ public:
       * @param fs a std::vector of callback functions that are used to calculate expectations with respect to the filtering distribution.
       */
     void filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs = std::vector<std::function<const Mat(const ssv&)> >());
-    
+
 
     /**
-     * @brief Evaluates the log of mu.
-     * @param x1 a Eigen::Matrix<float_t,dimx,1> representing time 1's state.
-     * @return a float_t evaluation.
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
      */
-    virtual float_t logMuEv (const ssv &x1 ) = 0;
-    
-    
+    void logMuEvBatch (const arrayVec &x1s, arrayfloat_t &out);
+
+
     /**
-     * @brief Evaluates the proposal distribution taking a Eigen::Matrix<float_t,dimx,1> from the previous time's state, and returning a state for the current time.
-     * @param xtm1 a Eigen::Matrix<float_t,dimx,1> representing the previous time's state.
-     * @return a Eigen::Matrix<float_t,dimx,1> representing a likely current time state, to be used by the observation density.
+     * @brief Evaluates propMu for every particle. Override this to vectorize.
+     * @param xtm1s the previous time's states
+     * @param out where the results are written
      */
-    virtual ssv propMu (const ssv &xtm1 ) = 0;
-    
-    
+    void propMuBatch (const arrayVec &xtm1s, arrayVec &out);
+
+
     /**
-     * @brief Samples from q1.
-     * @param y1 a Eigen::Matrix<float_t,dimy,1> representing time 1's data point.
-     * @return a Eigen::Matrix<float_t,dimx,1> sample for time 1's state.
+     * @brief Samples every particle from q1. Override this to vectorize.
+     * @param y1 time 1's data point
+     * @param out where the samples are written
      */
-    virtual ssv q1Samp (const osv &y1) = 0;
-    
-    
+    void q1SampBatch (const osv &y1, arrayVec &out);
+
+
     /**
-     * @brief Samples from f.
-     * @param xtm1 a Eigen::Matrix<float_t,dimx,1> representing the previous time's state.
-     * @return a Eigen::Matrix<float_t,dimx,1> state sample for the current time.
+     * @brief Samples every particle from f. Override this to vectorize.
+     * @param xtm1s the previous time's states
+     * @param out where the samples are written (never the same array as xtm1s)
      */
-    virtual ssv fSamp (const ssv &xtm1) = 0;
-    
-    
+    void fSampBatch (const arrayVec &xtm1s, arrayVec &out);
+
+
     /**
-     * @brief Evaluates the log of q1.
-     * @param x1 a Eigen::Matrix<float_t,dimx,1> representing time 1's state.
-     * @param y1 a Eigen::Matrix<float_t,dimy,1> representing time 1's data observation.
-     * @return a float_t evaluation.
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s time 1's states
+     * @param y1 time 1's data observation
+     * @param out where the log-densities are written
      */
-    virtual float_t logQ1Ev (const ssv &x1, const osv &y1) = 0;
-    
-    
+    void logQ1EvBatch (const arrayVec &x1s, const osv &y1, arrayfloat_t &out);
+
+
     /**
-     * @brief Evaluates the log of g.
-     * @param yt a Eigen::Matrix<float_t,dimy,1> representing time t's data observation.
-     * @param xt a Eigen::Matrix<float_t,dimx,1> representing time t's state.
-     * @return a float_t evaluation.
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt time t's data observation
+     * @param xts time t's states
+     * @param out where the log-densities are written
      */
-    virtual float_t logGEv (const osv &yt, const ssv &xt) = 0;
+    void logGEvBatch (const osv &yt, const arrayVec &xts, arrayfloat_t &out);
 
 
 protected:
     /** @brief particle samples */
-    std::array<ssv,nparts>  m_particles;
+    arrayVec m_particles;
     
     /** @brief particle unnormalized weights */
-    std::array<float_t,nparts> m_logUnNormWeights;
+    arrayfloat_t m_logUnNormWeights;
     
     /** @brief curren time */
     unsigned int m_now; 
@@ -143,217 +211,506 @@ protected:
     /** @brief log p(y_t|y_{1:t-1}) or log p(y1) */
     float_t m_logLastCondLike; 
     
-    /** @brief the resampling schedule */
-    unsigned int m_rs;
-    
     /** @brief resampler object (default ctor'd)*/
     resamp_t m_resampler;
+
+    /** @brief normalizing, expectations and the resampling decision */
+    FilterCore<nparts, ssv, float_t> m_core;
     
-    /** @brief k generator object (default ctor'd)*/
+    /** @brief k generator object (draws with an alias table) */
     rvsamp::k_gen<nparts,float_t> m_kGen;
-    
-    /** @brief expectations E[h(x_t) | y_{1:t}] for user defined "h"s */
-    std::vector<Mat> m_expectations;
-    
+
+    /** @brief the first stage indexes drawn by m_kGen */
+    arrayUInt m_ks;
+
+    /** @brief scratch space for whole-population states */
+    arrayVec m_scratchStates;
+
+    /** @brief scratch space for per-particle log densities */
+    arrayfloat_t m_scratch;
+
+    /** @brief log g(y_t | propMu(x_{t-1})) for every particle */
+    arrayfloat_t m_firstStageAdj;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
 };
 
 
 
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-APF<nparts, dimx, dimy, resamp_t, float_t, debug>::APF(const unsigned int &rs) 
-    : m_now(0)
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::APFStatic(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts) 
+    : m_particles(part_storage<ssv, nparts>::make(num_parts))
+    , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_now(0)
     , m_logLastCondLike(0.0)
-    , m_rs(rs)
+    , m_core(rs, num_threads, num_parts)
+    , m_kGen(true)
+    , m_ks(part_storage<unsigned int, nparts>::make(num_parts))
+    , m_scratchStates(part_storage<ssv, nparts>::make(num_parts))
+    , m_scratch(part_storage<float_t, nparts>::make(num_parts))
+    , m_firstStageAdj(part_storage<float_t, nparts>::make(num_parts))
 {
+    share_num_threads(m_resampler, m_core.getNumThreads());
     std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
 }
 
 
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-APF<nparts, dimx, dimy, resamp_t, float_t, debug>::~APF() { }
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::~APFStatic() { }
 
 
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs)
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logMuEvBatch(const arrayVec &x1s, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logMuEv(x1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::propMuBatch(const arrayVec &xtm1s, arrayVec &out)
+{
+    m_core.pool().parallel_for(xtm1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().propMu(xtm1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::q1SampBatch(const osv &y1, arrayVec &out)
+{
+    m_core.pool().parallel_for(out.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().q1Samp(y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::fSampBatch(const arrayVec &xtm1s, arrayVec &out)
+{
+    m_core.pool().parallel_for(xtm1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().fSamp(xtm1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logQ1EvBatch(const arrayVec &x1s, const osv &y1, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logQ1Ev(x1s[ii], y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logGEvBatch(const osv &yt, const arrayVec &xts, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(xts.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logGEv(yt, xts[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs)
 {
+    const size_t N = m_logUnNormWeights.size();
     
     if(m_now > 0)
     { 
         
         // set up "first stage weights" to make k index sampler 
-        arrayfloat_t logFirstStageUnNormWeights = m_logUnNormWeights;
-        arrayVec oldPartics = m_particles;
-        float_t m3(-std::numeric_limits<float_t>::infinity());
-        float_t m2(-std::numeric_limits<float_t>::infinity());
-        for(size_t ii = 0; ii < nparts; ++ii)  
-        {
-            // update m3
-            if(m_logUnNormWeights[ii] > m3)
-                m3 = m_logUnNormWeights[ii];
-            
-            // sample
-            ssv xtm1                        = oldPartics[ii];
-            logFirstStageUnNormWeights[ii] += logGEv(data, propMu(xtm1)); 
-            
-            // accumulate things
-            if(logFirstStageUnNormWeights[ii] > m2)
-                m2 = logFirstStageUnNormWeights[ii];
+        // (the log-sum-exp reductions are split across workers)
+        lse_partial<float_t> oldLSE = m_core.reduce(m_logUnNormWeights.data(), N);
+        derived().propMuBatch(m_particles, m_scratchStates);
+        derived().logGEvBatch(data, m_scratchStates, m_firstStageAdj);
+        // (the first stage weights live in m_scratch until the ks are drawn)
+        arrayfloat_t &logFirstStageUnNormWeights = m_scratch;
+        for(size_t ii = 0; ii < N; ++ii)  
+            logFirstStageUnNormWeights[ii] = m_logUnNormWeights[ii] + m_firstStageAdj[ii]; 
+        lse_partial<float_t> firstStageLSE = m_core.reduce(logFirstStageUnNormWeights.data(), N);
             
-            // print stuff if debug mode is on
-            if constexpr(debug) {
+        // print stuff if debug mode is on
+        if constexpr(debug) {
+            for(size_t ii = 0; ii < N; ++ii)
                 std::cout << "time: " << m_now 
                           << ", first stage log unnorm weight: " << logFirstStageUnNormWeights[ii] 
                           << "\n";
-            }
-
         }
                
         // draw ks (indexes) (handles underflow issues)
-        arrayUInt myKs = m_kGen.sample(logFirstStageUnNormWeights); 
+        m_kGen.sample(logFirstStageUnNormWeights, m_ks); 
                 
-        // now draw xts
-        float_t m1(-std::numeric_limits<float_t>::infinity());
-        float_t first_cll_sum(0.0);
-        float_t second_cll_sum(0.0);
-        float_t third_cll_sum(0.0);
-        ssv xtm1k;
-        ssv muT;
-        for(size_t ii = 0; ii < nparts; ++ii)   
-        {
-            // calclations for log p(y_t|y_{1:t-1}) (using log-sum-exp trick)
-            second_cll_sum += std::exp( logFirstStageUnNormWeights[ii] - m2 );
-            third_cll_sum  += std::exp( m_logUnNormWeights[ii] - m3 );            
-            
-            // sampling and unnormalized weight update
-            xtm1k                   = oldPartics[myKs[ii]];
-            m_particles[ii]         = fSamp(xtm1k); 
-            muT                     = propMu(xtm1k); 
-            m_logUnNormWeights[ii] += logGEv(data, m_particles[ii]) - logGEv(data, muT);
-            
-            if constexpr(debug){ 
-                std::cout << "time: " << m_now 
-                          << ", transposed sample: " << m_particles[ii].transpose() 
-                          << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
-            }
-
-            // update m1
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
-        }
+        // now draw xts from the chosen parents 
+        for(size_t ii = 0; ii < N; ++ii)
+            m_scratchStates[ii] = m_particles[m_ks[ii]];
+        derived().fSampBatch(m_scratchStates, m_particles);
+        derived().logGEvBatch(data, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] = m_scratch[ii] - m_firstStageAdj[m_ks[ii]];
 
         // calculate estimate for log of last conditonal likelihood
-        for(size_t p = 0; p < nparts; ++p)
-             first_cll_sum += std::exp( m_logUnNormWeights[p] - m1 );
-        m_logLastCondLike = m1 + std::log(first_cll_sum) + m2 + std::log(second_cll_sum) - 2*m3 - 2*std::log(third_cll_sum);
+        // (the old weights were already used up when the ks were drawn)
+        m_logLastCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - std::log(static_cast<float_t>(N)) 
+                            + firstStageLSE.logSumExp() - oldLSE.logSumExp();
+    
+    } else { // (m_now == 0) 
 
-        if constexpr(debug) 
-            std::cout << "time: " << m_now << ", log cond like: " << m_logLastCondLike << "\n";
+        // sample and weight the whole population
+        derived().q1SampBatch(data, m_particles);
+        derived().logMuEvBatch(m_particles, m_logUnNormWeights);
+        derived().logGEvBatch(data, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+        derived().logQ1EvBatch(m_particles, data, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] -= m_scratch[ii];
+        
+        // calculate log-likelihood with log-exp-sum trick
+        m_logLastCondLike = - std::log( static_cast<float_t>(N) ) + m_core.weigh(m_logUnNormWeights).logSumExp();
+    }
 
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        for(auto & h : fs){
-    
-            Mat testOutput = h(m_particles[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp(m_logUnNormWeights[prtcl] - m1);
-            }
-            m_expectations[fId] = numer/denom;
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t ii = 0; ii < N; ++ii)
+            std::cout << "time: " << m_now 
+                      << ", transposed sample: " << m_particles[ii].transpose() 
+                      << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
+        std::cout << "time: " << m_now << ", log cond like: " << m_logLastCondLike << "\n";
+    }
 
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << "; " << m_expectations[fId] << "\n";
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_particles[i]); });
+    m_core.expectFunctionals([this](size_t i) -> const ssv& { return m_particles[i]; });
 
-            fId++;
-        }
+    if constexpr(debug) {
+        for(size_t fId = 0; fId < fs.size(); ++fId)
+            std::cout << "transposed expectation " << fId << "; " << m_core.getExpectations()[fId] << "\n";
+    }
 
-        // if you have to resample
-        if( (m_now+1)%m_rs == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-            
-        // advance time
-        m_now += 1; 
-    
-    } else { // (m_now == 0) 
+    // resample if you should (automatically normalizes)
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_particles, m_logUnNormWeights, m_core.normWeights());
 
-        float_t max(-std::numeric_limits<float_t>::infinity());
-        for(size_t ii = 0; ii < nparts; ++ii)
-        {
-            // sample particles
-            m_particles[ii]  = q1Samp(data);
-            m_logUnNormWeights[ii]  = logMuEv(m_particles[ii]);
-            m_logUnNormWeights[ii] += logGEv(data, m_particles[ii]);
-            m_logUnNormWeights[ii] -= logQ1Ev(m_particles[ii], data);
-
-            // print stuff if debug mode is on
-            if constexpr(debug) {
-                std::cout << "time: " << m_now 
-                          << ", log unnorm weight: " << m_logUnNormWeights[ii] 
-                          << ", transposed sample: " << m_particles[ii].transpose()
-                          << "\n";
-            }
+    // advance time step
+    m_now += 1;    
+}
 
-            // update maximum
-            if( m_logUnNormWeights[ii] > max)
-                max = m_logUnNormWeights[ii];
-        }
-        
-        // calculate log-likelihood with log-exp-sum trick
-        float_t sumExp(0.0);
-        for( size_t i = 0; i < nparts; ++i){
-            sumExp += std::exp( m_logUnNormWeights[i] - max );
-        }
-        m_logLastCondLike = - std::log( static_cast<float_t>(nparts) ) + max + std::log(sumExp);
-        
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        for(auto & h : fs){
-            
-            Mat testOutput = h(m_particles[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - max);
-                denom += std::exp(m_logUnNormWeights[prtcl] - max);
-            }
-            m_expectations[fId] = numer/denom;
-
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << "; " << m_expectations[fId] << "\n";
-
-            fId++;
-        }
-        
-        // resample if you should (automatically normalizes)
-        if( (m_now+1) % m_rs == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
 
-        // advance time step
-        m_now += 1;    
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getLogCondLike() const
+{
+    return m_logLastCondLike;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+unsigned int APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getNumThreads() const
+{
+    return m_core.getNumThreads();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::addFunctional(const outFunc &h, size_t rows, size_t cols)
+{
+    return m_core.addFunctional(h, rows, cols);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getFunctionalExpectations() const -> const std::vector<Mat>&
+{
+    return m_core.getFunctionalExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APFStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_particles, m_logUnNormWeights, n);
+    }else{
+        part_storage<ssv, nparts>::resize(m_particles, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
     }
+    m_core.resize(n);
+    part_storage<ssv, nparts>::resize(m_scratchStates, n);
+    part_storage<float_t, nparts>::resize(m_scratch, n);
+    part_storage<float_t, nparts>::resize(m_firstStageAdj, n);
+    part_storage<unsigned int, nparts>::resize(m_ks, n);
+}
+
+
+//! A base-class for Auxiliary Particle Filtering. Filtering only, no smoothing.
+ /**
+  * @class APF
+  * @author taylor
+  * @file auxiliary_pf.h
+  * @brief A base class for Auxiliary Particle Filtering.
+  * Inherit from this if you want to use an APF for your state space model. 
+  * Filtering only, no smoothing. 
+  * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+  * @tparam dimx the dimension of the state
+  * @tparam dimy the dimension of the observations
+  * @tparam resamp_t the resampler type
+  * 
+  * If num_threads > 1 is passed to the constructor, both the first-stage weight pass
+  * and the second-stage sampling pass are split into one contiguous chunk of particles 
+  * per worker thread, and the model methods are called concurrently. In that case 
+  * they must be thread-safe (see thread_pool::this_worker()).
+  * 
+  * The filter only ever calls the "...Batch" methods, which work on the whole population 
+  * at once. By default they loop over the per-particle methods (one chunk per worker), 
+  * so a model only has to override them if it can vectorize. Overridden batch methods are 
+  * called from the calling thread only.
+  * 
+  * The model methods are pure virtual. APFStatic runs the same algorithm 
+  * without virtual calls if the model is known at compile time.
+  */
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class APF : public APFStatic<APF<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = APFStatic<APF<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>;
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv = typename base_t::ssv;
+    /** "observation size vector" type alias for linear algebra stuff */
+    using osv = typename base_t::osv;
+    /** type alias for linear algebra stuff (dimension of the state ^2) */
+    using Mat = typename base_t::Mat;
+    /** type alias for array of float_ts */
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+    /** type alias for array of state vectors */
+    using arrayVec = typename base_t::arrayVec;
+    /** type alias for array of unsigned ints */
+    using arrayUInt = typename base_t::arrayUInt;
+
 
+    /**
+     * @brief The constructor.
+     * @param rs resampling schedule (e.g. resample every rs time points).
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    APF(const unsigned int &rs=1, const unsigned int &num_threads=1, const size_t &num_parts=nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~APF();
+
+
+    /**
+     * @brief Evaluates the log of mu.
+     * @param x1 a Eigen::Matrix<float_t,dimx,1> representing time 1's state.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logMuEv (const ssv &x1 ) = 0;
+
+
+    /**
+     * @brief Evaluates the proposal distribution taking a Eigen::Matrix<float_t,dimx,1> from the previous time's state, and returning a state for the current time.
+     * @param xtm1 a Eigen::Matrix<float_t,dimx,1> representing the previous time's state.
+     * @return a Eigen::Matrix<float_t,dimx,1> representing a likely current time state, to be used by the observation density.
+     */
+    virtual ssv propMu (const ssv &xtm1 ) = 0;
+
+
+    /**
+     * @brief Samples from q1.
+     * @param y1 a Eigen::Matrix<float_t,dimy,1> representing time 1's data point.
+     * @return a Eigen::Matrix<float_t,dimx,1> sample for time 1's state.
+     */
+    virtual ssv q1Samp (const osv &y1) = 0;
+
+
+    /**
+     * @brief Samples from f.
+     * @param xtm1 a Eigen::Matrix<float_t,dimx,1> representing the previous time's state.
+     * @return a Eigen::Matrix<float_t,dimx,1> state sample for the current time.
+     */
+    virtual ssv fSamp (const ssv &xtm1) = 0;
+
+
+    /**
+     * @brief Evaluates the log of q1.
+     * @param x1 a Eigen::Matrix<float_t,dimx,1> representing time 1's state.
+     * @param y1 a Eigen::Matrix<float_t,dimy,1> representing time 1's data observation.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logQ1Ev (const ssv &x1, const osv &y1) = 0;
+
+
+    /**
+     * @brief Evaluates the log of g.
+     * @param yt a Eigen::Matrix<float_t,dimy,1> representing time t's data observation.
+     * @param xt a Eigen::Matrix<float_t,dimx,1> representing time t's state.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logGEv (const osv &yt, const ssv &xt) = 0;
+
+
+    /**
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
+     */
+    virtual void logMuEvBatch (const arrayVec &x1s, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates propMu for every particle. Override this to vectorize.
+     * @param xtm1s the previous time's states
+     * @param out where the results are written
+     */
+    virtual void propMuBatch (const arrayVec &xtm1s, arrayVec &out);
+
+
+    /**
+     * @brief Samples every particle from q1. Override this to vectorize.
+     * @param y1 time 1's data point
+     * @param out where the samples are written
+     */
+    virtual void q1SampBatch (const osv &y1, arrayVec &out);
+
+
+    /**
+     * @brief Samples every particle from f. Override this to vectorize.
+     * @param xtm1s the previous time's states
+     * @param out where the samples are written (never the same array as xtm1s)
+     */
+    virtual void fSampBatch (const arrayVec &xtm1s, arrayVec &out);
+
+
+    /**
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s time 1's states
+     * @param y1 time 1's data observation
+     * @param out where the log-densities are written
+     */
+    virtual void logQ1EvBatch (const arrayVec &x1s, const osv &y1, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt time t's data observation
+     * @param xts time t's states
+     * @param out where the log-densities are written
+     */
+    virtual void logGEvBatch (const osv &yt, const arrayVec &xts, arrayfloat_t &out);
+};
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+APF<nparts, dimx, dimy, resamp_t, float_t, debug>::APF(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+    : base_t(rs, num_threads, num_parts)
+{
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-float_t APF<nparts, dimx, dimy, resamp_t, float_t, debug>::getLogCondLike() const
+APF<nparts, dimx, dimy, resamp_t, float_t, debug>::~APF() {}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::logMuEvBatch(const arrayVec &x1s, arrayfloat_t &out)
 {
-    return m_logLastCondLike;
+    base_t::logMuEvBatch(x1s, out);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::propMuBatch(const arrayVec &xtm1s, arrayVec &out)
+{
+    base_t::propMuBatch(xtm1s, out);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::q1SampBatch(const osv &y1, arrayVec &out)
+{
+    base_t::q1SampBatch(y1, out);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::fSampBatch(const arrayVec &xtm1s, arrayVec &out)
+{
+    base_t::fSampBatch(xtm1s, out);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::logQ1EvBatch(const arrayVec &x1s, const osv &y1, arrayfloat_t &out)
+{
+    base_t::logQ1EvBatch(x1s, y1, out);
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-auto APF<nparts, dimx, dimy, resamp_t, float_t, debug>::getExpectations() const -> std::vector<Mat>
+void APF<nparts, dimx, dimy, resamp_t, float_t, debug>::logGEvBatch(const osv &yt, const arrayVec &xts, arrayfloat_t &out)
 {
-    return m_expectations;
+    base_t::logGEvBatch(yt, xts, out);
 }
 
+
 #endif //APF_H
 
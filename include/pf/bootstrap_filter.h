@@ -2,25 +2,34 @@
 #define BOOTSTRAP_FILTER_H
 
 #include <array>
+#include <iostream> // debug printing
 #include <vector>
 #include <Eigen/Dense>
 
 #include "pf_base.h"
+#include "filter_core.h"
+#include "part_storage.h"
+#include "thread_pool.h"
     
 
-//! A base class for the bootstrap particle filter.
+//! The bootstrap particle filter engine with compile-time (CRTP) dispatch to the model.
 /**
- * @class BSFilter
- * @author taylor
+ * @class BSFilterStatic
+ * @author t
  * @file bootstrap_filter.h
- * @brief bootstrap particle filter
- * @tparam nparts the number of particles
+ * @brief bootstrap particle filter that calls the model methods of Derived directly, 
+ * so they can be inlined into the particle loops. Derived inherits from 
+ * BSFilterStatic<Derived, ...> and provides (public, non-virtual) logMuEv, q1Samp, 
+ * logQ1Ev, logGEv and fSamp with the same signatures as BSFilter's. Any of the 
+ * "...Batch" methods can be redefined in Derived as well. See BSFilter for threading.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimx the dimension of the state
  * @tparam dimy the dimension of the observations
  * @tparam resamp_t the type of resampler
  */
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
-class BSFilter : public pf_base<float_t, dimy, dimx>
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class BSFilterStatic : public pf_base<float_t, dimy, dimx>
 {
 public:
 
@@ -30,25 +39,29 @@ public:
     using osv         = Eigen::Matrix<float_t, dimy, 1>; // obs size vec
     /** type alias for dynamically sized matrix */
     using Mat         = Eigen::Matrix<float_t, Eigen::Dynamic, Eigen::Dynamic>;
+    /** type alias for functionals that write into a preallocated output */
+    using outFunc = typename expectation_engine<ssv, float_t>::func_t;
     /** type alias for linear algebra stuff */
-    using arrayStates = std::array<ssv, nparts>;
+    using arrayStates = part_array<ssv, nparts>;
     /** type alias for array of floating points */
-    using arrayFloat = std::array<float_t, nparts>;
-    /** the number of particles */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** the number of particles (0 if it is chosen at run time) */
     static constexpr unsigned int num_particles = nparts;
 
 
     /**
      * @brief The constructor
      * @param rs the resampling schedule (e.g. every rs time point) 
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    BSFilter(const unsigned int &rs = 1);
+    BSFilterStatic(const unsigned int &rs = 1, const unsigned int &num_threads = 1, const size_t &num_parts = nparts);
     
     
     /**
      * @brief The (virtual) destructor
      */
-    virtual ~BSFilter();
+    virtual ~BSFilterStatic();
     
     
     /**
@@ -56,6 +69,44 @@ public:
      * @return log p(y_t | y_{1:t-1})
      */
     float_t getLogCondLike() const; 
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the number of worker threads (including the calling thread).
+     * @return the number of threads particles are split across
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
     
     
     /**
@@ -72,8 +123,369 @@ public:
      * @return return a std::vector<Mat> of expectations. How many depends on how many callbacks you gave to 
      */
     auto getExpectations () const -> std::vector<Mat>;
+
+
+    /**
+     * @brief Registers a functional h that writes h(x_t) into a preallocated rows x cols slot.
+     * Its expectation is computed on every time step (before resampling) along with the other 
+     * registered functionals, in one sweep over the particles and without allocating. 
+     * It gets called from all the worker threads.
+     * @param h the functional
+     * @param rows the number of rows of h(x_t)
+     * @param cols the number of columns of h(x_t)
+     * @return the index of its expectation in getFunctionalExpectations()
+     */
+    size_t addFunctional(const outFunc &h, size_t rows, size_t cols = 1);
+
+
+    /**
+     * @brief return the expectations of the registered functionals
+     * @return one matrix for each registered functional, in the order they were added
+     */
+    const std::vector<Mat>& getFunctionalExpectations() const;
+
+
+    /**
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
+     */
+    void logMuEvBatch (const arrayStates &x1s, arrayFloat &out);
+
+
+    /**
+     * @brief Samples every particle from the time 1 proposal. Override this to vectorize.
+     * @param y1 the first observed datum
+     * @param out where the samples are written
+     */
+    void q1SampBatch (const osv &y1, arrayStates &out);
+
+
+    /**
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param y1 the time 1 datum
+     * @param out where the log-densities are written
+     */
+    void logQ1EvBatch (const arrayStates &x1s, const osv &y1, arrayFloat &out);
+
+
+    /**
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt the time t datum
+     * @param xts the time t states
+     * @param out where the log-densities are written
+     */
+    void logGEvBatch (const osv &yt, const arrayStates &xts, arrayFloat &out);
+
+
+    /**
+     * @brief Samples every particle from the state transition. Override this to vectorize.
+     * @param in the time t-1 states
+     * @param out where the time t samples are written (the filter passes the same array as in)
+     */
+    void fSampBatch (const arrayStates &in, arrayStates &out);
+    
+protected:
+    /** @brief particle samples */
+    arrayStates      m_particles;
     
+    /** @brief particle unnormalized weights */
+    arrayFloat       m_logUnNormWeights;
+    
+    /** @brief time point */
+    unsigned int     m_now;         
+    
+    /** @brief log p(y_t|y_{1:t-1}) or log p(y1)  */
+    float_t       m_logLastCondLike;
+
+    /** @brief resampler object */
+    resamp_t          m_resampler;
+
+    /** @brief normalizing, expectations and the resampling decision */
+    FilterCore<nparts, ssv, float_t> m_core;
+
+    /** @brief scratch space for per-particle log densities */
+    arrayFloat       m_scratch;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
     
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::BSFilterStatic(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+                : m_particles(part_storage<ssv, nparts>::make(num_parts))
+                , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+                , m_now(0)
+                , m_logLastCondLike(0.0)
+                , m_core(rs, num_threads, num_parts)
+                , m_scratch(part_storage<float_t, nparts>::make(num_parts))
+{
+    share_num_threads(m_resampler, m_core.getNumThreads());
+    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::~BSFilterStatic() {}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logMuEvBatch(const arrayStates &x1s, arrayFloat &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logMuEv(x1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::q1SampBatch(const osv &y1, arrayStates &out)
+{
+    m_core.pool().parallel_for(out.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().q1Samp(y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logQ1EvBatch(const arrayStates &x1s, const osv &y1, arrayFloat &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logQ1Ev(x1s[ii], y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::logGEvBatch(const osv &yt, const arrayStates &xts, arrayFloat &out)
+{
+    m_core.pool().parallel_for(xts.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logGEv(yt, xts[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::fSampBatch(const arrayStates &in, arrayStates &out)
+{
+    m_core.pool().parallel_for(in.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().fSamp(in[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::filter(const osv &dat, const std::vector<std::function<const Mat(const ssv&)> >& fs) 
+{
+    const size_t N = m_logUnNormWeights.size();
+
+    if( m_now > 0)
+    {
+        // sample and get weight adjustments for the whole population 
+        // (the log-sum-exp reductions are split across workers too)
+        lse_partial<float_t> oldLSE = m_core.reduce(m_logUnNormWeights.data(), N);
+        derived().fSampBatch(m_particles, m_particles);
+        derived().logGEvBatch(dat, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+
+        // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
+        m_logLastCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
+    }
+    else //  (m_now == 0) //time 1
+    {  
+        // sample and weight the whole population
+        derived().q1SampBatch(dat, m_particles);
+        derived().logMuEvBatch(m_particles, m_logUnNormWeights);
+        derived().logGEvBatch(dat, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+        derived().logQ1EvBatch(m_particles, dat, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] -= m_scratch[ii];
+
+        // calculate log cond likelihood with log-exp-sum trick
+        m_logLastCondLike = -std::log(N) + m_core.weigh(m_logUnNormWeights).logSumExp();
+    }
+
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t ii = 0; ii < N; ++ii)
+            std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
+    }
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_particles[i]); });
+    m_core.expectFunctionals([this](size_t i) -> const ssv& { return m_particles[i]; });
+
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t fId = 0; fId < fs.size(); ++fId)
+            std::cout << "transposed expectation " << fId << ": " << m_core.getExpectations()[fId].transpose() << "\n";
+    }
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_particles, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time
+    m_now += 1;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getLogCondLike() const
+{
+    return m_logLastCondLike;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+unsigned int BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getNumThreads() const
+{
+    return m_core.getNumThreads();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::addFunctional(const outFunc &h, size_t rows, size_t cols)
+{
+    return m_core.addFunctional(h, rows, cols);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getFunctionalExpectations() const -> const std::vector<Mat>&
+{
+    return m_core.getFunctionalExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterStatic<Derived, nparts, dimx, dimy, resamp_t, float_t, debug>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_particles, m_logUnNormWeights, n);
+    }else{
+        part_storage<ssv, nparts>::resize(m_particles, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+    part_storage<float_t, nparts>::resize(m_scratch, n);
+}
+
+
+//! A base class for the bootstrap particle filter.
+/**
+ * @class BSFilter
+ * @author taylor
+ * @file bootstrap_filter.h
+ * @brief bootstrap particle filter
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimx the dimension of the state
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the type of resampler
+ * 
+ * If num_threads > 1 is passed to the constructor, the particles are split into one 
+ * contiguous chunk per worker thread, and q1Samp, logMuEv, logQ1Ev, fSamp and logGEv 
+ * are called concurrently. In that case these methods must be thread-safe. Keep one 
+ * sampler per worker (indexed by thread_pool::this_worker()), and seed each one, if you 
+ * want results that are reproducible for a fixed seed and thread count.
+ * 
+ * The filter only ever calls the "...Batch" methods, which work on the whole population 
+ * at once. By default they loop over the per-particle methods (one chunk per worker), 
+ * so a model only has to override them if it can do better (e.g. with one Eigen 
+ * expression over all particles). Overridden batch methods are called from the 
+ * calling thread only.
+ * 
+ * The model methods are pure virtual. BSFilterStatic runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
+ */
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class BSFilter : public BSFilterStatic<BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = BSFilterStatic<BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>;
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv = typename base_t::ssv;
+    /** "obs size vector" type alias for linear algebra stuff */
+    using osv = typename base_t::osv;
+    /** type alias for dynamically sized matrix */
+    using Mat = typename base_t::Mat;
+    /** type alias for linear algebra stuff */
+    using arrayStates = typename base_t::arrayStates;
+    /** type alias for array of floating points */
+    using arrayFloat = typename base_t::arrayFloat;
+
+
+    /**
+     * @brief The constructor.
+     * @param rs the resampling schedule (e.g. every rs time point)
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    BSFilter(const unsigned int &rs = 1, const unsigned int &num_threads = 1, const size_t &num_parts = nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~BSFilter();
+
+
     /**
      * @brief  Calculate muEv or logmuEv
      * @param x1 is a const Vec& describing the state sample
@@ -88,7 +500,7 @@ public:
      * @return the sample as a Vec
      */
     virtual ssv q1Samp (const osv &y1) = 0;    
-    
+
 
     /**
      * @brief Calculate q1Ev or log q1Ev
@@ -97,7 +509,7 @@ public:
      * @return the density or log-density evaluation
      */
     virtual float_t logQ1Ev (const ssv &x1, const osv &y1 ) = 0;
-    
+
 
     /**
      * @brief Calculate gEv or logGEv
@@ -106,8 +518,8 @@ public:
      * @return the density or log-density evaluation 
      */
     virtual float_t logGEv (const osv &yt, const ssv &xt ) = 0;
-    
-    
+
+
     //!
     /**
      * @brief Sample from the state transition distribution
@@ -115,39 +527,55 @@ public:
      * @return the sample as a Vec
      */
     virtual ssv fSamp (const ssv &xtm1) = 0;
-    
-protected:
-    /** @brief particle samples */
-    arrayStates      m_particles;
-    
-    /** @brief particle unnormalized weights */
-    arrayFloat       m_logUnNormWeights;
-    
-    /** @brief time point */
-    unsigned int     m_now;         
-    
-    /** @brief log p(y_t|y_{1:t-1}) or log p(y1)  */
-    float_t       m_logLastCondLike;
 
-    /** @brief resampler object */
-    resamp_t          m_resampler;
-    
-    /** @brief expectations E[h(x_t) | y_{1:t}] for user defined "h"s */
-    std::vector<Mat> m_expectations; 
-    
-    /** @brief resampling schedule (e.g. resample every __ time points) */
-    unsigned int     m_resampSched;
+
+    /**
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
+     */
+    virtual void logMuEvBatch (const arrayStates &x1s, arrayFloat &out);
+
+
+    /**
+     * @brief Samples every particle from the time 1 proposal. Override this to vectorize.
+     * @param y1 the first observed datum
+     * @param out where the samples are written
+     */
+    virtual void q1SampBatch (const osv &y1, arrayStates &out);
+
+
+    /**
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param y1 the time 1 datum
+     * @param out where the log-densities are written
+     */
+    virtual void logQ1EvBatch (const arrayStates &x1s, const osv &y1, arrayFloat &out);
+
+
+    /**
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt the time t datum
+     * @param xts the time t states
+     * @param out where the log-densities are written
+     */
+    virtual void logGEvBatch (const osv &yt, const arrayStates &xts, arrayFloat &out);
+
+
+    /**
+     * @brief Samples every particle from the state transition. Override this to vectorize.
+     * @param in the time t-1 states
+     * @param out where the time t samples are written (the filter passes the same array as in)
+     */
+    virtual void fSampBatch (const arrayStates &in, arrayStates &out);
 };
 
-    
+
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::BSFilter(const unsigned int &rs)
-                : m_now(0)
-                , m_logLastCondLike(0.0)
-                , m_resampSched(rs)
-                  
+BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::BSFilter(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+    : base_t(rs, num_threads, num_parts)
 {
-    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
 }
 
 
@@ -156,147 +584,38 @@ BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::~BSFilter() {}
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::filter(const osv &dat, const std::vector<std::function<const Mat(const ssv&)> >& fs) 
+void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logMuEvBatch(const arrayStates &x1s, arrayFloat &out)
 {
+    base_t::logMuEvBatch(x1s, out);
+}
 
-    if( m_now > 0)
-    {
-       
-        // try to iterate over particles all at once
-        ssv newSamp;
-        float_t maxOldLogUnNormWts(-1.0/0.0);
-        arrayFloat oldLogUnNormWts = m_logUnNormWeights;
-        for(size_t ii = 0; ii < nparts; ++ii)
-        {
-            // update max of old logUnNormWts
-            if (m_logUnNormWeights[ii] > maxOldLogUnNormWts)
-                maxOldLogUnNormWts = m_logUnNormWeights[ii];
-            
-            // sample and get weight adjustments
-            newSamp = fSamp(m_particles[ii]);
-            m_logUnNormWeights[ii] = logGEv(dat, newSamp);
-
-            // overwrite stuff
-            m_particles[ii] = newSamp;
-
-            // print stuff if debug mode is on
-            if constexpr(debug) 
-                std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
-        }
-        
-        // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
-        float_t maxNumer = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end()); //because you added log adjustments
-        float_t sumExp1(0.0);
-        float_t sumExp2(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp1 += std::exp(m_logUnNormWeights[i] - maxNumer);
-            sumExp2 += std::exp(oldLogUnNormWts[i] - maxOldLogUnNormWts);  //1
-        }
-        m_logLastCondLike = maxNumer + std::log(sumExp1) - maxOldLogUnNormWts - std::log(sumExp2);
-
-        // calculate expectations before you resample
-        int fId(0);
-        for(auto & h : fs){ 
-        
-            Mat testOutput = h(m_particles[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t weightNormConst (0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - maxNumer);
-                weightNormConst += std::exp(m_logUnNormWeights[prtcl] - maxNumer);
-            }
-            m_expectations[fId] = numer/weightNormConst;
-            
-            // print stuff if debug mode is on
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << ": " << m_expectations[fId].transpose() << "\n";
-            
-            fId++;
-        }
-
-        // resample if you should
-        if ( (m_now+1) % m_resampSched == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-
-        // advance time
-        m_now += 1;       
-    }
-    else //  (m_now == 0) //time 1
-    {  
-        // only need to iterate over particles once
-        for(size_t ii = 0; ii < nparts; ++ii)
-        {
-            // sample particles
-            m_particles[ii] = q1Samp(dat);
-            m_logUnNormWeights[ii] = logMuEv(m_particles[ii]);
-            m_logUnNormWeights[ii] += logGEv(dat, m_particles[ii]);
-            m_logUnNormWeights[ii] -= logQ1Ev(m_particles[ii], dat);
-
-            // print stuff if debug mode is on
-            if constexpr(debug) 
-                std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
-
-        }
-       
-        // calculate log cond likelihood with log-exp-sum trick
-        float_t max = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        float_t sumExp(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp += std::exp(m_logUnNormWeights[i] - max);
-        }
-        m_logLastCondLike = -std::log(nparts) + (max) + std::log(sumExp);
-   
-        // calculate expectations before you resample
-        // paying mind to underflow
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_particles[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t weightNormConst (0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_particles[prtcl]) * std::exp( m_logUnNormWeights[prtcl] - (max) );
-                weightNormConst += std::exp( m_logUnNormWeights[prtcl] - (max) );
-            }
-            m_expectations[fId] = numer/weightNormConst;
-
-            // print stuff if debug mode is on
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << ": " << m_expectations[fId].transpose() << "\n";
-
-            fId++;
-        }
-   
-        // resample if you should
-        if ( (m_now+1) % m_resampSched == 0){
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-        }
-        
-        // advance time step
-        m_now += 1;   
-    }
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::q1SampBatch(const osv &y1, arrayStates &out)
+{
+    base_t::q1SampBatch(y1, out);
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-float_t BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::getLogCondLike() const
+void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logQ1EvBatch(const arrayStates &x1s, const osv &y1, arrayFloat &out)
 {
-    return m_logLastCondLike;
+    base_t::logQ1EvBatch(x1s, y1, out);
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-auto BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::getExpectations() const -> std::vector<Mat>
+void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logGEvBatch(const osv &yt, const arrayStates &xts, arrayFloat &out)
 {
-    return m_expectations;
+    base_t::logGEvBatch(yt, xts, out);
 }
 
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::fSampBatch(const arrayStates &in, arrayStates &out)
+{
+    base_t::fSampBatch(in, out);
+}
+
 
 #endif // BOOTSTRAP_FILTER_H
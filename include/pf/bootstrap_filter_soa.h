@@ -0,0 +1,395 @@
+#ifndef BOOTSTRAP_FILTER_SOA_H
+#define BOOTSTRAP_FILTER_SOA_H
+
+#include <array>
+#include <iostream> // debug printing
+#include <vector>
+#include <Eigen/Dense>
+
+#include "pf_base.h"
+#include "filter_core.h"
+#include "part_storage.h"
+#include "soa_particles.h"
+#include "thread_pool.h"
+
+
+//! A base class for the bootstrap particle filter with structure-of-arrays particle storage.
+/**
+ * @class BSFilterSoA
+ * @author t
+ * @file bootstrap_filter_soa.h
+ * @brief bootstrap particle filter that stores particles in a soa_particles container.
+ * Instead of one call per particle, the model methods get a block of consecutive
+ * particles (a dimx x n column block where each row is one state coordinate)
+ * and fill in all of them at once, so they can be written as vectorized Eigen
+ * expressions. If num_threads > 1, each worker gets its own block, and the block
+ * methods are called concurrently (see BSFilter).
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimx the dimension of the state
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the type of resampler (must accept soa_particles)
+ */
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class BSFilterSoA : public pf_base<float_t, dimy, dimx>
+{
+public:
+
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv         = Eigen::Matrix<float_t, dimx, 1>;
+    /** "obs size vector" type alias for linear algebra stuff */
+    using osv         = Eigen::Matrix<float_t, dimy, 1>;
+    /** type alias for dynamically sized matrix */
+    using Mat         = Eigen::Matrix<float_t, Eigen::Dynamic, Eigen::Dynamic>;
+    /** type alias for functionals that write into a preallocated output */
+    using outFunc = typename expectation_engine<ssv, float_t>::func_t;
+    /** type alias for the particle container */
+    using soaParts    = soa_particles<nparts, dimx, float_t>;
+    /** type alias for a writable block of particles */
+    using stateBlock  = typename soaParts::block_t;
+    /** type alias for a read-only block of particles */
+    using constStateBlock = typename soaParts::constBlock_t;
+    /** type alias for a writable block of log weights (or other per-particle numbers) */
+    using floatBlock  = Eigen::Ref<Eigen::Array<float_t, Eigen::Dynamic, 1>>;
+    /** type alias for array of floating points */
+    using arrayFloat  = part_array<float_t, nparts>;
+    /** the number of particles (0 if it is chosen at run time) */
+    static constexpr unsigned int num_particles = nparts;
+
+
+    /**
+     * @brief The constructor
+     * @param rs the resampling schedule (e.g. every rs time point)
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    BSFilterSoA(const unsigned int &rs = 1, const unsigned int &num_threads = 1, const size_t &num_parts = nparts);
+
+
+    /**
+     * @brief The (virtual) destructor
+     */
+    virtual ~BSFilterSoA();
+
+
+    /**
+     * @brief Returns the most recent (log-) conditiona likelihood.
+     * @return log p(y_t | y_{1:t-1})
+     */
+    float_t getLogCondLike() const;
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the number of worker threads (including the calling thread).
+     * @return the number of threads particles are split across
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts).
+     * After the first time step, n particles are resampled from the current
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
+
+
+    /**
+     * @brief updates filtering distribution on a new datapoint.
+     * Optionally stores expectations of functionals.
+     * @param data the most recent data point
+     * @param fs a vector of functions if you want to calculate expectations.
+     */
+    void filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs = std::vector<std::function<const Mat(const ssv&)> >());
+
+
+    /**
+     * @brief return all stored expectations (taken with respect to $p(x_t|y_{1:t})$
+     * @return return a std::vector<Mat> of expectations. How many depends on how many callbacks you gave to
+     */
+    auto getExpectations () const -> std::vector<Mat>;
+
+
+    /**
+     * @brief Registers a functional h that writes h(x_t) into a preallocated rows x cols slot.
+     * Its expectation is computed on every time step (before resampling) along with the other 
+     * registered functionals, in one sweep over the particles and without allocating. 
+     * It gets called from all the worker threads.
+     * @param h the functional
+     * @param rows the number of rows of h(x_t)
+     * @param cols the number of columns of h(x_t)
+     * @return the index of its expectation in getFunctionalExpectations()
+     */
+    size_t addFunctional(const outFunc &h, size_t rows, size_t cols = 1);
+
+
+    /**
+     * @brief return the expectations of the registered functionals
+     * @return one matrix for each registered functional, in the order they were added
+     */
+    const std::vector<Mat>& getFunctionalExpectations() const;
+
+
+    /**
+     * @brief Evaluates log mu for a block of particles
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written (one per particle)
+     */
+    virtual void logMuEvBlock (constStateBlock x1s, floatBlock out) = 0;
+
+
+    /**
+     * @brief Samples a block of particles from the time 1 proposal
+     * @param y1 the first observed datum
+     * @param x1s where the samples are written
+     */
+    virtual void q1SampBlock (const osv &y1, stateBlock x1s) = 0;
+
+
+    /**
+     * @brief Evaluates log q1 for a block of particles
+     * @param x1s the time 1 state samples
+     * @param y1 the time 1 datum
+     * @param out where the log-densities are written (one per particle)
+     */
+    virtual void logQ1EvBlock (constStateBlock x1s, const osv &y1, floatBlock out) = 0;
+
+
+    /**
+     * @brief Evaluates log g for a block of particles
+     * @param yt the time t datum
+     * @param xts the time t states
+     * @param out where the log-densities are written (one per particle)
+     */
+    virtual void logGEvBlock (const osv &yt, constStateBlock xts, floatBlock out) = 0;
+
+
+    /**
+     * @brief Samples a block of particles from the state transition distribution
+     * @param xs holds the time t-1 states going in, and the time t samples coming out
+     */
+    virtual void fSampBlock (stateBlock xs) = 0;
+
+protected:
+    /** @brief particle samples */
+    soaParts         m_particles;
+
+    /** @brief particle unnormalized weights */
+    arrayFloat       m_logUnNormWeights;
+
+    /** @brief time point */
+    unsigned int     m_now;
+
+    /** @brief log p(y_t|y_{1:t-1}) or log p(y1)  */
+    float_t          m_logLastCondLike;
+
+    /** @brief resampler object */
+    resamp_t         m_resampler;
+
+    /** @brief normalizing, expectations and the resampling decision */
+    FilterCore<nparts, ssv, float_t> m_core;
+
+    /** @brief scratch space for per-particle log densities */
+    arrayFloat       m_scratch;
+
+    /** @brief one log-sum-exp reduction per worker for the new log weights (allocated once) */
+    std::vector<lse_partial<float_t>> m_newLSE;
+
+    /** @brief one log-sum-exp reduction per worker for the old log weights (allocated once) */
+    std::vector<lse_partial<float_t>> m_oldLSE;
+};
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::BSFilterSoA(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+                : m_particles(num_parts)
+                , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+                , m_now(0)
+                , m_logLastCondLike(0.0)
+                , m_core(rs, num_threads, num_parts)
+                , m_scratch(part_storage<float_t, nparts>::make(num_parts))
+                , m_newLSE(m_core.getNumThreads())
+                , m_oldLSE(m_core.getNumThreads())
+{
+    share_num_threads(m_resampler, m_core.getNumThreads());
+    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::~BSFilterSoA() {}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::filter(const osv &dat, const std::vector<std::function<const Mat(const ssv&)> >& fs)
+{
+    const size_t N = m_logUnNormWeights.size();
+    using wtMap = Eigen::Map<Eigen::Array<float_t, Eigen::Dynamic, 1>>;
+
+    // one reduction per worker for the new and the old log weights
+    std::fill(m_newLSE.begin(), m_newLSE.end(), lse_partial<float_t>());
+    std::fill(m_oldLSE.begin(), m_oldLSE.end(), lse_partial<float_t>());
+    if( m_now > 0)
+    {
+        // sample and weight one block of particles per worker
+        m_core.pool().parallel_for(N, [&](size_t first, size_t last, unsigned int w)
+        {
+            const size_t n = last - first;
+            m_oldLSE[w].add(&m_logUnNormWeights[first], n);
+            wtMap tmp(&m_scratch[first], n);
+            fSampBlock(m_particles.map().middleCols(first, n));
+            logGEvBlock(dat, m_particles.map().middleCols(first, n), tmp);
+            wtMap(&m_logUnNormWeights[first], n) += tmp;
+            m_newLSE[w].add(&m_logUnNormWeights[first], n, &m_core.normWeights()[first]);
+        });
+    }
+    else //  (m_now == 0) //time 1
+    {
+        m_core.pool().parallel_for(N, [&](size_t first, size_t last, unsigned int w)
+        {
+            const size_t n = last - first;
+            wtMap logWts(&m_logUnNormWeights[first], n);
+            wtMap tmp(&m_scratch[first], n);
+            q1SampBlock(dat, m_particles.map().middleCols(first, n));
+            logMuEvBlock(m_particles.map().middleCols(first, n), logWts);
+            logGEvBlock(dat, m_particles.map().middleCols(first, n), tmp);
+            logWts += tmp;
+            logQ1EvBlock(m_particles.map().middleCols(first, n), dat, tmp);
+            logWts -= tmp;
+            m_newLSE[w].add(&m_logUnNormWeights[first], n, &m_core.normWeights()[first]);
+        });
+    }
+    for(unsigned int w = 1; w < m_core.pool().size(); ++w)
+        m_oldLSE[0].merge(m_oldLSE[w]);
+    lse_partial<float_t> lse = m_core.weigh(m_newLSE);
+
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t ii = 0; ii < N; ++ii)
+            std::cout << "time: " << m_now << ", transposed sample: " << m_particles.get(ii).transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
+    }
+
+    // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
+    if(m_now > 0)
+        m_logLastCondLike = lse.logSumExp() - m_oldLSE[0].logSumExp();
+    else
+        m_logLastCondLike = -std::log(N) + lse.logSumExp();
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_particles.get(i)); });
+    m_core.expectFunctionals([this](size_t i) { return m_particles.get(i); });
+
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t fId = 0; fId < fs.size(); ++fId)
+            std::cout << "transposed expectation " << fId << ": " << m_core.getExpectations()[fId].transpose() << "\n";
+    }
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_particles, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time
+    m_now += 1;
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getLogCondLike() const
+{
+    return m_logLastCondLike;
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+unsigned int BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getNumThreads() const
+{
+    return m_core.getNumThreads();
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::addFunctional(const outFunc &h, size_t rows, size_t cols)
+{
+    return m_core.addFunctional(h, rows, cols);
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getFunctionalExpectations() const -> const std::vector<Mat>&
+{
+    return m_core.getFunctionalExpectations();
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void BSFilterSoA<nparts, dimx, dimy, resamp_t, float_t, debug>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_particles, m_logUnNormWeights, n);
+    }else{
+        m_particles.resize(n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+    part_storage<float_t, nparts>::resize(m_scratch, n);
+}
+
+
+#endif // BOOTSTRAP_FILTER_SOA_H
@@ -1,27 +1,33 @@
-#ifndef BOOTSTRAP_FILTER_H
-#define BOOTSTRAP_FILTER_H
+#ifndef BOOTSTRAP_FILTER_WC_H
+#define BOOTSTRAP_FILTER_WC_H
 
 #include <array>
 #include <vector>
 #include <Eigen/Dense>
 
+#include "part_storage.h"
+#include "filter_core.h"
 #include "pf_base.h"
     
 
-//! A base class for the bootstrap particle filter with covariates.
+//! The bootstrap particle filter (with covariates) engine with compile-time (CRTP) dispatch to the model.
 /**
- * @class BSFilterWC
- * @author taylor
+ * @class BSFilterWCStatic
+ * @author t
  * @file bootstrap_filter_with_covariates.h
- * @brief bootstrap particle filter with covariates
- * @tparam nparts the number of particles
+ * @brief bootstrap particle filter with covariates that calls the model methods of Derived 
+ * directly, so they can be inlined into the particle loop. Derived inherits from 
+ * BSFilterWCStatic<Derived, ...> and provides (public, non-virtual) versions of 
+ * BSFilterWC's model methods.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimx the dimension of the state
  * @tparam dimy the dimension of the observations
  * @tparam dimcov the dimension of the covariates
  * @tparam resamp_t the type of resampler
  */
-template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-class BSFilterWC 
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+class BSFilterWCStatic 
 {
 public:
     
@@ -34,23 +40,24 @@ public:
     /** type alias for dynamically sized matrix */
     using Mat         = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
     /** type alias for linear algebra stuff */
-    using arrayStates = std::array<ssv, nparts>;
+    using arrayStates = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayfloat_t = std::array<float_t, nparts>;
+    using arrayfloat_t = part_array<float_t, nparts>;
     /** type alias for function */
     using Funcs = std::vector<std::function<const Mat(const ssv&, const cvsv&)>>;
 
     /**
      * @brief The constructor
      * @param rs the resampling schedule (e.g. every rs time point) 
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    BSFilterWC(const unsigned int &rs = 1);
+    BSFilterWCStatic(const unsigned int &rs = 1, const size_t &num_parts = nparts);
     
     
     /**
      * @brief The (virtual) destructor
      */
-    virtual ~BSFilterWC();
+    virtual ~BSFilterWCStatic();
     
     
     /**
@@ -58,6 +65,37 @@ public:
      * @return log p(y_t | y_{1:t-1})
      */
     float_t getLogCondLike() const; 
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
     
     
     /**
@@ -75,55 +113,8 @@ public:
      * @return return a std::vector<Mat> of expectations. How many depends on how many callbacks you gave to 
      */
     auto getExpectations () const -> std::vector<Mat>;
-    
-    
-    /**
-     * @brief  Calculate muEv or logmuEv
-     * @param x1 is a const Vec& describing the state sample
-     * @param z1 is a const Vec& describing the covariate sample
-     * @return the density or log-density evaluation as a float_t
-     */
-    virtual float_t logMuEv (const ssv &x1, const cvsv &z1) = 0;
-
-
-    /**
-     * @brief Samples from time 1 proposal 
-     * @param y1 is a const Vec& representing the first observed datum
-     * @param z1 is the const Vec& representing the first covariate 
-     * @return the sample as a Vec
-     */
-    virtual ssv q1Samp (const osv &y1, const cvsv &z1) = 0;    
-    
 
-    /**
-     * @brief Calculate q1Ev or log q1Ev
-     * @param x1 is a const Vec& describing the time 1 state sample
-     * @param y1 is a const Vec& describing the time 1 datum
-     * @param z1 is a const Vec& describing the time 1 covariate
-     * @return the density or log-density evaluation as a float_t
-     */
-    virtual float_t logQ1Ev (const ssv &x1, const osv &y1, const cvsv &z1) = 0;
-    
 
-    /**
-     * @brief Calculate gEv or logGEv
-     * @param yt is a const Vec& describing the time t datum
-     * @param xt is a const Vec& describing the time t state
-     * @param zt is a const Vec& describing the time t covariate
-     * @return the density or log-density evaluation as a float_t
-     */
-    virtual float_t logGEv (const osv &yt, const ssv &xt, const cvsv &zt) = 0;
-    
-    
-    //!
-    /**
-     * @brief Sample from the state transition distribution
-     * @param xtm1 is a const Vec& describing the time t-1 state
-     * @param zt is a const Vec& describing the time t covariate
-     * @return the sample as a Vec
-     */
-    virtual ssv fSamp (const ssv &xtm1, const cvsv &zt) = 0;
-    
 protected:
     /** @brief particle samples */
     arrayStates      m_particles;
@@ -140,11 +131,16 @@ protected:
     /** @brief resampler object */
     resamp_t          m_resampler;
     
-    /** @brief expectations E[h(x_t) | y_{1:t}] for user defined "h"s */
-    std::vector<Mat> m_expectations; 
-    
-    /** @brief resampling schedule (e.g. resample every __ time points) */
-    unsigned int     m_resampSched;
+    /** @brief normalizing, expectations and the resampling decision */
+    FilterCore<nparts, ssv, float_t> m_core;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
 };
 
     
@@ -153,143 +149,238 @@ protected:
 ///////////////////////////////////////// implementations ///////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::BSFilterWC(const unsigned int &rs)
-                : m_now(0)
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::BSFilterWCStatic(const unsigned int &rs, const size_t &num_parts)
+                : m_particles(part_storage<ssv, nparts>::make(num_parts))
+                , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+                , m_now(0)
                 , m_logLastCondLike(0.0)
-                , m_resampSched(rs)
-                  
+                , m_core(rs, 1, num_parts)
 {
     std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0); // log(1) = 0
 }
 
 
-template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::~BSFilterWC() {}
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::~BSFilterWCStatic() {}
 
 
-template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-void BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::filter(const osv &dat, const cvsv &covData, const Funcs& fs) 
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+void BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::filter(const osv &dat, const cvsv &covData, const Funcs& fs) 
 {
+    const size_t N = m_logUnNormWeights.size();
 
     if (m_now == 0) //time 1
     {  
         // only need to iterate over particles once
-        for(size_t ii = 0; ii < nparts; ++ii)
+        for(size_t ii = 0; ii < N; ++ii)
         {
             // sample particles
-            m_particles[ii] = q1Samp(dat, covData);
-            m_logUnNormWeights[ii] = logMuEv(m_particles[ii], covData);
-            m_logUnNormWeights[ii] += logGEv(dat, m_particles[ii], covData);
-            m_logUnNormWeights[ii] -= logQ1Ev(m_particles[ii], dat, covData);
+            m_particles[ii] = derived().q1Samp(dat, covData);
+            m_logUnNormWeights[ii] = derived().logMuEv(m_particles[ii], covData);
+            m_logUnNormWeights[ii] += derived().logGEv(dat, m_particles[ii], covData);
+            m_logUnNormWeights[ii] -= derived().logQ1Ev(m_particles[ii], dat, covData);
         }
-       
+
         // calculate log cond likelihood with log-exp-sum trick
-        float_t max = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        float_t sumExp(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp += std::exp(m_logUnNormWeights[i] - max);
-        }
-        m_logLastCondLike = -std::log(nparts) + max + std::log(sumExp);
-   
-        // calculate expectations before you resample
-        // paying mind to underflow
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_particles[0], covData);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t weightNormConst (0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ // iterate over all particles
-                numer += h(m_particles[prtcl],covData) * std::exp( m_logUnNormWeights[prtcl] - (max) );
-                weightNormConst += std::exp( m_logUnNormWeights[prtcl] - (max) );
-            }
-            m_expectations[fId] = numer/weightNormConst;
-            fId++;
-        }
-   
-        // resample if you should
-        if ( (m_now+1) % m_resampSched == 0){
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-        }
-        
-        // advance time step
-        m_now += 1;   
+        m_logLastCondLike = -std::log(N) + m_core.weigh(m_logUnNormWeights).logSumExp();
     }
     else // m_now > 0
     {
-       
         // try to iterate over particles all at once
         ssv newSamp;
-        float_t maxOldLogUnNormWts(-1.0/0.0);
-        arrayfloat_t oldLogUnNormWts = m_logUnNormWeights;
-        for(size_t ii = 0; ii < nparts; ++ii)
+        lse_partial<float_t> oldLSE;
+        oldLSE.add(m_logUnNormWeights.data(), N);
+        for(size_t ii = 0; ii < N; ++ii)
         {
-            // update max of old logUnNormWts
-            if (m_logUnNormWeights[ii] > maxOldLogUnNormWts)
-                maxOldLogUnNormWts = m_logUnNormWeights[ii];
-            
             // sample and get weight adjustments
-            newSamp = fSamp(m_particles[ii], covData);
-            m_logUnNormWeights[ii] = logGEv(dat, newSamp, covData);
+            newSamp = derived().fSamp(m_particles[ii], covData);
+            m_logUnNormWeights[ii] += derived().logGEv(dat, newSamp, covData);
  
             // overwrite stuff
             m_particles[ii] = newSamp;
         }
         
         // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
-        float_t maxNumer = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end()); //because you added log adjustments
-        float_t sumExp1(0.0);
-        float_t sumExp2(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp1 += std::exp(m_logUnNormWeights[i] - maxNumer);
-            sumExp2 += std::exp(oldLogUnNormWts[i] - maxOldLogUnNormWts);  //1
-        }
-        m_logLastCondLike = maxNumer + std::log(sumExp1) - maxOldLogUnNormWts - std::log(sumExp2);
+        m_logLastCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
+    }
 
-        // calculate expectations before you resample
-        int fId(0);
-        for(auto & h : fs){ // iterate over all functions
-        
-            Mat testOutput = h(m_particles[0],covData);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t weightNormConst (0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ // iterate over all particles
-                numer += h(m_particles[prtcl],covData) * std::exp(m_logUnNormWeights[prtcl] - maxNumer);
-                weightNormConst += std::exp(m_logUnNormWeights[prtcl] - maxNumer);
-            }
-            m_expectations[fId] = numer/weightNormConst;
-            fId++;
-        }
+    // calculate expectations before you resample
+    m_core.expect(fs, [&](const auto &h, size_t i) { return h(m_particles[i], covData); });
 
-        // resample if you should
-        if ( (m_now+1) % m_resampSched == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_particles, m_logUnNormWeights, m_core.normWeights());
 
-        // advance time
-        m_now += 1;       
-    }
+    // advance time
+    m_now += 1;
 }
 
 
-template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-float_t BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::getLogCondLike() const
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+float_t BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::getLogCondLike() const
 {
     return m_logLastCondLike;
 }
 
 
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+float_t BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+void BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+auto BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+size_t BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+void BSFilterWCStatic<Derived, nparts, dimx, dimy, dimcov, resamp_t, float_t>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_particles, m_logUnNormWeights, n);
+    }else{
+        part_storage<ssv, nparts>::resize(m_particles, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+}
+
+
+//! A base class for the bootstrap particle filter with covariates.
+/**
+ * @class BSFilterWC
+ * @author taylor
+ * @file bootstrap_filter_with_covariates.h
+ * @brief bootstrap particle filter with covariates
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimx the dimension of the state
+ * @tparam dimy the dimension of the observations
+ * @tparam dimcov the dimension of the covariates
+ * @tparam resamp_t the type of resampler
+ * 
+ * The model methods are pure virtual. BSFilterWCStatic runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
+ */
+template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+class BSFilterWC : public BSFilterWCStatic<BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>, nparts, dimx, dimy, dimcov, resamp_t, float_t>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = BSFilterWCStatic<BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>, nparts, dimx, dimy, dimcov, resamp_t, float_t>;
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv = typename base_t::ssv;
+    /** "obs size vector" type alias for linear algebra stuff */
+    using osv = typename base_t::osv;
+    /** covariate size vector" type alias for linear algebra stuff */
+    using cvsv = typename base_t::cvsv;
+    /** type alias for dynamically sized matrix */
+    using Mat = typename base_t::Mat;
+    /** type alias for linear algebra stuff */
+    using arrayStates = typename base_t::arrayStates;
+    /** type alias for array of float_ts */
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+    /** type alias for function */
+    using Funcs = typename base_t::Funcs;
+
+
+    /**
+     * @brief The constructor.
+     * @param rs the resampling schedule (e.g. every rs time point)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    BSFilterWC(const unsigned int &rs = 1, const size_t &num_parts = nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~BSFilterWC();
+
+
+    /**
+     * @brief  Calculate muEv or logmuEv
+     * @param x1 is a const Vec& describing the state sample
+     * @param z1 is a const Vec& describing the covariate sample
+     * @return the density or log-density evaluation as a float_t
+     */
+    virtual float_t logMuEv (const ssv &x1, const cvsv &z1) = 0;
+
+
+    /**
+     * @brief Samples from time 1 proposal 
+     * @param y1 is a const Vec& representing the first observed datum
+     * @param z1 is the const Vec& representing the first covariate 
+     * @return the sample as a Vec
+     */
+    virtual ssv q1Samp (const osv &y1, const cvsv &z1) = 0;    
+
+
+    /**
+     * @brief Calculate q1Ev or log q1Ev
+     * @param x1 is a const Vec& describing the time 1 state sample
+     * @param y1 is a const Vec& describing the time 1 datum
+     * @param z1 is a const Vec& describing the time 1 covariate
+     * @return the density or log-density evaluation as a float_t
+     */
+    virtual float_t logQ1Ev (const ssv &x1, const osv &y1, const cvsv &z1) = 0;
+
+
+    /**
+     * @brief Calculate gEv or logGEv
+     * @param yt is a const Vec& describing the time t datum
+     * @param xt is a const Vec& describing the time t state
+     * @param zt is a const Vec& describing the time t covariate
+     * @return the density or log-density evaluation as a float_t
+     */
+    virtual float_t logGEv (const osv &yt, const ssv &xt, const cvsv &zt) = 0;
+
+
+    //!
+    /**
+     * @brief Sample from the state transition distribution
+     * @param xtm1 is a const Vec& describing the time t-1 state
+     * @param zt is a const Vec& describing the time t covariate
+     * @return the sample as a Vec
+     */
+    virtual ssv fSamp (const ssv &xtm1, const cvsv &zt) = 0;
+};
+
+
 template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
-auto BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::getExpectations() const -> std::vector<Mat>
+BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::BSFilterWC(const unsigned int &rs, const size_t &num_parts)
+    : base_t(rs, num_parts)
 {
-    return m_expectations;
 }
 
 
+template<size_t nparts, size_t dimx, size_t dimy, size_t dimcov, typename resamp_t, typename float_t>
+BSFilterWC<nparts, dimx, dimy, dimcov, resamp_t, float_t>::~BSFilterWC() {}
+
 
-#endif // BOOTSTRAP_FILTER_H
+#endif // BOOTSTRAP_FILTER_WC_H
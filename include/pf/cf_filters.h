@@ -185,7 +185,7 @@ private:
     bool m_fresh;
     
     /** @brief pi */
-    const float_t m_pi;
+    float_t m_pi;
     
     /**
      * @todo handle diagonal variance matrices, and ensure symmetricness in other ways
@@ -224,7 +224,10 @@ template<size_t dimstate, size_t dimobs, size_t diminput, typename float_t>
 kalman<dimstate,dimobs,diminput,float_t>::kalman() 
         : cf_filter<dimstate,dimobs,float_t>()
         , m_predMean(ssv::Zero())
+        , m_filtMean(ssv::Zero())
         , m_predVar(ssMat::Zero()) 
+        , m_filtVar(ssMat::Zero())
+        , m_lastLogCondLike(0.0)
         , m_fresh(true)
         , m_pi(3.14159265358979)
 {
@@ -235,7 +238,10 @@ template<size_t dimstate, size_t dimobs, size_t diminput, typename float_t>
 kalman<dimstate,dimobs,diminput,float_t>::kalman(const ssv &initStateMean, const ssMat &initStateVar) 
         : cf_filter<dimstate,dimobs,float_t>()
         , m_predMean(initStateMean)
+        , m_filtMean(ssv::Zero())
         , m_predVar(initStateVar) 
+        , m_filtVar(ssMat::Zero())
+        , m_lastLogCondLike(0.0)
         , m_fresh(true)
         , m_pi(3.14159265358979)
 {
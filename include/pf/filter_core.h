@@ -0,0 +1,718 @@
+#ifndef FILTER_CORE_H
+#define FILTER_CORE_H
+
+#include <algorithm> // fill
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <type_traits> // void_t
+#include <utility> // pair, declval
+#include <vector>
+#include <Eigen/Dense>
+
+#include "part_storage.h"
+#include "thread_pool.h"
+
+
+//! A piece of a log-sum-exp reduction that can be merged with other pieces.
+/**
+ * @class lse_partial
+ * @author t
+ * @file filter_core.h
+ * @brief Holds the max, the sum of exp(x - max) and the sum of exp(2(x - max)) for a 
+ * chunk of log weights, which is enough for the log-sum-exp and the effective sample size.
+ * Each worker thread reduces its own chunk, and the pieces are merged at the end,
+ * so no accumulator is shared between threads.
+ * @tparam float_t (e.g. double, float, etc.)
+ */
+template<typename float_t>
+struct alignas(64) lse_partial
+{
+    /** @brief the largest element seen so far */
+    float_t max;
+
+    /** @brief sum of exp(x - max) over the elements seen so far */
+    float_t sumExp;
+
+    /** @brief sum of exp(2(x - max)) over the elements seen so far */
+    float_t sumExp2;
+
+
+    /**
+     * @brief The constructor makes an empty reduction.
+     */
+    lse_partial();
+
+
+    /**
+     * @brief reduces a contiguous chunk of log weights (one pass for the max, one for the sum)
+     * @param logWts pointer to the first log weight
+     * @param n how many log weights there are
+     * @param expWts if not null, exp(x - (this chunk's max)) is written here, so nobody has to exponentiate again
+     */
+    void add(const float_t *logWts, size_t n, float_t *expWts = nullptr);
+
+
+    /**
+     * @brief merges another piece into this one
+     * @param other the other piece
+     */
+    void merge(const lse_partial &other);
+
+
+    /**
+     * @brief the reduction's answer
+     * @return log sum_i exp(x_i)
+     */
+    float_t logSumExp() const;
+
+
+    /**
+     * @brief the effective sample size of the weights exp(x_i)
+     * @return (sum_i exp(x_i))^2 / sum_i exp(2 x_i)
+     */
+    float_t ess() const;
+};
+
+
+template<typename float_t>
+lse_partial<float_t>::lse_partial()
+    : max(-std::numeric_limits<float_t>::infinity())
+    , sumExp(0.0)
+    , sumExp2(0.0)
+{
+}
+
+
+template<typename float_t>
+void lse_partial<float_t>::add(const float_t *logWts, size_t n, float_t *expWts)
+{
+    float_t m(-std::numeric_limits<float_t>::infinity());
+    for(size_t i = 0; i < n; ++i)
+        m = (logWts[i] > m) ? logWts[i] : m;
+    if(m == -std::numeric_limits<float_t>::infinity()){
+        if(expWts)
+            std::fill(expWts, expWts + n, 0.0);
+        return;
+    }
+
+    float_t s(0.0), s2(0.0);
+    for(size_t i = 0; i < n; ++i){
+        float_t e = std::exp(logWts[i] - m);
+        if(expWts)
+            expWts[i] = e;
+        s += e;
+        s2 += e*e;
+    }
+
+    lse_partial<float_t> chunk;
+    chunk.max = m;
+    chunk.sumExp = s;
+    chunk.sumExp2 = s2;
+    merge(chunk);
+}
+
+
+template<typename float_t>
+void lse_partial<float_t>::merge(const lse_partial &other)
+{
+    if(other.sumExp == 0.0)
+        return;
+
+    if(other.max > max){
+        float_t r = std::exp(max - other.max);
+        sumExp = sumExp * r + other.sumExp;
+        sumExp2 = sumExp2 * r * r + other.sumExp2;
+        max = other.max;
+    }else{
+        float_t r = std::exp(other.max - max);
+        sumExp += other.sumExp * r;
+        sumExp2 += other.sumExp2 * r * r;
+    }
+}
+
+
+template<typename float_t>
+float_t lse_partial<float_t>::logSumExp() const
+{
+    return max + std::log(sumExp);
+}
+
+
+template<typename float_t>
+float_t lse_partial<float_t>::ess() const
+{
+    return sumExp * sumExp / sumExp2;
+}
+
+
+/**
+ * @brief the adaptive half of the resampling rule (the other half is the schedule)
+ * @param ess the current effective sample size
+ * @param essFrac resample only if ess < essFrac * n (anything <= 0 turns the check off)
+ * @param n the number of particles
+ * @return true if the particles should be resampled
+ */
+template<typename float_t>
+bool ess_below(float_t ess, float_t essFrac, size_t n)
+{
+    return essFrac <= 0.0 || ess < essFrac * n;
+}
+
+
+/** @brief true if resamp_t runs on its own workers (i.e. it has a setNumThreads(), like par_rbase) */
+template<typename resamp_t, typename = void>
+struct has_num_threads : std::false_type {};
+
+/** @brief true if resamp_t runs on its own workers (i.e. it has a setNumThreads(), like par_rbase) */
+template<typename resamp_t>
+struct has_num_threads<resamp_t, std::void_t<decltype(std::declval<resamp_t&>().setNumThreads(1u))>> : std::true_type {};
+
+
+/**
+ * @brief gives a multi-threaded resampler as many workers as the filter that owns it (serial ones are left alone)
+ * @param resampler the filter's resampler
+ * @param num_threads the filter's number of workers
+ */
+template<typename resamp_t>
+void share_num_threads(resamp_t &resampler, unsigned int num_threads)
+{
+    if constexpr(has_num_threads<resamp_t>::value)
+        resampler.setNumThreads(num_threads);
+}
+
+
+/**
+ * @brief reduces log weights to their log-sum-exp, one chunk per worker
+ * @param pool the workers
+ * @param pieces scratch space for one reduction per worker (it is reset, and it only allocates the first time)
+ * @param logWts pointer to the first log weight
+ * @param n how many log weights there are
+ * @return the merged reduction
+ */
+template<typename float_t>
+lse_partial<float_t> parallel_lse(thread_pool &pool, std::vector<lse_partial<float_t>> &pieces, const float_t *logWts, size_t n)
+{
+    pieces.assign(pool.size(), lse_partial<float_t>());
+    pool.parallel_for(n, [&](size_t first, size_t last, unsigned int w)
+    {
+        pieces[w].add(logWts + first, last - first);
+    });
+    for(unsigned int w = 1; w < pool.size(); ++w)
+        pieces[0].merge(pieces[w]);
+    return pieces[0];
+}
+
+
+/**
+ * @brief Finishes a normalization that was started chunk by chunk. Worker w must have
+ * called pieces[w].add() (on a fresh piece) with an expWts pointer for its parallel_for chunk of [0, n).
+ * The chunks were exponentiated relative to their own max, so they get rescaled here.
+ * @param pool the workers
+ * @param pieces one reduction per worker
+ * @param normWts the exponentiated weights, which are normalized in place
+ * @param n how many weights there are
+ * @return the merged reduction
+ */
+template<typename float_t>
+lse_partial<float_t> normalize_pieces(thread_pool &pool, const std::vector<lse_partial<float_t>> &pieces, float_t *normWts, size_t n)
+{
+    lse_partial<float_t> total;
+    for(unsigned int w = 0; w < pool.size(); ++w)
+        total.merge(pieces[w]);
+
+    // parallel_for hands worker w the same chunk every time
+    pool.parallel_for(n, [&](size_t first, size_t last, unsigned int w)
+    {
+        const float_t c = std::exp(pieces[w].max - total.max) / total.sumExp;
+        for(size_t i = first; i < last; ++i)
+            normWts[i] *= c;
+    });
+    return total;
+}
+
+
+/**
+ * @brief The fused post-propagation stage. In one reduction (max, then exp) it finds the
+ * log-sum-exp and the ESS, and it writes the normalized weights, so the expectations and the 
+ * resampler can use them without calling exp again. The only extra pass is a rescaling.
+ * @param pool the workers
+ * @param pieces scratch space for one reduction per worker (it is reset, and it only allocates the first time)
+ * @param logWts pointer to the first log weight
+ * @param normWts where the normalized weights are written (n of them)
+ * @param n how many log weights there are
+ * @return the merged reduction
+ */
+template<typename float_t>
+lse_partial<float_t> parallel_normalize(thread_pool &pool, std::vector<lse_partial<float_t>> &pieces, const float_t *logWts, float_t *normWts, size_t n)
+{
+    pieces.assign(pool.size(), lse_partial<float_t>());
+    pool.parallel_for(n, [&](size_t first, size_t last, unsigned int w)
+    {
+        pieces[w].add(logWts + first, last - first, normWts + first);
+    });
+    return normalize_pieces(pool, pieces, normWts, n);
+}
+
+
+//! Evaluates registered functionals of the particles without allocating.
+/**
+ * @class expectation_engine
+ * @author t
+ * @file filter_core.h
+ * @brief Each functional writes its value into an output slot that was allocated when it was 
+ * registered, instead of returning a new Mat. All functionals are evaluated in one sweep over 
+ * the particles, split across the workers, and each worker keeps its own running sums. After the
+ * first time step nothing is allocated at all. Functionals get called from several threads at 
+ * once, so they must not modify shared state.
+ * @tparam ssv the state vector type
+ * @tparam float_t (e.g. double, float, etc.)
+ */
+template<typename ssv, typename float_t>
+class expectation_engine
+{
+public:
+
+    /** type alias for dynamically sized matrices */
+    using Mat = Eigen::Matrix<float_t, Eigen::Dynamic, Eigen::Dynamic>;
+    /** type alias for a functional: it writes h(x_t) into out (which is already rows x cols) */
+    using func_t = std::function<void(const ssv &xt, Eigen::Ref<Mat> out)>;
+
+
+    /**
+     * @brief registers a functional
+     * @param h the functional
+     * @param rows the number of rows of h's output
+     * @param cols the number of columns of h's output
+     * @return the index of its expectation in get()
+     */
+    size_t add(const func_t &h, size_t rows, size_t cols = 1);
+
+
+    /**
+     * @brief the number of registered functionals
+     * @return the number of registered functionals
+     */
+    size_t size() const;
+
+
+    /**
+     * @brief computes sum_i normWts[i] h(x_i) for every registered functional
+     * @param pool the workers
+     * @param n the number of particles
+     * @param particle a callable that returns particle i (by reference or by value)
+     * @param normWts pointer to the first normalized weight
+     */
+    template<typename getter_t>
+    void evaluate(thread_pool &pool, size_t n, getter_t &&particle, const float_t *normWts);
+
+
+    /**
+     * @brief the most recent expectations (one for each registered functional)
+     * @return the expectations, in the order they were registered
+     */
+    const std::vector<Mat>& get() const;
+
+private:
+
+    /** @brief the functionals */
+    std::vector<func_t> m_funcs;
+
+    /** @brief the shape of each functional's output */
+    std::vector<std::pair<size_t, size_t>> m_shapes;
+
+    /** @brief the output slots (one for each worker and functional) */
+    std::vector<std::vector<Mat>> m_slots;
+
+    /** @brief the running sums (one for each worker and functional) */
+    std::vector<std::vector<Mat>> m_sums;
+
+    /** @brief the expectations */
+    std::vector<Mat> m_results;
+};
+
+
+template<typename ssv, typename float_t>
+size_t expectation_engine<ssv, float_t>::add(const func_t &h, size_t rows, size_t cols)
+{
+    m_funcs.push_back(h);
+    m_shapes.emplace_back(rows, cols);
+    m_results.push_back(Mat::Zero(rows, cols));
+    m_slots.clear(); // reallocated on the next evaluate()
+    m_sums.clear();
+    return m_funcs.size() - 1;
+}
+
+
+template<typename ssv, typename float_t>
+size_t expectation_engine<ssv, float_t>::size() const
+{
+    return m_funcs.size();
+}
+
+
+template<typename ssv, typename float_t>
+template<typename getter_t>
+void expectation_engine<ssv, float_t>::evaluate(thread_pool &pool, size_t n, getter_t &&particle, const float_t *normWts)
+{
+    const size_t nf = m_funcs.size();
+    if(nf == 0)
+        return;
+
+    if(m_slots.size() != pool.size()){
+        m_slots.assign(pool.size(), std::vector<Mat>(nf));
+        m_sums.assign(pool.size(), std::vector<Mat>(nf));
+        for(unsigned int w = 0; w < pool.size(); ++w){
+            for(size_t k = 0; k < nf; ++k){
+                m_slots[w][k].resize(m_shapes[k].first, m_shapes[k].second);
+                m_sums[w][k].resize(m_shapes[k].first, m_shapes[k].second);
+            }
+        }
+    }
+
+    pool.run([&](unsigned int w)
+    {
+        for(size_t k = 0; k < nf; ++k)
+            m_sums[w][k].setZero();
+    });
+    pool.parallel_for(n, [&](size_t first, size_t last, unsigned int w)
+    {
+        std::vector<Mat> &slots = m_slots[w];
+        std::vector<Mat> &sums = m_sums[w];
+        for(size_t i = first; i < last; ++i){
+            const auto &x = particle(i);
+            for(size_t k = 0; k < nf; ++k){
+                m_funcs[k](x, slots[k]);
+                sums[k].noalias() += normWts[i] * slots[k];
+            }
+        }
+    });
+
+    for(size_t k = 0; k < nf; ++k){
+        m_results[k] = m_sums[0][k];
+        for(unsigned int w = 1; w < pool.size(); ++w)
+            m_results[k] += m_sums[w][k];
+    }
+}
+
+
+template<typename ssv, typename float_t>
+auto expectation_engine<ssv, float_t>::get() const -> const std::vector<Mat>&
+{
+    return m_results;
+}
+
+
+//! The weighting, expectation and resampling logic that every filter shares.
+/**
+ * @class FilterCore
+ * @author t
+ * @file filter_core.h
+ * @brief After a filter has propagated its particles and updated their log weights, the 
+ * rest of the time step is the same for all of them (and for time 1 and time t): normalize 
+ * the weights (which also gives the log-sum-exp and the ESS), take expectations, and decide 
+ * whether it is time to resample. Each filter owns one of these, so any speedup made here 
+ * shows up in all of them. It also owns the worker threads.
+ * @tparam nparts the number of particles (or dynamic_parts)
+ * @tparam ssv the type that registered functionals get called with
+ * @tparam float_t (e.g. double, float, etc.)
+ */
+template<size_t nparts, typename ssv, typename float_t>
+class FilterCore
+{
+public:
+
+    /** type alias for dynamically sized matrices */
+    using Mat = Eigen::Matrix<float_t, Eigen::Dynamic, Eigen::Dynamic>;
+    /** type alias for array of floating points */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for functionals that write into a preallocated output */
+    using outFunc = typename expectation_engine<ssv, float_t>::func_t;
+
+
+    /**
+     * @brief The constructor.
+     * @param rs resampling schedule (e.g. every rs time points)
+     * @param num_threads the number of worker threads (including the calling thread)
+     * @param num_parts the number of particles
+     */
+    FilterCore(unsigned int rs, unsigned int num_threads, size_t num_parts);
+
+
+    /**
+     * @brief the worker threads
+     * @return the pool
+     */
+    thread_pool& pool();
+
+
+    /**
+     * @brief the number of workers
+     * @return the number of worker threads (including the calling thread)
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief reduces some log weights to their log-sum-exp (split across the workers)
+     * @param logWts pointer to the first log weight
+     * @param n how many log weights there are
+     * @return the reduction
+     */
+    lse_partial<float_t> reduce(const float_t *logWts, size_t n);
+
+
+    /**
+     * @brief The fused post-propagation stage. Writes the normalized weights and records the ESS.
+     * @param logWts the log unnormalized weights
+     * @return the reduction (logSumExp() is what the likelihood needs)
+     */
+    lse_partial<float_t> weigh(const arrayFloat &logWts);
+
+
+    /**
+     * @brief Same as the other weigh(), for filters that already reduced each worker's chunk
+     * inside their own particle loop (with normWeights() as the expWts argument).
+     * @param pieces one reduction per worker
+     * @return the merged reduction
+     */
+    lse_partial<float_t> weigh(const std::vector<lse_partial<float_t>> &pieces);
+
+
+    /**
+     * @brief computes E[h(x_t) | y_{1:t}] for each h in fs with the normalized weights
+     * @param fs the functionals
+     * @param apply a callable such that apply(h, i) is h evaluated at particle i
+     */
+    template<typename funcs_t, typename apply_t>
+    void expect(const funcs_t &fs, apply_t &&apply);
+
+
+    /**
+     * @brief computes the expectations of all the registered functionals
+     * @param particle a callable that returns particle i
+     */
+    template<typename getter_t>
+    void expectFunctionals(getter_t &&particle);
+
+
+    /**
+     * @brief whether the particles should be resampled at the end of this time step
+     * @param now the current time (starting at 0)
+     * @return true if it is a scheduled time point and the ESS is low enough
+     */
+    bool resampleDue(unsigned int now) const;
+
+
+    /**
+     * @brief changes the number of particles (the ESS is reset too)
+     * @param n the new number of particles
+     */
+    void resize(size_t n);
+
+
+    /**
+     * @brief the normalized weights from the last call to weigh()
+     * @return the normalized weights
+     */
+    arrayFloat& normWeights();
+
+
+    /**
+     * @brief the effective sample size from the last call to weigh()
+     * @return the ESS
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief see the filters' setESSThreshold()
+     * @param frac the fraction of the number of particles (0 turns it off)
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief the expectations from the last call to expect()
+     * @return one matrix for each functional
+     */
+    const std::vector<Mat>& getExpectations() const;
+
+
+    /**
+     * @brief registers a functional (see expectation_engine)
+     * @param h the functional
+     * @param rows the number of rows of h(x_t)
+     * @param cols the number of columns of h(x_t)
+     * @return the index of its expectation
+     */
+    size_t addFunctional(const outFunc &h, size_t rows, size_t cols);
+
+
+    /**
+     * @brief the expectations from the last call to expectFunctionals()
+     * @return one matrix for each registered functional
+     */
+    const std::vector<Mat>& getFunctionalExpectations() const;
+
+private:
+
+    /** @brief resampling schedule (e.g. resample every __ time points) */
+    unsigned int m_resampSched;
+
+    /** @brief resample only if the ESS is below this fraction of the number of particles (0 turns this off) */
+    float_t m_essFrac;
+
+    /** @brief effective sample size of the most recent weights */
+    float_t m_ess;
+
+    /** @brief worker threads for the per-particle loops */
+    thread_pool m_pool;
+
+    /** @brief normalized weights */
+    arrayFloat m_normWeights;
+
+    /** @brief one reduction per worker for reduce() and weigh() (allocated once) */
+    std::vector<lse_partial<float_t>> m_pieces;
+
+    /** @brief expectations E[h(x_t) | y_{1:t}] for user defined "h"s */
+    std::vector<Mat> m_expectations;
+
+    /** @brief registered functionals */
+    expectation_engine<ssv, float_t> m_functionals;
+};
+
+
+template<size_t nparts, typename ssv, typename float_t>
+FilterCore<nparts, ssv, float_t>::FilterCore(unsigned int rs, unsigned int num_threads, size_t num_parts)
+    : m_resampSched(rs)
+    , m_essFrac(0.0)
+    , m_ess(num_parts)
+    , m_pool(num_threads)
+    , m_normWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_pieces(m_pool.size())
+{
+    part_storage<float_t, nparts>::check(num_parts);
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+thread_pool& FilterCore<nparts, ssv, float_t>::pool()
+{
+    return m_pool;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+unsigned int FilterCore<nparts, ssv, float_t>::getNumThreads() const
+{
+    return m_pool.size();
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+lse_partial<float_t> FilterCore<nparts, ssv, float_t>::reduce(const float_t *logWts, size_t n)
+{
+    return parallel_lse(m_pool, m_pieces, logWts, n);
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+lse_partial<float_t> FilterCore<nparts, ssv, float_t>::weigh(const arrayFloat &logWts)
+{
+    lse_partial<float_t> lse = parallel_normalize(m_pool, m_pieces, logWts.data(), m_normWeights.data(), logWts.size());
+    m_ess = lse.ess();
+    return lse;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+lse_partial<float_t> FilterCore<nparts, ssv, float_t>::weigh(const std::vector<lse_partial<float_t>> &pieces)
+{
+    lse_partial<float_t> lse = normalize_pieces(m_pool, pieces, m_normWeights.data(), m_normWeights.size());
+    m_ess = lse.ess();
+    return lse;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+template<typename funcs_t, typename apply_t>
+void FilterCore<nparts, ssv, float_t>::expect(const funcs_t &fs, apply_t &&apply)
+{
+    const size_t N = m_normWeights.size();
+    m_expectations.resize(fs.size());
+    for(size_t k = 0; k < fs.size(); ++k){
+        Mat numer = apply(fs[k], 0) * m_normWeights[0];
+        for(size_t prtcl = 1; prtcl < N; ++prtcl)
+            numer += apply(fs[k], prtcl) * m_normWeights[prtcl];
+        m_expectations[k] = std::move(numer);
+    }
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+template<typename getter_t>
+void FilterCore<nparts, ssv, float_t>::expectFunctionals(getter_t &&particle)
+{
+    m_functionals.evaluate(m_pool, m_normWeights.size(), particle, m_normWeights.data());
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+bool FilterCore<nparts, ssv, float_t>::resampleDue(unsigned int now) const
+{
+    return (now+1) % m_resampSched == 0 && ess_below(m_ess, m_essFrac, m_normWeights.size());
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+void FilterCore<nparts, ssv, float_t>::resize(size_t n)
+{
+    part_storage<float_t, nparts>::resize(m_normWeights, n);
+    m_ess = n;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+auto FilterCore<nparts, ssv, float_t>::normWeights() -> arrayFloat&
+{
+    return m_normWeights;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+float_t FilterCore<nparts, ssv, float_t>::getESS() const
+{
+    return m_ess;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+void FilterCore<nparts, ssv, float_t>::setESSThreshold(const float_t &frac)
+{
+    m_essFrac = frac;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+auto FilterCore<nparts, ssv, float_t>::getExpectations() const -> const std::vector<Mat>&
+{
+    return m_expectations;
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+size_t FilterCore<nparts, ssv, float_t>::addFunctional(const outFunc &h, size_t rows, size_t cols)
+{
+    return m_functionals.add(h, rows, cols);
+}
+
+
+template<size_t nparts, typename ssv, typename float_t>
+auto FilterCore<nparts, ssv, float_t>::getFunctionalExpectations() const -> const std::vector<Mat>&
+{
+    return m_functionals.get();
+}
+
+
+#endif // FILTER_CORE_H
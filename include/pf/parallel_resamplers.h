@@ -0,0 +1,1103 @@
+#ifndef PARALLEL_RESAMPLERS_H
+#define PARALLEL_RESAMPLERS_H
+
+#include <algorithm> // lower_bound
+#include <cmath>
+#include <limits>
+#include <memory> // unique_ptr
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "filter_core.h" // lse_partial
+#include "part_storage.h"
+#include "resamplers.h" // permute_ancestors
+#include "rng.h" // fresh_seed, seed_stream
+#include "soa_particles.h"
+#include "thread_pool.h"
+
+
+//! Base class for the multi-threaded resamplers.
+/**
+ * @class par_rbase
+ * @author t
+ * @file parallel_resamplers.h
+ * @brief Owns the worker threads and the scratch space, and does every stage of resampling
+ * in parallel. The work is cut into blocks of block_size indexes, and the workers share out the blocks.
+ * Each block of log weights is exponentiated relative to the block's max, and then the blocks are
+ * rescaled and turned into cumulative sums (a two pass prefix sum). Each block of the sorted
+ * positions U_1 < ... < U_M finds where it starts with a binary search and then walks the cumulative
+ * sums. Finally the survivors are gathered in parallel. Every block draws its random numbers from
+ * its own stream, so a fixed seed gives the same ancestors whatever the number of threads.
+ * A filter that owns a resampler gives it as many workers as it has (see share_num_threads()).
+ * The resampling functions are defined here, and a resampler only says how it draws ancestors
+ * from log weights (resampIndices()) and from normalized weights (normIndices()).
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class par_rbase
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+    /** how many indexes make up one block of work */
+    static constexpr size_t block_size = 4096;
+
+
+    /**
+     * @brief The constructor starts the workers and seeds the prng with rvsamp::fresh_seed().
+     * @param num_threads the number of workers (including the calling thread)
+     */
+    explicit par_rbase(unsigned int num_threads);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     * @param seed the new seed
+     */
+    void setSeed(std::uint32_t seed);
+
+
+    /**
+     * @brief Re-seeds the prng with one of several streams for the same seed (see rvsamp::seed_stream()).
+     * @param seed the new seed
+     * @param stream the stream id
+     */
+    void setSeed(std::uint64_t seed, std::uint64_t stream);
+
+
+    /**
+     * @brief the number of workers
+     * @return the number of workers (including the calling thread)
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief Replaces the workers (the filters call this with their own thread count).
+     * @param num_threads the number of workers (including the calling thread)
+     */
+    void setNumThreads(unsigned int num_threads);
+
+
+    /**
+     * @brief resamples particles.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0);
+
+
+    /**
+     * @brief resamples particles stored as a structure of arrays (the final gather is serial).
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0);
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (so nothing is exponentiated again).
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0);
+
+
+    /**
+     * @brief resamples particles stored as a structure of arrays with weights that are already normalized.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0);
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    virtual void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) = 0;
+
+protected:
+
+    /** @brief prng */
+    rng_t m_gen;
+
+    /** @brief worker threads (on the heap so setNumThreads() can replace them) */
+    std::unique_ptr<thread_pool> m_pool;
+
+    /** @brief drawn from m_gen every time the blocks need random numbers (see seedBlock()) */
+    std::uint64_t m_blockSeed;
+
+
+    /**
+     * @brief draws ancestor indexes from normalized weights (every resampler supplies this)
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    virtual void normIndices(const arrayFloat &normWts, arrayInt &ancestors) = 0;
+
+    // the scratch space lives on the heap, so it doesn't make the filters that own
+    // a resampler any bigger
+
+    /** @brief cumulative sums of the normalized weights */
+    part_array<float_t, dynamic_parts> m_cumsum;
+
+    /** @brief the survivors get gathered here before they replace the old particles (only when the number of particles changes) */
+    part_array<ssv, dynamic_parts> m_scratch;
+
+
+    /**
+     * @brief writes the cumulative sums of the normalized weights into m_cumsum
+     * @param logWts the log unnormalized weights
+     */
+    void cumulateLogWts(const arrayFloat &logWts);
+
+
+    /**
+     * @brief writes the cumulative sums of already normalized weights into m_cumsum
+     * @param normWts the normalized weights
+     */
+    void cumulateNormWts(const arrayFloat &normWts);
+
+
+    /**
+     * @brief calls f(b, first, last) for every block b = [first, last) of the indexes 0, ..., n-1 (in parallel)
+     * @param n the number of indexes
+     * @param f the work for one block
+     */
+    template<typename func_t>
+    void forBlocks(size_t n, func_t &&f);
+
+
+    /**
+     * @brief finds the ancestors of the positions first, ..., last-1 (from m_cumsum)
+     * @param ancestors where the indexes are written
+     * @param first the first position
+     * @param last one past the last position
+     * @param position a callable taking i that returns U_i. It is called for i = first, first + 1, ...,
+     * and the U_i must increase with i.
+     */
+    template<typename position_t>
+    void search(arrayInt &ancestors, size_t first, size_t last, position_t &&position);
+
+
+    /**
+     * @brief replaces particle i with old particle ancestors[i] for all i (in parallel). If the number
+     * of particles doesn't change, the ancestors are reordered (see permute_ancestors()) and only the
+     * slots whose particles die are overwritten, so the new particles are not sorted by ancestor.
+     * Otherwise (only with dynamic_parts) the survivors are copied into m_scratch, which then trades
+     * places with parts.
+     * @param parts the particles
+     * @param ancestors the indexes of the particles that survive resampling (they may be reordered)
+     */
+    void gather(arrayVec &parts, arrayInt &ancestors);
+
+
+    /**
+     * @brief replaces particle i with old particle ancestors[i] for all i, in the same order as the other gather() (serially)
+     * @param parts the particles
+     * @param ancestors the indexes of the particles that survive resampling (they may be reordered)
+     */
+    void gather(soaParts &parts, arrayInt &ancestors);
+
+
+    /**
+     * @brief draws a new seed from m_gen for the blocks to share (once per resampling)
+     */
+    void newBlockSeed();
+
+
+    /**
+     * @brief seeds a prng with block b's own stream of the current block seed
+     * @param gen the prng
+     * @param b the block
+     */
+    void seedBlock(rng_t &gen, size_t b) const;
+
+
+    /**
+     * @brief the largest weight (one block at a time)
+     * @param wts the (log) weights
+     * @return the largest element
+     */
+    float_t maxOf(const arrayFloat &wts);
+
+
+    /**
+     * @brief scratch space for ancestor indexes
+     * @param n how many indexes are needed
+     * @return the indexes (valid until the next call)
+     */
+    arrayInt &ancestorBuffer(size_t n);
+
+private:
+
+    /** @brief scratch space for ancestorBuffer() */
+    std::unique_ptr<arrayInt> m_ancestors;
+
+
+    /**
+     * @brief turns m_cumsum into cumulative sums after every block has been scaled
+     * @param src the (exponentiated) weights
+     * @param scales the factor for each block
+     */
+    void prefixSum(const float_t *src, const std::vector<float_t> &scales);
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+par_rbase<nparts, dimx, float_t, rng_t>::par_rbase(unsigned int num_threads)
+    : m_gen(rvsamp::fresh_seed())
+    , m_pool(std::make_unique<thread_pool>(num_threads))
+    , m_blockSeed(0)
+    , m_cumsum(nparts)
+    , m_ancestors(std::make_unique<arrayInt>())
+{
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::setSeed(std::uint32_t seed)
+{
+    m_gen.seed(seed);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::setSeed(std::uint64_t seed, std::uint64_t stream)
+{
+    rvsamp::seed_stream(m_gen, seed, stream);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+unsigned int par_rbase<nparts, dimx, float_t, rng_t>::getNumThreads() const
+{
+    return m_pool->size();
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::setNumThreads(unsigned int num_threads)
+{
+    if(num_threads != m_pool->size())
+        m_pool = std::make_unique<thread_pool>(num_threads);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : oldLogUnNormWts.size());
+    resampIndices(oldLogUnNormWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : oldLogUnNormWts.size());
+    resampIndices(oldLogUnNormWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : normWts.size());
+    normIndices(normWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : normWts.size());
+    normIndices(normWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::cumulateLogWts(const arrayFloat &logWts)
+{
+    // exponentiate each block relative to its own max
+    const size_t n = logWts.size();
+    m_cumsum.resize(n);
+    std::vector<lse_partial<float_t>> pieces((n + block_size - 1) / block_size);
+    forBlocks(n, [&](size_t b, size_t first, size_t last)
+    {
+        pieces[b].add(logWts.data() + first, last - first, m_cumsum.data() + first);
+    });
+
+    // then put all the blocks on the same scale while summing them up
+    lse_partial<float_t> total;
+    for(const auto &piece : pieces)
+        total.merge(piece);
+    std::vector<float_t> scales(pieces.size());
+    for(size_t b = 0; b < pieces.size(); ++b)
+        scales[b] = std::exp(pieces[b].max - total.max) / total.sumExp;
+    prefixSum(m_cumsum.data(), scales);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::cumulateNormWts(const arrayFloat &normWts)
+{
+    m_cumsum.resize(normWts.size());
+    prefixSum(normWts.data(), std::vector<float_t>((normWts.size() + block_size - 1) / block_size, 1.0));
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::prefixSum(const float_t *src, const std::vector<float_t> &scales)
+{
+    // cumulative sums within each block
+    const size_t n = m_cumsum.size();
+    std::vector<float_t> blockSums(scales.size(), 0.0);
+    forBlocks(n, [&](size_t b, size_t first, size_t last)
+    {
+        float_t s(0.0);
+        for(size_t i = first; i < last; ++i){
+            s += src[i] * scales[b];
+            m_cumsum[i] = s;
+        }
+        blockSums[b] = s;
+    });
+
+    // shift each block by the total of the blocks before it
+    std::vector<float_t> offsets(scales.size(), 0.0);
+    for(size_t b = 1; b < scales.size(); ++b)
+        offsets[b] = offsets[b-1] + blockSums[b-1];
+    forBlocks(n, [&](size_t b, size_t first, size_t last)
+    {
+        if(offsets[b] != 0.0){
+            for(size_t i = first; i < last; ++i)
+                m_cumsum[i] += offsets[b];
+        }
+    });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+template<typename func_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::forBlocks(size_t n, func_t &&f)
+{
+    m_pool->parallel_for((n + block_size - 1) / block_size, [&](size_t firstBlock, size_t lastBlock, unsigned int)
+    {
+        for(size_t b = firstBlock; b < lastBlock; ++b)
+            f(b, b * block_size, std::min(n, (b + 1) * block_size));
+    });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+template<typename position_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::search(arrayInt &ancestors, size_t first, size_t last, position_t &&position)
+{
+    const size_t numIn = m_cumsum.size();
+    if(first == last)
+        return;
+
+    // jump to where this block starts, then walk
+    // (stays on the last index if rounding leaves the total below 1)
+    float_t u = position(first);
+    size_t j = std::lower_bound(m_cumsum.begin(), m_cumsum.end(), u) - m_cumsum.begin();
+    j = std::min(j, numIn - 1);
+    ancestors[first] = j;
+    for(size_t i = first + 1; i < last; ++i){
+        u = position(i);
+        while(m_cumsum[j] < u && j + 1 < numIn)
+            ++j;
+        ancestors[i] = j;
+    }
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::gather(arrayVec &parts, arrayInt &ancestors)
+{
+    if(ancestors.size() == parts.size()){
+        // every slot that gets written copies from a survivor, which stays put
+        permute_ancestors(ancestors);
+        m_pool->parallel_for(ancestors.size(), [&](size_t first, size_t last, unsigned int)
+        {
+            for(size_t i = first; i < last; ++i){
+                if(ancestors[i] != i)
+                    parts[i] = parts[ancestors[i]];
+            }
+        });
+    }else if constexpr(nparts == dynamic_parts){
+        m_scratch.resize(ancestors.size());
+        m_pool->parallel_for(ancestors.size(), [&](size_t first, size_t last, unsigned int)
+        {
+            for(size_t i = first; i < last; ++i)
+                m_scratch[i] = parts[ancestors[i]];
+        });
+        parts.swap(m_scratch);
+    }
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::gather(soaParts &parts, arrayInt &ancestors)
+{
+    if(ancestors.size() == parts.size())
+        permute_ancestors(ancestors);
+    parts.gather(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::newBlockSeed()
+{
+    m_blockSeed = static_cast<std::uint64_t>(m_gen()) << 32 ^ m_gen();
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rbase<nparts, dimx, float_t, rng_t>::seedBlock(rng_t &gen, size_t b) const
+{
+    rvsamp::seed_stream(gen, m_blockSeed, b);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+float_t par_rbase<nparts, dimx, float_t, rng_t>::maxOf(const arrayFloat &wts)
+{
+    std::vector<float_t> maxes((wts.size() + block_size - 1) / block_size, -std::numeric_limits<float_t>::infinity());
+    forBlocks(wts.size(), [&](size_t b, size_t first, size_t last)
+    {
+        for(size_t i = first; i < last; ++i)
+            maxes[b] = std::max(maxes[b], wts[i]);
+    });
+    return *std::max_element(maxes.begin(), maxes.end());
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+auto par_rbase<nparts, dimx, float_t, rng_t>::ancestorBuffer(size_t n) -> arrayInt&
+{
+    part_storage<unsigned int, nparts>::resize(*m_ancestors, n);
+    return *m_ancestors;
+}
+
+
+/**
+ * @class par_systematic_resampler
+ * @author t
+ * @file parallel_resamplers.h
+ * @brief Multi-threaded systematic resampling on "standard" models. It can be used as
+ * the resamp_t of any filter. Given the same seed, it picks the same ancestors as
+ * systematic_resampler (up to rounding in the cumulative sums) for any number of threads.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class par_systematic_resampler : private par_rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief The constructor.
+     * @param num_threads the number of workers (the ancestors don't depend on it, and a filter that owns the resampler replaces it with its own)
+     */
+    explicit par_systematic_resampler(unsigned int num_threads = 1);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setSeed;
+
+
+    /**
+     * @brief the number of workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::getNumThreads;
+
+
+    /**
+     * @brief replaces the workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setNumThreads;
+
+
+    /**
+     * @brief resamples particles (see par_rbase::resampLogWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see par_rbase::resampNormWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) override;
+
+private:
+
+    /**
+     * @brief draws ancestor indexes from normalized weights
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &normWts, arrayInt &ancestors) override;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling (from m_cumsum)
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void calcAncestors(arrayInt &ancestors);
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+par_systematic_resampler<nparts, dimx, float_t, rng_t>::par_systematic_resampler(unsigned int num_threads)
+    : par_rbase<nparts, dimx, float_t, rng_t>(num_threads)
+{
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_systematic_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    this->cumulateLogWts(logWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_systematic_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &normWts, arrayInt &ancestors)
+{
+    this->cumulateNormWts(normWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_systematic_resampler<nparts, dimx, float_t, rng_t>::calcAncestors(arrayInt &ancestors)
+{
+    // all the U_i = (i + u)/numOut share one uniform
+    const size_t numOut = ancestors.size();
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    const float_t u0 = u_sampler(this->m_gen);
+    this->forBlocks(numOut, [&](size_t, size_t first, size_t last)
+    {
+        this->search(ancestors, first, last, [&](size_t i) { return (i + u0) / numOut; });
+    });
+}
+
+
+/**
+ * @class par_stratif_resampler
+ * @author t
+ * @file parallel_resamplers.h
+ * @brief Multi-threaded stratified resampling on "standard" models. It can be used as
+ * the resamp_t of any filter. Each block of positions draws its uniforms from its own stream,
+ * so the ancestors only depend on the seed and not on the number of threads.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class par_stratif_resampler : private par_rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief The constructor.
+     * @param num_threads the number of workers (the ancestors don't depend on it, and a filter that owns the resampler replaces it with its own)
+     */
+    explicit par_stratif_resampler(unsigned int num_threads = 1);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setSeed;
+
+
+    /**
+     * @brief the number of workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::getNumThreads;
+
+
+    /**
+     * @brief replaces the workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setNumThreads;
+
+
+    /**
+     * @brief resamples particles (see par_rbase::resampLogWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see par_rbase::resampNormWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) override;
+
+private:
+
+    /**
+     * @brief draws ancestor indexes from normalized weights
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &normWts, arrayInt &ancestors) override;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling (from m_cumsum)
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void calcAncestors(arrayInt &ancestors);
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+par_stratif_resampler<nparts, dimx, float_t, rng_t>::par_stratif_resampler(unsigned int num_threads)
+    : par_rbase<nparts, dimx, float_t, rng_t>(num_threads)
+{
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_stratif_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    this->cumulateLogWts(logWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_stratif_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &normWts, arrayInt &ancestors)
+{
+    this->cumulateNormWts(normWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_stratif_resampler<nparts, dimx, float_t, rng_t>::calcAncestors(arrayInt &ancestors)
+{
+    // U_i = (i + u_i)/numOut, where every block draws its own u_i
+    const size_t numOut = ancestors.size();
+    this->newBlockSeed();
+    this->forBlocks(numOut, [&](size_t b, size_t first, size_t last)
+    {
+        rng_t gen;
+        this->seedBlock(gen, b);
+        this->search(ancestors, first, last, [&](size_t i)
+        {
+            float_t u = std::generate_canonical<float_t, std::numeric_limits<float_t>::digits>(gen);
+            return (i + u) / numOut;
+        });
+    });
+}
+
+
+/**
+ * @class par_metropolis_resampler
+ * @author t
+ * @file parallel_resamplers.h
+ * @brief Metropolis resampling (Murray, Lee and Jacob, 2016) on "standard" models. Every offspring
+ * runs its own short Metropolis chain over the particle indexes. It starts at its own index k,
+ * proposes a uniformly chosen index j, and moves there with probability min(1, w_j/w_k). Only ratios
+ * of weights are needed, so nothing is normalized or summed and the workers never have to communicate.
+ * The offspring counts are biased for a finite number of steps. The bias shrinks geometrically as 
+ * the number of steps grows, and more slowly the more uneven the weights are.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class par_metropolis_resampler : private par_rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief The constructor.
+     * @param num_steps the length of every offspring's Metropolis chain
+     * @param num_threads the number of workers (the ancestors don't depend on it, and a filter that owns the resampler replaces it with its own)
+     */
+    explicit par_metropolis_resampler(unsigned int num_steps = 32, unsigned int num_threads = 1);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setSeed;
+
+
+    /**
+     * @brief the number of workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::getNumThreads;
+
+
+    /**
+     * @brief replaces the workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setNumThreads;
+
+
+    /**
+     * @brief changes the length of the Metropolis chains
+     * @param num_steps the number of steps each offspring takes
+     */
+    void setNumSteps(unsigned int num_steps);
+
+
+    /**
+     * @brief the length of the Metropolis chains
+     * @return the number of steps each offspring takes
+     */
+    unsigned int getNumSteps() const;
+
+
+    /**
+     * @brief resamples particles (see par_rbase::resampLogWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see par_rbase::resampNormWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) override;
+
+private:
+
+    /** @brief the length of every offspring's chain */
+    unsigned int m_numSteps;
+
+
+    /**
+     * @brief draws ancestor indexes from normalized weights
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &normWts, arrayInt &ancestors) override;
+
+
+    /**
+     * @brief runs one chain per offspring
+     * @param numIn the number of particles to choose from
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     * @param moveTo a callable taking (u, j, k) that says whether a chain at k accepts j for a uniform u
+     */
+    template<typename move_t>
+    void calcAncestors(size_t numIn, arrayInt &ancestors, move_t &&moveTo);
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+par_metropolis_resampler<nparts, dimx, float_t, rng_t>::par_metropolis_resampler(unsigned int num_steps, unsigned int num_threads)
+    : par_rbase<nparts, dimx, float_t, rng_t>(num_threads)
+    , m_numSteps(num_steps)
+{
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_metropolis_resampler<nparts, dimx, float_t, rng_t>::setNumSteps(unsigned int num_steps)
+{
+    m_numSteps = num_steps;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+unsigned int par_metropolis_resampler<nparts, dimx, float_t, rng_t>::getNumSteps() const
+{
+    return m_numSteps;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_metropolis_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    // accept with probability min(1, exp(logWts[j] - logWts[k]))
+    calcAncestors(logWts.size(), ancestors, [&](float_t u, size_t j, size_t k) { return std::log(u) < logWts[j] - logWts[k]; });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_metropolis_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &normWts, arrayInt &ancestors)
+{
+    // accept with probability min(1, w_j/w_k)
+    calcAncestors(normWts.size(), ancestors, [&](float_t u, size_t j, size_t k) { return u * normWts[k] < normWts[j]; });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+template<typename move_t>
+void par_metropolis_resampler<nparts, dimx, float_t, rng_t>::calcAncestors(size_t numIn, arrayInt &ancestors, move_t &&moveTo)
+{
+    this->newBlockSeed();
+    this->forBlocks(ancestors.size(), [&](size_t b, size_t first, size_t last)
+    {
+        rng_t gen;
+        this->seedBlock(gen, b);
+        std::uniform_int_distribution<size_t> pick(0, numIn - 1);
+        std::uniform_real_distribution<float_t> unif(0.0, 1.0);
+        for(size_t i = first; i < last; ++i){
+            size_t k = i % numIn;
+            for(unsigned int step = 0; step < m_numSteps; ++step){
+                size_t j = pick(gen);
+                if(moveTo(unif(gen), j, k))
+                    k = j;
+            }
+            ancestors[i] = k;
+        }
+    });
+}
+
+
+/**
+ * @class par_rejection_resampler
+ * @author t
+ * @file parallel_resamplers.h
+ * @brief Rejection resampling (Murray, Lee and Jacob, 2016) on "standard" models. Every offspring 
+ * proposes a uniformly chosen index j and keeps it with probability w_j / max_k w_k; otherwise it
+ * proposes another one and tries again. Every offspring is an independent draw from the weights, so
+ * this is exact multinomial resampling, and the only collective operation is finding the largest
+ * weight. The expected number of tries per offspring is N max_k w_k / sum_k w_k, so it is slow when
+ * a few weights dominate.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class par_rejection_resampler : private par_rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief The constructor.
+     * @param num_threads the number of workers (the ancestors don't depend on it, and a filter that owns the resampler replaces it with its own)
+     */
+    explicit par_rejection_resampler(unsigned int num_threads = 1);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setSeed;
+
+
+    /**
+     * @brief the number of workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::getNumThreads;
+
+
+    /**
+     * @brief replaces the workers
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::setNumThreads;
+
+
+    /**
+     * @brief resamples particles (see par_rbase::resampLogWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see par_rbase::resampNormWts()).
+     */
+    using par_rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) override;
+
+private:
+
+    /**
+     * @brief draws one index per offspring by rejection
+     * @param numIn the number of particles to choose from
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     * @param keep a callable taking (u, j) that says whether index j is accepted for a uniform u
+     */
+    template<typename keep_t>
+    void calcAncestors(size_t numIn, arrayInt &ancestors, keep_t &&keep);
+
+
+    /**
+     * @brief draws ancestor indexes from normalized weights
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &normWts, arrayInt &ancestors) override;
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+par_rejection_resampler<nparts, dimx, float_t, rng_t>::par_rejection_resampler(unsigned int num_threads)
+    : par_rbase<nparts, dimx, float_t, rng_t>(num_threads)
+{
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rejection_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    const float_t maxLogWt = this->maxOf(logWts);
+    if(maxLogWt == -std::numeric_limits<float_t>::infinity())
+        throw std::invalid_argument("error: can't resample when every weight is zero");
+    calcAncestors(logWts.size(), ancestors, [&](float_t u, size_t j) { return std::log(u) < logWts[j] - maxLogWt; });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void par_rejection_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &normWts, arrayInt &ancestors)
+{
+    const float_t maxWt = this->maxOf(normWts);
+    if(maxWt <= 0.0)
+        throw std::invalid_argument("error: can't resample when every weight is zero");
+    calcAncestors(normWts.size(), ancestors, [&](float_t u, size_t j) { return u * maxWt < normWts[j]; });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+template<typename keep_t>
+void par_rejection_resampler<nparts, dimx, float_t, rng_t>::calcAncestors(size_t numIn, arrayInt &ancestors, keep_t &&keep)
+{
+    this->newBlockSeed();
+    this->forBlocks(ancestors.size(), [&](size_t b, size_t first, size_t last)
+    {
+        rng_t gen;
+        this->seedBlock(gen, b);
+        std::uniform_int_distribution<size_t> pick(0, numIn - 1);
+        std::uniform_real_distribution<float_t> unif(0.0, 1.0);
+        for(size_t i = first; i < last; ++i){
+            size_t j = pick(gen);
+            while(!keep(unif(gen), j))
+                j = pick(gen);
+            ancestors[i] = j;
+        }
+    });
+}
+
+
+#endif // PARALLEL_RESAMPLERS_H
@@ -0,0 +1,119 @@
+#ifndef PART_STORAGE_H
+#define PART_STORAGE_H
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector> // aligned_allocator
+
+
+/** Pass this as nparts to choose the number of particles at run time. */
+inline constexpr size_t dynamic_parts = 0;
+
+
+//! Picks the container that holds one thing per particle.
+/**
+ * @class part_storage
+ * @author t
+ * @file part_storage.h
+ * @brief For a fixed number of particles, this is a std::array, which lives inside
+ * the filter object. If nparts is dynamic_parts (i.e. 0), this is a heap allocated, aligned
+ * std::vector, so the filter object stays small and the number of particles can change
+ * between time steps.
+ * @tparam T the type stored for each particle
+ * @tparam nparts the number of particles (or dynamic_parts)
+ */
+template<typename T, size_t nparts>
+struct part_storage
+{
+    /** type alias for the container */
+    using type = std::array<T, nparts>;
+
+    /**
+     * @brief makes a container for n particles
+     * @param n the number of particles (must equal nparts)
+     * @return the container
+     */
+    static type make(size_t n);
+
+    /**
+     * @brief resizes a container
+     * @param c the container
+     * @param n the new number of particles (must equal nparts)
+     */
+    static void resize(type &c, size_t n);
+
+    /**
+     * @brief throws unless n is the (compile time) number of particles
+     * @param n the requested number of particles
+     */
+    static void check(size_t n);
+};
+
+
+template<typename T, size_t nparts>
+auto part_storage<T, nparts>::make(size_t n) -> type
+{
+    check(n);
+    return type();
+}
+
+
+template<typename T, size_t nparts>
+void part_storage<T, nparts>::resize(type &, size_t n)
+{
+    check(n);
+}
+
+
+template<typename T, size_t nparts>
+void part_storage<T, nparts>::check(size_t n)
+{
+    if(n != nparts)
+        throw std::invalid_argument("error: this filter was compiled for " + std::to_string(nparts)
+                                    + " particles, so it can't use " + std::to_string(n)
+                                    + " (use dynamic_parts to choose at run time)");
+}
+
+
+//! The run-time sized specialization of part_storage.
+template<typename T>
+struct part_storage<T, dynamic_parts>
+{
+    /** type alias for the container */
+    using type = std::vector<T, Eigen::aligned_allocator<T>>;
+
+    /**
+     * @brief makes a container for n particles
+     * @param n the number of particles
+     * @return the container
+     */
+    static type make(size_t n) { return type(n); }
+
+    /**
+     * @brief resizes a container
+     * @param c the container
+     * @param n the new number of particles
+     */
+    static void resize(type &c, size_t n) { c.resize(n); }
+
+    /**
+     * @brief throws if n is zero (any other number of particles is fine)
+     * @param n the requested number of particles
+     */
+    static void check(size_t n)
+    {
+        if(n == 0)
+            throw std::invalid_argument("error: a filter needs at least one particle");
+    }
+};
+
+
+/** type alias for the container holding one T per particle */
+template<typename T, size_t nparts>
+using part_array = typename part_storage<T, nparts>::type;
+
+
+#endif // PART_STORAGE_H
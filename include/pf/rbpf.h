@@ -7,24 +7,29 @@
 #include <Eigen/Dense>
 #include <algorithm> // std::fill
 
+#include "part_storage.h"
+#include "filter_core.h"
 #include "pf_base.h"
 #include "cf_filters.h" // for closed form filter objects
 
 
-//! Rao-Blackwellized/Marginal Particle Filter with inner HMMs
+//! Rao-Blackwellized/Marginal Particle Filter with inner HMMs (CRTP engine)
 /**
- * @class rbpf_hmm
+ * @class rbpf_hmm_static
  * @author t
  * @file rbpf.h
- * @brief Rao-Blackwellized/Marginal Particle Filter with inner HMMs
- * @tparam nparts the number of particles
+ * @brief Rao-Blackwellized/Marginal Particle Filter with inner HMMs that calls the model methods of Derived directly, so they can be 
+ * inlined into the particle loops. Derived inherits from rbpf_hmm_static<Derived, ...> 
+ * and provides (public, non-virtual) versions of rbpf_hmm's model methods.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimnss dimension of "not sampled state"
  * @tparam dimss dimension of "sampled state"
  * @tparam dimy the dimension of the observations
  * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
  */
-template<size_t nparts, size_t dimnss,size_t dimss,size_t dimy,typename resamp_t, typename float_t >
-class rbpf_hmm : public rbpf_base<float_t, dimss, dimnss, dimy >
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+class rbpf_hmm_static : public rbpf_base<float_t, dimss, dimnss, dimy >
 {
 public:
 
@@ -39,25 +44,26 @@ public:
     /** Dynamic size matrix*/
     using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
     /** array of model objects */
-    using arrayMod = std::array<hmm<dimnss,dimy,float_t>,nparts>;
+    using arrayMod = part_array<hmm<dimnss,dimy,float_t>, nparts>;
     /** array of samples */
-    using arrayVec = std::array<sssv,nparts>;
+    using arrayVec = part_array<sssv, nparts>;
     /** array of weights */
-    using arrayfloat_t = std::array<float_t,nparts>;
+    using arrayfloat_t = part_array<float_t, nparts>;
 
 
     //! The constructor.
     /**
      * @brief constructor.
      * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    rbpf_hmm(const unsigned int &resamp_sched=1);
+    rbpf_hmm_static(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
 
 
     /**
      * @brief The (virtual) destructor.
      */
-    virtual ~rbpf_hmm();
+    virtual ~rbpf_hmm_static();
 
 
     //! Filter.
@@ -77,98 +83,45 @@ public:
      * @return the latest conditional likelihood.
      */
     float_t getLogCondLike() const;
-    
-    //!
-    /**
-     * @brief Get vector of expectations.
-     * @return vector of expectations
-     */
-    std::vector<Mat> getExpectations() const;
 
-    //! Evaluates the first time state density.
-    /**
-     * @brief evaluates mu.
-     * @param x21 component two at time 1
-     * @return a float_t evaluation
-     */
-    virtual float_t logMuEv(const sssv &x21) = 0;
-    
-    
-    //! Sample from the first sampler.
-    /**
-     * @brief samples the second component of the state at time 1.
-     * @param y1 most recent datum.
-     * @return a sssv sample for x21.
-     */
-    virtual sssv q1Samp(const osv &y1) = 0;
-    
-    
-    //! Provides the initial mean vector for each HMM filter object.
-    /**
-     * @brief provides the initial probability vector for each HMM filter object.
-     * @param x21 the second state componenent at time 1.
-     * @return a Vec representing the probability of each state element.
-     */
-    virtual nsssv initHMMProbVec(const sssv &x21) = 0;
-    
-    
-    //! Provides the transition matrix for each HMM filter object.
-    /**
-     * @brief provides the transition matrix for each HMM filter object.
-     * @param x21 the second state component at time 1. 
-     * @return a transition matrix where element (ij) is the probability of transitioning from state i to state j.
-     */
-    virtual nsssMat initHMMTransMat(const sssv &x21) = 0;
 
-    //! Samples the time t second component. 
     /**
-     * @brief Samples the time t second component.
-     * @param x2tm1 the previous time's second state component.
-     * @param yt the current observation.
-     * @return a Vec sample of the second state component at the current time.
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
      */
-    virtual sssv qSamp(const sssv &x2tm1, const osv &yt) = 0;
-    
-    
-    //! Evaluates the proposal density of the second state component at time 1.
+    float_t getESS() const;
+
+
     /**
-     * @brief Evaluates the proposal density of the second state component at time 1.
-     * @param x21 the second state component at time 1 you sampled. 
-     * @param y1 time 1 observation.
-     * @return a float_t evaluation of the density.
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
      */
-    virtual float_t logQ1Ev(const sssv &x21, const osv &y1) = 0;
-    
-    
-    //! Evaluates the state transition density for the second state component.
+    void setESSThreshold(const float_t &frac);
+
+
     /**
-     * @brief Evaluates the state transition density for the second state component.
-     * @param x2t the current second state component.
-     * @param x2tm1 the previous second state component.
-     * @return a float_t evaluation.
+     * @brief Returns the current number of particles.
+     * @return the number of particles
      */
-    virtual float_t logFEv(const sssv &x2t, const sssv &x2tm1) = 0;
-    
-    
-    //! Evaluates the proposal density at time t > 1.
+    size_t getNumParticles() const;
+
+
     /**
-     * @brief Evaluates the proposal density at time t > 1. 
-     * @param x2t the current second state component.
-     * @param x2tm1 the previous second state component.
-     * @param yt the current time series observation.
-     * @return a float_t evaluation.
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
      */
-    virtual float_t logQEv(const sssv &x2t, const sssv &x2tm1, const osv &yt ) = 0;
+    void setNumParticles(const size_t &n);
     
-    
-    //! How to update your inner HMM filter object at each time.
+    //!
     /**
-     * @brief How to update your inner HMM filter object at each time.
-     * @param aModel a HMM filter object describing the conditional closed-form model.
-     * @param yt the current time series observation.
-     * @param x2t the current second state component.
+     * @brief Get vector of expectations.
+     * @return vector of expectations
      */
-    virtual void updateHMM(hmm<dimnss,dimy,float_t> &aModel, const osv &yt, const sssv &x2t) = 0;
+    std::vector<Mat> getExpectations() const;
+
 
 private:
     
@@ -176,8 +129,6 @@ private:
     unsigned int m_now;
     /** last conditional likelihood */
     float_t m_lastLogCondLike;
-    /** resampling schedue */
-    unsigned int m_rs;
     /** the array of inner closed-form models */ 
     arrayMod m_p_innerMods;
     /** the array of samples for the second state portion */
@@ -186,85 +137,61 @@ private:
     arrayfloat_t m_logUnNormWeights;
     /** the resampler object */
     resamp_t m_resampler;
-    /** the vector of expectations */
-    std::vector<Mat> m_expectations; 
+    /** normalizing, expectations and the resampling decision */
+    FilterCore<nparts, sssv, float_t> m_core;
+
+private:
 
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
 };
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_hmm(const unsigned int &resamp_sched)
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_hmm_static(const unsigned int &resamp_sched, const size_t &num_parts)
     : m_now(0)
     , m_lastLogCondLike(0.0)
-    , m_rs(resamp_sched)
+    , m_p_innerMods(part_storage<typename arrayMod::value_type, nparts>::make(num_parts))
+    , m_p_samps(part_storage<sssv, nparts>::make(num_parts))
+    , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_core(resamp_sched, 1, num_parts)
 {
     std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_hmm() {}
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_hmm_static() {}
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-void rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs)
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs)
 {
+    const size_t N = m_logUnNormWeights.size();
 
     if(m_now > 0)
     { //m_now > 0
         
         // update
         sssv newX2Samp;
-        float_t sumexpdenom(0.0);
-        float_t m1(-1.0/0.0); // for revised log weights
-        float_t m2 = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(size_t ii = 0; ii < nparts; ++ii){
-            
-            newX2Samp = qSamp(m_p_samps[ii], data);
-            updateHMM(m_p_innerMods[ii], data, newX2Samp);
-            sumexpdenom += std::exp(m_logUnNormWeights[ii] - m2);
+        lse_partial<float_t> oldLSE;
+        oldLSE.add(m_logUnNormWeights.data(), N);
+        for(size_t ii = 0; ii < N; ++ii){
             
+            newX2Samp = derived().qSamp(m_p_samps[ii], data);
+            derived().updateHMM(m_p_innerMods[ii], data, newX2Samp);
             m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike()
-                                    + logFEv(newX2Samp, m_p_samps[ii]) 
-                                    - logQEv(newX2Samp, m_p_samps[ii], data);
-            
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
+                                    + derived().logFEv(newX2Samp, m_p_samps[ii]) 
+                                    - derived().logQEv(newX2Samp, m_p_samps[ii], data);
             
             m_p_samps[ii] = newX2Samp;
         }
         
         // calculate log p(y_t | y_{1:t-1})
-        float_t sumexpnumer(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexpnumer += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexpnumer) - m2 - std::log(sumexpdenom);
-        
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-            
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-
-        // resample (unnormalized weights ok)
-        if( (m_now+1) % m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-        
-        // update time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
     }
     else //( m_now == 0)
     { // first data point coming
@@ -272,154 +199,160 @@ void rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data
         // initialize and update the closed-form mods        
         nsssv tmpProbs;
         nsssMat tmpTransMat;
-        float_t m1(-1.0/0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
+        for(size_t ii = 0; ii < N; ++ii){
             
-            m_p_samps[ii] = q1Samp(data); 
-            tmpProbs = initHMMProbVec(m_p_samps[ii]);
-            tmpTransMat = initHMMTransMat(m_p_samps[ii]);
+            m_p_samps[ii] = derived().q1Samp(data); 
+            tmpProbs = derived().initHMMProbVec(m_p_samps[ii]);
+            tmpTransMat = derived().initHMMTransMat(m_p_samps[ii]);
             m_p_innerMods[ii] = hmm<dimnss,dimy,float_t>(tmpProbs, tmpTransMat);
-            this->updateHMM(m_p_innerMods[ii], data, m_p_samps[ii]);
-            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike() + logMuEv(m_p_samps[ii]) - logQ1Ev(m_p_samps[ii], data);
+            derived().updateHMM(m_p_innerMods[ii], data, m_p_samps[ii]);
+            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike() + derived().logMuEv(m_p_samps[ii]) - derived().logQ1Ev(m_p_samps[ii], data);
 
-            // maximum to be used in likelihood calc
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
         }
 
         // calc log p(y1)
-        float_t sumexp(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexp += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexp) - std::log(static_cast<float_t>(nparts));
-
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp(m_logUnNormWeights[prtcl] - m1);
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-        
-        // resample (unnormalized weights ok)
-        if( (m_now+1) % m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-
-        // advance time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - std::log(static_cast<float_t>(N));
     }
-   
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_p_innerMods[i].getFilterVec(), m_p_samps[i]); });
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time step
+    m_now ++;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-float_t rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
 {
     return m_lastLogCondLike;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-auto rbpf_hmm<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getESS() const
 {
-    return m_expectations;
+    return m_core.getESS();
 }
 
 
-//! Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+auto rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+size_t rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, n);
+    }else{
+        part_storage<typename arrayMod::value_type, nparts>::resize(m_p_innerMods, n);
+        part_storage<sssv, nparts>::resize(m_p_samps, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+}
+
+
+//! Rao-Blackwellized/Marginal Particle Filter with inner HMMs
 /**
- * @class rbpf_hmm_bs
+ * @class rbpf_hmm
  * @author t
  * @file rbpf.h
- * @brief Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs
- * @tparam nparts the number of particles
+ * @brief Rao-Blackwellized/Marginal Particle Filter with inner HMMs
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimnss dimension of "not sampled state"
  * @tparam dimss dimension of "sampled state"
  * @tparam dimy the dimension of the observations
  * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
+ * 
+ * The model methods are pure virtual. rbpf_hmm_static runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
  */
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-class rbpf_hmm_bs : public rbpf_base<float_t,dimss,dimnss,dimy>
+class rbpf_hmm : public rbpf_hmm_static<rbpf_hmm<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>
 {
 public:
 
+    /** the engine this class plugs its virtual methods into */
+    using base_t = rbpf_hmm_static<rbpf_hmm<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>;
     /** "sampled state size vector" */
-    using sssv = Eigen::Matrix<float_t,dimss,1>;
+    using sssv = typename base_t::sssv;
     /** "not sampled state size vector" */
-    using nsssv = Eigen::Matrix<float_t,dimnss,1>;
+    using nsssv = typename base_t::nsssv;
     /** "observation size vector" */
-    using osv = Eigen::Matrix<float_t,dimy,1>;
+    using osv = typename base_t::osv;
     /** "not sampled state size matrix" */
-    using nsssMat = Eigen::Matrix<float_t,dimnss,dimnss>;
-    /** Dynamic size matrix*/
-    using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    using nsssMat = typename base_t::nsssMat;
+    /** Dynamic size matrix */
+    using Mat = typename base_t::Mat;
     /** array of model objects */
-    using arrayMod = std::array<hmm<dimnss,dimy,float_t>,nparts>;
+    using arrayMod = typename base_t::arrayMod;
     /** array of samples */
-    using arrayVec = std::array<sssv,nparts>;
+    using arrayVec = typename base_t::arrayVec;
     /** array of weights */
-    using arrayfloat_t = std::array<float_t,nparts>;
+    using arrayfloat_t = typename base_t::arrayfloat_t;
 
 
-    //! The constructor.
     /**
-     * @brief constructor.
+     * @brief The constructor.
      * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    rbpf_hmm_bs(const unsigned int &resamp_sched=1);
-    
-    
+    rbpf_hmm(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
+
+
     /**
      * @brief The (virtual) destructor.
      */
-    virtual ~rbpf_hmm_bs();
-    
+    virtual ~rbpf_hmm();
 
-    //! Filter.
+
+    //! Evaluates the first time state density.
     /**
-     * @brief filters everything based on a new data point.
-     * @param data the most recent time series observation.
-     * @param fs a vector of functions computing E[h(x_1t, x_2t^i)| x_2t^i,y_1:t] to be averaged to yield E[h(x_1t, x_2t)|,y_1:t]. Will access the probability vector of x_1t
+     * @brief evaluates mu.
+     * @param x21 component two at time 1
+     * @return a float_t evaluation
      */
-    void filter(const osv &data,
-                const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs 
-                    = std::vector<std::function<const Mat(const nsssv&, const sssv&)> >());//, const std::vector<std::function<const Mat(const Vec&)> >& fs);
+    virtual float_t logMuEv(const sssv &x21) = 0;
 
 
-    //! Get the latest conditional likelihood.
-    /**
-     * @brief Get the latest conditional likelihood.
-     * @return the latest conditional likelihood.
-     */
-    float_t getLogCondLike() const;
-    
-    //!
-    /**
-     * @brief Get vector of expectations.
-     * @return vector of expectations
-     */
-    std::vector<Mat> getExpectations() const;
-    
-    
     //! Sample from the first sampler.
     /**
      * @brief samples the second component of the state at time 1.
+     * @param y1 most recent datum.
      * @return a sssv sample for x21.
      */
-    virtual sssv muSamp() = 0;
-    
-    
+    virtual sssv q1Samp(const osv &y1) = 0;
+
+
     //! Provides the initial mean vector for each HMM filter object.
     /**
      * @brief provides the initial probability vector for each HMM filter object.
@@ -427,8 +360,8 @@ public:
      * @return a Vec representing the probability of each state element.
      */
     virtual nsssv initHMMProbVec(const sssv &x21) = 0;
-    
-    
+
+
     //! Provides the transition matrix for each HMM filter object.
     /**
      * @brief provides the transition matrix for each HMM filter object.
@@ -437,15 +370,48 @@ public:
      */
     virtual nsssMat initHMMTransMat(const sssv &x21) = 0;
 
+
     //! Samples the time t second component. 
     /**
      * @brief Samples the time t second component.
      * @param x2tm1 the previous time's second state component.
-     * @return a sssv sample of the second state component at the current time.
+     * @param yt the current observation.
+     * @return a Vec sample of the second state component at the current time.
      */
-    virtual sssv fSamp(const sssv &x2tm1) = 0;
-    
-    
+    virtual sssv qSamp(const sssv &x2tm1, const osv &yt) = 0;
+
+
+    //! Evaluates the proposal density of the second state component at time 1.
+    /**
+     * @brief Evaluates the proposal density of the second state component at time 1.
+     * @param x21 the second state component at time 1 you sampled. 
+     * @param y1 time 1 observation.
+     * @return a float_t evaluation of the density.
+     */
+    virtual float_t logQ1Ev(const sssv &x21, const osv &y1) = 0;
+
+
+    //! Evaluates the state transition density for the second state component.
+    /**
+     * @brief Evaluates the state transition density for the second state component.
+     * @param x2t the current second state component.
+     * @param x2tm1 the previous second state component.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logFEv(const sssv &x2t, const sssv &x2tm1) = 0;
+
+
+    //! Evaluates the proposal density at time t > 1.
+    /**
+     * @brief Evaluates the proposal density at time t > 1. 
+     * @param x2t the current second state component.
+     * @param x2tm1 the previous second state component.
+     * @param yt the current time series observation.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logQEv(const sssv &x2t, const sssv &x2tm1, const osv &yt ) = 0;
+
+
     //! How to update your inner HMM filter object at each time.
     /**
      * @brief How to update your inner HMM filter object at each time.
@@ -454,184 +420,412 @@ public:
      * @param x2t the current second state component.
      */
     virtual void updateHMM(hmm<dimnss,dimy,float_t> &aModel, const osv &yt, const sssv &x2t) = 0;
-
-private:
-    
-    /** the current time period */
-    unsigned int m_now;
-    /** last conditional likelihood */
-    float_t m_lastLogCondLike;
-    /** resampling schedue */
-    unsigned int m_rs;
-    /** the array of inner closed-form models */ 
-    arrayMod m_p_innerMods;
-    /** the array of samples for the second state portion */
-    arrayVec m_p_samps;
-    /** the array of unnormalized log-weights */
-    arrayfloat_t m_logUnNormWeights;
-    /** the resampler object */
-    resamp_t m_resampler;
-    /** the vector of expectations */
-    std::vector<Mat> m_expectations; 
-
 };
 
 
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_hmm_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_hmm_bs(const unsigned int &resamp_sched)
-    : m_now(0)
-    , m_lastLogCondLike(0.0)
-    , m_rs(resamp_sched)
+rbpf_hmm<nparts, dimnss, dimss, dimy, resamp_t, float_t>::rbpf_hmm(const unsigned int &resamp_sched, const size_t &num_parts)
+    : base_t(resamp_sched, num_parts)
 {
-    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
 }
 
 
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_hmm_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_hmm_bs() {}
-
+rbpf_hmm<nparts, dimnss, dimss, dimy, resamp_t, float_t>::~rbpf_hmm() {}
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-void rbpf_hmm_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs)
-{
+
+//! Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs (CRTP engine)
+/**
+ * @class rbpf_hmm_bs_static
+ * @author t
+ * @file rbpf.h
+ * @brief Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs that calls the model methods of Derived directly, so they can be 
+ * inlined into the particle loops. Derived inherits from rbpf_hmm_bs_static<Derived, ...> 
+ * and provides (public, non-virtual) versions of rbpf_hmm_bs's model methods.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimnss dimension of "not sampled state"
+ * @tparam dimss dimension of "sampled state"
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
+ */
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+class rbpf_hmm_bs_static : public rbpf_base<float_t,dimss,dimnss,dimy>
+{
+public:
+
+    /** "sampled state size vector" */
+    using sssv = Eigen::Matrix<float_t,dimss,1>;
+    /** "not sampled state size vector" */
+    using nsssv = Eigen::Matrix<float_t,dimnss,1>;
+    /** "observation size vector" */
+    using osv = Eigen::Matrix<float_t,dimy,1>;
+    /** "not sampled state size matrix" */
+    using nsssMat = Eigen::Matrix<float_t,dimnss,dimnss>;
+    /** Dynamic size matrix*/
+    using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    /** array of model objects */
+    using arrayMod = part_array<hmm<dimnss,dimy,float_t>, nparts>;
+    /** array of samples */
+    using arrayVec = part_array<sssv, nparts>;
+    /** array of weights */
+    using arrayfloat_t = part_array<float_t, nparts>;
+
+
+    //! The constructor.
+    /**
+     * @brief constructor.
+     * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    rbpf_hmm_bs_static(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
+    
+    
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~rbpf_hmm_bs_static();
+    
+
+    //! Filter.
+    /**
+     * @brief filters everything based on a new data point.
+     * @param data the most recent time series observation.
+     * @param fs a vector of functions computing E[h(x_1t, x_2t^i)| x_2t^i,y_1:t] to be averaged to yield E[h(x_1t, x_2t)|,y_1:t]. Will access the probability vector of x_1t
+     */
+    void filter(const osv &data,
+                const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs 
+                    = std::vector<std::function<const Mat(const nsssv&, const sssv&)> >());//, const std::vector<std::function<const Mat(const Vec&)> >& fs);
+
+
+    //! Get the latest conditional likelihood.
+    /**
+     * @brief Get the latest conditional likelihood.
+     * @return the latest conditional likelihood.
+     */
+    float_t getLogCondLike() const;
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
+    
+    //!
+    /**
+     * @brief Get vector of expectations.
+     * @return vector of expectations
+     */
+    std::vector<Mat> getExpectations() const;
+
+
+private:
+    
+    /** the current time period */
+    unsigned int m_now;
+    /** last conditional likelihood */
+    float_t m_lastLogCondLike;
+    /** the array of inner closed-form models */ 
+    arrayMod m_p_innerMods;
+    /** the array of samples for the second state portion */
+    arrayVec m_p_samps;
+    /** the array of unnormalized log-weights */
+    arrayfloat_t m_logUnNormWeights;
+    /** the resampler object */
+    resamp_t m_resampler;
+    /** normalizing, expectations and the resampling decision */
+    FilterCore<nparts, sssv, float_t> m_core;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_hmm_bs_static(const unsigned int &resamp_sched, const size_t &num_parts)
+    : m_now(0)
+    , m_lastLogCondLike(0.0)
+    , m_p_innerMods(part_storage<typename arrayMod::value_type, nparts>::make(num_parts))
+    , m_p_samps(part_storage<sssv, nparts>::make(num_parts))
+    , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_core(resamp_sched, 1, num_parts)
+{
+    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_hmm_bs_static() {}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1tProbs, const sssv &x2t)> >& fs)
+{
+    const size_t N = m_logUnNormWeights.size();
 
     if(m_now > 0)
     {     
         // update
         sssv newX2Samp;
-        float_t sumexpdenom(0.0);
-        float_t m1(-1.0/0.0); // for revised log weights
-        float_t m2 = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(size_t ii = 0; ii < nparts; ++ii){
-            
-            newX2Samp = fSamp(m_p_samps[ii]);
-            updateHMM(m_p_innerMods[ii], data, newX2Samp);
-            sumexpdenom += std::exp(m_logUnNormWeights[ii] - m2);
+        lse_partial<float_t> oldLSE;
+        oldLSE.add(m_logUnNormWeights.data(), N);
+        for(size_t ii = 0; ii < N; ++ii){
             
+            newX2Samp = derived().fSamp(m_p_samps[ii]);
+            derived().updateHMM(m_p_innerMods[ii], data, newX2Samp);
             m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike();
             
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
-            
             m_p_samps[ii] = newX2Samp;
         }
         
         // calculate log p(y_t | y_{1:t-1})
-        float_t sumexpnumer(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexpnumer += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexpnumer) - m2 - std::log(sumexpdenom);
-        
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-            
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl])*std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-
-        // resample (unnormalized weights ok)
-        if( (m_now+1) % m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-        
-        // update time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
     }
     else// ( m_now == 0) // first data point coming
     {
         // initialize and update the closed-form mods        
         nsssv tmpProbs;
         nsssMat tmpTransMat;
-        float_t m1(-1.0/0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
+        for(size_t ii = 0; ii < N; ++ii){
             
-            m_p_samps[ii] = muSamp(); 
-            tmpProbs = initHMMProbVec(m_p_samps[ii]);
-            tmpTransMat = initHMMTransMat(m_p_samps[ii]);
+            m_p_samps[ii] = derived().muSamp(); 
+            tmpProbs = derived().initHMMProbVec(m_p_samps[ii]);
+            tmpTransMat = derived().initHMMTransMat(m_p_samps[ii]);
             m_p_innerMods[ii] = hmm<dimnss,dimy,float_t>(tmpProbs, tmpTransMat);
-            this->updateHMM(m_p_innerMods[ii], data, m_p_samps[ii]);
+            derived().updateHMM(m_p_innerMods[ii], data, m_p_samps[ii]);
             m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike();
 
-            // maximum to be used in likelihood calc
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
         }
 
         // calc log p(y1)
-        float_t sumexp(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexp += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexp) - std::log(static_cast<float_t>(nparts));
-
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end()); /// TODO: can we just use m1?
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-        
-        // resample (unnormalized weights ok)
-        if( (m_now+1) % m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-
-        // advance time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - std::log(static_cast<float_t>(N));
     }
-   
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_p_innerMods[i].getFilterVec(), m_p_samps[i]); });
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time step
+    m_now ++;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-float_t rbpf_hmm_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
 {
     return m_lastLogCondLike;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-auto rbpf_hmm_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getESS() const
 {
-    return m_expectations;
+    return m_core.getESS();
 }
 
 
-//! Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objectss
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+auto rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+size_t rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_hmm_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, n);
+    }else{
+        part_storage<typename arrayMod::value_type, nparts>::resize(m_p_innerMods, n);
+        part_storage<sssv, nparts>::resize(m_p_samps, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+}
+
+
+//! Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs
 /**
- * @class rbpf_kalman
+ * @class rbpf_hmm_bs
  * @author t
  * @file rbpf.h
- * @brief Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objectss
- * @tparam nparts the number of particles
- * @tparam dimnss dimension of not-sampled-state vector
- * @tparam dimss dimension of sampled-state vector
+ * @brief Rao-Blackwellized/Marginal Bootstrap Filter with inner HMMs
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimnss dimension of "not sampled state"
+ * @tparam dimss dimension of "sampled state"
  * @tparam dimy the dimension of the observations
- * @tparam resamp_t the resampler type
+ * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
+ * 
+ * The model methods are pure virtual. rbpf_hmm_bs_static runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
  */
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-class rbpf_kalman : public rbpf_base<float_t,dimss,dimnss,dimy>
+class rbpf_hmm_bs : public rbpf_hmm_bs_static<rbpf_hmm_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = rbpf_hmm_bs_static<rbpf_hmm_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>;
+    /** "sampled state size vector" */
+    using sssv = typename base_t::sssv;
+    /** "not sampled state size vector" */
+    using nsssv = typename base_t::nsssv;
+    /** "observation size vector" */
+    using osv = typename base_t::osv;
+    /** "not sampled state size matrix" */
+    using nsssMat = typename base_t::nsssMat;
+    /** Dynamic size matrix */
+    using Mat = typename base_t::Mat;
+    /** array of model objects */
+    using arrayMod = typename base_t::arrayMod;
+    /** array of samples */
+    using arrayVec = typename base_t::arrayVec;
+    /** array of weights */
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+
+
+    /**
+     * @brief The constructor.
+     * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    rbpf_hmm_bs(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~rbpf_hmm_bs();
+
+
+    //! Sample from the first sampler.
+    /**
+     * @brief samples the second component of the state at time 1.
+     * @return a sssv sample for x21.
+     */
+    virtual sssv muSamp() = 0;
+
+
+    //! Provides the initial mean vector for each HMM filter object.
+    /**
+     * @brief provides the initial probability vector for each HMM filter object.
+     * @param x21 the second state componenent at time 1.
+     * @return a Vec representing the probability of each state element.
+     */
+    virtual nsssv initHMMProbVec(const sssv &x21) = 0;
+
+
+    //! Provides the transition matrix for each HMM filter object.
+    /**
+     * @brief provides the transition matrix for each HMM filter object.
+     * @param x21 the second state component at time 1. 
+     * @return a transition matrix where element (ij) is the probability of transitioning from state i to state j.
+     */
+    virtual nsssMat initHMMTransMat(const sssv &x21) = 0;
+
+
+    //! Samples the time t second component. 
+    /**
+     * @brief Samples the time t second component.
+     * @param x2tm1 the previous time's second state component.
+     * @return a sssv sample of the second state component at the current time.
+     */
+    virtual sssv fSamp(const sssv &x2tm1) = 0;
+
+
+    //! How to update your inner HMM filter object at each time.
+    /**
+     * @brief How to update your inner HMM filter object at each time.
+     * @param aModel a HMM filter object describing the conditional closed-form model.
+     * @param yt the current time series observation.
+     * @param x2t the current second state component.
+     */
+    virtual void updateHMM(hmm<dimnss,dimy,float_t> &aModel, const osv &yt, const sssv &x2t) = 0;
+};
+
+
+template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>::rbpf_hmm_bs(const unsigned int &resamp_sched, const size_t &num_parts)
+    : base_t(resamp_sched, num_parts)
+{
+}
+
+
+template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_hmm_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>::~rbpf_hmm_bs() {}
+
+
+//! Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objects (CRTP engine)
+/**
+ * @class rbpf_kalman_static
+ * @author t
+ * @file rbpf.h
+ * @brief Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objects that calls the model methods of Derived directly, so they can be 
+ * inlined into the particle loops. Derived inherits from rbpf_kalman_static<Derived, ...> 
+ * and provides (public, non-virtual) versions of rbpf_kalman's model methods.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimnss dimension of "not sampled state"
+ * @tparam dimss dimension of "sampled state"
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
+ */
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+class rbpf_kalman_static : public rbpf_base<float_t,dimss,dimnss,dimy>
 {
 
 public:
@@ -647,23 +841,24 @@ public:
     /** "not sampled state size matrix" */
     using nsssMat = Eigen::Matrix<float_t,dimnss,dimnss>;
     /** array of model objects */
-    using arrayMod = std::array<kalman<dimnss,dimy,0,float_t>,nparts>;
+    using arrayMod = part_array<kalman<dimnss,dimy,0,float_t>, nparts>;
     /** array of samples */
-    using arrayVec = std::array<sssv,nparts>;
+    using arrayVec = part_array<sssv, nparts>;
     /** array of weights */
-    using arrayfloat_t = std::array<float_t,nparts>;
+    using arrayfloat_t = part_array<float_t, nparts>;
 
     //! The constructor.
     /**
      \param resamp_sched how often you want to resample (e.g once every resamp_sched time points)
+     \param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    rbpf_kalman(const unsigned int &resamp_sched=1);
+    rbpf_kalman_static(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
     
     
     /**
      * @brief 
      */
-    virtual ~rbpf_kalman();
+    virtual ~rbpf_kalman_static();
     
     
     //! Filter! 
@@ -680,6 +875,37 @@ public:
      * \return the latest log conditional likelihood.
      */
     float_t getLogCondLike() const; 
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
     
     
     //! Get the latest filtered expectation E[h(x_1t, x_2t) | y_{1:t}]
@@ -688,98 +914,426 @@ public:
      * @return a vector of Mats
      */
     std::vector<Mat> getExpectations() const;
+
+
+private:
+
+    /** the array of inner Kalman filter objects */
+    arrayMod m_p_innerMods;
+    /** the array of particle samples */
+    arrayVec m_p_samps;
+    /** the array of the (log of) unnormalized weights */
+    arrayfloat_t m_logUnNormWeights;
+    /** the current time period */
+    unsigned int m_now;
+    /** log p(y_t|y_{1:t-1}) or log p(y1) */
+    float_t m_lastLogCondLike; 
+    /** resampler object */
+    resamp_t m_resampler;
+    /** normalizing, expectations and the resampling decision */
+    FilterCore<nparts, sssv, float_t> m_core;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_kalman_static(const unsigned int &resamp_sched, const size_t &num_parts)
+    : m_now(0)
+    , m_lastLogCondLike(0.0)
+    , m_p_innerMods(part_storage<typename arrayMod::value_type, nparts>::make(num_parts))
+    , m_p_samps(part_storage<sssv, nparts>::make(num_parts))
+    , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_core(resamp_sched, 1, num_parts)
+{
+    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_kalman_static() {}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs)
+{
+    const size_t N = m_logUnNormWeights.size();
     
-    
+    if(m_now > 0)
+    {
+        
+        // update
+        sssv newX2Samp;
+        lse_partial<float_t> oldLSE;
+        oldLSE.add(m_logUnNormWeights.data(), N);
+        for(size_t ii = 0; ii < N; ++ii){
+            newX2Samp = derived().qSamp(m_p_samps[ii], data);
+            derived().updateKalman(m_p_innerMods[ii], data, newX2Samp);
+
+            // update the weights
+            m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike() + derived().logFEv(newX2Samp, m_p_samps[ii]) - derived().logQEv(newX2Samp, m_p_samps[ii], data);
+            
+            m_p_samps[ii] = newX2Samp;
+        }
+        
+        // calc log p(y_t | y_{1:t-1})
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
+    }
+    else //( m_now == 0) // first data point coming
+    {
+        // initialize and update the closed-form mods      
+        nsssv tmpMean;
+        nsssMat tmpVar;
+        for(size_t ii = 0; ii < N; ++ii){
+            m_p_samps[ii] = derived().q1Samp(data); 
+            tmpMean = derived().initKalmanMean(m_p_samps[ii]);
+            tmpVar  = derived().initKalmanVar(m_p_samps[ii]);
+            m_p_innerMods[ii] = kalman<dimnss,dimy,0,float_t>(tmpMean, tmpVar);
+            derived().updateKalman(m_p_innerMods[ii], data, m_p_samps[ii]);
+
+            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike() + derived().logMuEv(m_p_samps[ii]) - derived().logQ1Ev(m_p_samps[ii], data);
+
+        }
+
+        // calculate log p(y1)
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - std::log(static_cast<float_t>(N));
+    }
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_p_innerMods[i].getFilterVec(), m_p_samps[i]); });
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time step
+    m_now ++;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
+{
+    return m_lastLogCondLike;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+auto rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+size_t rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, n);
+    }else{
+        part_storage<typename arrayMod::value_type, nparts>::resize(m_p_innerMods, n);
+        part_storage<sssv, nparts>::resize(m_p_samps, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+}
+
+
+//! Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objectss
+/**
+ * @class rbpf_kalman
+ * @author t
+ * @file rbpf.h
+ * @brief Rao-Blackwellized/Marginal Particle Filter with inner Kalman Filter objectss
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimnss dimension of not-sampled-state vector
+ * @tparam dimss dimension of sampled-state vector
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the resampler type
+ * 
+ * The model methods are pure virtual. rbpf_kalman_static runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
+ */
+template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+class rbpf_kalman : public rbpf_kalman_static<rbpf_kalman<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = rbpf_kalman_static<rbpf_kalman<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>;
+    /** "sampled state size vector" */
+    using sssv = typename base_t::sssv;
+    /** "not sampled state size vector" */
+    using nsssv = typename base_t::nsssv;
+    /** "observation size vector" */
+    using osv = typename base_t::osv;
+    /** "not sampled state size matrix" */
+    using nsssMat = typename base_t::nsssMat;
+    /** Dynamic size matrix */
+    using Mat = typename base_t::Mat;
+    /** array of model objects */
+    using arrayMod = typename base_t::arrayMod;
+    /** array of samples */
+    using arrayVec = typename base_t::arrayVec;
+    /** array of weights */
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+
+
+    /**
+     * @brief The constructor.
+     * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    rbpf_kalman(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~rbpf_kalman();
+
+
     //! Evaluates the first time state density.
     /**
      * @brief evaluates log mu(x21).
      * @param x21 component two at time 1
      * @return a float_t evaluation
      */
-    virtual float_t logMuEv(const sssv &x21) = 0;
+    virtual float_t logMuEv(const sssv &x21) = 0;
+
+
+    //! Sample from the first time's proposal distribution.
+    /**
+     * @brief samples the second component of the state at time 1.
+     * @param y1 most recent datum.
+     * @return a Vec sample for x21.
+     */
+    virtual sssv q1Samp(const osv &y1) = 0;
+
+
+    //! Provides the initial mean vector for each Kalman filter object.
+    /**
+     * @brief provides the initial mean vector for each Kalman filter object.
+     * @param x21 the second state componenent at time 1.
+     * @return a nsssv representing the unconditional mean.
+     */
+    virtual nsssv initKalmanMean(const sssv &x21) = 0;
+
+
+    //! Provides the initial covariance matrix for each Kalman filter object.
+    /**
+     * @brief provides the initial covariance matrix for each Kalman filter object.
+     * @param x21 the second state component at time 1.
+     * @return a covariance matrix. 
+     */
+    virtual nsssMat initKalmanVar(const sssv &x21) = 0;
+
+
+    //! Samples the time t second component. 
+    /**
+     * @brief Samples the time t second component.
+     * @param x2tm1 the previous time's second state component.
+     * @param yt the current observation.
+     * @return a sssv sample of the second state component at the current time.
+     */
+    virtual sssv qSamp(const sssv &x2tm1, const osv &yt) = 0;
+
+
+    //! Evaluates the proposal density of the second state component at time 1.
+    /**
+     * @brief Evaluates the proposal density of the second state component at time 1.
+     * @param x21 the second state component at time 1 you sampled. 
+     * @param y1 time 1 observation.
+     * @return a float_t evaluation of the density.
+     */
+    virtual float_t logQ1Ev(const sssv &x21, const osv &y1) = 0;
+
+
+    //! Evaluates the state transition density for the second state component.
+    /**
+     * @brief Evaluates the state transition density for the second state component.
+     * @param x2t the current second state component.
+     * @param x2tm1 the previous second state component.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logFEv(const sssv &x2t, const sssv &x2tm1) = 0;
+
+
+    //! Evaluates the proposal density at time t > 1.
+    /**
+     * @brief Evaluates the proposal density at time t > 1. 
+     * @param x2t the current second state component.
+     * @param x2tm1 the previous second state component.
+     * @param yt the current time series observation.
+     * @return a float_t evaluation.
+     */
+    virtual float_t logQEv(const sssv &x2t, const sssv &x2tm1, const osv &yt) = 0;
+
+
+    //! How to update your inner Kalman filter object at each time.
+    /**
+     * @brief How to update your inner Kalman filter object at each time.
+     * @param kMod a Kalman filter object describing the conditional closed-form model.
+     * @param yt the current time series observation.
+     * @param x2t the current second state component.
+     */
+    virtual void updateKalman(kalman<dimnss,dimy,0,float_t> &kMod, const osv &yt, const sssv &x2t) = 0;
+};
+
+
+template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman<nparts, dimnss, dimss, dimy, resamp_t, float_t>::rbpf_kalman(const unsigned int &resamp_sched, const size_t &num_parts)
+    : base_t(resamp_sched, num_parts)
+{
+}
+
+
+template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman<nparts, dimnss, dimss, dimy, resamp_t, float_t>::~rbpf_kalman() {}
+
+
+//! Rao-Blackwellized/Marginal Bootstrap Filter with inner Kalman Filter objects (CRTP engine)
+/**
+ * @class rbpf_kalman_bs_static
+ * @author t
+ * @file rbpf.h
+ * @brief Rao-Blackwellized/Marginal Bootstrap Filter with inner Kalman Filter objects that calls the model methods of Derived directly, so they can be 
+ * inlined into the particle loops. Derived inherits from rbpf_kalman_bs_static<Derived, ...> 
+ * and provides (public, non-virtual) versions of rbpf_kalman_bs's model methods.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimnss dimension of "not sampled state"
+ * @tparam dimss dimension of "sampled state"
+ * @tparam dimy the dimension of the observations
+ * @tparam resamp_t the resampler type (e.g. multinomial, etc.)
+ */
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+class rbpf_kalman_bs_static : public rbpf_base<float_t,dimss,dimnss,dimy>
+{
+
+public:
+
+    /** "sampled state size vector" */
+    using sssv = Eigen::Matrix<float_t,dimss,1>;
+    /** "not sampled state size vector" */
+    using nsssv = Eigen::Matrix<float_t,dimnss,1>;
+    /** "observation size vector" */
+    using osv = Eigen::Matrix<float_t,dimy,1>;
+    /** dynamic size matrices */
+    using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    /** "not sampled state size matrix" */
+    using nsssMat = Eigen::Matrix<float_t,dimnss,dimnss>;
+    /** array of model objects */
+    using arrayMod = part_array<kalman<dimnss,dimy,0,float_t>, nparts>;
+    /** array of samples */
+    using arrayVec = part_array<sssv, nparts>;
+    /** array of weights */
+    using arrayfloat_t = part_array<float_t, nparts>;
+
+    //! The constructor.
+    /**
+     \param resamp_sched how often you want to resample (e.g once every resamp_sched time points)
+     \param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    rbpf_kalman_bs_static(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
     
     
-    //! Sample from the first time's proposal distribution.
     /**
-     * @brief samples the second component of the state at time 1.
-     * @param y1 most recent datum.
-     * @return a Vec sample for x21.
+     * @brief The (virtual) destructor. 
      */
-    virtual sssv q1Samp(const osv &y1) = 0;
+    virtual ~rbpf_kalman_bs_static();
     
     
-    //! Provides the initial mean vector for each Kalman filter object.
+    //! Filter! 
     /**
-     * @brief provides the initial mean vector for each Kalman filter object.
-     * @param x21 the second state componenent at time 1.
-     * @return a nsssv representing the unconditional mean.
+     * \brief The workhorse function
+     * \param data the most recent observable portion of the time series.
+     * \param fs a vector of functions computing E[h(x_1t, x_2t^i)| x_2t^i,y_1:t]. to be averaged to yield E[h(x_1t, x_2t)|,y_1:t]
      */
-    virtual nsssv initKalmanMean(const sssv &x21) = 0;
-    
-    
-    //! Provides the initial covariance matrix for each Kalman filter object.
+    void filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs
+                                     = std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >() );
+
+    //! Get the latest log conditional likelihood.
     /**
-     * @brief provides the initial covariance matrix for each Kalman filter object.
-     * @param x21 the second state component at time 1.
-     * @return a covariance matrix. 
+     * \return the latest log conditional likelihood.
      */
-    virtual nsssMat initKalmanVar(const sssv &x21) = 0;
-    
-    
-    //! Samples the time t second component. 
+    float_t getLogCondLike() const; 
+
+
     /**
-     * @brief Samples the time t second component.
-     * @param x2tm1 the previous time's second state component.
-     * @param yt the current observation.
-     * @return a sssv sample of the second state component at the current time.
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
      */
-    virtual sssv qSamp(const sssv &x2tm1, const osv &yt) = 0;
-    
-    
-    //! Evaluates the proposal density of the second state component at time 1.
+    float_t getESS() const;
+
+
     /**
-     * @brief Evaluates the proposal density of the second state component at time 1.
-     * @param x21 the second state component at time 1 you sampled. 
-     * @param y1 time 1 observation.
-     * @return a float_t evaluation of the density.
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
      */
-    virtual float_t logQ1Ev(const sssv &x21, const osv &y1) = 0;
-    
-    
-    //! Evaluates the state transition density for the second state component.
+    void setESSThreshold(const float_t &frac);
+
+
     /**
-     * @brief Evaluates the state transition density for the second state component.
-     * @param x2t the current second state component.
-     * @param x2tm1 the previous second state component.
-     * @return a float_t evaluation.
+     * @brief Returns the current number of particles.
+     * @return the number of particles
      */
-    virtual float_t logFEv(const sssv &x2t, const sssv &x2tm1) = 0;
-    
-    
-    //! Evaluates the proposal density at time t > 1.
+    size_t getNumParticles() const;
+
+
     /**
-     * @brief Evaluates the proposal density at time t > 1. 
-     * @param x2t the current second state component.
-     * @param x2tm1 the previous second state component.
-     * @param yt the current time series observation.
-     * @return a float_t evaluation.
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
      */
-    virtual float_t logQEv(const sssv &x2t, const sssv &x2tm1, const osv &yt) = 0;
+    void setNumParticles(const size_t &n);
     
     
-    //! How to update your inner Kalman filter object at each time.
+    //! Get the latest filtered expectation E[h(x_1t, x_2t) | y_{1:t}]
     /**
-     * @brief How to update your inner Kalman filter object at each time.
-     * @param kMod a Kalman filter object describing the conditional closed-form model.
-     * @param yt the current time series observation.
-     * @param x2t the current second state component.
+     * @brief Get the expectations you're keeping track of.
+     * @return a vector of Mats
      */
-    virtual void updateKalman(kalman<dimnss,dimy,0,float_t> &kMod, const osv &yt, const sssv &x2t) = 0;
-    
+    std::vector<Mat> getExpectations() const;
+
+
 private:
 
-    /** the resamplign schedule */
-    unsigned int m_rs;
     /** the array of inner Kalman filter objects */
     arrayMod m_p_innerMods;
     /** the array of particle samples */
@@ -792,155 +1346,148 @@ private:
     float_t m_lastLogCondLike; 
     /** resampler object */
     resamp_t m_resampler;
-    /** expectations */
-    std::vector<Mat> m_expectations;
+    /** normalizing, expectations and the resampling decision */
+    FilterCore<nparts, sssv, float_t> m_core;
+
+private:
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
 };
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_kalman(const unsigned int &resamp_sched)
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_kalman_bs_static(const unsigned int &resamp_sched, const size_t &num_parts)
     : m_now(0)
     , m_lastLogCondLike(0.0)
-    , m_rs(resamp_sched)
+    , m_p_innerMods(part_storage<typename arrayMod::value_type, nparts>::make(num_parts))
+    , m_p_samps(part_storage<sssv, nparts>::make(num_parts))
+    , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+    , m_core(resamp_sched, 1, num_parts)
 {
     std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_kalman() {}
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_kalman_bs_static() {}
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-void rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs)
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs)
 {
+    const size_t N = m_logUnNormWeights.size();
     
     if(m_now > 0)
     {
         
         // update
         sssv newX2Samp;
-        float_t m1(-1.0/0.0); // for updated weights
-        float_t m2 = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        float_t sumexpdenom(0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
-            newX2Samp = qSamp(m_p_samps[ii], data);
-            this->updateKalman(m_p_innerMods[ii], data, newX2Samp);
-
-            // before you update the weights
-            sumexpdenom += std::exp(m_logUnNormWeights[ii] - m2);
+        lse_partial<float_t> oldLSE;
+        oldLSE.add(m_logUnNormWeights.data(), N);
+        for(size_t ii = 0; ii < N; ++ii){
             
+            newX2Samp = derived().fSamp(m_p_samps[ii]);
+            derived().updateKalman(m_p_innerMods[ii], data, newX2Samp);
+
             // update the weights
-            m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike() + logFEv(newX2Samp, m_p_samps[ii]) - logQEv(newX2Samp, m_p_samps[ii], data);
+            m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike();
             
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
-                
             m_p_samps[ii] = newX2Samp;
         }
         
         // calc log p(y_t | y_{1:t-1})
-        float_t sumexpnumer(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexpnumer += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexpnumer) - m2 - std::log(sumexpdenom);
-        
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-
-        // resample (unnormalized weights ok)
-        if( (m_now+1)%m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-        
-        // update time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
     }
-    else //( m_now == 0) // first data point coming
+    else // ( m_now == 0) // first data point coming
     {
         // initialize and update the closed-form mods      
         nsssv tmpMean;
         nsssMat tmpVar;
-        float_t m1(-1.0/0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
-            m_p_samps[ii] = q1Samp(data); 
-            tmpMean = initKalmanMean(m_p_samps[ii]);
-            tmpVar  = initKalmanVar(m_p_samps[ii]);
-            m_p_innerMods[ii] = kalman<dimnss,dimy,1,float_t>(tmpMean, tmpVar);   // TODO: allow for input or check to make sure this doesn't break anything else
-            this->updateKalman(m_p_innerMods[ii], data, m_p_samps[ii]);
-
-            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike() + logMuEv(m_p_samps[ii]) - logQ1Ev(m_p_samps[ii], data);
-
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
+        for(size_t ii = 0; ii < N; ++ii){
+            m_p_samps[ii] = derived().muSamp(); 
+            tmpMean = derived().initKalmanMean(m_p_samps[ii]);
+            tmpVar  = derived().initKalmanVar(m_p_samps[ii]);
+            m_p_innerMods[ii] = kalman<dimnss,dimy,0,float_t>(tmpMean, tmpVar);
+            derived().updateKalman(m_p_innerMods[ii], data, m_p_samps[ii]);
+
+            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike();
+
         }
 
         // calculate log p(y1)
-        float_t sumexp(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexp += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexp) - std::log(static_cast<float_t>(nparts));  
-
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-        
-        // resample (unnormalized weights ok)
-        if( (m_now+1)%m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-            
-        // advance time step
-        m_now ++;
+        m_lastLogCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - std::log(static_cast<float_t>(N));
     }
 
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_p_innerMods[i].getFilterVec(), m_p_samps[i]); });
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time step
+    m_now ++;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-float_t rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
 {
     return m_lastLogCondLike;
 }
 
 
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-auto rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+float_t rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+auto rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+size_t rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::getNumParticles() const
 {
-    return m_expectations;
+    return m_logUnNormWeights.size();
 }
 
 
+template<typename Derived, size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
+void rbpf_kalman_bs_static<Derived, nparts,dimnss,dimss,dimy,resamp_t,float_t>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights, n);
+    }else{
+        part_storage<typename arrayMod::value_type, nparts>::resize(m_p_innerMods, n);
+        part_storage<sssv, nparts>::resize(m_p_samps, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+}
+
 
 //! Rao-Blackwellized/Marginal Bootstrap Filter with inner Kalman Filter objectss
 /**
@@ -948,80 +1495,62 @@ auto rbpf_kalman<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() c
  * @author t
  * @file rbpf.h
  * @brief Rao-Blackwellized/Marginal Bootstrap Filter with inner Kalman Filter objectss
- * @tparam nparts the number of particles
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimnss dimension of not-sampled-state vector
  * @tparam dimss dimension of sampled-state vector
  * @tparam dimy the dimension of the observations
  * @tparam resamp_t the resampler type
+ * 
+ * The model methods are pure virtual. rbpf_kalman_bs_static runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
  */
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-class rbpf_kalman_bs : public rbpf_base<float_t,dimss,dimnss,dimy>
+class rbpf_kalman_bs : public rbpf_kalman_bs_static<rbpf_kalman_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>
 {
-
 public:
 
+    /** the engine this class plugs its virtual methods into */
+    using base_t = rbpf_kalman_bs_static<rbpf_kalman_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>, nparts, dimnss, dimss, dimy, resamp_t, float_t>;
     /** "sampled state size vector" */
-    using sssv = Eigen::Matrix<float_t,dimss,1>;
+    using sssv = typename base_t::sssv;
     /** "not sampled state size vector" */
-    using nsssv = Eigen::Matrix<float_t,dimnss,1>;
+    using nsssv = typename base_t::nsssv;
     /** "observation size vector" */
-    using osv = Eigen::Matrix<float_t,dimy,1>;
-    /** dynamic size matrices */
-    using Mat = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    using osv = typename base_t::osv;
     /** "not sampled state size matrix" */
-    using nsssMat = Eigen::Matrix<float_t,dimnss,dimnss>;
+    using nsssMat = typename base_t::nsssMat;
+    /** Dynamic size matrix */
+    using Mat = typename base_t::Mat;
     /** array of model objects */
-    using arrayMod = std::array<kalman<dimnss,dimy,0,float_t>,nparts>;
+    using arrayMod = typename base_t::arrayMod;
     /** array of samples */
-    using arrayVec = std::array<sssv,nparts>;
+    using arrayVec = typename base_t::arrayVec;
     /** array of weights */
-    using arrayfloat_t = std::array<float_t,nparts>;
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+
 
-    //! The constructor.
     /**
-     \param resamp_sched how often you want to resample (e.g once every resamp_sched time points)
+     * @brief The constructor.
+     * @param resamp_sched how often to resample (e.g. once every resamp_sched time periods)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    rbpf_kalman_bs(const unsigned int &resamp_sched=1);
-    
-    
+    rbpf_kalman_bs(const unsigned int &resamp_sched=1, const size_t &num_parts=nparts);
+
+
     /**
-     * @brief The (virtual) destructor. 
+     * @brief The (virtual) destructor.
      */
     virtual ~rbpf_kalman_bs();
-    
-    
-    //! Filter! 
-    /**
-     * \brief The workhorse function
-     * \param data the most recent observable portion of the time series.
-     * \param fs a vector of functions computing E[h(x_1t, x_2t^i)| x_2t^i,y_1:t]. to be averaged to yield E[h(x_1t, x_2t)|,y_1:t]
-     */
-    void filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs
-                                     = std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >() );
 
-    //! Get the latest log conditional likelihood.
-    /**
-     * \return the latest log conditional likelihood.
-     */
-    float_t getLogCondLike() const; 
-    
-    
-    //! Get the latest filtered expectation E[h(x_1t, x_2t) | y_{1:t}]
-    /**
-     * @brief Get the expectations you're keeping track of.
-     * @return a vector of Mats
-     */
-    std::vector<Mat> getExpectations() const;
-    
-    
+
     //! Sample from the first time's proposal distribution.
     /**
      * @brief samples the second component of the state at time 1.
      * @return a sssv sample for x21.
      */
     virtual sssv muSamp() = 0;
-    
-    
+
+
     //! Provides the initial mean vector for each Kalman filter object.
     /**
      * @brief provides the initial mean vector for each Kalman filter object.
@@ -1029,8 +1558,8 @@ public:
      * @return a nsssv representing the unconditional mean.
      */
     virtual nsssv initKalmanMean(const sssv &x21) = 0;
-    
-    
+
+
     //! Provides the initial covariance matrix for each Kalman filter object.
     /**
      * @brief provides the initial covariance matrix for each Kalman filter object.
@@ -1038,8 +1567,8 @@ public:
      * @return a covariance matrix. 
      */
     virtual nsssMat initKalmanVar(const sssv &x21) = 0;
-    
-    
+
+
     //! Samples the time t second component. 
     /**
      * @brief Samples the time t second component.
@@ -1047,8 +1576,8 @@ public:
      * @return a sssv sample of the second state component at the current time.
      */
     virtual sssv fSamp(const sssv &x2tm1) = 0;
-    
-    
+
+
     //! How to update your inner Kalman filter object at each time.
     /**
      * @brief How to update your inner Kalman filter object at each time.
@@ -1057,171 +1586,18 @@ public:
      * @param x2t the current second state component.
      */
     virtual void updateKalman(kalman<dimnss, dimy,0,float_t> &kMod, const osv &yt, const sssv &x2t) = 0;
-    
-private:
-
-    /** the resamplign schedule */
-    unsigned int m_rs;
-    /** the array of inner Kalman filter objects */
-    arrayMod m_p_innerMods;
-    /** the array of particle samples */
-    arrayVec m_p_samps;
-    /** the array of the (log of) unnormalized weights */
-    arrayfloat_t m_logUnNormWeights;
-    /** the current time period */
-    unsigned int m_now;
-    /** log p(y_t|y_{1:t-1}) or log p(y1) */
-    float_t m_lastLogCondLike; 
-    /** resampler object */
-    resamp_t m_resampler;
-    /** expectations */
-    std::vector<Mat> m_expectations;
 };
 
 
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_kalman_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::rbpf_kalman_bs(const unsigned int &resamp_sched)
-    : m_now(0)
-    , m_lastLogCondLike(0.0)
-    , m_rs(resamp_sched)
-{
-    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
-}
-
-
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-rbpf_kalman_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::~rbpf_kalman_bs() {}
-
-
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-void rbpf_kalman_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::filter(const osv &data, const std::vector<std::function<const Mat(const nsssv &x1t, const sssv &x2t)> >& fs)
-{
-    
-    if(m_now > 0)
-    {
-        
-        // update
-        sssv newX2Samp;
-        float_t m1(-1.0/0.0); // for updated weights
-        float_t m2 = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        float_t sumexpdenom(0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
-            
-            newX2Samp = fSamp(m_p_samps[ii], data);
-            this->updateKalman(m_p_innerMods[ii], data, newX2Samp);
-
-            // before you update the weights
-            sumexpdenom += std::exp(m_logUnNormWeights[ii] - m2);
-            
-            // update the weights
-            m_logUnNormWeights[ii] += m_p_innerMods[ii].getLogCondLike();
-            
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
-                
-            m_p_samps[ii] = newX2Samp;
-        }
-        
-        // calc log p(y_t | y_{1:t-1})
-        float_t sumexpnumer(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexpnumer += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexpnumer) - m2 - std::log(sumexpdenom);
-        
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl]) * std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-
-        // resample (unnormalized weights ok)
-        if( (m_now+1)%m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-        
-        // update time step
-        m_now ++;
-    }
-    else // ( m_now == 0) // first data point coming
-    {
-        // initialize and update the closed-form mods      
-        nsssv tmpMean;
-        nsssMat tmpVar;
-        float_t m1(-1.0/0.0);
-        for(size_t ii = 0; ii < nparts; ++ii){
-            m_p_samps[ii] = muSamp(data); 
-            tmpMean = initKalmanMean(m_p_samps[ii]);
-            tmpVar  = initKalmanVar(m_p_samps[ii]);
-            m_p_innerMods[ii] = kalman<dimnss,dimy,1,float_t>(tmpMean, tmpVar);   // TODO: allow for input or check to make sure this doesn't break anything else
-            this->updateKalman(m_p_innerMods[ii], data, m_p_samps[ii]);
-
-            m_logUnNormWeights[ii] = m_p_innerMods[ii].getLogCondLike();
-
-            // update a max
-            if(m_logUnNormWeights[ii] > m1)
-                m1 = m_logUnNormWeights[ii];
-        }
-
-        // calculate log p(y1)
-        float_t sumexp(0.0);
-        for(size_t p = 0; p < nparts; ++p)
-            sumexp += std::exp(m_logUnNormWeights[p] - m1);
-        m_lastLogCondLike = m1 + std::log(sumexp) - std::log(static_cast<float_t>(nparts));  
-
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        //float_t m = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        for(auto & h : fs){
-
-            Mat testOutput = h(m_p_innerMods[0].getFilterVec(), m_p_samps[0]);
-            unsigned int rows = testOutput.rows();
-            unsigned int cols = testOutput.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_p_innerMods[prtcl].getFilterVec(), m_p_samps[prtcl])*std::exp(m_logUnNormWeights[prtcl] - m1);
-                denom += std::exp( m_logUnNormWeights[prtcl] - m1 );
-            }
-            m_expectations[fId] = numer/denom;
-            fId++;
-        }
-        
-        // resample (unnormalized weights ok)
-        if( (m_now+1)%m_rs == 0)
-            m_resampler.resampLogWts(m_p_innerMods, m_p_samps, m_logUnNormWeights);
-            
-        // advance time step
-        m_now ++;
-    }
-
-}
-
-
-template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-float_t rbpf_kalman_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getLogCondLike() const
+rbpf_kalman_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>::rbpf_kalman_bs(const unsigned int &resamp_sched, const size_t &num_parts)
+    : base_t(resamp_sched, num_parts)
 {
-    return m_lastLogCondLike;
 }
 
 
 template<size_t nparts, size_t dimnss, size_t dimss, size_t dimy, typename resamp_t, typename float_t>
-auto rbpf_kalman_bs<nparts,dimnss,dimss,dimy,resamp_t,float_t>::getExpectations() const -> std::vector<Mat>
-{
-    return m_expectations;
-}
+rbpf_kalman_bs<nparts, dimnss, dimss, dimy, resamp_t, float_t>::~rbpf_kalman_bs() {}
 
 
 #endif //RBPF_H
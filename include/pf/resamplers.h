@@ -1,13 +1,88 @@
 #ifndef RESAMPLERS_H
 #define RESAMPLERS_H
 
-#include <chrono>
+#include <algorithm> // min, sort
 #include <array>
 #include <random>
 #include <numeric> // accumulate, partial_sum
 #include <cmath> //floor
+#include <cstdint>
+#include <limits>
+#include <memory> // unique_ptr
+#include <stdexcept>
+#include <utility> // move, swap
+#include <vector>
 #include <Eigen/Dense>
 
+#include "part_storage.h"
+#include "rng.h" // fresh_seed, seed_stream
+#include "rv_samp.h" // alias_table
+#include "soa_particles.h"
+
+
+/**
+ * @brief reorders ancestor indexes (without changing which ones there are) so that every 
+ * particle that survives resampling keeps its own slot, i.e. ancestors[j] == j whenever j 
+ * appears at all. Doing it twice changes nothing.
+ * @param ancestors the indexes of the particles that survive resampling (one per particle)
+ */
+template<typename arrayInt>
+void permute_ancestors(arrayInt &ancestors)
+{
+    for(size_t i = 0; i < ancestors.size(); ++i){
+        // each swap puts some j into slot j for good
+        while(ancestors[i] != i && ancestors[ancestors[i]] != ancestors[i]){
+            unsigned int j = ancestors[i];
+            std::swap(ancestors[i], ancestors[j]);
+        }
+    }
+}
+
+
+/**
+ * @brief replaces particle i with old particle ancestors[i] for all i, in place. 
+ * The ancestors are reordered first (see permute_ancestors()), so particles that survive
+ * stay where they are and every other slot is written once. Nothing is copied into a 
+ * temporary array, which makes this cheap for heavy particles (e.g. closed-form models).
+ * @param parts the particles (anything indexable with size(), e.g. arrayVec or arrayMod)
+ * @param ancestors the indexes of the particles that survive resampling (reordered in place)
+ */
+template<typename array_t, typename arrayInt>
+void apply_ancestors(array_t &parts, arrayInt &ancestors)
+{
+    if(parts.size() != ancestors.size())
+        throw std::invalid_argument("error: apply_ancestors needs exactly one ancestor index per particle");
+
+    permute_ancestors(ancestors);
+    for(size_t i = 0; i < ancestors.size(); ++i){
+        if(ancestors[i] != i)
+            parts[i] = parts[ancestors[i]];
+    }
+}
+
+
+/**
+ * @brief sets to[i] to from[ancestors[i]] for all i. The children of each particle must sit
+ * next to each other in ancestors (sorted ancestors are), because the last one takes the
+ * particle by move assignment and only the others get copies.
+ * @param from the old particles (the ones that were moved from are left valid but unspecified)
+ * @param ancestors the indexes of the particles that survive resampling, grouped by ancestor
+ * @param to where the new particles go (it must already have one element per ancestor)
+ */
+template<typename array_t, typename arrayInt>
+void move_ancestors(array_t &from, const arrayInt &ancestors, array_t &to)
+{
+    if(to.size() != ancestors.size())
+        throw std::invalid_argument("error: move_ancestors needs exactly one ancestor index per new particle");
+
+    for(size_t i = 0; i < ancestors.size(); ++i){
+        if(i + 1 < ancestors.size() && ancestors[i+1] == ancestors[i])
+            to[i] = from[ancestors[i]];
+        else
+            to[i] = std::move(from[ancestors[i]]);
+    }
+}
+
 
 //! Base class for all resampler types.
 /**
@@ -17,11 +92,15 @@
  * @file resamplers.h
  * @brief all resamplers must inherit from this. 
  * This will enforce certain structure that are assumed by 
- * all particle filters.
- * @tparam nparts the number of particles.
+ * all particle filters. Resampling particles always goes the same way: draw the ancestors,
+ * gather the survivors, and reset the weights, so that is done here. A resampler only says how 
+ * it draws ancestors from normalized weights (normIndices()), and from log weights 
+ * (resampIndices()) if it can do better than normalizing them first.
+ * @tparam nparts the number of particles (or dynamic_parts).
  * @tparam dimx the dimension of each state sample.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
  */
-template<size_t nparts, size_t dimx, typename float_t >
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
 class rbase
 {
 public:
@@ -29,474 +108,1173 @@ public:
     /** type alias for linear algebra stuff */
     using ssv = Eigen::Matrix<float_t,dimx,1>;
     /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
+    using arrayVec = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
 
 
     /**
-     * @brief The default constructor gets called by default, and it sets the seed with the clock. 
+     * @brief The default constructor gets called by default, and it sets the seed with rvsamp::fresh_seed(). 
+     * It also allocates the scratch space.
      */
     rbase();
     
     /**
-     * @brief Function to resample from log unnormalized weights
-     * @param oldParts
-     * @param oldLogUnNormWts
+     * @brief resamples particles.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
      */
-    virtual void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts) = 0;
+    virtual void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0);
 
-protected:
 
-    /** @brief prng */
-    std::mt19937 m_gen;
+    /**
+     * @brief resamples particles stored as a structure of arrays.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    virtual void resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0);
 
-};
 
+    /**
+     * @brief resamples particles with weights that are already normalized (so nothing is exponentiated again).
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    virtual void resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0);
 
-template<size_t nparts, size_t dimx, typename float_t>
-rbase<nparts, dimx, float_t>::rbase() 
-        : m_gen{static_cast<std::uint32_t>(
-                    std::chrono::high_resolution_clock::now().time_since_epoch().count()
-                                           )}
-{
-}
 
+    /**
+     * @brief resamples particles stored as a structure of arrays with weights that are already normalized.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    virtual void resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0);
 
-/**
- * @class mn_resampler
- * @author taylor
- * @date 15/04/18
- * @file resamplers.h
- * @brief Class that performs multinomial resampling for "standard" models.
- * @tparam nparts the number of particles.
- * @tparam dimx the dimension of each state sample.
- */
-template<size_t nparts, size_t dimx, typename float_t>
-class mn_resampler : private rbase<nparts, dimx, float_t>
-{
-public:
 
-    /** type alias for linear algebra stuff */
-    using ssv = Eigen::Matrix<float_t,dimx,1>;
-    /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
-    /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
-    /** type alias for array of integers */
-    using arrayInt = std::array<unsigned int,nparts>;
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * Unless a resampler overrides it, this normalizes the weights and calls normIndices().
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    virtual void resampIndices(const arrayFloat &logWts, arrayInt &ancestors);
+
 
     /**
-     * @brief Default constructor. Only option available.
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     * @param seed the new seed
      */
-    mn_resampler() = default;
-    
-    
+    void setSeed(std::uint32_t seed);
+
+
     /**
-     * @brief resamples particles.
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
+     * @brief Re-seeds the prng with one of several streams for the same seed (see rvsamp::seed_stream()).
+     * @param seed the new seed
+     * @param stream the stream id
      */
-    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
-    
-};
+    void setSeed(std::uint64_t seed, std::uint64_t stream);
 
+protected:
 
-template<size_t nparts, size_t dimx, typename float_t>
-void mn_resampler<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
-{
-    // these log weights may be very negative. If that's the case, exponentiating them may cause underflow
-    // so we use the "log-exp-sum" trick
-    // actually not quite...we just shift the log-weights because after they're exponentiated
-    // they have the same normalized probabilities
-       
-    // Create the distribution with exponentiated log-weights
-    arrayFloat w;
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(), 
-                    [&m](float_t& d) -> float_t { return std::exp( d - m ); } );
-    std::discrete_distribution<> idxSampler(w.begin(), w.end());
-    
-    // create temporary particle vector and weight vector
-    arrayVec tmpPartics = oldParts; 
-    
-    // sample from the original parts and store in tmpParts
-    unsigned int whichPart;
-    for(size_t part = 0; part < nparts; ++part)
-    {
-        whichPart = idxSampler(this->m_gen);
-        tmpPartics[part] = oldParts[whichPart];
-    }
-        
-    //overwrite olds with news
-    oldParts = std::move(tmpPartics);
-    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0); // change back    
-}
+    /** @brief prng */
+    rng_t m_gen;
 
 
+    /**
+     * @brief draws the indexes of the particles that survive resampling (every resampler supplies this)
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    virtual void normIndices(const arrayFloat &normWts, arrayInt &ancestors) = 0;
 
-/**
- * @class mn_resampler_rbpf
- * @author taylor
- * @file resamplers.h
- * @brief Class that performs multinomial resampling for RBPFs.
- * @tparam nparts the number of particles.
- * @tparam dimsampledx the dimension of each state sample.
- * @tparam cfModT the type of closed form model
- * @tparam float_t the type of floating point number
- */
-template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t>
-class mn_resampler_rbpf
-{
-public:
 
-    /** type alias for linear algebra stuff */
-    using ssv = Eigen::Matrix<float_t,dimsampledx,1>;
-    /** type alias for linear algebra stuff */
-    using arrayVec = std::array<ssv, nparts>;
-    /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
-    /** type alias for array of closed-form models */
-    using arrayMod = std::array<cfModT,nparts>;
+    /**
+     * @brief whether the new particles have to come out in the order their ancestors were drawn
+     * (the default is no, so gather() can work in place)
+     * @return true if gather() has to keep the order
+     */
+    virtual bool keepsOrder() const;
+
 
     /**
-     * @brief Default constructor. Only option available.
+     * @brief replaces particle i with old particle ancestors[i] for all i. If the number of 
+     * particles doesn't change, only the slots whose particles die are overwritten (see 
+     * apply_ancestors()), so the new particles are not sorted by ancestor. Otherwise, or if 
+     * keepsOrder(), they are copied into a back buffer, which then trades places with parts
+     * (for a fixed nparts it is copied back).
+     * @param parts the particles
+     * @param ancestors the indexes of the particles that survive resampling (they may be reordered)
      */
-    mn_resampler_rbpf();
-    
-    
+    void gather(arrayVec &parts, arrayInt &ancestors);
+
+
     /**
-     * @brief resamples particles.
-     * @param oldMods the old closed-form models
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
+     * @brief replaces particle i with old particle ancestors[i] for all i, in the same order as the other gather()
+     * @param parts the particles
+     * @param ancestors the indexes of the particles that survive resampling (they may be reordered)
      */
-    void resampLogWts(arrayMod &oldMods, arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
-    
+    void gather(soaParts &parts, arrayInt &ancestors);
+
+
+    /**
+     * @brief exponentiates log weights (after subtracting their max) and normalizes them
+     * @param logWts the log unnormalized weights
+     * @return the normalized weights (valid until the next call)
+     */
+    const arrayFloat &normalize(const arrayFloat &logWts);
+
+
+    /**
+     * @brief scratch space for ancestor indexes
+     * @param n how many indexes are needed
+     * @return the indexes (valid until the next call)
+     */
+    arrayInt &ancestorBuffer(size_t n);
+
 private:
 
-    /** @brief prng */
-    std::mt19937 m_gen;
+    // the scratch space lives on the heap, so it doesn't make the filters that own
+    // a resampler any bigger (for a fixed nparts the first two are std::arrays)
+
+    /** @brief scratch space for normalize() */
+    std::unique_ptr<arrayFloat> m_normWts;
+
+    /** @brief scratch space for ancestorBuffer() */
+    std::unique_ptr<arrayInt> m_ancestors;
+
+    /** @brief the back buffer for gather() (only used when it can't work in place) */
+    part_array<ssv, dynamic_parts> m_backBuffer;
 
 };
 
 
-template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t>
-mn_resampler_rbpf<nparts, dimsampledx, cfModT,float_t>::mn_resampler_rbpf() 
-    : m_gen{static_cast<std::uint32_t>(
-                    std::chrono::high_resolution_clock::now().time_since_epoch().count()
-                                           )}
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+rbase<nparts, dimx, float_t, rng_t>::rbase() 
+        : m_gen(rvsamp::fresh_seed())
+        , m_normWts(std::make_unique<arrayFloat>())
+        , m_ancestors(std::make_unique<arrayInt>())
 {
 }
 
 
-template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t>
-void mn_resampler_rbpf<nparts, dimsampledx, cfModT,float_t>::resampLogWts(arrayMod &oldMods, arrayVec &oldSamps, arrayFloat &oldLogUnNormWts) 
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::setSeed(std::uint32_t seed)
 {
-    // Create the distribution with exponentiated log-weights
-    arrayFloat w;
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(), 
-                    [&m](float_t& d) -> float_t { return std::exp( d - m ); } );
-    std::discrete_distribution<> idxSampler(w.begin(), w.end());
-    
-    // create temporary vectors for samps and mods
-    arrayVec tmpSamps;
-    arrayMod tmpMods;
-    
-    // sample from the original parts and store in temporary
-    unsigned int whichPart;
-    for(size_t part = 0; part < nparts; ++part)
-    {
-        whichPart = idxSampler(m_gen);
-        tmpSamps[part] = oldSamps[whichPart];
-        tmpMods[part] = oldMods[whichPart];
-    }
-    
-    //overwrite olds with news
-    oldMods = std::move(tmpMods);
-    oldSamps = std::move(tmpSamps);
+    m_gen.seed(seed);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::setSeed(std::uint64_t seed, std::uint64_t stream)
+{
+    rvsamp::seed_stream(m_gen, seed, stream);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : oldLogUnNormWts.size());
+    resampIndices(oldLogUnNormWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
     std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
+
 
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : oldLogUnNormWts.size());
+    resampIndices(oldLogUnNormWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
 }
 
 
-/**
- * @class resid_resampler
- * @author taylor
- * @date 10/25/19
- * @file resamplers.h
- * @brief Class that performs residual resampling on "standard" models.
- * @tparam nparts the number of particles.
- * @tparam dimx the dimension of each state sample.
- * @tparam float_t the floating point for samples
- */
-template<size_t nparts, size_t dimx, typename float_t>
-class resid_resampler : private rbase<nparts, dimx, float_t>
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
 {
-public:
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : normWts.size());
+    normIndices(normWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
 
-    /** type alias for linear algebra stuff */
-    using ssv = Eigen::Matrix<float_t,dimx,1>;
-    /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
-    /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
-    /** type alias for array of integers */
-    using arrayInt = std::array<unsigned int, nparts>;
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : normWts.size());
+    normIndices(normWts, ancestors);
+    gather(oldParts, ancestors);
+    part_storage<float_t, nparts>::resize(oldLogUnNormWts, ancestors.size());
+    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);
+}
 
 
-    /**
-     * @brief Default constructor. Only option available.
-     */
-    resid_resampler() = default;
-    
-    
-    /**
-     * @brief resamples particles.
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
-     */
-    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
-    
-};
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    normIndices(normalize(logWts), ancestors);
+}
 
 
-template<size_t nparts, size_t dimx, typename float_t>
-void resid_resampler<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+bool rbase<nparts, dimx, float_t, rng_t>::keepsOrder() const
 {
+    return false;
+}
 
-    // calculate normalized weights
-    arrayFloat w; 
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(), 
-                    [&m](const float_t& d) -> float_t { return std::exp( d - m ); } );
-    float_t norm_const (0.0);
-    norm_const = std::accumulate(w.begin(), w.end(), norm_const);
-    for( auto& weight : w)
-        weight = weight/norm_const;
 
-    // calc unNormWBars and numRandomSamples (N-R using IIHMM notation)
-    size_t i;
-    arrayFloat unNormWBar;
-    float_t numRandomSamples(0.0);
-    for(i = 0; i < nparts; ++i) {
-        unNormWBar[i] = w[i]*nparts - std::floor(w[i]*nparts);
-        numRandomSamples += unNormWBar[i];
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::gather(arrayVec &parts, arrayInt &ancestors)
+{
+    if(ancestors.size() == parts.size() && !keepsOrder()){
+        apply_ancestors(parts, ancestors);
+        return;
     }
 
-    // make multinomial distribution for residuals
-    std::discrete_distribution<> idxSampler(unNormWBar.begin(), unNormWBar.end());
+    m_backBuffer.resize(ancestors.size());
+    for(size_t i = 0; i < ancestors.size(); ++i)
+        m_backBuffer[i] = parts[ancestors[i]];
+    if constexpr(nparts == dynamic_parts)
+        parts.swap(m_backBuffer);
+    else
+        std::copy(m_backBuffer.begin(), m_backBuffer.end(), parts.begin());
+}
 
-    // start resampling by producing a count vector
-    arrayInt sampleCounts;
-    for(i = 0; i < nparts; ++i) {
-        sampleCounts[i] = static_cast<unsigned int>(std::floor(nparts*w[i])); // initial
-    }
-    for(i = 0; i < static_cast<unsigned int>(numRandomSamples); ++i) {
-        sampleCounts[idxSampler(this->m_gen)]++;
-    }
-    
-    // now resample the particles using the counts 
-    arrayVec tmpPartics;
-    unsigned int c(0);
-    for(i = 0; i < nparts; ++i) { // over count container
-        unsigned int num_replicants = sampleCounts[i];
-        if( num_replicants > 0) {
-            for(size_t j = 0; j < num_replicants; ++j) { // assign the same thing several times
-                tmpPartics[c] = oldParts[i];
-                c++;
-            }
-        }
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void rbase<nparts, dimx, float_t, rng_t>::gather(soaParts &parts, arrayInt &ancestors)
+{
+    if(ancestors.size() == parts.size() && !keepsOrder())
+        permute_ancestors(ancestors);
+    parts.gather(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+auto rbase<nparts, dimx, float_t, rng_t>::normalize(const arrayFloat &logWts) -> const arrayFloat&
+{
+    arrayFloat &normWts = *m_normWts;
+    part_storage<float_t, nparts>::resize(normWts, logWts.size());
+    float_t m = *std::max_element(logWts.begin(), logWts.end());
+    float_t normConst(0.0);
+    for(size_t i = 0; i < logWts.size(); ++i){
+        normWts[i] = std::exp(logWts[i] - m);
+        normConst += normWts[i];
     }
+    for(auto &weight : normWts)
+        weight /= normConst;
+    return normWts;
+}
 
-    //overwrite olds with news
-    oldParts = std::move(tmpPartics);
-    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0); // change back    
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+auto rbase<nparts, dimx, float_t, rng_t>::ancestorBuffer(size_t n) -> arrayInt&
+{
+    part_storage<unsigned int, nparts>::resize(*m_ancestors, n);
+    return *m_ancestors;
 }
 
 
 /**
- * @class stratif_resampler
+ * @class mn_resampler
  * @author taylor
- * @date 10/25/19
+ * @date 15/04/18
  * @file resamplers.h
- * @brief Class that performs stratified resampling on "standard" models.
- * @tparam nparts the number of particles.
+ * @brief Class that performs multinomial resampling for "standard" models.
+ * @tparam nparts the number of particles (or dynamic_parts).
  * @tparam dimx the dimension of each state sample.
- * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
  */
-template<size_t nparts, size_t dimx, typename float_t>
-class stratif_resampler : private rbase<nparts, dimx, float_t>
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class mn_resampler : private rbase<nparts, dimx, float_t, rng_t>
 {
 public:
 
     /** type alias for linear algebra stuff */
     using ssv = Eigen::Matrix<float_t,dimx,1>;
     /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
+    using arrayVec = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
+    using arrayFloat = part_array<float_t, nparts>;
     /** type alias for array of integers */
-    using arrayInt = std::array<unsigned int, nparts>;
-
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
 
     /**
      * @brief Default constructor. Only option available.
      */
-    stratif_resampler() = default;
+    mn_resampler() = default;
     
     
     /**
-     * @brief resamples particles.
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
      */
-    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
     
-};
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
 
 
-template<size_t nparts, size_t dimx, typename float_t>
-void stratif_resampler<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
-{
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
 
-    // calculate normalized weights
-    arrayFloat w; 
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(), 
-                    [&m](const float_t& d) -> float_t { return std::exp( d - m ); } );
-    float_t norm_const (0.0);
-    norm_const = std::accumulate(w.begin(), w.end(), norm_const);
-    for( auto& weight : w)
-        weight = weight/norm_const;
 
-    // calculate the cumulative sums of the weights
-    // TODO: possible bug
-    arrayFloat cumsums;
-    std::partial_sum(w.begin(), w.end(), cumsums.begin());
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
 
-    // samplethe Uis
-    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0/nparts);
-    arrayFloat u_samples;
-    for(size_t i = 0; i < nparts; ++i) {
-        u_samples[i] = i/nparts + u_sampler(this->m_gen);
-    }
+private:
 
-    // resample
-    arrayVec tmpPartics;
-    for(size_t i = 0; i < nparts; ++i){ // tmpPartics, Uis
-
-        // find which index
-        unsigned int idx;
-        for(unsigned int j = 0; j < nparts; ++j){
-            
-            // get the first time it gets covered by a cumsum
-            if(cumsums[j] >= u_samples[i]){ 
-                idx = j;
-                break;
-            }   
-        }
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+    
+};
 
-        // assign
-        tmpPartics[i] = oldParts[idx];
-    }
 
-    //overwrite olds with news
-    oldParts = std::move(tmpPartics);
-    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0); // change back    
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // Create the distribution with the (already normalized) weights
+    std::discrete_distribution<> idxSampler(w.begin(), w.end());
+    
+    // sample the indexes of the original parts
+    for(size_t part = 0; part < ancestors.size(); ++part)
+        ancestors[part] = idxSampler(this->m_gen);
 }
 
 
+
 /**
- * @class systematic_resampler
- * @author taylor
- * @date 10/25/19
+ * @class mn_alias_resampler
+ * @author t
  * @file resamplers.h
- * @brief Class that performs systematic resampling on "standard" models.
- * @tparam nparts the number of particles.
+ * @brief Multinomial resampling for "standard" models that draws from an alias table.
+ * The table is rebuilt in place every time, so resampling the same number of
+ * particles does not allocate anything for the weights, and each ancestor is drawn in constant time.
+ * The ancestors come out in a different order than mn_resampler's (with the same distribution).
+ * @tparam nparts the number of particles (or dynamic_parts).
  * @tparam dimx the dimension of each state sample.
  * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
  */
-template<size_t nparts, size_t dimx, typename float_t>
-class systematic_resampler : private rbase<nparts, dimx, float_t>
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class mn_alias_resampler : private rbase<nparts, dimx, float_t, rng_t>
 {
 public:
 
     /** type alias for linear algebra stuff */
     using ssv = Eigen::Matrix<float_t,dimx,1>;
     /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
+    using arrayVec = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
+    using arrayFloat = part_array<float_t, nparts>;
     /** type alias for array of integers */
-    using arrayInt = std::array<unsigned int, nparts>;
-
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
 
     /**
      * @brief Default constructor. Only option available.
      */
-    systematic_resampler() = default;
+    mn_alias_resampler() = default;
     
     
     /**
-     * @brief resamples particles.
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
      */
-    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
     
-};
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
 
 
-template<size_t nparts, size_t dimx, typename float_t>
-void systematic_resampler<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
-{
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
 
-    // calculate normalized weights
-    arrayFloat w; 
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), w.begin(), 
-                    [&m](const float_t& d) -> float_t { return std::exp( d - m ); } );
-    float_t norm_const (0.0);
-    norm_const = std::accumulate(w.begin(), w.end(), norm_const);
-    for( auto& weight : w)
-        weight = weight/norm_const;
 
-    // calculate the cumulative sums of the weights
-    arrayFloat cumsums;
-    std::partial_sum(w.begin(), w.end(), cumsums.begin());
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * The log weights go straight into the table, so they are never normalized.
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors) override;
 
-    // samplethe Uis
-    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0/nparts);
-    arrayFloat u_samples;
-    u_samples[0] = u_sampler(this->m_gen);
-    for(size_t i = 1; i < nparts; ++i) {
-        u_samples[i] = u_samples[i-1] + 1.0/nparts;
-    }
+private:
 
-    // resample (same code from here on as stratified)
-    arrayVec tmpPartics;
-    for(size_t i = 0; i < nparts; ++i){ // tmpPartics, Uis
-
-        // find which index
-        unsigned int idx;
-        for(unsigned int j = 0; j < nparts; ++j){
-            
-            // get the first time it gets covered by a cumsum
-            if(cumsums[j] >= u_samples[i]){ 
-                idx = j;
-                break;
-            }   
+    /** @brief the alias table (rebuilt for every resampling) */
+    rvsamp::alias_table<float_t> m_table;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param normWts the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &normWts, arrayInt &ancestors) override;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling from the current table
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void calcAncestors(arrayInt &ancestors);
+    
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_alias_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    // the table exponentiates (after subtracting the max) on its own
+    m_table.setLogWeights(logWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_alias_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &normWts, arrayInt &ancestors)
+{
+    m_table.setWeights(normWts);
+    calcAncestors(ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_alias_resampler<nparts, dimx, float_t, rng_t>::calcAncestors(arrayInt &ancestors)
+{
+    for(size_t part = 0; part < ancestors.size(); ++part)
+        ancestors[part] = m_table.draw(this->m_gen);
+}
+
+
+
+//! Base class for the RBPF resamplers.
+/**
+ * @class rbpf_rbase
+ * @author t
+ * @file resamplers.h
+ * @brief holds what the RBPF resamplers share: the prng, the scratch buffers, and moving
+ * the samples and closed-form models around once the ancestors are drawn. A resampler only
+ * says how it draws ancestors from exponentiated weights (normIndices()).
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimsampledx the dimension of each state sample.
+ * @tparam cfModT the type of closed form model
+ * @tparam float_t the type of floating point number
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t = std::mt19937>
+class rbpf_rbase
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimsampledx,1>;
+    /** type alias for linear algebra stuff */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of closed-form models */
+    using arrayMod = part_array<cfModT, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+
+    /**
+     * @brief The default constructor sets the seed with rvsamp::fresh_seed() and allocates the scratch space.
+     */
+    rbpf_rbase();
+
+
+    /**
+     * @brief resamples particles.
+     * @param oldMods the old closed-form models
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampLogWts(arrayMod &oldMods, arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0);
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (so nothing is exponentiated again).
+     * @param oldMods the old closed-form models
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampNormWts(arrayMod &oldMods, arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0);
+
+
+    /**
+     * @brief draws ancestor indexes without touching any models or samples (see apply_ancestors()).
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayFloat &logWts, arrayInt &ancestors);
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     * @param seed the new seed
+     */
+    void setSeed(std::uint32_t seed);
+
+
+    /**
+     * @brief Re-seeds the prng with one of several streams for the same seed (see rvsamp::seed_stream()).
+     * @param seed the new seed
+     * @param stream the stream id
+     */
+    void setSeed(std::uint64_t seed, std::uint64_t stream);
+
+protected:
+
+    /** @brief prng */
+    rng_t m_gen;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling (every resampler supplies this)
+     * @param w the weights (they don't have to be normalized)
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    virtual void normIndices(const arrayFloat &w, arrayInt &ancestors) = 0;
+
+
+    /**
+     * @brief scratch space for ancestor indexes
+     * @param n how many indexes are needed
+     * @return the indexes (valid until the next call)
+     */
+    arrayInt &ancestorBuffer(size_t n);
+
+
+    /**
+     * @brief exponentiates log weights (after subtracting their max)
+     * @param logWts the log unnormalized weights
+     * @return the unnormalized weights (valid until the next call)
+     */
+    const arrayFloat &expWts(const arrayFloat &logWts);
+
+
+    /**
+     * @brief replaces model and sample i with old model and sample ancestors[i] for all i, 
+     * and resets the log weights. When the number of particles stays the same, only the slots
+     * whose particles die get overwritten (see apply_ancestors()). Otherwise nparts is 
+     * dynamic_parts, and the back buffers are filled with move_ancestors() and swapped in.
+     * @param mods the closed-form models
+     * @param samps the samples
+     * @param logWts the log unnormalized weights
+     * @param ancestors the indexes of the particles that survive resampling (reordered in place)
+     */
+    void gather(arrayMod &mods, arrayVec &samps, arrayFloat &logWts, arrayInt &ancestors);
+
+private:
+
+    // the scratch space lives on the heap (see rbase)
+
+    /** @brief scratch space for expWts() */
+    std::unique_ptr<arrayFloat> m_wts;
+
+    /** @brief scratch space for ancestorBuffer() */
+    std::unique_ptr<arrayInt> m_ancestors;
+
+    /** @brief back buffer for the samples (only used when the number of particles changes, so it stays empty for a fixed nparts) */
+    part_array<ssv, dynamic_parts> m_tmpSamps;
+
+    /** @brief back buffer for the models (only used when the number of particles changes, so it stays empty for a fixed nparts) */
+    part_array<cfModT, dynamic_parts> m_tmpMods;
+};
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::rbpf_rbase()
+    : m_gen(rvsamp::fresh_seed())
+    , m_wts(std::make_unique<arrayFloat>())
+    , m_ancestors(std::make_unique<arrayInt>())
+{
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::setSeed(std::uint32_t seed)
+{
+    m_gen.seed(seed);
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::setSeed(std::uint64_t seed, std::uint64_t stream)
+{
+    rvsamp::seed_stream(m_gen, seed, stream);
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampLogWts(arrayMod &oldMods, arrayVec &oldSamps, arrayFloat &oldLogUnNormWts, size_t numOut) 
+{
+    // exponentiate the log-weights (the samplers don't need them normalized)
+    resampNormWts(oldMods, oldSamps, oldLogUnNormWts, expWts(oldLogUnNormWts), numOut);
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampNormWts(arrayMod &oldMods, arrayVec &oldSamps, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut) 
+{
+    arrayInt &ancestors = ancestorBuffer(numOut ? numOut : normWts.size());
+    normIndices(normWts, ancestors);
+    gather(oldMods, oldSamps, oldLogUnNormWts, ancestors);
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampIndices(const arrayFloat &logWts, arrayInt &ancestors)
+{
+    normIndices(expWts(logWts), ancestors);
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+auto rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::ancestorBuffer(size_t n) -> arrayInt&
+{
+    part_storage<unsigned int, nparts>::resize(*m_ancestors, n);
+    return *m_ancestors;
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+auto rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::expWts(const arrayFloat &logWts) -> const arrayFloat&
+{
+    arrayFloat &wts = *m_wts;
+    part_storage<float_t, nparts>::resize(wts, logWts.size());
+    float_t m = *std::max_element(logWts.begin(), logWts.end());
+    for(size_t i = 0; i < logWts.size(); ++i)
+        wts[i] = std::exp(logWts[i] - m);
+    return wts;
+}
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::gather(arrayMod &mods, arrayVec &samps, arrayFloat &logWts, arrayInt &ancestors)
+{
+    if(ancestors.size() == samps.size()){
+
+        // models are expensive to copy, so only overwrite the ones that die
+        apply_ancestors(mods, ancestors);
+        apply_ancestors(samps, ancestors);
+    }else if constexpr(nparts == dynamic_parts){
+
+        // the number of particles changes, so fill the back buffers and swap
+        if(!std::is_sorted(ancestors.begin(), ancestors.end()))
+            std::sort(ancestors.begin(), ancestors.end());
+        m_tmpSamps.resize(ancestors.size());
+        m_tmpMods.resize(ancestors.size());
+        move_ancestors(samps, ancestors, m_tmpSamps);
+        move_ancestors(mods, ancestors, m_tmpMods);
+        std::swap(mods, m_tmpMods);
+        std::swap(samps, m_tmpSamps);
+    }
+
+    part_storage<float_t, nparts>::resize(logWts, ancestors.size());
+    std::fill(logWts.begin(), logWts.end(), 0.0);
+}
+
+
+/**
+ * @class mn_resampler_rbpf
+ * @author taylor
+ * @file resamplers.h
+ * @brief Class that performs multinomial resampling for RBPFs.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimsampledx the dimension of each state sample.
+ * @tparam cfModT the type of closed form model
+ * @tparam float_t the type of floating point number
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t = std::mt19937>
+class mn_resampler_rbpf : private rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimsampledx,1>;
+    /** type alias for linear algebra stuff */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of closed-form models */
+    using arrayMod = part_array<cfModT, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    mn_resampler_rbpf() = default;
+    
+    
+    /**
+     * @brief resamples particles (see rbpf_rbase::resampLogWts()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbpf_rbase::resampNormWts()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any models or samples (see rbpf_rbase::resampIndices()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampIndices;
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::setSeed;
+    
+private:
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the weights (they don't have to be normalized)
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+
+};
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void mn_resampler_rbpf<nparts, dimsampledx, cfModT, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    std::discrete_distribution<> idxSampler(w.begin(), w.end());
+    for(size_t part = 0; part < ancestors.size(); ++part)
+        ancestors[part] = idxSampler(this->m_gen);
+}
+
+
+/**
+ * @class sys_resampler_rbpf
+ * @author t
+ * @file resamplers.h
+ * @brief Class that performs systematic resampling for RBPFs. The ancestors come out sorted
+ * from one uniform draw and a single pass over the weights, instead of a binary search per 
+ * particle. Surviving models stay in their slots, so only the particles that die get a copy,
+ * and when the number of particles changes, each ancestor's last child takes its model by move.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimsampledx the dimension of each state sample.
+ * @tparam cfModT the type of closed form model
+ * @tparam float_t the type of floating point number
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t = std::mt19937>
+class sys_resampler_rbpf : private rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimsampledx,1>;
+    /** type alias for linear algebra stuff */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of closed-form models */
+    using arrayMod = part_array<cfModT, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    sys_resampler_rbpf() = default;
+    
+    
+    /**
+     * @brief resamples particles (see rbpf_rbase::resampLogWts()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbpf_rbase::resampNormWts()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any models or samples (see rbpf_rbase::resampIndices()).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::resampIndices;
+
+
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbpf_rbase<nparts, dimsampledx, cfModT, float_t, rng_t>::setSeed;
+    
+private:
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the weights (they don't have to be normalized)
+     * @param ancestors where the indexes are written, in increasing order
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+
+};
+
+
+template<size_t nparts, size_t dimsampledx, typename cfModT, typename float_t, typename rng_t>
+void sys_resampler_rbpf<nparts, dimsampledx, cfModT, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // one uniform offset, then a merge walk over the cumulative weights
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    const float_t total = std::accumulate(w.begin(), w.end(), float_t(0.0));
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    const float_t u0 = u_sampler(this->m_gen);
+    float_t cumsum = w[0];
+    size_t j = 0;
+    for(size_t i = 0; i < numOut; ++i){
+        float_t u = total * (i + u0) / numOut;
+        while(cumsum < u && j + 1 < numIn)
+            cumsum += w[++j];
+        ancestors[i] = j;
+    }
+}
+
+
+/**
+ * @class resid_resampler
+ * @author taylor
+ * @date 10/25/19
+ * @file resamplers.h
+ * @brief Class that performs residual resampling on "standard" models.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class resid_resampler : private rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    resid_resampler() = default;
+    
+    
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
+
+private:
+
+    /** @brief scratch space for the leftover (fractional) parts of N times the weights (on the heap for any nparts) */
+    part_array<float_t, dynamic_parts> m_residuals;
+
+    /** @brief scratch space for the number of children of each particle (on the heap for any nparts) */
+    part_array<unsigned int, dynamic_parts> m_counts;
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+    
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void resid_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // calc unNormWBars and numRandomSamples (N-R using IIHMM notation)
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    size_t i;
+    m_residuals.resize(numIn);
+    m_counts.resize(numIn);
+    auto &unNormWBar = m_residuals;
+    auto &sampleCounts = m_counts;
+    size_t numDeterministic(0);
+    for(i = 0; i < numIn; ++i) {
+        sampleCounts[i] = static_cast<unsigned int>(std::floor(numOut*w[i])); // initial
+        unNormWBar[i] = w[i]*numOut - sampleCounts[i];
+        numDeterministic += sampleCounts[i];
+    }
+    const size_t numRandomSamples = numOut > numDeterministic ? numOut - numDeterministic : 0;
+
+    // make multinomial distribution for residuals
+    std::discrete_distribution<> idxSampler(unNormWBar.begin(), unNormWBar.end());
+
+    // finish the count vector (the residuals sum to numRandomSamples, but counting 
+    // the deterministic children exactly keeps rounding from leaving slots empty)
+    for(i = 0; i < numRandomSamples; ++i) {
+        sampleCounts[idxSampler(this->m_gen)]++;
+    }
+    
+    // now turn the counts into indexes
+    unsigned int c(0);
+    for(i = 0; i < numIn; ++i) { // over count container
+        unsigned int num_replicants = sampleCounts[i];
+        if( num_replicants > 0) {
+            for(size_t j = 0; j < num_replicants && c < numOut; ++j) { // assign the same thing several times
+                ancestors[c] = i;
+                c++;
+            }
         }
+    }
+}
+
+
+/**
+ * @class stratif_resampler
+ * @author taylor
+ * @date 10/25/19
+ * @file resamplers.h
+ * @brief Class that performs stratified resampling on "standard" models.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class stratif_resampler : private rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    stratif_resampler() = default;
+    
+    
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
+
+private:
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+    
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void stratif_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // U_i = (i + u_i)/numOut is increasing in i, so one walk along 
+    // the cumulative sums of the weights finds every ancestor: O(numIn + numOut)
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    float_t cumsum = w[0];
+    size_t j = 0;
+    for(size_t i = 0; i < numOut; ++i){
+
+        // the first index whose cumulative sum covers U_i
+        // (stays on the last one if rounding leaves the total below 1)
+        float_t u = (i + u_sampler(this->m_gen)) / numOut;
+        while(cumsum < u && j + 1 < numIn)
+            cumsum += w[++j];
+        ancestors[i] = j;
+    }
+}
+
+
+/**
+ * @class systematic_resampler
+ * @author taylor
+ * @date 10/25/19
+ * @file resamplers.h
+ * @brief Class that performs systematic resampling on "standard" models.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class systematic_resampler : private rbase<nparts, dimx, float_t, rng_t>
+{
+public:
 
-        // assign
-        tmpPartics[i] = oldParts[idx];
-    }
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    systematic_resampler() = default;
+    
+    
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
+
+private:
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+    
+};
 
-    //overwrite olds with news
-    oldParts = std::move(tmpPartics);
-    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0); // change back    
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void systematic_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // same walk as the stratified resampler, except that 
+    // all the U_i = (i + u)/numOut share one uniform
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    const float_t u0 = u_sampler(this->m_gen);
+    float_t cumsum = w[0];
+    size_t j = 0;
+    for(size_t i = 0; i < numOut; ++i){
+        float_t u = (i + u0) / numOut;
+        while(cumsum < u && j + 1 < numIn)
+            cumsum += w[++j];
+        ancestors[i] = j;
+    }
 }
 
 
@@ -506,22 +1284,25 @@ void systematic_resampler<nparts, dimx, float_t>::resampLogWts(arrayVec &oldPart
  * @file resamplers.h
  * @brief Class that performs multinomial resampling for "standard" models. 
  * For justification, see page 244 of "Inference in Hidden Markov Models"
- * @tparam nparts the number of particles.
+ * @tparam nparts the number of particles (or dynamic_parts).
  * @tparam dimx the dimension of each state sample.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
  */
-template<size_t nparts, size_t dimx, typename float_t>
-class mn_resamp_fast1 : private rbase<nparts, dimx, float_t>
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class mn_resamp_fast1 : private rbase<nparts, dimx, float_t, rng_t>
 {
 public:
 
     /** type alias for linear algebra stuff */
     using ssv = Eigen::Matrix<float_t,dimx,1>;
     /** type alias for array of Eigen Matrices */
-    using arrayVec = std::array<ssv, nparts>;
+    using arrayVec = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayFloat = std::array<float_t,nparts>;
+    using arrayFloat = part_array<float_t, nparts>;
     /** type alias for array of integers */
-    using arrayInt = std::array<unsigned int,nparts>;
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
 
     /**
      * @brief Default constructor. Only option available.
@@ -530,30 +1311,49 @@ public:
     
     
     /**
-     * @brief resamples particles.
-     * @param oldParts the old particles
-     * @param oldLogUnNormWts the old log unnormalized weights
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
+
+private:
+
+    /** @brief scratch space for the exponential spacings (on the heap for any nparts) */
+    part_array<float_t, dynamic_parts> m_exponentials;
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
      */
-    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts);
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
     
 };
 
 
-template<size_t nparts, size_t dimx, typename float_t>
-void mn_resamp_fast1<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts)
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_resamp_fast1<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
 {
-    // these log weights may be very negative. If that's the case, exponentiating them may cause underflow
-    // so we use the "log-exp-sum" trick
-    // actually not quite...we just shift the log-weights because after they're exponentiated
-    // they have the same normalized probabilities
-       
-    // Also, we're using a fancier algorthm detailed on page 244 of IHMM 
-
-    // Create unnormalized weights
-    arrayFloat unnorm_weights;
-    float_t m = *std::max_element(oldLogUnNormWts.begin(), oldLogUnNormWts.end());
-    std::transform(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), unnorm_weights.begin(), 
-                    [&m](float_t& d) -> float_t { return std::exp( d - m ); } );
+    // we're using a fancier algorthm detailed on page 244 of IHMM 
+    // (w is normalized already, but summing it again guards against rounding)
+    const arrayFloat &unnorm_weights = w;
     
     // get a uniform rv sampler
     std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
@@ -563,40 +1363,462 @@ void mn_resamp_fast1<nparts, dimx, float_t>::resampLogWts(arrayVec &oldParts, ar
     // 2.) generate all these exponentials to help with getting order statistics
     // NB: you never need to store E_{N+1}! (this is subtle)
     float_t weight_norm_const(0.0);
-    arrayFloat exponentials;
-    float_t G(0.0);
-    for(size_t i = 0; i < nparts; ++i) {
+    for(size_t i = 0; i < unnorm_weights.size(); ++i)
         weight_norm_const += unnorm_weights[i];
+    const size_t numOut = ancestors.size();
+    m_exponentials.resize(numOut);
+    auto &exponentials = m_exponentials;
+    float_t G(0.0);
+    for(size_t i = 0; i < numOut; ++i) {
         exponentials[i] = -std::log(u_sampler(this->m_gen));   
         G += exponentials[i];
     }
-    G+= std::log(u_sampler(this->m_gen)); // E_{N+1}
+    G -= std::log(u_sampler(this->m_gen)); // E_{N+1}
 
     // see Fig 7.15 in IHMM on page 243
-    arrayVec tmpPartics = oldParts;                // the new particles 
+    // the order statistics only go up, so the last index picked already satisfies 
+    // \sum_{j=1}^{I-1} \omega^j < U_{(i)}, and only the upper bound has to be checked
+    // (the last index also catches order statistics that rounding leaves above the total)
     float_t uniform_order_stat(0.0);               // U_{(i)} in the notation of IHMM
     float_t running_sum_normalized_weights(unnorm_weights[0]/weight_norm_const); // \sum_{j=1}^I \omega^j in the notation of IHMM
-    float_t one_less_summand(0.0);                 // \sum_{j=1}^{I-1} \omega^j 
     unsigned int idx = 0;
-    for(size_t i = 0; i < nparts; ++i){
+    const unsigned int lastIdx = unnorm_weights.size() - 1;
+    for(size_t i = 0; i < numOut; ++i){
         uniform_order_stat += exponentials[i]/G; // add a spacing E_i/G
-        do {
-            if( one_less_summand < uniform_order_stat <= running_sum_normalized_weights ) {
-                // select index idx
-                tmpPartics[i] = oldParts[idx];
-                break;
-            }else{
-                // increment idx because it will never be chosen (all the other order statistics are even higher) 
-                idx++;
-                running_sum_normalized_weights += unnorm_weights[idx]/weight_norm_const;
-                one_less_summand += unnorm_weights[idx-1]/weight_norm_const;
-            }
-        }while(true);
+        while(uniform_order_stat > running_sum_normalized_weights && idx < lastIdx){
+            // increment idx because it will never be chosen (all the other order statistics are even higher) 
+            idx++;
+            running_sum_normalized_weights += unnorm_weights[idx]/weight_norm_const;
+        }
+        ancestors[i] = idx;
+    }
+
+}
+
+/**
+ * @class mn_sorted_resampler
+ * @author t
+ * @file resamplers.h
+ * @brief Multinomial resampling for "standard" models that draws the uniforms in sorted order 
+ * and then finds all of their ancestors in one linear walk over the weights.
+ * The uniforms are bucket sorted (one bucket per uniform), which takes O(N) expected time
+ * and no transcendental functions, unlike generating the order statistics from exponential spacings.
+ * The ancestors come out sorted, and the scratch space is kept between calls.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class mn_sorted_resampler : private rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    mn_sorted_resampler() = default;
+    
+    
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles (see rbase::resampLogWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampLogWts;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (see rbase::resampNormWts()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampNormWts;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see rbase::resampIndices()).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::resampIndices;
+
+private:
+
+    /** @brief the uniforms, in the order they were drawn */
+    std::vector<float_t> m_unifs;
+
+    /** @brief the uniforms, sorted */
+    std::vector<float_t> m_sorted;
+
+    /** @brief where each bucket of uniforms ends (and then starts) in m_sorted */
+    std::vector<unsigned int> m_buckets;
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void mn_sorted_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    m_unifs.resize(numOut);
+    m_sorted.resize(numOut);
+    m_buckets.assign(numOut, 0);
+
+    // draw the uniforms and count how many land in each of the numOut buckets
+    auto bucketOf = [numOut](float_t u) { return std::min(static_cast<size_t>(u * numOut), numOut - 1); };
+    for(size_t i = 0; i < numOut; ++i)
+        m_unifs[i] = u_sampler(this->m_gen);
+    for(size_t i = 0; i < numOut; ++i)
+        m_buckets[bucketOf(m_unifs[i])]++;
+
+    // scatter them into their buckets (afterwards m_buckets holds where each one starts)
+    std::partial_sum(m_buckets.begin(), m_buckets.end(), m_buckets.begin());
+    for(size_t i = numOut; i-- > 0; )
+        m_sorted[--m_buckets[bucketOf(m_unifs[i])]] = m_unifs[i];
+
+    // only uniforms in the same bucket can be out of order, and there is about one per bucket,
+    // so insertion sort finishes in linear expected time
+    for(size_t i = 1; i < numOut; ++i){
+        float_t u = m_sorted[i];
+        size_t k = i;
+        for(; k > 0 && m_sorted[k-1] > u; --k)
+            m_sorted[k] = m_sorted[k-1];
+        m_sorted[k] = u;
+    }
+
+    // merge the sorted uniforms with the cumulative weights
+    float_t cumsum = w[0];
+    size_t j = 0;
+    for(size_t i = 0; i < numOut; ++i){
+        while(cumsum < m_sorted[i] && j + 1 < numIn)
+            cumsum += w[++j];
+        ancestors[i] = j;
+    }
+}
+
+
+/**
+ * @class hilbert_resampler
+ * @author t
+ * @file resamplers.h
+ * @brief Systematic resampling along a Hilbert curve through the states (Gerber, Chopin and 
+ * Whiteley, 2019). The particles are sorted by where their states fall on the curve, and then one
+ * systematic pass is run over the weights in that order. Particles that are close on the curve are
+ * close in the state space, so the resampled cloud follows the weighted one more closely than it
+ * would in an arbitrary order. The only randomness is one uniform offset, and it keeps the 
+ * likelihood estimates unbiased. Meant for low dimensional states: each coordinate gets 64/dimx 
+ * bits (16 at most), and only the first 64 coordinates are used.
+ * @tparam nparts the number of particles (or dynamic_parts).
+ * @tparam dimx the dimension of each state sample.
+ * @tparam float_t the floating point for samples
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
+ */
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t = std::mt19937>
+class hilbert_resampler : private rbase<nparts, dimx, float_t, rng_t>
+{
+public:
+
+    /** type alias for linear algebra stuff */
+    using ssv = Eigen::Matrix<float_t,dimx,1>;
+    /** type alias for array of Eigen Matrices */
+    using arrayVec = part_array<ssv, nparts>;
+    /** type alias for array of float_ts */
+    using arrayFloat = part_array<float_t, nparts>;
+    /** type alias for array of integers */
+    using arrayInt = part_array<unsigned int, nparts>;
+    /** type alias for structure-of-arrays particle storage */
+    using soaParts = soa_particles<nparts, dimx, float_t>;
+
+    /**
+     * @brief Default constructor. Only option available.
+     */
+    hilbert_resampler() = default;
+    
+    
+    /**
+     * @brief Re-seeds the prng (e.g. for reproducible runs).
+     */
+    using rbase<nparts, dimx, float_t, rng_t>::setSeed;
+    
+    
+    /**
+     * @brief resamples particles.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0) override;
+
+
+    /**
+     * @brief resamples particles stored as a structure of arrays.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut = 0) override;
+
+
+    /**
+     * @brief resamples particles with weights that are already normalized (so nothing is exponentiated again).
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0) override;
+
+
+    /**
+     * @brief resamples particles stored as a structure of arrays with weights that are already normalized.
+     * @param oldParts the old particles
+     * @param oldLogUnNormWts the old log unnormalized weights (these only get reset)
+     * @param normWts the normalized weights (they must sum to 1)
+     * @param numOut how many particles to draw (0 keeps the current number; anything else needs dynamic_parts)
+     */
+    void resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut = 0) override;
+
+
+    /**
+     * @brief draws ancestor indexes without touching any particles (see apply_ancestors()).
+     * Unlike the other resamplers, this one has to see the states.
+     * @param parts the particles
+     * @param logWts the log unnormalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void resampIndices(const arrayVec &parts, const arrayFloat &logWts, arrayInt &ancestors);
+
+private:
+
+    /** @brief how many coordinates go into the sort */
+    static constexpr size_t m_sortDims = dimx < 64 ? dimx : 64;
+
+    /** @brief how many bits each coordinate gets (a 2^16 grid per axis is already far finer than the particle cloud) */
+    static constexpr unsigned int m_bits = m_sortDims > 4 ? 64 / m_sortDims : 16;
+
+    /** @brief type alias for a point on the (2^m_bits)^m_sortDims grid */
+    using gridPoint = std::array<std::uint32_t, m_sortDims>;
+
+    /** @brief (position on the curve, particle index) for every particle, sorted */
+    std::vector<std::pair<std::uint64_t, unsigned int>> m_order;
+
+
+    /**
+     * @brief sorts the particles along the curve (into m_order)
+     * @param n the number of particles
+     * @param coord a callable taking (i, d) that returns coordinate d of particle i
+     */
+    template<typename coord_t>
+    void sortAlongCurve(size_t n, coord_t &&coord);
+
+
+    /**
+     * @brief sorts the particles along the curve
+     * @param parts the particles
+     */
+    void sortAlongCurve(const arrayVec &parts);
+
+
+    /**
+     * @brief sorts the particles stored as a structure of arrays along the curve
+     * @param parts the particles
+     */
+    void sortAlongCurve(const soaParts &parts);
+
+
+    /**
+     * @brief draws the indexes of the particles that survive resampling (systematic, in m_order)
+     * @param w the normalized weights
+     * @param ancestors where the indexes are written (one is drawn for every element)
+     */
+    void normIndices(const arrayFloat &w, arrayInt &ancestors) override;
+
+
+    /**
+     * @brief the children come out in curve order, so neighbours stay close in memory
+     * @return true
+     */
+    bool keepsOrder() const override;
+
+
+    /**
+     * @brief the position of a grid point along the Hilbert curve (Skilling, 2004)
+     * @param X the grid point (overwritten)
+     * @return the position (m_sortDims * m_bits bits long)
+     */
+    static std::uint64_t hilbertKey(gridPoint &X);
+
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::resampLogWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    sortAlongCurve(oldParts);
+    rbase<nparts, dimx, float_t, rng_t>::resampLogWts(oldParts, oldLogUnNormWts, numOut);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::resampLogWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, size_t numOut)
+{
+    sortAlongCurve(oldParts);
+    rbase<nparts, dimx, float_t, rng_t>::resampLogWts(oldParts, oldLogUnNormWts, numOut);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::resampNormWts(arrayVec &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
+{
+    sortAlongCurve(oldParts);
+    rbase<nparts, dimx, float_t, rng_t>::resampNormWts(oldParts, oldLogUnNormWts, normWts, numOut);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::resampNormWts(soaParts &oldParts, arrayFloat &oldLogUnNormWts, const arrayFloat &normWts, size_t numOut)
+{
+    sortAlongCurve(oldParts);
+    rbase<nparts, dimx, float_t, rng_t>::resampNormWts(oldParts, oldLogUnNormWts, normWts, numOut);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::resampIndices(const arrayVec &parts, const arrayFloat &logWts, arrayInt &ancestors)
+{
+    sortAlongCurve(parts);
+    rbase<nparts, dimx, float_t, rng_t>::resampIndices(logWts, ancestors);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::sortAlongCurve(const arrayVec &parts)
+{
+    sortAlongCurve(parts.size(), [&](size_t i, size_t d) { return parts[i](d); });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::sortAlongCurve(const soaParts &parts)
+{
+    const auto states = parts.map();
+    sortAlongCurve(parts.size(), [&](size_t i, size_t d) { return states(d, i); });
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+template<typename coord_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::sortAlongCurve(size_t n, coord_t &&coord)
+{
+    // the bounding box of the states
+    std::array<float_t, m_sortDims> lo, hi;
+    lo.fill(std::numeric_limits<float_t>::infinity());
+    hi.fill(-std::numeric_limits<float_t>::infinity());
+    for(size_t i = 0; i < n; ++i){
+        for(size_t d = 0; d < m_sortDims; ++d){
+            lo[d] = std::min(lo[d], coord(i, d));
+            hi[d] = std::max(hi[d], coord(i, d));
+        }
+    }
+
+    // put every state on the grid and find its place on the curve
+    const double maxCell = static_cast<double>((std::uint64_t(1) << m_bits) - 1);
+    std::array<double, m_sortDims> scale;
+    for(size_t d = 0; d < m_sortDims; ++d)
+        scale[d] = hi[d] > lo[d] ? maxCell / (hi[d] - lo[d]) : 0.0;
+    m_order.resize(n);
+    gridPoint X;
+    for(size_t i = 0; i < n; ++i){
+        for(size_t d = 0; d < m_sortDims; ++d)
+            X[d] = static_cast<std::uint32_t>(std::min(maxCell, (coord(i, d) - lo[d]) * scale[d]));
+        m_order[i] = {hilbertKey(X), static_cast<unsigned int>(i)};
     }
+    std::sort(m_order.begin(), m_order.end());
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+bool hilbert_resampler<nparts, dimx, float_t, rng_t>::keepsOrder() const
+{
+    return true;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+void hilbert_resampler<nparts, dimx, float_t, rng_t>::normIndices(const arrayFloat &w, arrayInt &ancestors)
+{
+    // the systematic merge walk, with the particles taken in curve order
+    const size_t numIn = w.size();
+    const size_t numOut = ancestors.size();
+    std::uniform_real_distribution<float_t> u_sampler(0.0, 1.0);
+    const float_t u0 = u_sampler(this->m_gen);
+    float_t cumsum = w[m_order[0].second];
+    size_t j = 0;
+    for(size_t i = 0; i < numOut; ++i){
+        float_t u = (i + u0) / numOut;
+        while(cumsum < u && j + 1 < numIn)
+            cumsum += w[m_order[++j].second];
+        ancestors[i] = m_order[j].second;
+    }
+}
+
 
-    //overwrite olds with news
-    oldParts = std::move(tmpPartics);
-    std::fill(oldLogUnNormWts.begin(), oldLogUnNormWts.end(), 0.0);  
+template<size_t nparts, size_t dimx, typename float_t, typename rng_t>
+std::uint64_t hilbert_resampler<nparts, dimx, float_t, rng_t>::hilbertKey(gridPoint &X)
+{
+    // turn the coordinates into the "transposed" Hilbert index: if bit Q of X[d] is set, invert the
+    // low bits of X[0], otherwise swap them with X[d]'s. The bits are close to random, so this
+    // is done with masks rather than branches.
+    const std::uint32_t M = std::uint32_t(1) << (m_bits - 1);
+    std::uint32_t x0 = X[0];
+    for(std::uint32_t Q = M; Q > 1; Q >>= 1){
+        const std::uint32_t P = Q - 1;
+        x0 ^= P & -static_cast<std::uint32_t>((x0 & Q) != 0);
+        for(size_t d = 1; d < m_sortDims; ++d){
+            const std::uint32_t inv = -static_cast<std::uint32_t>((X[d] & Q) != 0);
+            const std::uint32_t t = (x0 ^ X[d]) & P & ~inv;
+            x0 ^= (P & inv) | t;
+            X[d] ^= t;
+        }
+    }
+    X[0] = x0;
+    for(size_t d = 1; d < m_sortDims; ++d)
+        X[d] ^= X[d-1];
+    std::uint32_t t = 0;
+    for(std::uint32_t Q = M; Q > 1; Q >>= 1)
+        t ^= (Q - 1) & -static_cast<std::uint32_t>((X[m_sortDims-1] & Q) != 0);
+    for(size_t d = 0; d < m_sortDims; ++d)
+        X[d] ^= t;
+
+    // then interleave the bits, most significant first
+    std::uint64_t key = 0;
+    for(int b = m_bits - 1; b >= 0; --b)
+        for(size_t d = 0; d < m_sortDims; ++d)
+            key = (key << 1) | ((X[d] >> b) & 1);
+    return key;
 }
 
+
 #endif // RESAMPLERS_H
@@ -0,0 +1,255 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <random>
+
+namespace rvsamp{
+
+
+/**
+ * @brief a seed for objects that weren't given one. It mixes the clock with a process-wide
+ * call count, so two objects built in the same clock tick still get different seeds.
+ * @return a 64 bit seed
+ */
+inline std::uint64_t fresh_seed()
+{
+    static std::atomic<std::uint64_t> calls{0};
+    std::uint64_t z = static_cast<std::uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    z += 0x9E3779B97F4A7C15ull * (calls.fetch_add(1, std::memory_order_relaxed) + 1);
+
+    // splitmix64's finalizer, so that nearby inputs give unrelated seeds
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+//! A counter-based random number generator.
+/**
+ * @class philox4x32
+ * @author t
+ * @file rng.h
+ * @brief Philox4x32-10 (Salmon, Moraes, Dror and Shaw, 2011). Every output block is a fixed
+ * function of a 64 bit key (the seed), a 64 bit stream id and a 64 bit block counter, so
+ * (seed, stream) pairs give independent substreams, and jumping ahead is O(1). The whole state
+ * is 44 bytes. It satisfies UniformRandomBitGenerator, so it works with the <random>
+ * distributions, and every sampler and resampler takes it as its rng_t.
+ */
+class philox4x32
+{
+public:
+
+    /** the type of the numbers it returns */
+    using result_type = std::uint32_t;
+
+    /** the seed used when none is given (the same one as the reference implementation's tests) */
+    static constexpr std::uint64_t default_seed = 20111115u;
+
+    /**
+     * @brief the smallest possible output
+     * @return 0
+     */
+    static constexpr result_type min() { return 0; }
+
+    /**
+     * @brief the largest possible output
+     * @return 2^32 - 1
+     */
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+
+    /**
+     * @brief constructs the generator at the start of a substream
+     * @param seed the key
+     * @param stream which substream of that key
+     */
+    explicit philox4x32(std::uint64_t seed = default_seed, std::uint64_t stream = 0);
+
+
+    /**
+     * @brief goes back to the start of a substream
+     * @param seed the key
+     * @param stream which substream of that key
+     */
+    void seed(std::uint64_t seed = default_seed, std::uint64_t stream = 0);
+
+
+    /**
+     * @brief the next number in the stream
+     * @return 32 random bits
+     */
+    result_type operator()();
+
+
+    /**
+     * @brief skips ahead without computing the numbers in between
+     * @param z how many numbers to skip
+     */
+    void discard(unsigned long long z);
+
+
+    /**
+     * @brief another stream with the same key
+     * @param stream which substream
+     * @return a generator at the start of that substream
+     */
+    philox4x32 substream(std::uint64_t stream) const;
+
+
+    /**
+     * @brief the Philox4x32-10 bijection
+     * @param ctr the counter
+     * @param key the key
+     * @return four random 32 bit words
+     */
+    static std::array<std::uint32_t, 4> block(std::array<std::uint32_t, 4> ctr, std::array<std::uint32_t, 2> key);
+
+
+    /**
+     * @brief two generators are equal if they will produce the same numbers from now on
+     */
+    friend bool operator==(const philox4x32 &a, const philox4x32 &b)
+    {
+        return a.m_key == b.m_key && a.position() == b.position() && a.m_ctr[2] == b.m_ctr[2] && a.m_ctr[3] == b.m_ctr[3];
+    }
+
+    /**
+     * @brief the opposite of operator==
+     */
+    friend bool operator!=(const philox4x32 &a, const philox4x32 &b) { return !(a == b); }
+
+private:
+
+    /** @brief the key (the seed) */
+    std::array<std::uint32_t, 2> m_key;
+
+    /** @brief the next block to compute (words 0 and 1) and the stream id (words 2 and 3) */
+    std::array<std::uint32_t, 4> m_ctr;
+
+    /** @brief the most recent block */
+    std::array<std::uint32_t, 4> m_out;
+
+    /** @brief the next word of m_out to hand out (4 once it's used up) */
+    unsigned int m_next;
+
+
+    /**
+     * @brief how many numbers have been handed out since the start of the stream
+     */
+    std::uint64_t position() const;
+
+
+    /**
+     * @brief sets the block counter
+     * @param b the next block to compute
+     */
+    void setBlock(std::uint64_t b);
+};
+
+
+inline philox4x32::philox4x32(std::uint64_t seed, std::uint64_t stream)
+{
+    this->seed(seed, stream);
+}
+
+
+inline void philox4x32::seed(std::uint64_t seed, std::uint64_t stream)
+{
+    m_key = {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)};
+    m_ctr = {0, 0, static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+    m_out = {0, 0, 0, 0};
+    m_next = 4;
+}
+
+
+inline auto philox4x32::operator()() -> result_type
+{
+    if(m_next == 4){
+        m_out = block(m_ctr, m_key);
+        setBlock((static_cast<std::uint64_t>(m_ctr[1]) << 32 | m_ctr[0]) + 1);
+        m_next = 0;
+    }
+    return m_out[m_next++];
+}
+
+
+inline void philox4x32::discard(unsigned long long z)
+{
+    const std::uint64_t pos = position() + z;
+    setBlock(pos / 4);
+    m_next = 4;
+    if(pos % 4 != 0){
+        operator()();
+        m_next = pos % 4;
+    }
+}
+
+
+inline philox4x32 philox4x32::substream(std::uint64_t stream) const
+{
+    return philox4x32(static_cast<std::uint64_t>(m_key[1]) << 32 | m_key[0], stream);
+}
+
+
+inline std::array<std::uint32_t, 4> philox4x32::block(std::array<std::uint32_t, 4> ctr, std::array<std::uint32_t, 2> key)
+{
+    for(int round = 0; round < 10; ++round){
+        const std::uint64_t p0 = static_cast<std::uint64_t>(0xD2511F53u) * ctr[0];
+        const std::uint64_t p1 = static_cast<std::uint64_t>(0xCD9E8D57u) * ctr[2];
+        ctr = {static_cast<std::uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0], static_cast<std::uint32_t>(p1),
+               static_cast<std::uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1], static_cast<std::uint32_t>(p0)};
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+    return ctr;
+}
+
+
+inline std::uint64_t philox4x32::position() const
+{
+    return 4*(static_cast<std::uint64_t>(m_ctr[1]) << 32 | m_ctr[0]) - (4 - m_next);
+}
+
+
+inline void philox4x32::setBlock(std::uint64_t b)
+{
+    m_ctr[0] = static_cast<std::uint32_t>(b);
+    m_ctr[1] = static_cast<std::uint32_t>(b >> 32);
+}
+
+
+/**
+ * @brief seeds any standard engine with a (seed, stream) pair, by running both through a std::seed_seq
+ * @param gen the generator
+ * @param seed the seed
+ * @param stream the stream id
+ */
+template<typename rng_t>
+void seed_stream(rng_t &gen, std::uint64_t seed, std::uint64_t stream)
+{
+    std::seed_seq seq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                      static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+    gen.seed(seq);
+}
+
+
+/**
+ * @brief seeds a philox4x32 with a (seed, stream) pair, which picks out an exact substream
+ * @param gen the generator
+ * @param seed the key
+ * @param stream the stream id
+ */
+inline void seed_stream(philox4x32 &gen, std::uint64_t seed, std::uint64_t stream)
+{
+    gen.seed(seed, stream);
+}
+
+
+} // namespace rvsamp
+
+#endif // RNG_H
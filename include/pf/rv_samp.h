@@ -1,9 +1,19 @@
 #ifndef RV_SAMP_H
 #define RV_SAMP_H
 
-#include <chrono>
-#include <Eigen/Dense> //linear algebra stuff
+#include <algorithm> // max_element, transform
+#include <array>
+#include <cstdint>
+#include <cmath>
+#include <numeric> // accumulate
 #include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <Eigen/Dense> //linear algebra stuff
+
+#include "part_storage.h"
+#include "rng.h"
 
 namespace rvsamp{
 
@@ -14,27 +24,109 @@ namespace rvsamp{
  * @author taylor
  * @file rv_samp.h
  * @brief all rv samplers must inherit from this. 
- * @tparam dim the dimension of each random vector sample.
+ * @tparam rng_t the random number generator (std::mt19937, philox4x32, or any other UniformRandomBitGenerator with seed())
  */
+template<typename rng_t = std::mt19937>
 class rvsamp_base
 {
 public:
 
     /**
-     * @brief The default constructor. This is the only option available. Sets the seed with the clock. 
+     * @brief The default constructor. This is the only option available. Sets the seed with fresh_seed(), 
+     * so samplers built back to back still get different streams.
+     */
+    inline rvsamp_base() : m_rng(fresh_seed()) {}
+
+
+    /**
+     * @brief Re-seeds the prng. Handy for giving each worker thread its own reproducible stream.
+     * @param seed the new seed.
+     */
+    inline void setSeed(std::uint32_t seed) { m_rng.seed(seed); }
+
+
+    /**
+     * @brief Re-seeds the prng with one of several streams for the same seed (see seed_stream()).
+     * With philox4x32 the streams are exactly independent.
+     * @param seed the new seed.
+     * @param stream the stream id (e.g. a thread or particle index).
      */
-    inline rvsamp_base() : 
-        m_rng{static_cast<std::uint32_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count())} 
-    {}
+    inline void setSeed(std::uint64_t seed, std::uint64_t stream) { seed_stream(m_rng, seed, stream); }
 
 protected:
 
     /** @brief prng */
-    std::mt19937 m_rng;
+    rng_t m_rng;
 
 };
 
 
+/**
+ * @brief fills an array with standard normal random variates, many at a time.
+ * It uses Box-Muller on blocks of 128: the uniforms are drawn first, and then the log, the square root,
+ * and polynomial sines and cosines on [-pi/4, pi/4] all run as vectorized Eigen array expressions.
+ * The quarter turn is picked with spare random bits.
+ * Its stream is not the same as std::normal_distribution's, and it needs a generator whose
+ * outputs are full 32 or 64 bit words (std::mt19937, std::mt19937_64, philox4x32).
+ * @tparam float_t float or double
+ * @param out where the draws go
+ * @param n how many draws
+ * @param gen the random number generator
+ */
+template<typename float_t, typename rng_t>
+void fill_std_normal(float_t *out, size_t n, rng_t &gen)
+{
+    static_assert(rng_t::min() == 0 && (rng_t::max() == 0xFFFFFFFFull || rng_t::max() == ~0ull),
+                  "fill_std_normal needs a generator with full 32 or 64 bit outputs");
+    constexpr bool wide = rng_t::max() == ~0ull; // not result_type, which is 64 bits for std::mt19937 on some platforms
+
+    constexpr int half = 64;
+    using block = Eigen::Array<float_t, half, 1>;
+    block u, x, swap, sign1, sign2;
+    std::array<float_t, 2*half> tail;
+
+    for(size_t i = 0; i < n; i += 2*half){
+
+        // u in (0,1) decides the radius, x in (-1/2, 1/2) the angle inside a quarter turn,
+        // and three more bits pick the quarter turn
+        for(int j = 0; j < half; ++j){
+            std::uint32_t bits;
+            if constexpr(std::is_same_v<float_t, float>){
+                u[j] = (static_cast<float_t>(static_cast<std::uint32_t>(gen())) + float_t(.5)) * float_t(2.3283064365386963e-10);
+                bits = static_cast<std::uint32_t>(gen());
+            }else if constexpr(wide){
+                u[j] = (static_cast<float_t>(static_cast<std::uint64_t>(gen()) >> 11) + float_t(.5)) * float_t(1.1102230246251565e-16);
+                bits = static_cast<std::uint32_t>(gen());
+            }else{
+                const std::uint64_t hi = static_cast<std::uint32_t>(gen());
+                u[j] = (static_cast<float_t>((hi << 32 | static_cast<std::uint32_t>(gen())) >> 11) + float_t(.5)) * float_t(1.1102230246251565e-16);
+                bits = static_cast<std::uint32_t>(gen());
+            }
+            x[j] = (static_cast<float_t>(bits >> 3) + float_t(.5)) * float_t(1.862645149230957e-09) - float_t(.5);
+            swap[j] = static_cast<float_t>(bits & 1u);
+            sign1[j] = float_t(1) - float_t(2)*static_cast<float_t>((bits >> 1) & 1u);
+            sign2[j] = float_t(1) - float_t(2)*static_cast<float_t>((bits >> 2) & 1u);
+        }
+
+        const block r = (float_t(-2)*u.log()).sqrt();
+        x *= float_t(1.5707963267948966);
+        const block x2 = x*x;
+        const block s = x*(1 + x2*(float_t(-1./6) + x2*(float_t(1./120) + x2*(float_t(-1./5040) + x2*(float_t(1./362880)
+                        + x2*(float_t(-1./39916800) + x2*(float_t(1./6227020800.) + x2*float_t(-1./1307674368000.))))))));
+        const block c = 1 + x2*(float_t(-.5) + x2*(float_t(1./24) + x2*(float_t(-1./720) + x2*(float_t(1./40320)
+                        + x2*(float_t(-1./3628800) + x2*(float_t(1./479001600) + x2*(float_t(-1./87178291200.)
+                        + x2*float_t(1./20922789888000.))))))));
+
+        float_t *dst = (n - i >= 2*half) ? out + i : tail.data();
+        Eigen::Map<block> first(dst), second(dst + half);
+        first = sign1*r*(swap*s + (1 - swap)*c);
+        second = sign2*r*(swap*c + (1 - swap)*s);
+        if(dst == tail.data())
+            std::copy(tail.begin(), tail.begin() + (n - i), out + i);
+    }
+}
+
+
 
 //! A class that performs sampling from a univariate Normal distribution.
 /**
@@ -42,9 +134,10 @@ protected:
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Normal distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class UnivNormSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class UnivNormSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -83,13 +176,32 @@ public:
       * @return a random sample of type float_t.
       */
     float_t sample();    
-    
+
+
+    /**
+     * @brief Draws many random numbers at once with fill_std_normal(), which is about twice as cheap per draw as sample().
+     * @param out where the samples go.
+     * @param n how many samples.
+     */
+    void fill(float_t *out, size_t n);
+
+
+    /**
+     * @brief Draws one random number for each of n (mean, std. dev.) pairs, with fill_std_normal().
+     * The sampler's own mean and standard deviation are ignored.
+     * @param mu the n means.
+     * @param sigma the n standard deviations.
+     * @param out where the n samples go (may be the same array as mu or sigma).
+     * @param n how many samples.
+     */
+    void sample(const float_t *mu, const float_t *sigma, float_t *out, size_t n);
+
 
 private:
 
     /** @brief makes normal random variates */
     std::normal_distribution<float_t> m_z_gen;
-    
+
     /** @brief the mean */
     float_t m_mu;
     
@@ -99,9 +211,9 @@ private:
 };
 
 
-template<typename float_t>
-UnivNormSampler<float_t>::UnivNormSampler()
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivNormSampler<float_t, rng_t>::UnivNormSampler()
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
 {
     setMean(0.0);
@@ -109,9 +221,9 @@ UnivNormSampler<float_t>::UnivNormSampler()
 }
 
 
-template<typename float_t>
-UnivNormSampler<float_t>::UnivNormSampler(float_t mu, float_t sigma)
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivNormSampler<float_t, rng_t>::UnivNormSampler(float_t mu, float_t sigma)
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
 {
     setMean(mu); 
@@ -119,24 +231,46 @@ UnivNormSampler<float_t>::UnivNormSampler(float_t mu, float_t sigma)
 }
 
 
-template<typename float_t>
-void UnivNormSampler<float_t>::setMean(float_t mu)
+template<typename float_t, typename rng_t>
+void UnivNormSampler<float_t, rng_t>::setMean(float_t mu)
 {
     m_mu = mu;
 }
 
 
-template<typename float_t>
-void UnivNormSampler<float_t>::setStdDev(float_t sigma)
+template<typename float_t, typename rng_t>
+void UnivNormSampler<float_t, rng_t>::setStdDev(float_t sigma)
 {
     m_sigma = sigma;
 }
 
 
-template<typename float_t>
-float_t UnivNormSampler<float_t>::sample()
+template<typename float_t, typename rng_t>
+float_t UnivNormSampler<float_t, rng_t>::sample()
+{
+    return m_mu + m_sigma * m_z_gen(this->m_rng);
+}
+
+
+template<typename float_t, typename rng_t>
+void UnivNormSampler<float_t, rng_t>::fill(float_t *out, size_t n)
 {
-    return m_mu + m_sigma * m_z_gen(m_rng);
+    fill_std_normal(out, n, this->m_rng);
+    Eigen::Map<Eigen::Array<float_t, Eigen::Dynamic, 1>> draws(out, n);
+    draws = m_mu + m_sigma * draws;
+}
+
+
+template<typename float_t, typename rng_t>
+void UnivNormSampler<float_t, rng_t>::sample(const float_t *mu, const float_t *sigma, float_t *out, size_t n)
+{
+    std::array<float_t, 128> z;
+    for(size_t i = 0; i < n; i += z.size()){
+        const size_t len = std::min(z.size(), n - i);
+        fill_std_normal(z.data(), len, this->m_rng);
+        for(size_t j = 0; j < len; ++j)
+            out[i+j] = mu[i+j] + sigma[i+j] * z[j];
+    }
 }
 
 
@@ -146,9 +280,10 @@ float_t UnivNormSampler<float_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Log-Normal distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class UnivLogNormSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class UnivLogNormSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -187,13 +322,24 @@ public:
       * @return a random sample of type float_t.
       */
     float_t sample();    
-    
+
+
+    /**
+     * @brief Draws one random number for each of n (mu, sigma) pairs, with fill_std_normal() and a vectorized exp.
+     * The sampler's own parameters are ignored.
+     * @param mu the n location parameters of the logged samples.
+     * @param sigma the n scale parameters of the logged samples.
+     * @param out where the n samples go (may be the same array as mu or sigma).
+     * @param n how many samples.
+     */
+    void sample(const float_t *mu, const float_t *sigma, float_t *out, size_t n);
+
 
 private:
 
     /** @brief makes normal random variates */
     std::normal_distribution<float_t> m_z_gen;
-    
+
     /** @brief mu */
     float_t m_mu;
     
@@ -203,9 +349,9 @@ private:
 };
 
 
-template<typename float_t>
-UnivLogNormSampler<float_t>::UnivLogNormSampler()
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivLogNormSampler<float_t, rng_t>::UnivLogNormSampler()
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
 {
     setMu(0.0);
@@ -213,9 +359,9 @@ UnivLogNormSampler<float_t>::UnivLogNormSampler()
 }
 
 
-template<typename float_t>
-UnivLogNormSampler<float_t>::UnivLogNormSampler(float_t mu, float_t sigma)
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivLogNormSampler<float_t, rng_t>::UnivLogNormSampler(float_t mu, float_t sigma)
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
 {
     setMu(mu); 
@@ -223,24 +369,37 @@ UnivLogNormSampler<float_t>::UnivLogNormSampler(float_t mu, float_t sigma)
 }
 
 
-template<typename float_t>
-void UnivLogNormSampler<float_t>::setMu(float_t mu)
+template<typename float_t, typename rng_t>
+void UnivLogNormSampler<float_t, rng_t>::setMu(float_t mu)
 {
     m_mu = mu;
 }
 
 
-template<typename float_t>
-void UnivLogNormSampler<float_t>::setSigma(float_t sigma)
+template<typename float_t, typename rng_t>
+void UnivLogNormSampler<float_t, rng_t>::setSigma(float_t sigma)
 {
     m_sigma = sigma;
 }
 
 
-template<typename float_t>
-float_t UnivLogNormSampler<float_t>::sample()
+template<typename float_t, typename rng_t>
+float_t UnivLogNormSampler<float_t, rng_t>::sample()
 {
-    return std::exp(m_mu + m_sigma * m_z_gen(m_rng));
+    return std::exp(m_mu + m_sigma * m_z_gen(this->m_rng));
+}
+
+
+template<typename float_t, typename rng_t>
+void UnivLogNormSampler<float_t, rng_t>::sample(const float_t *mu, const float_t *sigma, float_t *out, size_t n)
+{
+    using arr = Eigen::Array<float_t, Eigen::Dynamic, 1>;
+    Eigen::Array<float_t, 128, 1> z;
+    for(size_t i = 0; i < n; i += z.size()){
+        const Eigen::Index len = std::min<size_t>(z.size(), n - i);
+        fill_std_normal(z.data(), len, this->m_rng);
+        Eigen::Map<arr>(out + i, len) = (Eigen::Map<const arr>(mu + i, len) + Eigen::Map<const arr>(sigma + i, len) * z.head(len)).exp();
+    }
 }
 
 
@@ -250,9 +409,10 @@ float_t UnivLogNormSampler<float_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Gamma distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class UnivGammaSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class UnivGammaSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -276,12 +436,27 @@ public:
       * @return a random sample of type float_t.
       */
     float_t sample();    
-    
+
+
+    /**
+     * @brief Draws one random number for each of n (alpha, beta) pairs with Marsaglia and Tsang's (2000) method,
+     * whose setup is a square root and a division, instead of building a std::gamma_distribution for each pair.
+     * The normals it needs come a block at a time from fill_std_normal(). The sampler's own parameters are ignored.
+     * @param alpha the n positive shape parameters.
+     * @param beta the n positive scale parameters.
+     * @param out where the n samples go (may be the same array as alpha or beta).
+     * @param n how many samples.
+     */
+    void sample(const float_t *alpha, const float_t *beta, float_t *out, size_t n);
+
 
 private:
 
     /** @brief makes gamma random variates */
     std::gamma_distribution<float_t> m_gamma_gen;
+
+    /** @brief makes uniform random variates on [0,1) for sample(alpha, beta, out, n) */
+    std::uniform_real_distribution<float_t> m_u_gen;
     
     /** @brief mu */
     float_t m_alpha;
@@ -292,26 +467,60 @@ private:
 };
 
 
-template<typename float_t>
-UnivGammaSampler<float_t>::UnivGammaSampler()
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivGammaSampler<float_t, rng_t>::UnivGammaSampler()
+    : rvsamp_base<rng_t>()
     , m_gamma_gen(1.0, 1.0)
+    , m_u_gen(0.0, 1.0)
 {
 }
 
 
-template<typename float_t>
-UnivGammaSampler<float_t>::UnivGammaSampler(float_t alpha, float_t beta)
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivGammaSampler<float_t, rng_t>::UnivGammaSampler(float_t alpha, float_t beta)
+    : rvsamp_base<rng_t>()
     , m_gamma_gen(alpha, beta)
+    , m_u_gen(0.0, 1.0)
 {
 }
 
 
-template<typename float_t>
-float_t UnivGammaSampler<float_t>::sample()
+template<typename float_t, typename rng_t>
+float_t UnivGammaSampler<float_t, rng_t>::sample()
 {
-    return m_gamma_gen(m_rng);
+    return m_gamma_gen(this->m_rng);
+}
+
+
+template<typename float_t, typename rng_t>
+void UnivGammaSampler<float_t, rng_t>::sample(const float_t *alpha, const float_t *beta, float_t *out, size_t n)
+{
+    std::array<float_t, 128> z;
+    size_t next = z.size();
+    for(size_t i = 0; i < n; ++i){
+
+        // shapes below one are boosted by one, and the draw is scaled by u^(1/alpha) at the end
+        const float_t a = alpha[i];
+        const float_t boost = a < 1 ? std::pow(1 - m_u_gen(this->m_rng), 1/a) : float_t(1);
+        const float_t d = (a < 1 ? a + 1 : a) - float_t(1)/3;
+        const float_t c = 1 / std::sqrt(9*d);
+        float_t v;
+        while(true){
+            if(next == z.size()){
+                fill_std_normal(z.data(), z.size(), this->m_rng);
+                next = 0;
+            }
+            const float_t x = z[next++];
+            v = 1 + c*x;
+            if(v <= 0)
+                continue;
+            v = v*v*v;
+            const float_t u = 1 - m_u_gen(this->m_rng);
+            if(u < 1 - float_t(.0331)*x*x*x*x || std::log(u) < x*x/2 + d - d*v + d*std::log(v))
+                break;
+        }
+        out[i] = beta[i] * d * v * boost;
+    }
 }
 
 
@@ -321,9 +530,10 @@ float_t UnivGammaSampler<float_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Inverse Gamma distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class UnivInvGammaSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class UnivInvGammaSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -363,26 +573,26 @@ private:
 };
 
 
-template<typename float_t>
-UnivInvGammaSampler<float_t>::UnivInvGammaSampler()
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivInvGammaSampler<float_t, rng_t>::UnivInvGammaSampler()
+    : rvsamp_base<rng_t>()
     , m_gamma_gen(1.0, 1.0)
 {
 }
 
 
-template<typename float_t>
-UnivInvGammaSampler<float_t>::UnivInvGammaSampler(float_t alpha, float_t beta)
-    : rvsamp_base()
+template<typename float_t, typename rng_t>
+UnivInvGammaSampler<float_t, rng_t>::UnivInvGammaSampler(float_t alpha, float_t beta)
+    : rvsamp_base<rng_t>()
     , m_gamma_gen(alpha, beta)
 {
 }
 
 
-template<typename float_t>
-float_t UnivInvGammaSampler<float_t>::sample()
+template<typename float_t, typename rng_t>
+float_t UnivInvGammaSampler<float_t, rng_t>::sample()
 {
-    return 1.0/m_gamma_gen(m_rng);
+    return 1.0/m_gamma_gen(this->m_rng);
 }
 
 
@@ -392,13 +602,15 @@ float_t UnivInvGammaSampler<float_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from a truncated univariate Normal distribution using the 
-* acceptance rejection method. The proposal distribution used is a normal 
-* distribution with the same location and scale parameters as the target.
-* As a result, this method will take a long time when the width of the 
-* support of the target is narrow.
+* acceptance rejection method. The constructor standardizes the bounds to [a, b] (flipping the
+* sign so that a >= 0 whenever 0 is not inside), and then keeps whichever proposal accepts most often:
+* the normal itself, the half normal, a uniform on [a, b], or Robert's (1995) exponential
+* shifted to a. The acceptance rate stays bounded away from zero however far into the tail
+* or however narrow the interval is.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class TruncUnivNormSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class TruncUnivNormSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -408,8 +620,8 @@ public:
       * @brief The user must supply both mean and std. dev.
       * @param mu a float_t for the location parameter.
       * @param sigma a float_t (> 0) representing the scale of the samples.
-      * @param lower the lower bound of the support
-      * @param upper the upper bound of the support
+      * @param lower the lower bound of the support (may be -infinity)
+      * @param upper the upper bound of the support (may be +infinity, and must be above lower)
       */
     TruncUnivNormSampler(float_t mu, float_t sigma, float_t lower, float_t upper);
 
@@ -419,12 +631,28 @@ public:
       * @return a random sample of type float_t.
       */
     float_t sample();    
+
+
+    /**
+     * @brief Draws many random numbers at once. The proposals and their acceptance tests are
+     * computed a block at a time with vectorized Eigen array expressions, and the accepted
+     * ones are packed into out.
+     * @param out where the samples go.
+     * @param n how many samples.
+     */
+    void fill(float_t *out, size_t n);
     
 
 private:
- 
+
+    /** @brief the proposal distributions to choose from */
+    enum class proposal { normal, half_normal, uniform, exponential };
+
     /** @brief makes normal random variates */
     std::normal_distribution<float_t> m_z_gen;
+
+    /** @brief makes uniform random variates on [0,1) */
+    std::uniform_real_distribution<float_t> m_u_gen;
  
     /** @brief the mean */
     float_t m_mu;
@@ -437,36 +665,141 @@ private:
 
     /** @brief the upper bound */
     float_t m_upper;
+
+    /** @brief the standardized (and possibly flipped) lower bound */
+    float_t m_a;
+
+    /** @brief the standardized (and possibly flipped) upper bound */
+    float_t m_b;
+
+    /** @brief sigma, or -sigma if the bounds were flipped */
+    float_t m_scale;
+
+    /** @brief the exponential proposal's rate */
+    float_t m_alpha;
+
+    /** @brief the point of [a, b] closest to 0, squared */
+    float_t m_minSq;
+
+    /** @brief the proposal in use */
+    proposal m_prop;
 };
 
 
-template<typename float_t>
-TruncUnivNormSampler<float_t>::TruncUnivNormSampler(float_t mu, 
+template<typename float_t, typename rng_t>
+TruncUnivNormSampler<float_t, rng_t>::TruncUnivNormSampler(float_t mu, 
                                                     float_t sigma, 
                                                     float_t lower, 
                                                     float_t upper)
-    : rvsamp_base()
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
+    , m_u_gen(0.0, 1.0)
     , m_mu(mu)
     , m_sigma(sigma)
     , m_lower(lower)
     , m_upper(upper)
 {
+    if(!(lower < upper) || !(sigma > 0))
+        throw std::invalid_argument("error: TruncUnivNormSampler needs lower < upper and sigma > 0");
+
+    m_a = (lower - mu) / sigma;
+    m_b = (upper - mu) / sigma;
+    m_scale = sigma;
+    if(m_b <= 0){
+        std::swap(m_a, m_b);
+        m_a = -m_a;
+        m_b = -m_b;
+        m_scale = -sigma;
+    }
+    m_alpha = (m_a + std::sqrt(m_a*m_a + 4)) / 2;
+    m_minSq = m_a > 0 ? m_a*m_a : 0;
+
+    // every acceptance rate is the target's mass times one of these factors, so compare their logs
+    const float_t logSqrt2Pi = .5*std::log(2*3.14159265358979323846);
+    const float_t logUnif = logSqrt2Pi + m_minSq/2 - std::log(m_b - m_a);
+    if(m_a < 0){
+        m_prop = logUnif > 0 ? proposal::uniform : proposal::normal;
+    }else{
+        const float_t logHalf = std::log(float_t(2));
+        const float_t logExp = std::log(m_alpha) + logSqrt2Pi + m_alpha*m_a - m_alpha*m_alpha/2;
+        m_prop = proposal::half_normal;
+        float_t best = logHalf;
+        if(logUnif > best){
+            m_prop = proposal::uniform;
+            best = logUnif;
+        }
+        if(logExp > best)
+            m_prop = proposal::exponential;
+    }
 }
 
 
-template<typename float_t>
-float_t TruncUnivNormSampler<float_t>::sample()
+template<typename float_t, typename rng_t>
+float_t TruncUnivNormSampler<float_t, rng_t>::sample()
 {
-    float_t proposal;
+    float_t z;
     bool accepted = false;
     while(!accepted)
     {
-        proposal = m_mu + m_sigma*m_z_gen(this->m_rng);
-        if((m_lower <= proposal) & (proposal <= m_upper))
-            accepted = true;
+        switch(m_prop){
+        case proposal::normal:
+            z = m_z_gen(this->m_rng);
+            accepted = (m_a <= z) & (z <= m_b);
+            break;
+        case proposal::half_normal:
+            z = std::abs(m_z_gen(this->m_rng));
+            accepted = (m_a <= z) & (z <= m_b);
+            break;
+        case proposal::uniform:
+            z = m_a + (m_b - m_a)*m_u_gen(this->m_rng);
+            accepted = std::log1p(-m_u_gen(this->m_rng)) <= (m_minSq - z*z)/2;
+            break;
+        case proposal::exponential:
+            z = m_a - std::log1p(-m_u_gen(this->m_rng)) / m_alpha;
+            accepted = (z <= m_b) && std::log1p(-m_u_gen(this->m_rng)) <= -(z - m_alpha)*(z - m_alpha)/2;
+            break;
+        }
+    }
+    return m_mu + m_scale*z;
+}
+
+
+template<typename float_t, typename rng_t>
+void TruncUnivNormSampler<float_t, rng_t>::fill(float_t *out, size_t n)
+{
+    constexpr int len = 128;
+    using block = Eigen::Array<float_t, len, 1>;
+    block z, u, keep;
+
+    size_t filled = 0;
+    while(filled < n){
+
+        // propose a block and mark the keepers
+        if(m_prop == proposal::normal || m_prop == proposal::half_normal){
+            fill_std_normal(z.data(), len, this->m_rng);
+            if(m_prop == proposal::half_normal)
+                z = z.abs();
+            keep = ((z >= m_a) && (z <= m_b)).template cast<float_t>();
+        }else{
+            for(int j = 0; j < len; ++j){
+                z[j] = 1 - m_u_gen(this->m_rng);
+                u[j] = 1 - m_u_gen(this->m_rng);
+            }
+            if(m_prop == proposal::uniform){
+                z = m_b - (m_b - m_a)*z;
+                keep = (u.log() <= (m_minSq - z*z)/2).template cast<float_t>();
+            }else{
+                z = m_a - z.log() / m_alpha;
+                keep = ((z <= m_b) && (u.log() <= -(z - m_alpha).square()/2)).template cast<float_t>();
+            }
+        }
+
+        // pack them
+        for(int j = 0; j < len && filled < n; ++j){
+            out[filled] = m_mu + m_scale*z[j];
+            filled += static_cast<size_t>(keep[j]);
+        }
     }
-    return proposal;
 }
 
 
@@ -476,9 +809,10 @@ float_t TruncUnivNormSampler<float_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Poisson distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t, typename int_t>
-class PoissonSampler : public rvsamp_base
+template<typename float_t, typename int_t, typename rng_t = std::mt19937>
+class PoissonSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -509,40 +843,101 @@ public:
       * @return a random sample of type int_t.
       */
     int_t sample();    
-    
+
+
+    /**
+     * @brief Draws one random number for each of n lambdas, without rebuilding a std::poisson_distribution
+     * (whose setup calls lgamma and friends) for each one. Lambdas below 10 use inversion by sequential search,
+     * and larger ones use Hormann's (1993) transformed rejection (PTRS), whose setup is a few divisions.
+     * The sampler's own lambda is ignored.
+     * @param lambda the n nonnegative means.
+     * @param out where the n samples go.
+     * @param n how many samples.
+     */
+    void sample(const float_t *lambda, int_t *out, size_t n);
+
 
 private:
 
     /** @brief makes normal random variates */
     std::poisson_distribution<int_t> m_p_gen;
+
+    /** @brief makes uniform random variates on [0,1) for sample(lambda, out, n) */
+    std::uniform_real_distribution<double> m_u_gen;
 };
 
 
-template<typename float_t, typename int_t>
-PoissonSampler<float_t, int_t>::PoissonSampler() 
-    : rvsamp_base(), m_p_gen(float_t(1.0))
+template<typename float_t, typename int_t, typename rng_t>
+PoissonSampler<float_t, int_t, rng_t>::PoissonSampler() 
+    : rvsamp_base<rng_t>(), m_p_gen(float_t(1.0)), m_u_gen(0.0, 1.0)
 {
 }
 
 
-template<typename float_t, typename int_t>
-PoissonSampler<float_t, int_t>::PoissonSampler(float_t lambda) 
-    : rvsamp_base(), m_p_gen(lambda)
+template<typename float_t, typename int_t, typename rng_t>
+PoissonSampler<float_t, int_t, rng_t>::PoissonSampler(float_t lambda) 
+    : rvsamp_base<rng_t>(), m_p_gen(lambda), m_u_gen(0.0, 1.0)
 {
 }
 
 
-template<typename float_t, typename int_t>
-void PoissonSampler<float_t, int_t>::setLambda(float_t lambda)
+template<typename float_t, typename int_t, typename rng_t>
+void PoissonSampler<float_t, int_t, rng_t>::setLambda(float_t lambda)
 {
    m_p_gen.param(typename decltype(m_p_gen)::param_type(lambda)); 
 }
 
 
-template<typename float_t, typename int_t>
-int_t PoissonSampler<float_t, int_t>::sample()
+template<typename float_t, typename int_t, typename rng_t>
+int_t PoissonSampler<float_t, int_t, rng_t>::sample()
+{
+    return m_p_gen(this->m_rng);
+}
+
+
+template<typename float_t, typename int_t, typename rng_t>
+void PoissonSampler<float_t, int_t, rng_t>::sample(const float_t *lambda, int_t *out, size_t n)
 {
-    return m_p_gen(m_rng);
+    for(size_t i = 0; i < n; ++i){
+        const double lam = lambda[i];
+
+        if(lam < 10){
+            double pk = std::exp(-lam);
+            double cdf = pk;
+            const double u = m_u_gen(this->m_rng);
+            int_t k = 0;
+            while(u > cdf && pk > 0){
+                ++k;
+                pk *= lam / k;
+                cdf += pk;
+            }
+            out[i] = k;
+            continue;
+        }
+
+        const double slam = std::sqrt(lam);
+        const double loglam = std::log(lam);
+        const double b = .931 + 2.53*slam;
+        const double a = -.059 + .02483*b;
+        const double invalpha = 1.1239 + 1.1328/(b - 3.4);
+        const double vr = .9277 - 3.6224/(b - 2);
+        while(true){
+            const double U = m_u_gen(this->m_rng) - .5;
+            const double V = m_u_gen(this->m_rng);
+            const double us = .5 - std::abs(U);
+            const double k = std::floor((2*a/us + b)*U + lam + .43);
+            if(us >= .07 && V <= vr){
+                out[i] = static_cast<int_t>(k);
+                break;
+            }
+            if(k < 0 || (us < .013 && V > us))
+                continue;
+            if(std::log(V) + std::log(invalpha) - std::log(a/(us*us) + b) <= -lam + k*loglam - std::lgamma(k + 1)){
+                out[i] = static_cast<int_t>(k);
+                break;
+            }
+        }
+    }
 }
 
 
@@ -552,9 +947,10 @@ int_t PoissonSampler<float_t, int_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Samples from univariate Bernoulli distribution.
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t, typename int_t>
-class BernSampler : public rvsamp_base
+template<typename float_t, typename int_t, typename rng_t = std::mt19937>
+class BernSampler : public rvsamp_base<rng_t>
 {
     
 public:
@@ -585,43 +981,64 @@ public:
       * @return a random sample of type int_t.
       */
     int_t sample();    
-    
+
+
+    /**
+     * @brief Draws one random number for each of n probabilities. The sampler's own p is ignored.
+     * @param p the n probabilities that each sample equals 1.
+     * @param out where the n samples go.
+     * @param n how many samples.
+     */
+    void sample(const float_t *p, int_t *out, size_t n);
+
 
 private:
 
     /** @brief makes normal random variates */
     std::bernoulli_distribution m_B_gen;
+
+    /** @brief makes uniform random variates on [0,1) for sample(p, out, n) */
+    std::uniform_real_distribution<float_t> m_u_gen;
     
     /** @brief the mean */
     float_t m_p;
 };
 
 
-template<typename float_t, typename int_t>
-BernSampler<float_t, int_t>::BernSampler() 
-    : rvsamp_base(), m_B_gen(.5)
+template<typename float_t, typename int_t, typename rng_t>
+BernSampler<float_t, int_t, rng_t>::BernSampler() 
+    : rvsamp_base<rng_t>(), m_B_gen(.5), m_u_gen(0.0, 1.0), m_p(.5)
 {
 }
 
 
-template<typename float_t, typename int_t>
-BernSampler<float_t, int_t>::BernSampler(float_t p) 
-    : rvsamp_base(), m_B_gen(p)
+template<typename float_t, typename int_t, typename rng_t>
+BernSampler<float_t, int_t, rng_t>::BernSampler(float_t p) 
+    : rvsamp_base<rng_t>(), m_B_gen(p), m_u_gen(0.0, 1.0), m_p(p)
 {
 }
 
 
-template<typename float_t, typename int_t>
-void BernSampler<float_t, int_t>::setP(float_t p)
+template<typename float_t, typename int_t, typename rng_t>
+void BernSampler<float_t, int_t, rng_t>::setP(float_t p)
 {
     m_p = p;
+    m_B_gen.param(std::bernoulli_distribution::param_type(p));
 }
 
 
-template<typename float_t, typename int_t>
-int_t BernSampler<float_t, int_t>::sample()
+template<typename float_t, typename int_t, typename rng_t>
+int_t BernSampler<float_t, int_t, rng_t>::sample()
 {
-    return (m_B_gen(m_rng)) ? 1 : 0;
+    return (m_B_gen(this->m_rng)) ? 1 : 0;
+}
+
+
+template<typename float_t, typename int_t, typename rng_t>
+void BernSampler<float_t, int_t, rng_t>::sample(const float_t *p, int_t *out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+        out[i] = m_u_gen(this->m_rng) < p[i] ? 1 : 0;
 }
 
 
@@ -632,9 +1049,12 @@ int_t BernSampler<float_t, int_t>::sample()
 * @author taylor
 * @file rv_samp.h
 * @brief Can sample from a distribution with fixed mean and covariance, fixed mean only, fixed covariance only, or nothing fixed.
+* setCovar() accepts any positive semi-definite matrix. setCovarChol() and setCholFactor() keep a lower triangular
+* factor instead, which is cheaper to compute and can be updated in O(dim^2) with rankUpdate().
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<size_t dim, typename float_t>
-class MVNSampler : public rvsamp_base
+template<size_t dim, typename float_t, typename rng_t = std::mt19937>
+class MVNSampler : public rvsamp_base<rng_t>
 {
 public:
 
@@ -642,6 +1062,10 @@ public:
     using Vec = Eigen::Matrix<float_t,dim,1>;
     /** type alias for linear algebra stuff */
     using Mat = Eigen::Matrix<float_t,dim,dim>;
+    /** type alias for a batch of draws, one per column */
+    using Mats = Eigen::Matrix<float_t,dim,Eigen::Dynamic>;
+    /** type alias for a row-major batch of draws, e.g. a block of soa_particles */
+    using RowMats = Eigen::Matrix<float_t,dim,Eigen::Dynamic,Eigen::RowMajor>;
     
     /**
      * @todo: implement move semantics 
@@ -662,10 +1086,34 @@ public:
 
 
     /**
-     * @brief sets the covariance matrix of the sampler.
-     * @param covMat the desired covariance matrix.
+     * @brief sets the covariance matrix of the sampler with an eigendecomposition.
+     * @param covMat the desired covariance matrix (positive semi-definite).
      */
     void setCovar(const Mat &covMat);
+
+
+    /**
+     * @brief sets the covariance matrix of the sampler with a Cholesky (LLT) factorization,
+     * which is several times cheaper than setCovar()'s eigendecomposition.
+     * @param covMat the desired covariance matrix (positive definite).
+     */
+    void setCovarChol(const Mat &covMat);
+
+
+    /**
+     * @brief sets the covariance matrix to L L^T, for models that already keep a Cholesky factor.
+     * @param cholMat a lower triangular matrix with a positive diagonal (the upper triangle is ignored).
+     */
+    void setCholFactor(const Mat &cholMat);
+
+
+    /**
+     * @brief changes the covariance matrix to covMat + sigma v v^T. After setCovarChol() or setCholFactor()
+     * this updates the factor in O(dim^2). After setCovar() it refactors with setCovarChol().
+     * @param v the update vector.
+     * @param sigma the update's sign and scale (negative for a downdate).
+     */
+    void rankUpdate(const Vec &v, float_t sigma = 1);
     
     
     /**
@@ -680,6 +1128,22 @@ public:
       * @return a Vec random sample.
       */
     auto sample() -> Vec;    
+
+
+    /**
+     * @brief Draws one random vector per column of out, using fill_std_normal() and a single matrix product.
+     * @param out the matrix to fill. Its number of columns is the number of draws.
+     */
+    void sampleMany(Eigen::Ref<Mats> out);
+
+
+    /**
+     * @brief Draws one random vector per column of a row-major out, such as soa_particles::block_t,
+     * so samples can be written straight into particle storage. (With dim = 1 the overload above handles these.)
+     * @param out the matrix to fill. Its number of columns is the number of draws.
+     */
+    template<size_t d = dim, std::enable_if_t<(d > 1), int> = 0>
+    void sampleMany(Eigen::Ref<RowMats, 0, Eigen::OuterStride<>> out);
     
 private:
 
@@ -691,13 +1155,24 @@ private:
     
     /** @brief mean vector */
     Vec m_mean;
+
+    /** @brief whether m_scale_mat is a lower triangular Cholesky factor */
+    bool m_lower;
+
+
+    /**
+     * @brief replaces draws from N(0, I) with draws from N(mean, covariance).
+     * @param Z one draw per column.
+     */
+    template<typename Derived>
+    void color(Eigen::MatrixBase<Derived> &Z) const;
     
 };
 
 
-template<size_t dim, typename float_t>
-MVNSampler<dim, float_t>::MVNSampler()
-        : rvsamp_base()
+template<size_t dim, typename float_t, typename rng_t>
+MVNSampler<dim, float_t, rng_t>::MVNSampler()
+        : rvsamp_base<rng_t>()
         , m_z_gen(0.0, 1.0)
 {
     setMean(Vec::Zero());
@@ -705,9 +1180,9 @@ MVNSampler<dim, float_t>::MVNSampler()
 }
 
 
-template<size_t dim, typename float_t>
-MVNSampler<dim, float_t>::MVNSampler(const Vec &meanVec, const Mat &covMat)
-    : rvsamp_base()
+template<size_t dim, typename float_t, typename rng_t>
+MVNSampler<dim, float_t, rng_t>::MVNSampler(const Vec &meanVec, const Mat &covMat)
+    : rvsamp_base<rng_t>()
     , m_z_gen(0.0, 1.0)
 {
     setCovar(covMat);
@@ -715,30 +1190,114 @@ MVNSampler<dim, float_t>::MVNSampler(const Vec &meanVec, const Mat &covMat)
 }
 
 
-template<size_t dim, typename float_t>
-void MVNSampler<dim, float_t>::setCovar(const Mat &covMat)
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::setCovar(const Mat &covMat)
 {
     Eigen::SelfAdjointEigenSolver<Mat> eigenSolver(covMat);
     m_scale_mat = eigenSolver.eigenvectors() * eigenSolver.eigenvalues().cwiseMax(0).cwiseSqrt().asDiagonal();
+    m_lower = false;
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::setCovarChol(const Mat &covMat)
+{
+    Eigen::LLT<Mat> llt(covMat);
+    if(llt.info() != Eigen::Success)
+        throw std::invalid_argument("error: setCovarChol needs a positive definite covariance matrix");
+    setCholFactor(llt.matrixL());
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::setCholFactor(const Mat &cholMat)
+{
+    m_scale_mat = cholMat.template triangularView<Eigen::Lower>();
+    m_lower = true;
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::rankUpdate(const Vec &v, float_t sigma)
+{
+    if(!m_lower){
+        setCovarChol(m_scale_mat * m_scale_mat.transpose() + sigma * v * v.transpose());
+        return;
+    }
+
+    // the usual sequence of Givens (update) or hyperbolic (downdate) rotations, one column at a time
+    const float_t sign = sigma < 0 ? -1 : 1;
+    Vec w = std::sqrt(std::abs(sigma)) * v;
+    for(Eigen::Index k = 0; k < static_cast<Eigen::Index>(dim); ++k){
+        const float_t Lkk = m_scale_mat(k,k);
+        const float_t rr = Lkk*Lkk + sign*w(k)*w(k);
+        if(!(rr > 0))
+            throw std::invalid_argument("error: this downdate would leave a covariance matrix that isn't positive definite");
+        const float_t r = std::sqrt(rr);
+        const float_t c = r / Lkk;
+        const float_t sn = w(k) / Lkk;
+        m_scale_mat(k,k) = r;
+        const Eigen::Index rest = static_cast<Eigen::Index>(dim) - k - 1;
+        m_scale_mat.col(k).tail(rest) = (m_scale_mat.col(k).tail(rest) + sign*sn*w.tail(rest)) / c;
+        w.tail(rest) = c*w.tail(rest) - sn*m_scale_mat.col(k).tail(rest);
+    }
 }
 
 
-template<size_t dim, typename float_t>
-void MVNSampler<dim, float_t>::setMean(const Vec &meanVec)
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::setMean(const Vec &meanVec)
 {
     m_mean = meanVec;
 }
 
 
-template<size_t dim, typename float_t>
-auto MVNSampler<dim, float_t>::sample() -> Vec
+template<size_t dim, typename float_t, typename rng_t>
+auto MVNSampler<dim, float_t, rng_t>::sample() -> Vec
 {
     Vec Z;
     for (size_t i=0; i< dim; ++i) 
     {
         Z(i) = m_z_gen(this->m_rng);
     }
-    return m_mean + m_scale_mat * Z;
+    color(Z);
+    return Z;
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+void MVNSampler<dim, float_t, rng_t>::sampleMany(Eigen::Ref<Mats> out)
+{
+    // a single row is always contiguous, even though Eigen reports its outer stride as the number of columns
+    if(dim == 1 || out.outerStride() == static_cast<Eigen::Index>(dim)){
+        fill_std_normal(out.data(), out.size(), this->m_rng);
+        color(out);
+    }else{
+        Mats Z(dim, out.cols());
+        fill_std_normal(Z.data(), Z.size(), this->m_rng);
+        color(Z);
+        out = Z;
+    }
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+template<size_t d, std::enable_if_t<(d > 1), int>>
+void MVNSampler<dim, float_t, rng_t>::sampleMany(Eigen::Ref<RowMats, 0, Eigen::OuterStride<>> out)
+{
+    for(Eigen::Index i = 0; i < static_cast<Eigen::Index>(dim); ++i)
+        fill_std_normal(out.row(i).data(), out.cols(), this->m_rng);
+    color(out);
+}
+
+
+template<size_t dim, typename float_t, typename rng_t>
+template<typename Derived>
+void MVNSampler<dim, float_t, rng_t>::color(Eigen::MatrixBase<Derived> &Z) const
+{
+    // the product goes through a temporary, so Z can be on both sides. A triangularView product
+    // would skip the zeros of a Cholesky factor, but for the sizes here it's slower than the dense one.
+    Z = m_scale_mat * Z;
+    Z.colwise() += m_mean;
 }
 
 
@@ -749,9 +1308,10 @@ auto MVNSampler<dim, float_t>::sample() -> Vec
 * @author taylor
 * @file rv_samp.h
 * @brief 
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
 */
-template<typename float_t>
-class UniformSampler : public rvsamp_base
+template<typename float_t, typename rng_t = std::mt19937>
+class UniformSampler : public rvsamp_base<rng_t>
 {
 public:
 
@@ -783,26 +1343,182 @@ private:
 };
 
 
-template<typename float_t>
-UniformSampler<float_t>::UniformSampler() 
-        : rvsamp_base()
+template<typename float_t, typename rng_t>
+UniformSampler<float_t, rng_t>::UniformSampler() 
+        : rvsamp_base<rng_t>()
         , m_unif_gen(0.0, 1.0)
 {
 }
 
 
-template<typename float_t>
-UniformSampler<float_t>::UniformSampler(float_t lower, float_t upper) 
-        : rvsamp_base()
+template<typename float_t, typename rng_t>
+UniformSampler<float_t, rng_t>::UniformSampler(float_t lower, float_t upper) 
+        : rvsamp_base<rng_t>()
         , m_unif_gen(lower, upper)
 {    
 }
 
 
+template<typename float_t, typename rng_t>
+float_t UniformSampler<float_t, rng_t>::sample()
+{
+    return m_unif_gen(this->m_rng);
+}
+
+
+
+//! Walker's alias method for drawing indexes in constant time.
+/**
+ * @class alias_table
+ * @author t
+ * @file rv_samp.h
+ * @brief Draws from (0,1,...N-1) with probabilities proportional to some weights.
+ * It is built with Vose's algorithm in O(N), and each draw takes one uniform
+ * and one comparison. The storage is reused between builds, so rebuilding it
+ * for the same N does not allocate.
+ * @tparam float_t the floating point type of the weights
+ */
 template<typename float_t>
-float_t UniformSampler<float_t>::sample()
+class alias_table
 {
-    return m_unif_gen(m_rng);
+public:
+
+    /**
+     * @brief the default constructor makes an empty table.
+     */
+    alias_table() = default;
+
+
+    /**
+     * @brief builds the table from weights
+     * @param wts nonnegative weights (they don't have to be normalized, but one must be positive)
+     */
+    template<typename container_t>
+    void setWeights(const container_t &wts);
+
+
+    /**
+     * @brief builds the table from log weights (underflow is avoided by subtracting the max first)
+     * @param logWts log weights (they don't have to be normalized, but one must be finite)
+     */
+    template<typename container_t>
+    void setLogWeights(const container_t &logWts);
+
+
+    /**
+     * @brief the number of indexes the table draws from
+     * @return N
+     */
+    size_t size() const;
+
+
+    /**
+     * @brief draws one index
+     * @param gen a uniform random bit generator (e.g. std::mt19937)
+     * @return an integer in (0,1,...N-1)
+     */
+    template<typename gen_t>
+    unsigned int draw(gen_t &gen) const;
+
+private:
+
+    /** @brief the chance of keeping each column's own index (the weights, while building) */
+    std::vector<float_t> m_prob;
+
+    /** @brief the index each column gives its leftover chance to */
+    std::vector<unsigned int> m_alias;
+
+    /** @brief work list of underfull columns */
+    std::vector<unsigned int> m_small;
+
+    /** @brief work list of overfull columns */
+    std::vector<unsigned int> m_large;
+
+
+    /**
+     * @brief fills in the table (Vose's algorithm) from the weights sitting in m_prob
+     */
+    void build();
+};
+
+
+template<typename float_t>
+template<typename container_t>
+void alias_table<float_t>::setWeights(const container_t &wts)
+{
+    m_prob.assign(wts.begin(), wts.end());
+    build();
+}
+
+
+template<typename float_t>
+template<typename container_t>
+void alias_table<float_t>::setLogWeights(const container_t &logWts)
+{
+    m_prob.resize(logWts.size());
+    if(logWts.size() == 0)
+        throw std::invalid_argument("error: alias table needs at least one weight");
+    const float_t m = *std::max_element(logWts.begin(), logWts.end());
+    std::transform(logWts.begin(), logWts.end(), m_prob.begin(),
+                   [&m](float_t d) -> float_t { return std::exp(d-m); } );
+    build();
+}
+
+
+template<typename float_t>
+size_t alias_table<float_t>::size() const
+{
+    return m_prob.size();
+}
+
+
+template<typename float_t>
+template<typename gen_t>
+unsigned int alias_table<float_t>::draw(gen_t &gen) const
+{
+    // the integer part picks a column and the fractional part decides between it and its alias
+    const size_t n = m_prob.size();
+    double u = std::uniform_real_distribution<double>(0.0, static_cast<double>(n))(gen);
+    size_t col = std::min(static_cast<size_t>(u), n - 1);
+    return (u - col) < m_prob[col] ? col : m_alias[col];
+}
+
+
+template<typename float_t>
+void alias_table<float_t>::build()
+{
+    const size_t n = m_prob.size();
+    float_t sum = std::accumulate(m_prob.begin(), m_prob.end(), static_cast<float_t>(0.0));
+    if(!(sum > 0.0) || !std::isfinite(sum))
+        throw std::invalid_argument("error: alias table needs a positive, finite total weight");
+
+    // scale so the columns average 1, then sort them into under- and overfull
+    m_alias.resize(n);
+    m_small.clear();
+    m_large.clear();
+    const float_t scale = n / sum;
+    for(size_t i = 0; i < n; ++i){
+        m_prob[i] *= scale;
+        m_alias[i] = i;
+        (m_prob[i] < 1.0 ? m_small : m_large).push_back(i);
+    }
+
+    // top up each underfull column with what an overfull one has to spare
+    while(!m_small.empty() && !m_large.empty()){
+        unsigned int s = m_small.back();
+        unsigned int l = m_large.back();
+        m_small.pop_back();
+        m_large.pop_back();
+        m_alias[s] = l;
+        m_prob[l] = (m_prob[l] + m_prob[s]) - 1.0;
+        (m_prob[l] < 1.0 ? m_small : m_large).push_back(l);
+    }
+
+    // whatever is left is full up to rounding error
+    for(auto i : m_small)
+        m_prob[i] = 1.0;
+    for(auto i : m_large)
+        m_prob[i] = 1.0;
 }
 
 
@@ -813,34 +1529,74 @@ float_t UniformSampler<float_t>::sample()
  * @author taylor
  * @file rv_samp.h
  * @brief Basically a wrapper for std::discrete_distribution<>
- * outputs are in the rage (0,1,...N-1)
+ * outputs are in the rage (0,1,...N-1). It can also use an alias_table instead,
+ * which is rebuilt in its own storage on every call and draws each index in constant time.
+ * @tparam N the number of indexes (or dynamic_parts to use the length of the weights)
+ * @tparam rng_t the random number generator (std::mt19937 by default, or rvsamp::philox4x32)
  */
-template<size_t N, typename float_t>
-class k_gen : public rvsamp_base
+template<size_t N, typename float_t, typename rng_t = std::mt19937>
+class k_gen : public rvsamp_base<rng_t>
 {
 public:
     /**
      * @brief default constructor. only one available.
+     * @param use_alias whether to draw with an alias table instead of std::discrete_distribution<>
      */
-    k_gen();
+    explicit k_gen(bool use_alias = false);
 
     
     /**
      * @brief sample N times from (0,1,...N-1) 
-     * @param logWts possibly unnormalized type std::array<float_t, N>
-     * @return the integers in a std::array<unsigned int, N>
+     * @param logWts possibly unnormalized type part_array<float_t, N>
+     * @return the integers in a part_array<unsigned int, N>
+     */
+    part_array<unsigned int, N> sample(const part_array<float_t, N> &logWts);     
+
+
+    /**
+     * @brief sample from (0,1,...N-1) into storage the caller already has
+     * @param logWts possibly unnormalized type part_array<float_t, N>
+     * @param ks where the integers are written (one is drawn for every element)
      */
-    std::array<unsigned int, N> sample(const std::array<float_t, N> &logWts);     
+    void sample(const part_array<float_t, N> &logWts, part_array<unsigned int, N> &ks);
+
+private:
+
+    /** @brief whether the alias table is used */
+    bool m_useAlias;
+
+    /** @brief the alias table (only used if m_useAlias is true) */
+    alias_table<float_t> m_table;
 };
 
 
-template<size_t N, typename float_t>
-k_gen<N, float_t>::k_gen() : rvsamp_base() {}
+template<size_t N, typename float_t, typename rng_t>
+k_gen<N, float_t, rng_t>::k_gen(bool use_alias) 
+    : rvsamp_base<rng_t>()
+    , m_useAlias(use_alias)
+{
+}
 
 
-template<size_t N, typename float_t>
-std::array<unsigned int, N> k_gen<N, float_t>::sample(const std::array<float_t, N> &logWts)
+template<size_t N, typename float_t, typename rng_t>
+part_array<unsigned int, N> k_gen<N, float_t, rng_t>::sample(const part_array<float_t, N> &logWts)
 {
+    part_array<unsigned int, N> ks = part_storage<unsigned int, N>::make(logWts.size());
+    sample(logWts, ks);
+    return ks;
+}
+
+
+template<size_t N, typename float_t, typename rng_t>
+void k_gen<N, float_t, rng_t>::sample(const part_array<float_t, N> &logWts, part_array<unsigned int, N> &ks)
+{
+    if(m_useAlias){
+        m_table.setLogWeights(logWts);
+        for(size_t i = 0; i < ks.size(); ++i)
+            ks[i] = m_table.draw(this->m_rng);
+        return;
+    }
+
     // these log weights may be very negative. If that's the case, exponentiating them may cause underflow
     // so we use the "log-exp-sum" trick
     // actually not quite...we just shift the log-weights because after they're exponentiated
@@ -849,18 +1605,16 @@ std::array<unsigned int, N> k_gen<N, float_t>::sample(const std::array<float_t,
    // Create the distribution with exponentiated log-weights
    // subtract the max first to prevent underflow
    // normalization is taken care of by std::discrete_distribution
-    std::array<float_t, N> w;
+    part_array<float_t, N> w = part_storage<float_t, N>::make(logWts.size());
     float_t m = *std::max_element(logWts.begin(), logWts.end());
     std::transform(logWts.begin(), logWts.end(), w.begin(), 
                    [&m](float_t d) -> float_t { return std::exp(d-m); } );
     std::discrete_distribution<> kGen(w.begin(), w.end());
     
-    // sample and return ks
-    std::array<unsigned int, N> ks;
-    for(size_t i = 0; i < N; ++i){
+    // sample ks
+    for(size_t i = 0; i < ks.size(); ++i){
         ks[i] = kGen(this->m_rng);
     }
-    return ks;
 }
 
 
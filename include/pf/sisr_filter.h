@@ -2,23 +2,32 @@
 #define SISR_FILTER_H
 
 #include <array>
+#include <iostream> // debug printing
+#include <vector>
 #include <Eigen/Dense>
 
 #include "pf_base.h"
+#include "filter_core.h"
+#include "part_storage.h"
+#include "thread_pool.h"
 
-//! A base class for the Sequential Important Sampling with Resampling (SISR).
+//! The SISR filter engine with compile-time (CRTP) dispatch to the model.
 /**
- * @class SISRFilter
- * @author taylor
+ * @class SISRFilterStatic
+ * @author t
  * @file sisr_filter.h
- * @brief SISR filter.
- * @tparam nparts the number of particles
+ * @brief SISR filter that calls the model methods of Derived directly, so they can be 
+ * inlined into the particle loops. Derived inherits from SISRFilterStatic<Derived, ...> 
+ * and provides (public, non-virtual) versions of SISRFilter's model methods. Any of the 
+ * "...Batch" methods can be redefined in Derived as well.
+ * @tparam Derived the model class
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
  * @tparam dimx the size of the state
- * @tparam the size of the observation
+ * @tparam dimy the size of the observation
  * @tparam resamp_t the type of resampler
  */
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
-class SISRFilter : public pf_base<float_t, dimy, dimx>
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class SISRFilterStatic : public pf_base<float_t, dimy, dimx>
 {
 public:
 
@@ -28,25 +37,29 @@ public:
     using osv         = Eigen::Matrix<float_t, dimy, 1>; // obs size vec
     /** type alias for linear algebra stuff */
     using Mat         = Eigen::Matrix<float_t,Eigen::Dynamic,Eigen::Dynamic>;
+    /** type alias for functionals that write into a preallocated output */
+    using outFunc = typename expectation_engine<ssv, float_t>::func_t;
     /** type alias for linear algebra stuff */
-    using arrayStates = std::array<ssv, nparts>;
+    using arrayStates = part_array<ssv, nparts>;
     /** type alias for array of float_ts */
-    using arrayfloat_t = std::array<float_t, nparts>;
-     /** the number of particles */
+    using arrayfloat_t = part_array<float_t, nparts>;
+     /** the number of particles (0 if it is chosen at run time) */
     static constexpr unsigned int num_particles = nparts;
    
 
     /**
      * @brief The (one and only) constructor.
      * @param rs the resampling schedule (resample every rs time points). 
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
      */
-    SISRFilter(const unsigned int &rs=1);
+    SISRFilterStatic(const unsigned int &rs=1, const unsigned int &num_threads=1, const size_t &num_parts=nparts);
     
     
     /**
      * @brief The (virtual) destructor.
      */
-    virtual ~SISRFilter();
+    virtual ~SISRFilterStatic();
     
     
     /**
@@ -54,6 +67,44 @@ public:
      * @return log p(y_t | y_{1:t-1}) or log p(y_1)
      */
     float_t getLogCondLike() const; 
+
+
+    /**
+     * @brief Returns the effective sample size of the most recent weights (before any resampling).
+     * @return (sum_i w_i)^2 / sum_i w_i^2
+     */
+    float_t getESS() const;
+
+
+    /**
+     * @brief Makes resampling adaptive. On the scheduled time points, the particles are 
+     * only resampled if the ESS is below frac times the number of particles. 
+     * @param frac the fraction (e.g. .5). 0 (the default) resamples on every scheduled time point.
+     */
+    void setESSThreshold(const float_t &frac);
+
+
+    /**
+     * @brief Returns the number of worker threads (including the calling thread).
+     * @return the number of threads particles are split across
+     */
+    unsigned int getNumThreads() const;
+
+
+    /**
+     * @brief Returns the current number of particles.
+     * @return the number of particles
+     */
+    size_t getNumParticles() const;
+
+
+    /**
+     * @brief Changes the number of particles (only if nparts is dynamic_parts). 
+     * After the first time step, n particles are resampled from the current 
+     * weighted population, so the filter carries on from where it was.
+     * @param n the new number of particles
+     */
+    void setNumParticles(const size_t &n);
     
     
     /**
@@ -61,6 +112,26 @@ public:
      * @return return a std::vector<Mat> of expectations. How many depends on how many callbacks you gave to 
      */
     std::vector<Mat> getExpectations() const;
+
+
+    /**
+     * @brief Registers a functional h that writes h(x_t) into a preallocated rows x cols slot.
+     * Its expectation is computed on every time step (before resampling) along with the other 
+     * registered functionals, in one sweep over the particles and without allocating. 
+     * It gets called from all the worker threads.
+     * @param h the functional
+     * @param rows the number of rows of h(x_t)
+     * @param cols the number of columns of h(x_t)
+     * @return the index of its expectation in getFunctionalExpectations()
+     */
+    size_t addFunctional(const outFunc &h, size_t rows, size_t cols = 1);
+
+
+    /**
+     * @brief return the expectations of the registered functionals
+     * @return one matrix for each registered functional, in the order they were added
+     */
+    const std::vector<Mat>& getFunctionalExpectations() const;
     
     
     /**
@@ -70,24 +141,418 @@ public:
      * @param fs a vector of functions if you want to calculate expectations.
      */
     void filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs = std::vector<std::function<const Mat(const ssv&)> >());
+
+
+    /**
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
+     */
+    void logMuEvBatch (const arrayStates &x1s, arrayfloat_t &out);
+
+
+    /**
+     * @brief Samples every particle from the time 1 proposal. Override this to vectorize.
+     * @param y1 the first observed datum
+     * @param out where the samples are written
+     */
+    void q1SampBatch (const osv &y1, arrayStates &out);
+
+
+    /**
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param y1 the time 1 datum
+     * @param out where the log-densities are written
+     */
+    void logQ1EvBatch (const arrayStates &x1s, const osv &y1, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt the time t datum
+     * @param xts the time t states
+     * @param out where the log-densities are written
+     */
+    void logGEvBatch (const osv &yt, const arrayStates &xts, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates logFEv for every particle. Override this to vectorize.
+     * @param xts the current states
+     * @param xtm1s the previous states
+     * @param out where the log-densities are written
+     */
+    void logFEvBatch (const arrayStates &xts, const arrayStates &xtm1s, arrayfloat_t &out);
+
+
+    /**
+     * @brief Samples every particle from the proposal at time t. Override this to vectorize.
+     * @param xtm1s the previous states
+     * @param yt the current observation
+     * @param out where the samples are written (never the same array as xtm1s)
+     */
+    void qSampBatch (const arrayStates &xtm1s, const osv &yt, arrayStates &out);
+
+
+    /**
+     * @brief Evaluates logQEv for every particle. Override this to vectorize.
+     * @param xts the current states
+     * @param xtm1s the previous states
+     * @param yt the current observation
+     * @param out where the log-densities are written
+     */
+    void logQEvBatch (const arrayStates &xts, const arrayStates &xtm1s, const osv &yt, arrayfloat_t &out);
     
+private:
+
+    /** @brief particle samples */
+    arrayStates m_particles;
+
+    /** @brief particle weights */
+    arrayfloat_t m_logUnNormWeights;
     
+    /** @brief current time point */
+    unsigned int m_now; 
+
+    /** @brief log p(y_t|y_{1:t-1}) or log p(y1) */
+    float_t m_logLastCondLike;  
+    
+    /** @brief resampling object */
+    resamp_t m_resampler;
+
+    /** @brief normalizing, expectations and the resampling decision */
+    FilterCore<nparts, ssv, float_t> m_core;
+
+    /** @brief the previous time's particle samples */
+    arrayStates m_oldParticles;
+
+    /** @brief scratch space for per-particle log densities */
+    arrayfloat_t m_scratch;
+
+
+    /**
+     * @brief the model (i.e. this object as the derived class)
+     * @return a reference to the derived object
+     */
+    Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::SISRFilterStatic(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+                : m_particles(part_storage<ssv, nparts>::make(num_parts))
+                , m_logUnNormWeights(part_storage<float_t, nparts>::make(num_parts))
+                , m_now(0)
+                , m_logLastCondLike(0.0)
+                , m_core(rs, num_threads, num_parts)
+                , m_oldParticles(part_storage<ssv, nparts>::make(num_parts))
+                , m_scratch(part_storage<float_t, nparts>::make(num_parts))
+{
+    share_num_threads(m_resampler, m_core.getNumThreads());
+    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0); // log(1) = 0
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::~SISRFilterStatic() {}
+
+    
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getLogCondLike() const
+{
+    return m_logLastCondLike;
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+float_t SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getESS() const
+{
+    return m_core.getESS();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::setESSThreshold(const float_t &frac)
+{
+    m_core.setESSThreshold(frac);
+}
+    
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+unsigned int SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getNumThreads() const
+{
+    return m_core.getNumThreads();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>    
+auto SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getExpectations() const -> std::vector<Mat> 
+{
+    return m_core.getExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::addFunctional(const outFunc &h, size_t rows, size_t cols)
+{
+    return m_core.addFunctional(h, rows, cols);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+auto SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getFunctionalExpectations() const -> const std::vector<Mat>&
+{
+    return m_core.getFunctionalExpectations();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+size_t SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::getNumParticles() const
+{
+    return m_logUnNormWeights.size();
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::setNumParticles(const size_t &n)
+{
+    part_storage<float_t, nparts>::check(n);
+    if(n == getNumParticles())
+        return;
+
+    if(m_now > 0){
+        // draw the new population from the current weighted one
+        m_resampler.resampLogWts(m_particles, m_logUnNormWeights, n);
+    }else{
+        part_storage<ssv, nparts>::resize(m_particles, n);
+        part_storage<float_t, nparts>::resize(m_logUnNormWeights, n);
+        std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0);
+    }
+    m_core.resize(n);
+    part_storage<ssv, nparts>::resize(m_oldParticles, n);
+    part_storage<float_t, nparts>::resize(m_scratch, n);
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::logMuEvBatch(const arrayStates &x1s, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logMuEv(x1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::q1SampBatch(const osv &y1, arrayStates &out)
+{
+    m_core.pool().parallel_for(out.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().q1Samp(y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::logQ1EvBatch(const arrayStates &x1s, const osv &y1, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(x1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logQ1Ev(x1s[ii], y1);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::logGEvBatch(const osv &yt, const arrayStates &xts, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(xts.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logGEv(yt, xts[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::logFEvBatch(const arrayStates &xts, const arrayStates &xtm1s, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(xts.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logFEv(xts[ii], xtm1s[ii]);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::qSampBatch(const arrayStates &xtm1s, const osv &yt, arrayStates &out)
+{
+    m_core.pool().parallel_for(xtm1s.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().qSamp(xtm1s[ii], yt);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::logQEvBatch(const arrayStates &xts, const arrayStates &xtm1s, const osv &yt, arrayfloat_t &out)
+{
+    m_core.pool().parallel_for(xts.size(), [&](size_t first, size_t last, unsigned int)
+    {
+        for(size_t ii = first; ii < last; ++ii)
+            out[ii] = derived().logQEv(xts[ii], xtm1s[ii], yt);
+    });
+}
+
+
+template<typename Derived, size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilterStatic<Derived, nparts,dimx,dimy,resamp_t,float_t, debug>::filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs)
+{
+    const size_t N = m_logUnNormWeights.size();
+
+    if(m_now > 0)
+    {
+
+        // sample and get weight adjustments for the whole population
+        // (the log-sum-exp reductions are split across workers too)
+        lse_partial<float_t> oldLSE = m_core.reduce(m_logUnNormWeights.data(), N);
+        std::swap(m_particles, m_oldParticles);
+        derived().qSampBatch(m_oldParticles, data, m_particles);
+        derived().logFEvBatch(m_particles, m_oldParticles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+        derived().logGEvBatch(data, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+        derived().logQEvBatch(m_particles, m_oldParticles, data, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] -= m_scratch[ii];
+
+        // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
+        m_logLastCondLike = m_core.weigh(m_logUnNormWeights).logSumExp() - oldLSE.logSumExp();
+    }
+    else // (m_now == 0) //time 1
+    {
+       
+        // sample and weight the whole population
+        derived().q1SampBatch(data, m_particles);
+        derived().logMuEvBatch(m_particles, m_logUnNormWeights);
+        derived().logGEvBatch(data, m_particles, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] += m_scratch[ii];
+        derived().logQ1EvBatch(m_particles, data, m_scratch);
+        for(size_t ii = 0; ii < N; ++ii)
+            m_logUnNormWeights[ii] -= m_scratch[ii];
+
+        // calculate log cond likelihood with log-exp-sum trick
+        m_logLastCondLike = -std::log(N) + m_core.weigh(m_logUnNormWeights).logSumExp();
+    }
+
+    if constexpr(debug) {
+        for(size_t ii = 0; ii < N; ++ii)
+            std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
+    }
+
+    // calculate expectations before you resample
+    m_core.expect(fs, [this](const auto &h, size_t i) { return h(m_particles[i]); });
+    m_core.expectFunctionals([this](size_t i) -> const ssv& { return m_particles[i]; });
+
+    // print stuff if debug mode is on
+    if constexpr(debug) {
+        for(size_t fId = 0; fId < fs.size(); ++fId)
+            std::cout << "transposed expectation " << fId << ": " << m_core.getExpectations()[fId].transpose() << "\n";
+    }
+
+    // resample if you should
+    if(m_core.resampleDue(m_now))
+        m_resampler.resampNormWts(m_particles, m_logUnNormWeights, m_core.normWeights());
+
+    // advance time
+    m_now += 1;
+}
+
+
+//! A base class for the Sequential Important Sampling with Resampling (SISR).
+/**
+ * @class SISRFilter
+ * @author taylor
+ * @file sisr_filter.h
+ * @brief SISR filter.
+ * @tparam nparts the number of particles (or dynamic_parts to choose it at run time)
+ * @tparam dimx the size of the state
+ * @tparam the size of the observation
+ * @tparam resamp_t the type of resampler
+ * 
+ * If num_threads > 1 is passed to the constructor, the particles are split into one 
+ * contiguous chunk per worker thread, and the model methods are called concurrently. 
+ * In that case they must be thread-safe (see thread_pool::this_worker()).
+ * 
+ * The filter only ever calls the "...Batch" methods, which work on the whole population 
+ * at once. By default they loop over the per-particle methods (one chunk per worker), 
+ * so a model only has to override them if it can vectorize. Overridden batch methods are 
+ * called from the calling thread only.
+ * 
+ * The model methods are pure virtual. SISRFilterStatic runs the same algorithm 
+ * without virtual calls if the model is known at compile time.
+ */
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug=false>
+class SISRFilter : public SISRFilterStatic<SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>
+{
+public:
+
+    /** the engine this class plugs its virtual methods into */
+    using base_t = SISRFilterStatic<SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>, nparts, dimx, dimy, resamp_t, float_t, debug>;
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv = typename base_t::ssv;
+    /** "obs size vector" type alias for linear algebra stuff */
+    using osv = typename base_t::osv;
+    /** type alias for linear algebra stuff */
+    using Mat = typename base_t::Mat;
+    /** type alias for linear algebra stuff */
+    using arrayStates = typename base_t::arrayStates;
+    /** type alias for array of float_ts */
+    using arrayfloat_t = typename base_t::arrayfloat_t;
+
+
+    /**
+     * @brief The constructor.
+     * @param rs the resampling schedule (resample every rs time points).
+     * @param num_threads the number of threads used to propagate and weight particles (and to resample, if resamp_t is multi-threaded)
+     * @param num_parts the starting number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    SISRFilter(const unsigned int &rs=1, const unsigned int &num_threads=1, const size_t &num_parts=nparts);
+
+
+    /**
+     * @brief The (virtual) destructor.
+     */
+    virtual ~SISRFilter();
+
+
     /**
      * @brief  Calculate muEv or logmuEv
      * @param x1 is a const Vec& describing the state sample
      * @return the density or log-density evaluation as a float_t
      */
     virtual float_t logMuEv (const ssv &x1) = 0;
-    
-    
+
+
     /**
      * @brief Samples from time 1 proposal 
      * @param y1 is a const Vec& representing the first observed datum 
      * @return the sample as a Vec
      */
     virtual ssv q1Samp (const osv &y1) = 0;    
-    
-    
+
+
     /**
      * @brief Calculate q1Ev or log q1Ev
      * @param x1 is a const Vec& describing the time 1 state sample
@@ -95,8 +560,8 @@ public:
      * @return the density or log-density evaluation as a float_t
      */
     virtual float_t logQ1Ev (const ssv &x1, const osv &y1 ) = 0;
-    
-    
+
+
     /**
      * @brief Calculate gEv or logGEv
      * @param yt is a const Vec& describing the time t datum
@@ -104,8 +569,8 @@ public:
      * @return the density or log-density evaluation as a float_t
      */
     virtual float_t logGEv (const osv &yt, const ssv &xt ) = 0;
-    
-    
+
+
     /**
      * @brief Evaluates the state transition density.
      * @param xt the current state
@@ -113,8 +578,8 @@ public:
      * @return a float_t evaluaton of the log density/pmf
      */
     virtual float_t logFEv (const ssv &xt, const ssv &xtm1 ) = 0;
-    
-    
+
+
     /**
      * @brief Samples from the proposal/instrumental/importance density at time t
      * @param xtm1 the previous state sample
@@ -122,8 +587,8 @@ public:
      * @return a state sample for the current time xt
      */
     virtual ssv qSamp (const ssv &xtm1, const osv &yt ) = 0;
-    
-    
+
+
     /**
      * @brief Evaluates the proposal/instrumental/importance density/pmf
      * @param xt current state
@@ -132,206 +597,129 @@ public:
      * @return a float_t evaluation of the log density/pmf
      */
     virtual float_t logQEv (const ssv &xt, const ssv &xtm1, const osv &yt ) = 0;    
-    
-private:
 
-    /** @brief particle samples */
-    arrayStates m_particles;
 
-    /** @brief particle weights */
-    arrayfloat_t m_logUnNormWeights;
-    
-    /** @brief current time point */
-    unsigned int m_now; 
+    /**
+     * @brief Evaluates logMuEv for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param out where the log-densities are written
+     */
+    virtual void logMuEvBatch (const arrayStates &x1s, arrayfloat_t &out);
+
 
-    /** @brief log p(y_t|y_{1:t-1}) or log p(y1) */
-    float_t m_logLastCondLike;  
-    
-    /** @brief resampling object */
-    resamp_t m_resampler;
-    
-    /** @brief expectations E[h(x_t) | y_{1:t}] for user defined "h"s */
-    std::vector<Mat> m_expectations; // stores any sample averages the user wants
-    
-    /** @brief resampling schedule (e.g. resample every __ time points) */
-    unsigned int m_resampSched;
-    
-    
     /**
-     * @todo implement ESS stuff
+     * @brief Samples every particle from the time 1 proposal. Override this to vectorize.
+     * @param y1 the first observed datum
+     * @param out where the samples are written
      */
-  
-};
+    virtual void q1SampBatch (const osv &y1, arrayStates &out);
+
 
+    /**
+     * @brief Evaluates logQ1Ev for every particle. Override this to vectorize.
+     * @param x1s the time 1 state samples
+     * @param y1 the time 1 datum
+     * @param out where the log-densities are written
+     */
+    virtual void logQ1EvBatch (const arrayStates &x1s, const osv &y1, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates logGEv for every particle. Override this to vectorize.
+     * @param yt the time t datum
+     * @param xts the time t states
+     * @param out where the log-densities are written
+     */
+    virtual void logGEvBatch (const osv &yt, const arrayStates &xts, arrayfloat_t &out);
+
+
+    /**
+     * @brief Evaluates logFEv for every particle. Override this to vectorize.
+     * @param xts the current states
+     * @param xtm1s the previous states
+     * @param out where the log-densities are written
+     */
+    virtual void logFEvBatch (const arrayStates &xts, const arrayStates &xtm1s, arrayfloat_t &out);
+
+
+    /**
+     * @brief Samples every particle from the proposal at time t. Override this to vectorize.
+     * @param xtm1s the previous states
+     * @param yt the current observation
+     * @param out where the samples are written (never the same array as xtm1s)
+     */
+    virtual void qSampBatch (const arrayStates &xtm1s, const osv &yt, arrayStates &out);
+
+
+    /**
+     * @brief Evaluates logQEv for every particle. Override this to vectorize.
+     * @param xts the current states
+     * @param xtm1s the previous states
+     * @param yt the current observation
+     * @param out where the log-densities are written
+     */
+    virtual void logQEvBatch (const arrayStates &xts, const arrayStates &xtm1s, const osv &yt, arrayfloat_t &out);
+};
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-SISRFilter<nparts,dimx,dimy,resamp_t,float_t, debug>::SISRFilter(const unsigned int &rs)
-                : m_now(0)
-                , m_logLastCondLike(0.0)
-                , m_resampSched(rs) 
+SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::SISRFilter(const unsigned int &rs, const unsigned int &num_threads, const size_t &num_parts)
+    : base_t(rs, num_threads, num_parts)
 {
-    std::fill(m_logUnNormWeights.begin(), m_logUnNormWeights.end(), 0.0); // log(1) = 0
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-SISRFilter<nparts,dimx,dimy,resamp_t,float_t, debug>::~SISRFilter() {}
+SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::~SISRFilter() {}
+
 
-    
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-float_t SISRFilter<nparts,dimx,dimy,resamp_t,float_t, debug>::getLogCondLike() const
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logMuEvBatch(const arrayStates &x1s, arrayfloat_t &out)
 {
-    return m_logLastCondLike;
+    base_t::logMuEvBatch(x1s, out);
 }
-    
 
-template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>    
-auto SISRFilter<nparts,dimx,dimy,resamp_t,float_t, debug>::getExpectations() const -> std::vector<Mat> 
+
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::q1SampBatch(const osv &y1, arrayStates &out)
 {
-    return m_expectations;
+    base_t::q1SampBatch(y1, out);
 }
 
 
 template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
-void SISRFilter<nparts,dimx,dimy,resamp_t,float_t, debug>::filter(const osv &data, const std::vector<std::function<const Mat(const ssv&)> >& fs)
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logQ1EvBatch(const arrayStates &x1s, const osv &y1, arrayfloat_t &out)
 {
+    base_t::logQ1EvBatch(x1s, y1, out);
+}
 
-    if(m_now > 0)
-    {
-
-        // try to iterate over particles all at once
-        ssv newSamp;
-        arrayfloat_t oldLogUnNormWts = m_logUnNormWeights;
-        float_t maxOldLogUnNormWts(-1.0/0.0);
-        for(size_t ii = 0; ii < nparts; ++ii)
-        {
-
-            // update max of old logUnNormWts before you change the element
-            if (m_logUnNormWeights[ii] > maxOldLogUnNormWts)
-                maxOldLogUnNormWts = m_logUnNormWeights[ii];
-            
-            // sample and get weight adjustments
-            newSamp = qSamp(m_particles[ii], data);
-            m_logUnNormWeights[ii]  = logFEv(newSamp, m_particles[ii]);
-            m_logUnNormWeights[ii] += logGEv(data, newSamp);
-            m_logUnNormWeights[ii] -= logQEv(newSamp, m_particles[ii], data);
-
-            // overwrite stuff
-            m_particles[ii] = newSamp;
-
-            if constexpr(debug) 
-                std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
-        
-        }
-       
-        // compute estimate of log p(y_t|y_{1:t-1}) with log-exp-sum trick
-        float_t maxNumer = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end()); //because you added log adjustments
-        float_t sumExp1(0.0);
-        float_t sumExp2(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp1 += std::exp(m_logUnNormWeights[i] - maxNumer);
-            sumExp2 += std::exp(oldLogUnNormWts[i] - maxOldLogUnNormWts);
-        }
-        m_logLastCondLike = maxNumer + std::log(sumExp1) - maxOldLogUnNormWts - std::log(sumExp2);
-
-        // calculate expectations before you resample
-        unsigned int fId(0);
-        float_t weightNormConst(0.0);
-        for(auto & h : fs){ // iterate over all functions
-
-            Mat testOut = h(m_particles[0]);
-            unsigned int rows = testOut.rows();
-            unsigned int cols = testOut.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ // iterate over all particles
-                numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl]);
-                denom += std::exp(m_logUnNormWeights[prtcl]);
-            }
-            m_expectations[fId] = numer/denom;
-
-            // print stuff if debug mode is on
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << ": " << m_expectations[fId].transpose() << "\n";
-
-            fId++;
-        }
- 
-        // resample if you should
-        if( (m_now + 1) % m_resampSched == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-
-        // advance time
-        m_now += 1;       
-    }
-    else // (m_now == 0) //time 1
-    {
-       
-        // only need to iterate over particles once
-        float_t sumWts(0.0);
-        for(size_t ii = 0; ii < nparts; ++ii)
-        {
-            // sample particles
-            m_particles[ii] = q1Samp(data);
-            m_logUnNormWeights[ii] = logMuEv(m_particles[ii]);
-            m_logUnNormWeights[ii] += logGEv(data, m_particles[ii]);
-            m_logUnNormWeights[ii] -= logQ1Ev(m_particles[ii], data);
-
-            if constexpr(debug) 
-                std::cout << "time: " << m_now << ", transposed sample: " << m_particles[ii].transpose() << ", log unnorm weight: " << m_logUnNormWeights[ii] << "\n";
-
-
-        }
-       
-        // calculate log cond likelihood with log-exp-sum trick
-        float_t max = *std::max_element(m_logUnNormWeights.begin(), m_logUnNormWeights.end());
-        float_t sumExp(0.0);
-        for(size_t i = 0; i < nparts; ++i){
-            sumExp += std::exp(m_logUnNormWeights[i] - max);
-        }
-        m_logLastCondLike = -std::log(nparts) + max + std::log(sumExp);
-   
-        // calculate expectations before you resample
-        m_expectations.resize(fs.size());
-        unsigned int fId(0);
-        for(auto & h : fs){
-            
-            Mat testOut = h(m_particles[0]);
-            unsigned int rows = testOut.rows();
-            unsigned int cols = testOut.cols();
-            Mat numer = Mat::Zero(rows,cols);
-            float_t denom(0.0);
-
-            for(size_t prtcl = 0; prtcl < nparts; ++prtcl){ 
-                numer += h(m_particles[prtcl]) * std::exp(m_logUnNormWeights[prtcl]);
-                denom += std::exp(m_logUnNormWeights[prtcl]);
-            }
-            m_expectations[fId] = numer/denom;
-
-            // print stuff if debug mode is on
-            if constexpr(debug)
-                std::cout << "transposed expectation " << fId << ": " << m_expectations[fId].transpose() << "\n";
-
-            fId++;
-        }
-   
-        // resample if you should
-        if( (m_now + 1) % m_resampSched == 0)
-            m_resampler.resampLogWts(m_particles, m_logUnNormWeights);
-   
-        // advance time step
-        m_now += 1;   
-    }
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logGEvBatch(const osv &yt, const arrayStates &xts, arrayfloat_t &out)
+{
+    base_t::logGEvBatch(yt, xts, out);
 }
 
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logFEvBatch(const arrayStates &xts, const arrayStates &xtm1s, arrayfloat_t &out)
+{
+    base_t::logFEvBatch(xts, xtm1s, out);
+}
 
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::qSampBatch(const arrayStates &xtm1s, const osv &yt, arrayStates &out)
+{
+    base_t::qSampBatch(xtm1s, yt, out);
+}
 
 
+template<size_t nparts, size_t dimx, size_t dimy, typename resamp_t, typename float_t, bool debug>
+void SISRFilter<nparts, dimx, dimy, resamp_t, float_t, debug>::logQEvBatch(const arrayStates &xts, const arrayStates &xtm1s, const osv &yt, arrayfloat_t &out)
+{
+    base_t::logQEvBatch(xts, xtm1s, yt, out);
+}
 
 
 #endif //SISR_FILTER_H
@@ -0,0 +1,224 @@
+#ifndef SOA_PARTICLES_H
+#define SOA_PARTICLES_H
+
+#include <array>
+#include <utility> // swap
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector> // aligned_allocator
+
+#include "part_storage.h"
+
+
+//! Structure-of-arrays storage for particles.
+/**
+ * @class soa_particles
+ * @author t
+ * @file soa_particles.h
+ * @brief Stores all particles in one contiguous, aligned dimx x nparts buffer.
+ * Each row holds one coordinate of the state for every particle, so a whole coordinate
+ * can be processed with packet (SIMD) instructions. Rows are padded so that
+ * each one starts on an aligned boundary. The buffer is exposed as an Eigen::Map,
+ * and column j of the map is particle j. The buffer is always on the heap; if nparts
+ * is dynamic_parts, the number of particles can also change.
+ * @tparam nparts the number of particles (or dynamic_parts)
+ * @tparam dimx the dimension of each state
+ * @tparam float_t (e.g. double, float, etc.)
+ */
+template<size_t nparts, size_t dimx, typename float_t>
+class soa_particles
+{
+public:
+
+    /** "state size vector" type alias for linear algebra stuff */
+    using ssv         = Eigen::Matrix<float_t, dimx, 1>;
+    /** type alias for the (row-major) shape of the particle matrix */
+    using matType     = Eigen::Matrix<float_t, dimx, Eigen::Dynamic, Eigen::RowMajor>;
+    /** type alias for a writable view of all particles */
+    using mapType     = Eigen::Map<matType, Eigen::AlignedMax, Eigen::OuterStride<>>;
+    /** type alias for a read-only view of all particles */
+    using constMapType = Eigen::Map<const matType, Eigen::AlignedMax, Eigen::OuterStride<>>;
+    /** type alias for a writable block of consecutive particles (what model callbacks see) */
+    using block_t     = Eigen::Ref<matType, 0, Eigen::OuterStride<>>;
+    /** type alias for a read-only block of consecutive particles */
+    using constBlock_t = Eigen::Ref<const matType, 0, Eigen::OuterStride<>>;
+    /** type alias for ancestor indexes */
+    using arrayInt    = part_array<unsigned int, nparts>;
+
+    /**
+     * @brief the length of a row that holds n particles, after padding
+     * @param n the number of particles
+     * @return the padded row length
+     */
+    static constexpr size_t paddedLength(size_t n)
+    {
+        return ((n * sizeof(float_t) + EIGEN_MAX_ALIGN_BYTES - 1) / EIGEN_MAX_ALIGN_BYTES) * EIGEN_MAX_ALIGN_BYTES / sizeof(float_t);
+    }
+
+
+    /**
+     * @brief The constructor allocates the buffer and zeros it out.
+     * @param n the number of particles (must be nparts unless nparts is dynamic_parts)
+     */
+    explicit soa_particles(size_t n = nparts);
+
+
+    /**
+     * @brief the number of particles
+     * @return the number of particles
+     */
+    size_t size() const;
+
+
+    /**
+     * @brief changes the number of particles. The contents are zeroed out.
+     * @param n the new number of particles
+     */
+    void resize(size_t n);
+
+
+    /**
+     * @brief a view of all the particles
+     * @return a dimx x nparts Eigen::Map
+     */
+    mapType map();
+
+
+    /**
+     * @brief a read-only view of all the particles
+     * @return a dimx x nparts Eigen::Map
+     */
+    constMapType map() const;
+
+
+    /**
+     * @brief copies out one particle
+     * @param i the particle index
+     * @return the particle as a state sized vector
+     */
+    ssv get(size_t i) const;
+
+
+    /**
+     * @brief overwrites one particle
+     * @param i the particle index
+     * @param x the new state
+     */
+    void set(size_t i, const ssv &x);
+
+
+    /**
+     * @brief replaces particle i with old particle ancestors[i] for all i (row by row).
+     * Afterwards there are ancestors.size() particles.
+     * @param ancestors the indexes of the particles that survive resampling
+     */
+    void gather(const arrayInt &ancestors);
+
+
+    /**
+     * @brief swaps buffers with another set of particles (no copying)
+     * @param other the other particles
+     */
+    void swap(soa_particles &other);
+
+private:
+
+    /** @brief the number of particles */
+    size_t m_n;
+
+    /** @brief the length of each (padded) row */
+    size_t m_stride;
+
+    /** @brief the buffer (dimx rows, each m_stride long) */
+    std::vector<float_t, Eigen::aligned_allocator<float_t>> m_data;
+
+    /** @brief scratch space for gather() */
+    std::vector<float_t, Eigen::aligned_allocator<float_t>> m_scratch;
+};
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+soa_particles<nparts, dimx, float_t>::soa_particles(size_t n)
+    : m_n(n)
+    , m_stride(paddedLength(n))
+    , m_data(dimx * m_stride, 0.0)
+    , m_scratch(dimx * m_stride, 0.0)
+{
+    part_storage<float_t, nparts>::check(n);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+size_t soa_particles<nparts, dimx, float_t>::size() const
+{
+    return m_n;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+void soa_particles<nparts, dimx, float_t>::resize(size_t n)
+{
+    part_storage<float_t, nparts>::check(n);
+    m_n = n;
+    m_stride = paddedLength(n);
+    m_data.assign(dimx * m_stride, 0.0);
+    m_scratch.assign(dimx * m_stride, 0.0);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+auto soa_particles<nparts, dimx, float_t>::map() -> mapType
+{
+    return mapType(m_data.data(), dimx, m_n, Eigen::OuterStride<>(m_stride));
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+auto soa_particles<nparts, dimx, float_t>::map() const -> constMapType
+{
+    return constMapType(m_data.data(), dimx, m_n, Eigen::OuterStride<>(m_stride));
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+auto soa_particles<nparts, dimx, float_t>::get(size_t i) const -> ssv
+{
+    return map().col(i);
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+void soa_particles<nparts, dimx, float_t>::set(size_t i, const ssv &x)
+{
+    map().col(i) = x;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+void soa_particles<nparts, dimx, float_t>::gather(const arrayInt &ancestors)
+{
+    const size_t n = ancestors.size();
+    const size_t newStride = paddedLength(n);
+    m_scratch.resize(dimx * newStride);
+    for(size_t r = 0; r < dimx; ++r){
+        const float_t *src = m_data.data() + r*m_stride;
+        float_t *dst = m_scratch.data() + r*newStride;
+        for(size_t i = 0; i < n; ++i)
+            dst[i] = src[ancestors[i]];
+    }
+    m_data.swap(m_scratch);
+    m_n = n;
+    m_stride = newStride;
+}
+
+
+template<size_t nparts, size_t dimx, typename float_t>
+void soa_particles<nparts, dimx, float_t>::swap(soa_particles &other)
+{
+    m_data.swap(other.m_data);
+    std::swap(m_n, other.m_n);
+    std::swap(m_stride, other.m_stride);
+}
+
+
+#endif // SOA_PARTICLES_H
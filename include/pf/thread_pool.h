@@ -0,0 +1,244 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! A small pool of persistent worker threads used to split up loops over particles.
+/**
+ * @class thread_pool
+ * @author t
+ * @file thread_pool.h
+ * @brief Splits the range [0, n) into one contiguous chunk per worker. The calling
+ * thread is always worker 0, so a pool of size 1 never spawns a thread and runs everything
+ * inline. Chunk boundaries only depend on n and the number of workers, so anything
+ * that is keyed on the worker index (e.g. one random number generator per worker)
+ * is reproducible for a fixed thread count. Jobs must not call back into the same pool.
+ */
+class thread_pool
+{
+public:
+
+    /**
+     * @brief The constructor spawns num_threads - 1 worker threads.
+     * @param num_threads the total number of workers (including the calling thread). 0 is treated as 1.
+     */
+    inline explicit thread_pool(unsigned int num_threads = 1);
+
+
+    /**
+     * @brief The destructor joins all the worker threads.
+     */
+    inline ~thread_pool();
+
+
+    /* pools own threads, so they can't be copied */
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+
+    /**
+     * @brief the number of workers (including the calling thread)
+     * @return the number of workers
+     */
+    inline unsigned int size() const;
+
+
+    /**
+     * @brief calls f(worker) once on every worker and waits for all of them to finish.
+     * The first exception thrown by any worker is rethrown in the calling thread.
+     * @param f a callable taking an unsigned int worker index
+     */
+    template<typename func_t>
+    void run(func_t &&f);
+
+
+    /**
+     * @brief calls f(first, last, worker) for one contiguous chunk [first, last) of [0, n) per worker.
+     * @param n the size of the index range
+     * @param f a callable taking (size_t first, size_t last, unsigned int worker)
+     */
+    template<typename func_t>
+    void parallel_for(size_t n, func_t &&f);
+
+
+    /**
+     * @brief the index of the worker that is executing the current job.
+     * Model code can use this to pick per-worker state (e.g. a sampler).
+     * @return 0 for the calling thread, 1, 2, ... for the spawned threads
+     */
+    static inline unsigned int this_worker();
+
+private:
+
+    /** @brief spawned threads (there are size() - 1 of them) */
+    std::vector<std::thread> m_threads;
+
+    /** @brief guards everything below */
+    std::mutex m_mut;
+
+    /** @brief wakes up the workers when a new job is posted */
+    std::condition_variable m_start_cv;
+
+    /** @brief wakes up the caller when the last worker finishes */
+    std::condition_variable m_done_cv;
+
+    /** @brief the current job */
+    std::function<void(unsigned int)> m_job;
+
+    /** @brief the first exception thrown by a spawned thread */
+    std::exception_ptr m_error;
+
+    /** @brief incremented every time a new job is posted */
+    unsigned long m_generation;
+
+    /** @brief number of spawned threads still working on the current job */
+    unsigned int m_pending;
+
+    /** @brief tells the spawned threads to exit */
+    bool m_stop;
+
+    /**
+     * @brief the loop each spawned thread runs
+     * @param id the worker index of this thread
+     */
+    inline void work(unsigned int id);
+
+    /**
+     * @brief storage for this_worker()
+     * @return a reference to this thread's worker index
+     */
+    static inline unsigned int& worker_id();
+};
+
+
+thread_pool::thread_pool(unsigned int num_threads)
+    : m_generation(0)
+    , m_pending(0)
+    , m_stop(false)
+{
+    for(unsigned int id = 1; id < num_threads; ++id)
+        m_threads.emplace_back(&thread_pool::work, this, id);
+}
+
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mut);
+        m_stop = true;
+    }
+    m_start_cv.notify_all();
+    for(auto &t : m_threads)
+        t.join();
+}
+
+
+unsigned int thread_pool::size() const
+{
+    return m_threads.size() + 1;
+}
+
+
+unsigned int& thread_pool::worker_id()
+{
+    thread_local unsigned int id = 0;
+    return id;
+}
+
+
+unsigned int thread_pool::this_worker()
+{
+    return worker_id();
+}
+
+
+void thread_pool::work(unsigned int id)
+{
+    worker_id() = id;
+    unsigned long seen(0);
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mut);
+            m_start_cv.wait(lock, [&]{ return m_stop || m_generation != seen; });
+            if(m_stop)
+                return;
+            seen = m_generation;
+        }
+
+        // m_job isn't touched by the caller until m_pending hits 0
+        try {
+            m_job(id);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(m_mut);
+            if(!m_error)
+                m_error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mut);
+        if(--m_pending == 0)
+            m_done_cv.notify_one();
+    }
+}
+
+
+template<typename func_t>
+void thread_pool::run(func_t &&f)
+{
+    // nothing to hand off
+    if(m_threads.empty()){
+        f(0u);
+        return;
+    }
+
+    // post the job
+    {
+        std::lock_guard<std::mutex> lock(m_mut);
+        m_job = [&f](unsigned int w){ f(w); };
+        m_error = nullptr;
+        m_pending = m_threads.size();
+        ++m_generation;
+    }
+    m_start_cv.notify_all();
+
+    // the calling thread is worker 0
+    std::exception_ptr err;
+    try {
+        f(0u);
+    } catch(...) {
+        err = std::current_exception();
+    }
+
+    // wait for everybody else
+    std::unique_lock<std::mutex> lock(m_mut);
+    m_done_cv.wait(lock, [this]{ return m_pending == 0; });
+    m_job = nullptr;
+    if(!err)
+        err = m_error;
+    lock.unlock();
+
+    if(err)
+        std::rethrow_exception(err);
+}
+
+
+template<typename func_t>
+void thread_pool::parallel_for(size_t n, func_t &&f)
+{
+    const size_t nw = size();
+    run([&](unsigned int w){
+        size_t first = n * w / nw;
+        size_t last  = n * (w + 1) / nw;
+        if(first < last)
+            f(first, last, w);
+    });
+}
+
+
+#endif // THREAD_POOL_H
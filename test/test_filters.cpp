@@ -0,0 +1,498 @@
+#include <catch2/catch.hpp>
+
+#include <pf/auxiliary_pf.h>
+#include <pf/bootstrap_filter.h>
+#include <pf/bootstrap_filter_soa.h>
+#include <pf/sisr_filter.h>
+#include <pf/sisr_filter_soa.h>
+#include <pf/resamplers.h>
+#include <pf/parallel_resamplers.h>
+#include <pf/rv_eval.h>
+#include <pf/rv_samp.h>
+
+#define FILTNPARTS 500
+
+
+// x_t = .9 x_{t-1} + e_t, y_t = x_t + u_t, with standard normal noise
+// one sampler per worker so that the parallel filters are reproducible
+// (has everything the bootstrap, SISR and auxiliary filters ask for)
+template<typename base_t>
+class ar1_model : public base_t 
+{
+public:
+    using ssv = Eigen::Matrix<double,1,1>;
+    using osv = Eigen::Matrix<double,1,1>;
+
+    std::vector<rvsamp::UnivNormSampler<double>> m_samplers;
+
+    ar1_model(unsigned int nthreads, std::uint32_t seed, size_t nparts = FILTNPARTS) 
+        : base_t(1, nthreads, nparts), m_samplers(nthreads)
+    {
+        for(unsigned int w = 0; w < nthreads; ++w)
+            m_samplers[w].setSeed(seed + w);
+    }
+
+    double z() { return m_samplers[thread_pool::this_worker()].sample(); }
+
+    double logMuEv(const ssv &x1) { return rveval::evalUnivNorm<double>(x1(0), 0.0, 1.0/std::sqrt(.19), true); }
+    ssv q1Samp(const osv &) { ssv x; x(0) = z()/std::sqrt(.19); return x; }
+    double logQ1Ev(const ssv &x1, const osv &) { return logMuEv(x1); }
+    double logGEv(const osv &yt, const ssv &xt) { return rveval::evalUnivNorm<double>(yt(0), xt(0), 1.0, true); }
+    ssv fSamp(const ssv &xtm1) { ssv x; x(0) = .9*xtm1(0) + z(); return x; }
+    double logFEv(const ssv &xt, const ssv &xtm1) { return rveval::evalUnivNorm<double>(xt(0), .9*xtm1(0), 1.0, true); }
+    ssv qSamp(const ssv &xtm1, const osv &) { return fSamp(xtm1); }
+    double logQEv(const ssv &xt, const ssv &xtm1, const osv &) { return logFEv(xt, xtm1); }
+    ssv propMu(const ssv &xtm1) { return .9*xtm1; }
+};
+
+
+// the bootstrap filter's resampler is visible, so it can be seeded too
+template<typename base_t>
+class ar1_bs : public ar1_model<base_t>
+{
+public:
+    ar1_bs(unsigned int nthreads, std::uint32_t seed, size_t nparts = FILTNPARTS) 
+        : ar1_model<base_t>(nthreads, seed, nparts)
+    {
+        this->m_resampler.setSeed(seed);
+    }
+};
+
+// reports how many workers the filter gave its resampler
+template<typename base_t>
+class ar1_par : public ar1_bs<base_t>
+{
+public:
+    using ar1_bs<base_t>::ar1_bs;
+
+    unsigned int resamplerThreads() const { return this->m_resampler.getNumThreads(); }
+};
+
+// overrides one of the whole-population callbacks
+template<typename base_t>
+class ar1_batch : public ar1_bs<base_t>
+{
+public:
+    using arrayStates = typename base_t::arrayStates;
+    using arrayFloat = typename base_t::arrayFloat;
+    using osv = Eigen::Matrix<double,1,1>;
+
+    unsigned int m_batchCalls;
+
+    ar1_batch(unsigned int nthreads, std::uint32_t seed) : ar1_bs<base_t>(nthreads, seed), m_batchCalls(0) {}
+
+    void logGEvBatch(const osv &yt, const arrayStates &xts, arrayFloat &out) override
+    {
+        m_batchCalls++;
+        for(size_t i = 0; i < out.size(); ++i)
+            out[i] = -.5*(yt(0) - xts[i](0))*(yt(0) - xts[i](0)) - .5*std::log(2*M_PI);
+    }
+};
+
+
+// the same model with compile-time dispatch (no virtual calls)
+class ar1_static : public BSFilterStatic<ar1_static, FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>
+{
+public:
+    using ssv = Eigen::Matrix<double,1,1>;
+    using osv = Eigen::Matrix<double,1,1>;
+
+    rvsamp::UnivNormSampler<double> m_sampler;
+
+    explicit ar1_static(std::uint32_t seed) 
+    {
+        m_sampler.setSeed(seed);
+        m_resampler.setSeed(seed);
+    }
+
+    double logMuEv(const ssv &x1) { return rveval::evalUnivNorm<double>(x1(0), 0.0, 1.0/std::sqrt(.19), true); }
+    ssv q1Samp(const osv &) { ssv x; x(0) = m_sampler.sample()/std::sqrt(.19); return x; }
+    double logQ1Ev(const ssv &x1, const osv &) { return logMuEv(x1); }
+    double logGEv(const osv &yt, const ssv &xt) { return rveval::evalUnivNorm<double>(yt(0), xt(0), 1.0, true); }
+    ssv fSamp(const ssv &xtm1) { ssv x; x(0) = .9*xtm1(0) + m_sampler.sample(); return x; }
+};
+
+
+// the same model written against the block (structure-of-arrays) interface
+template<typename base_t>
+class ar1_soa : public base_t 
+{
+public:
+    using osv = Eigen::Matrix<double,1,1>;
+    using stateBlock = typename base_t::stateBlock;
+    using constStateBlock = typename base_t::constStateBlock;
+    using floatBlock = typename base_t::floatBlock;
+
+    std::vector<rvsamp::UnivNormSampler<double>> m_samplers;
+
+    ar1_soa(unsigned int nthreads, std::uint32_t seed, size_t nparts = FILTNPARTS) 
+        : base_t(1, nthreads, nparts), m_samplers(nthreads)
+    {
+        for(unsigned int w = 0; w < nthreads; ++w)
+            m_samplers[w].setSeed(seed + w);
+    }
+
+    double z() { return m_samplers[thread_pool::this_worker()].sample(); }
+
+    // log N(x; mean, 1) for a whole row at once
+    template<typename T>
+    static auto logStdNorm(const T& resid) { return -.5*resid.square() - .5*std::log(2*M_PI); }
+
+    void logMuEvBlock(constStateBlock x1s, floatBlock out) { out = (logStdNorm(x1s.row(0).array()*std::sqrt(.19)) + .5*std::log(.19)).transpose(); }
+    void q1SampBlock(const osv &, stateBlock x1s) { for(int i = 0; i < x1s.cols(); ++i) x1s(0,i) = z()/std::sqrt(.19); }
+    void logQ1EvBlock(constStateBlock x1s, const osv &, floatBlock out) { logMuEvBlock(x1s, out); }
+    void logGEvBlock(const osv &yt, constStateBlock xts, floatBlock out) { out = logStdNorm(xts.row(0).array() - yt(0)).transpose(); }
+    void fSampBlock(stateBlock xs) { for(int i = 0; i < xs.cols(); ++i) xs(0,i) = .9*xs(0,i) + z(); }
+    void logFEvBlock(constStateBlock xts, constStateBlock xtm1s, floatBlock out) { out = logStdNorm(xts.row(0).array() - .9*xtm1s.row(0).array()).transpose(); }
+    void qSampBlock(constStateBlock xtm1s, const osv &, stateBlock xts) { for(int i = 0; i < xts.cols(); ++i) xts(0,i) = .9*xtm1s(0,i) + z(); }
+    void logQEvBlock(constStateBlock xts, constStateBlock xtm1s, const osv &, floatBlock out) { logFEvBlock(xts, xtm1s, out); }
+};
+
+
+using bs_t = BSFilter<FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>;
+using sisr_t = SISRFilter<FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>;
+using apf_t = APF<FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>;
+using bs_soa_t = BSFilterSoA<FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>;
+using sisr_soa_t = SISRFilterSoA<FILTNPARTS, 1, 1, systematic_resampler<FILTNPARTS,1,double>, double>;
+using bs_dyn_t = BSFilter<dynamic_parts, 1, 1, systematic_resampler<dynamic_parts,1,double>, double>;
+using sisr_dyn_t = SISRFilter<dynamic_parts, 1, 1, systematic_resampler<dynamic_parts,1,double>, double>;
+using apf_dyn_t = APF<dynamic_parts, 1, 1, systematic_resampler<dynamic_parts,1,double>, double>;
+using sisr_soa_dyn_t = SISRFilterSoA<dynamic_parts, 1, 1, systematic_resampler<dynamic_parts,1,double>, double>;
+
+
+TEST_CASE("parallel bootstrap filter is reproducible for a fixed seed and thread count", "[filters]")
+{
+    ar1_bs<bs_t> f1(4, 123);
+    ar1_bs<bs_t> f2(4, 123);
+    REQUIRE(f1.getNumThreads() == 4);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        f1.filter(y);
+        f2.filter(y);
+        REQUIRE(std::isfinite(f1.getLogCondLike()));
+        REQUIRE(f1.getLogCondLike() == f2.getLogCondLike());
+    }
+}
+
+
+TEST_CASE("serial and parallel bootstrap filters agree in distribution", "[filters]")
+{
+    ar1_bs<bs_t> serial(1, 1);
+    ar1_bs<bs_t> parallel(3, 2);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        serial.filter(y, fs);
+        parallel.filter(y, fs);
+        ll1 += serial.getLogCondLike();
+        ll2 += parallel.getLogCondLike();
+        REQUIRE(serial.getExpectations()[0](0) == Approx(parallel.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
+
+
+TEMPLATE_TEST_CASE("serial and parallel SISR and auxiliary filters agree in distribution", "[filters]", sisr_t, apf_t)
+{
+    ar1_model<TestType> serial(1, 1);
+    ar1_model<TestType> parallel(4, 2);
+    REQUIRE(parallel.getNumThreads() == 4);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        serial.filter(y, fs);
+        parallel.filter(y, fs);
+        REQUIRE(std::isfinite(parallel.getLogCondLike()));
+        ll1 += serial.getLogCondLike();
+        ll2 += parallel.getLogCondLike();
+        REQUIRE(serial.getExpectations()[0](0) == Approx(parallel.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
+
+
+TEMPLATE_TEST_CASE("structure-of-arrays filters agree with the per-particle bootstrap filter", "[filters]", bs_soa_t, sisr_soa_t)
+{
+    ar1_model<bs_t> aos(1, 1);
+    ar1_soa<TestType> soa(2, 2);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        aos.filter(y, fs);
+        soa.filter(y, fs);
+        REQUIRE(std::isfinite(soa.getLogCondLike()));
+        ll1 += aos.getLogCondLike();
+        ll2 += soa.getLogCondLike();
+        REQUIRE(aos.getExpectations()[0](0) == Approx(soa.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
+
+
+TEST_CASE("overridden batch callbacks replace the per-particle ones", "[filters]")
+{
+    ar1_bs<bs_t> perParticle(1, 7);
+    ar1_batch<bs_t> batched(1, 7);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 10; ++t){
+        y(0) = std::cos(t);
+        perParticle.filter(y);
+        batched.filter(y);
+        REQUIRE(perParticle.getLogCondLike() == Approx(batched.getLogCondLike()));
+    }
+    REQUIRE(batched.m_batchCalls == 10);
+}
+
+
+TEST_CASE("static and virtual dispatch give the same bootstrap filter", "[filters]")
+{
+    ar1_bs<bs_t> virt(1, 11);
+    ar1_static stat(11);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 10; ++t){
+        y(0) = std::sin(t);
+        virt.filter(y);
+        stat.filter(y);
+        REQUIRE(virt.getLogCondLike() == stat.getLogCondLike());
+    }
+}
+
+
+TEST_CASE("run-time and compile-time particle counts give the same bootstrap filter", "[filters]")
+{
+    ar1_bs<bs_t> fixed(1, 5);
+    ar1_bs<bs_dyn_t> dyn(1, 5, FILTNPARTS);
+    REQUIRE(dyn.getNumParticles() == FILTNPARTS);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 10; ++t){
+        y(0) = std::sin(t);
+        fixed.filter(y);
+        dyn.filter(y);
+        REQUIRE(fixed.getLogCondLike() == dyn.getLogCondLike());
+    }
+}
+
+
+TEMPLATE_TEST_CASE("run-time particle counts can change between time steps", "[filters]", bs_dyn_t, sisr_dyn_t, apf_dyn_t)
+{
+    ar1_model<TestType> f(2, 3, 100);
+
+    Eigen::Matrix<double,1,1> y;
+    const size_t sizes[] = {100, 100, 2000, 2000, 50, 50, 701};
+    for(int t = 0; t < 7; ++t){
+        f.setNumParticles(sizes[t]);
+        REQUIRE(f.getNumParticles() == sizes[t]);
+        y(0) = std::sin(t);
+        f.filter(y);
+        REQUIRE(std::isfinite(f.getLogCondLike()));
+    }
+}
+
+
+TEST_CASE("run-time particle counts work with structure-of-arrays storage", "[filters]")
+{
+    ar1_soa<sisr_soa_dyn_t> f(2, 3, 64);
+
+    Eigen::Matrix<double,1,1> y;
+    for(size_t t = 0; t < 6; ++t){
+        f.setNumParticles(64 + 37*t);
+        REQUIRE(f.getNumParticles() == 64 + 37*t);
+        y(0) = std::cos(t);
+        f.filter(y);
+        REQUIRE(std::isfinite(f.getLogCondLike()));
+    }
+}
+
+
+TEMPLATE_TEST_CASE("run-time particle counts must be positive", "[filters]", bs_dyn_t, sisr_dyn_t, apf_dyn_t)
+{
+    // the filters' constructors default to nparts particles, which is zero here
+    REQUIRE_THROWS_AS(ar1_model<TestType>(1, 3, dynamic_parts), std::invalid_argument);
+    REQUIRE_THROWS_AS(ar1_soa<sisr_soa_dyn_t>(1, 3, dynamic_parts), std::invalid_argument);
+
+    ar1_model<TestType> f(1, 3, 100);
+    REQUIRE_THROWS_AS(f.setNumParticles(0), std::invalid_argument);
+    Eigen::Matrix<double,1,1> y;
+    y(0) = 1.0;
+    f.filter(y);
+    REQUIRE_THROWS_AS(f.setNumParticles(0), std::invalid_argument);
+    REQUIRE(f.getNumParticles() == 100);
+}
+
+
+TEST_CASE("compile-time particle counts can't be changed", "[filters]")
+{
+    ar1_bs<bs_t> f(1, 3);
+    REQUIRE_NOTHROW(f.setNumParticles(FILTNPARTS));
+    REQUIRE_THROWS_AS(f.setNumParticles(FILTNPARTS + 1), std::invalid_argument);
+    REQUIRE_THROWS_AS(ar1_bs<bs_t>(1, 3, 10), std::invalid_argument);
+}
+
+
+TEMPLATE_TEST_CASE("adaptive resampling agrees with resampling every time", "[filters]", bs_t, sisr_t, apf_t)
+{
+    ar1_model<TestType> always(1, 1);
+    ar1_model<TestType> adaptive(2, 2);
+    adaptive.setESSThreshold(.5);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        always.filter(y, fs);
+        adaptive.filter(y, fs);
+        REQUIRE(adaptive.getESS() > 0.0);
+        REQUIRE(adaptive.getESS() <= FILTNPARTS*(1.0 + 1e-12));
+        ll1 += always.getLogCondLike();
+        ll2 += adaptive.getLogCondLike();
+        REQUIRE(always.getExpectations()[0](0) == Approx(adaptive.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
+
+
+TEST_CASE("without resampling the weights keep accumulating", "[filters]")
+{
+    ar1_soa<bs_soa_t> f(2, 3);
+    f.setESSThreshold(1e-9);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 5; ++t){
+        y(0) = std::sin(t);
+        f.filter(y);
+        REQUIRE(std::isfinite(f.getLogCondLike()));
+    }
+    // a degenerate population is the sign that nothing was resampled
+    REQUIRE(f.getESS() < FILTNPARTS/2.0);
+}
+
+
+TEMPLATE_TEST_CASE("registered functionals agree with the returned ones", "[filters]", bs_t, sisr_t, apf_t, bs_soa_t)
+{
+    using ssv = Eigen::Matrix<double,1,1>;
+    using filt_t = std::conditional_t<std::is_same<TestType, bs_soa_t>::value, ar1_soa<TestType>, ar1_model<TestType>>;
+    filt_t f(3, 1);
+    REQUIRE(f.addFunctional([](const ssv &xt, Eigen::Ref<Eigen::MatrixXd> out){ out = xt; }, 1) == 0);
+    REQUIRE(f.addFunctional([](const ssv &xt, Eigen::Ref<Eigen::MatrixXd> out){ out << xt(0), xt(0)*xt(0); }, 1, 2) == 1);
+
+    auto idty = [](const ssv& xt) -> const Eigen::MatrixXd { return xt; };
+    auto sq = [](const ssv& xt) -> const Eigen::MatrixXd { return xt*xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const ssv&)>> fs{idty, sq};
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 5; ++t){
+        y(0) = std::sin(t);
+        f.filter(y, fs);
+        const auto &ex = f.getFunctionalExpectations();
+        REQUIRE(ex.size() == 2);
+        REQUIRE(ex[1].cols() == 2);
+        REQUIRE(ex[0](0) == Approx(f.getExpectations()[0](0)));
+        REQUIRE(ex[1](0) == Approx(f.getExpectations()[0](0)));
+        REQUIRE(ex[1](1) == Approx(f.getExpectations()[1](0)));
+    }
+}
+
+
+TEST_CASE("the parallel systematic resampler gives the same bootstrap filter", "[filters]")
+{
+    // same seeds and the same ancestors
+    ar1_bs<bs_t> serial(2, 13);
+    ar1_bs<BSFilter<FILTNPARTS, 1, 1, par_systematic_resampler<FILTNPARTS,1,double>, double>> parallel(2, 13);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 10; ++t){
+        y(0) = std::sin(t);
+        serial.filter(y);
+        parallel.filter(y);
+        REQUIRE(serial.getLogCondLike() == Approx(parallel.getLogCondLike()));
+    }
+}
+
+
+TEST_CASE("bootstrap filters resample on as many threads as they propagate on", "[filters]")
+{
+    // several blocks, so more than one worker draws ancestors
+    const size_t n = 3*par_rbase<dynamic_parts,1,double>::block_size + 77;
+    ar1_bs<bs_dyn_t> serial(3, 13, n);
+    ar1_par<BSFilter<dynamic_parts, 1, 1, par_systematic_resampler<dynamic_parts,1,double>, double>> parallel(3, 13, n);
+    REQUIRE(parallel.resamplerThreads() == 3);
+
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 10; ++t){
+        y(0) = std::sin(t);
+        serial.filter(y);
+        parallel.filter(y);
+        REQUIRE(serial.getLogCondLike() == Approx(parallel.getLogCondLike()));
+    }
+}
+
+
+TEMPLATE_TEST_CASE("SISR and auxiliary filters work with the parallel stratified resampler", "[filters]",
+                   (SISRFilter<FILTNPARTS, 1, 1, par_stratif_resampler<FILTNPARTS,1,double>, double>),
+                   (APF<FILTNPARTS, 1, 1, par_stratif_resampler<FILTNPARTS,1,double>, double>))
+{
+    ar1_model<sisr_t> serial(1, 1);
+    ar1_model<TestType> parallel(2, 2);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        serial.filter(y, fs);
+        parallel.filter(y, fs);
+        REQUIRE(std::isfinite(parallel.getLogCondLike()));
+        ll1 += serial.getLogCondLike();
+        ll2 += parallel.getLogCondLike();
+        REQUIRE(serial.getExpectations()[0](0) == Approx(parallel.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
+
+
+TEST_CASE("the Hilbert resampler plugs into the bootstrap filter", "[filters]")
+{
+    ar1_bs<bs_t> systematic(1, 1);
+    ar1_bs<BSFilter<FILTNPARTS, 1, 1, hilbert_resampler<FILTNPARTS,1,double>, double>> hilbert(1, 2);
+
+    auto idty = [](const Eigen::Matrix<double,1,1>& xt) -> const Eigen::MatrixXd { return xt; };
+    std::vector<std::function<const Eigen::MatrixXd(const Eigen::Matrix<double,1,1>&)>> fs{idty};
+
+    double ll1(0.0), ll2(0.0);
+    Eigen::Matrix<double,1,1> y;
+    for(int t = 0; t < 20; ++t){
+        y(0) = std::sin(t);
+        systematic.filter(y, fs);
+        hilbert.filter(y, fs);
+        REQUIRE(std::isfinite(hilbert.getLogCondLike()));
+        ll1 += systematic.getLogCondLike();
+        ll2 += hilbert.getLogCondLike();
+        REQUIRE(systematic.getExpectations()[0](0) == Approx(hilbert.getExpectations()[0](0)).margin(.25));
+    }
+    REQUIRE(ll1 == Approx(ll2).margin(1.0));
+}
@@ -1,6 +1,14 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
 #include <pf/resamplers.h>
+#include <pf/parallel_resamplers.h>
 #include <pf/cf_filters.h>
 
 #define NUMPARTICLES 20
@@ -63,6 +71,8 @@ public:
                 m_vw[i] = -1.0/0.0;
             }
         }
+        m_vparts2 = m_vparts3 = m_vparts4 = m_vparts;
+        m_vw2 = m_vw3 = m_vw4 = m_vw;
 
         // for Test_resampLogWts_RBPF
         // make the first particle have 0 for samples and weights,
@@ -285,3 +295,646 @@ TEST_CASE_METHOD(MRFixture, "test resampLogWts_systematic2", "[resamplers]")
     }
 }
 
+
+
+TEMPLATE_TEST_CASE("structure-of-arrays resampling matches array resampling", "[resamplers]",
+                   (mn_resampler<NUMPARTICLES,DIMSTATE,double>), (resid_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_resamp_fast1<NUMPARTICLES,DIMSTATE,double>), (mn_alias_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_sorted_resampler<NUMPARTICLES,DIMSTATE,double>), (hilbert_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (par_systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_metropolis_resampler<NUMPARTICLES,DIMSTATE,double>), (par_rejection_resampler<NUMPARTICLES,DIMSTATE,double>))
+{
+    using ssv = Eigen::Matrix<double,DIMSTATE,1>;
+    std::array<ssv,NUMPARTICLES> aos;
+    soa_particles<NUMPARTICLES,DIMSTATE,double> soa;
+    std::array<double,NUMPARTICLES> w1, w2;
+    for(size_t i = 0; i < NUMPARTICLES; ++i){
+        aos[i] = ssv::LinSpaced(i, i + 1);
+        soa.set(i, aos[i]);
+        w1[i] = w2[i] = -.1*i;
+    }
+
+    // same seed, so the same ancestors get picked
+    TestType r1, r2;
+    r1.setSeed(1);
+    r2.setSeed(1);
+    r1.resampLogWts(aos, w1);
+    r2.resampLogWts(soa, w2);
+    for(size_t i = 0; i < NUMPARTICLES; ++i){
+        REQUIRE(w2[i] == 0.0);
+        REQUIRE(soa.get(i) == aos[i]);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("resampling normalized weights matches resampling log weights", "[resamplers]",
+                   (mn_resampler<NUMPARTICLES,DIMSTATE,double>), (resid_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_resamp_fast1<NUMPARTICLES,DIMSTATE,double>), (mn_alias_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_sorted_resampler<NUMPARTICLES,DIMSTATE,double>), (hilbert_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (par_systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_metropolis_resampler<NUMPARTICLES,DIMSTATE,double>), (par_rejection_resampler<NUMPARTICLES,DIMSTATE,double>))
+{
+    using ssv = Eigen::Matrix<double,DIMSTATE,1>;
+    std::array<ssv,NUMPARTICLES> p1, p2;
+    std::array<double,NUMPARTICLES> w1, w2, normWts;
+    double normConst(0.0);
+    for(size_t i = 0; i < NUMPARTICLES; ++i){
+        p1[i] = p2[i] = ssv::Constant(i);
+        w1[i] = w2[i] = -.1*i;
+        normWts[i] = std::exp(w1[i] - w1[0]);
+        normConst += normWts[i];
+    }
+    for(auto &w : normWts)
+        w /= normConst;
+
+    TestType r1, r2;
+    r1.setSeed(3);
+    r2.setSeed(3);
+    r1.resampLogWts(p1, w1);
+    r2.resampNormWts(p2, w2, normWts);
+    for(size_t i = 0; i < NUMPARTICLES; ++i){
+        REQUIRE(w2[i] == 0.0);
+        REQUIRE(p1[i] == p2[i]);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("run-time sized resamplers can change the number of particles", "[resamplers]",
+                   (mn_resampler<dynamic_parts,DIMSTATE,double>), (mn_alias_resampler<dynamic_parts,DIMSTATE,double>),
+                   (mn_sorted_resampler<dynamic_parts,DIMSTATE,double>), (hilbert_resampler<dynamic_parts,DIMSTATE,double>),
+                   (resid_resampler<dynamic_parts,DIMSTATE,double>),
+                   (stratif_resampler<dynamic_parts,DIMSTATE,double>), (systematic_resampler<dynamic_parts,DIMSTATE,double>),
+                   (par_stratif_resampler<dynamic_parts,DIMSTATE,double>), (par_systematic_resampler<dynamic_parts,DIMSTATE,double>),
+                   (par_metropolis_resampler<dynamic_parts,DIMSTATE,double>), (par_rejection_resampler<dynamic_parts,DIMSTATE,double>))
+{
+    using ssv = Eigen::Matrix<double,DIMSTATE,1>;
+    const size_t numIn = 20;
+    for(size_t numOut : {numIn, 3*numIn + 1, numIn/3}){
+
+        typename TestType::arrayVec aos(numIn);
+        typename TestType::arrayFloat w1(numIn), w2(numIn);
+        soa_particles<dynamic_parts,DIMSTATE,double> soa(numIn);
+        for(size_t i = 0; i < numIn; ++i){
+            aos[i] = ssv::Constant(i);
+            soa.set(i, aos[i]);
+            w1[i] = w2[i] = -.1*i;
+        }
+
+        TestType r1, r2;
+        r1.setSeed(2);
+        r2.setSeed(2);
+        r1.resampLogWts(aos, w1, numOut);
+        r2.resampLogWts(soa, w2, numOut);
+        REQUIRE(aos.size() == numOut);
+        REQUIRE(soa.size() == numOut);
+        REQUIRE(w1.size() == numOut);
+        for(size_t i = 0; i < numOut; ++i){
+            REQUIRE(w1[i] == 0.0);
+            REQUIRE(aos[i](0) < numIn);
+            REQUIRE(aos[i] == ssv::Constant(aos[i](0)));
+            REQUIRE(soa.get(i) == aos[i]);
+        }
+    }
+}
+
+
+TEMPLATE_TEST_CASE("stratified and systematic offspring counts stay close to N times the weights", "[resamplers]",
+                   (stratif_resampler<dynamic_parts,1,double>), (systematic_resampler<dynamic_parts,1,double>),
+                   (par_stratif_resampler<dynamic_parts,1,double>), (par_systematic_resampler<dynamic_parts,1,double>),
+                   (systematic_resampler<dynamic_parts,1,double,rvsamp::philox4x32>),
+                   (par_stratif_resampler<dynamic_parts,1,double,rvsamp::philox4x32>))
+{
+    using ssv = Eigen::Matrix<double,1,1>;
+
+    // some particles have no weight at all, and the heaviest one is last
+    const size_t N = 1000;
+    typename TestType::arrayVec parts(N);
+    typename TestType::arrayFloat logWts(N);
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        parts[i] = ssv::Constant(i);
+        logWts[i] = i % 7 == 0 ? -std::numeric_limits<double>::infinity() : std::log(1.0 + i);
+        w[i] = i % 7 == 0 ? 0.0 : 1.0 + i;
+        sum += w[i];
+    }
+
+    // both schemes draw the ancestors in order (the particles are gathered in place, so they aren't)
+    TestType r, r2;
+    r.setSeed(4);
+    r2.setSeed(4);
+    typename TestType::arrayInt ancestors(N);
+    r2.resampIndices(logWts, ancestors);
+    r.resampLogWts(parts, logWts);
+    for(size_t i = 1; i < N; ++i)
+        REQUIRE(ancestors[i] >= ancestors[i-1]);
+
+    // both schemes give each particle floor(N w_i) or ceil(N w_i) children, give or take one
+    std::vector<size_t> counts(N, 0), drawn(N, 0);
+    for(size_t i = 0; i < N; ++i){
+        counts[static_cast<size_t>(parts[i](0))]++;
+        drawn[ancestors[i]]++;
+    }
+    REQUIRE(counts == drawn);
+    for(size_t i = 0; i < N; ++i){
+        REQUIRE(std::abs(counts[i] - N*w[i]/sum) < 2.0);
+        if(w[i] == 0.0)
+            REQUIRE(counts[i] == 0);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("resampIndices draws the same ancestors as resampLogWts", "[resamplers]",
+                   (mn_resampler<NUMPARTICLES,DIMSTATE,double>), (mn_alias_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_resamp_fast1<NUMPARTICLES,DIMSTATE,double>), (mn_sorted_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (resid_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_stratif_resampler<NUMPARTICLES,DIMSTATE,double>), (par_systematic_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (par_metropolis_resampler<NUMPARTICLES,DIMSTATE,double>), (par_rejection_resampler<NUMPARTICLES,DIMSTATE,double>),
+                   (mn_resampler<NUMPARTICLES,DIMSTATE,double,rvsamp::philox4x32>))
+{
+    using ssv = Eigen::Matrix<double,DIMSTATE,1>;
+    typename TestType::arrayVec parts;
+    typename TestType::arrayFloat logWts;
+    typename TestType::arrayInt ancestors;
+    for(size_t i = 0; i < NUMPARTICLES; ++i){
+        parts[i] = ssv::Constant(i);
+        logWts[i] = std::sin(1.0*i);
+    }
+
+    TestType r1, r2;
+    r1.setSeed(5);
+    r2.setSeed(5);
+    r1.resampIndices(logWts, ancestors);
+    r2.resampLogWts(parts, logWts);
+
+    // resampling in place keeps the survivors in their own slots
+    permute_ancestors(ancestors);
+    for(size_t i = 0; i < NUMPARTICLES; ++i)
+        REQUIRE(parts[i] == ssv::Constant(ancestors[i]));
+}
+
+
+// counts how many times it gets overwritten
+struct copy_counter
+{
+    unsigned int id = 0;
+    unsigned int *copies = nullptr;
+    copy_counter& operator=(const copy_counter &other)
+    {
+        id = other.id;
+        (*copies)++;
+        return *this;
+    }
+};
+
+
+TEST_CASE("apply_ancestors copies each particle that dies exactly once", "[resamplers]")
+{
+    const size_t N = 50;
+    unsigned int copies(0);
+    std::vector<copy_counter> parts(N);
+    std::vector<unsigned int> ancestors(N);
+    std::vector<size_t> counts(N, 0);
+    for(size_t i = 0; i < N; ++i){
+        parts[i].id = i;
+        parts[i].copies = &copies;
+        ancestors[i] = (7*i*i + 3) % N / 2;
+        counts[ancestors[i]]++;
+    }
+
+    apply_ancestors(parts, ancestors);
+
+    // same indexes as before, and every survivor keeps its slot
+    size_t dead(0);
+    for(size_t i = 0; i < N; ++i){
+        REQUIRE(parts[i].id == ancestors[i]);
+        if(counts[i] > 0)
+            REQUIRE(ancestors[i] == i);
+        else
+            dead++;
+        counts[ancestors[i]]--;
+    }
+    for(size_t i = 0; i < N; ++i)
+        REQUIRE(counts[i] == 0);
+    REQUIRE(copies == dead);
+
+    // applying the same ancestors again changes nothing
+    apply_ancestors(parts, ancestors);
+    REQUIRE(copies == 2*dead);
+    for(size_t i = 0; i < N; ++i)
+        REQUIRE(parts[i].id == ancestors[i]);
+
+    std::vector<unsigned int> tooFew(N-1, 0);
+    REQUIRE_THROWS_AS(apply_ancestors(parts, tooFew), std::invalid_argument);
+}
+
+
+struct move_counter
+{
+    unsigned int id = 0;
+    unsigned int *copies = nullptr;
+    unsigned int *moves = nullptr;
+    move_counter& operator=(const move_counter &other)
+    {
+        id = other.id;
+        copies = other.copies;
+        moves = other.moves;
+        (*copies)++;
+        return *this;
+    }
+    move_counter& operator=(move_counter &&other)
+    {
+        id = other.id;
+        copies = other.copies;
+        moves = other.moves;
+        (*moves)++;
+        return *this;
+    }
+};
+
+
+TEST_CASE("move_ancestors moves each surviving particle once and copies the rest", "[resamplers]")
+{
+    const size_t N = 30;
+    unsigned int copies(0), moves(0);
+    std::vector<move_counter> from(N);
+    for(size_t i = 0; i < N; ++i){
+        from[i].id = i;
+        from[i].copies = &copies;
+        from[i].moves = &moves;
+    }
+
+    // 25 children from the 10 particles whose indexes are multiples of 3
+    std::vector<unsigned int> ancestors;
+    for(unsigned int i = 0; i < N; i += 3)
+        for(unsigned int c = 0; c < 1 + i % 4; ++c)
+            ancestors.push_back(i);
+    std::vector<move_counter> to(ancestors.size());
+    move_ancestors(from, ancestors, to);
+
+    for(size_t i = 0; i < ancestors.size(); ++i)
+        REQUIRE(to[i].id == ancestors[i]);
+    REQUIRE(moves == N/3);
+    REQUIRE(copies == ancestors.size() - N/3);
+
+    std::vector<move_counter> tooMany(ancestors.size() + 1);
+    REQUIRE_THROWS_AS(move_ancestors(from, ancestors, tooMany), std::invalid_argument);
+}
+
+
+TEMPLATE_TEST_CASE("RBPF resamplers keep every model with its sample", "[resamplers]",
+                   (mn_resampler_rbpf<dynamic_parts,1,hmm<2,1,double>,double>),
+                   (sys_resampler_rbpf<dynamic_parts,1,hmm<2,1,double>,double>))
+{
+    // sample i and the first element of model i's filter vector are both i,
+    // and every fourth particle has no weight
+    const size_t N = 40;
+    typename TestType::arrayMod mods(N);
+    typename TestType::arrayVec samps(N);
+    typename TestType::arrayFloat logWts(N);
+    auto reset = [&]{
+        part_storage<hmm<2,1,double>, dynamic_parts>::resize(mods, N);
+        part_storage<Eigen::Matrix<double,1,1>, dynamic_parts>::resize(samps, N);
+        part_storage<double, dynamic_parts>::resize(logWts, N);
+        for(size_t i = 0; i < N; ++i){
+            mods[i] = hmm<2,1,double>(Eigen::Vector2d(i, 0.0), Eigen::Matrix2d::Identity());
+            samps[i](0) = i;
+            logWts[i] = i % 4 == 0 ? -std::numeric_limits<double>::infinity() : std::log(1.0 + i % 3);
+        }
+    };
+
+    TestType r;
+    r.setSeed(5);
+    for(size_t numOut : {0, 65, 17}){
+        reset();
+        r.resampLogWts(mods, samps, logWts, numOut);
+        const size_t n = numOut ? numOut : N;
+        REQUIRE(mods.size() == n);
+        REQUIRE(samps.size() == n);
+        REQUIRE(logWts.size() == n);
+        for(size_t i = 0; i < n; ++i){
+            REQUIRE(mods[i].getFilterVec()(0) == samps[i](0));
+            REQUIRE(static_cast<size_t>(samps[i](0)) % 4 != 0);
+            REQUIRE(logWts[i] == 0.0);
+        }
+    }
+}
+
+
+TEST_CASE("systematic RBPF resampling gives sorted ancestors within one of N times their weight", "[resamplers]")
+{
+    const size_t N = 200;
+    using r_t = sys_resampler_rbpf<dynamic_parts,1,kalman<2,1,0,double>,double>;
+    r_t::arrayFloat logWts(N);
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        w[i] = i % 7 == 0 ? 0.0 : 1.0 + std::sin(.1*i);
+        logWts[i] = std::log(w[i]);
+        sum += w[i];
+    }
+
+    r_t r;
+    r.setSeed(9);
+    r_t::arrayInt ancestors(N);
+    for(size_t rep = 0; rep < 20; ++rep){
+        r.resampIndices(logWts, ancestors);
+        std::vector<size_t> counts(N, 0);
+        for(size_t i = 0; i < N; ++i){
+            if(i > 0)
+                REQUIRE(ancestors[i] >= ancestors[i-1]);
+            counts[ancestors[i]]++;
+        }
+        for(size_t i = 0; i < N; ++i)
+            REQUIRE(std::abs(counts[i] - N*w[i]/sum) < 1.0 + 1e-9);
+    }
+}
+
+
+TEST_CASE("parallel systematic resampling picks the same ancestors as serial systematic resampling", "[resamplers]")
+{
+    const size_t N = 10007;
+    std::vector<double> w(N);
+    systematic_resampler<dynamic_parts,1,double>::arrayFloat logWts(N);
+    for(size_t i = 0; i < N; ++i)
+        logWts[i] = 3.0*std::sin(.01*i) + (i % 11 == 0 ? -std::numeric_limits<double>::infinity() : 0.0);
+
+    for(unsigned int nthreads = 1; nthreads <= 4; ++nthreads){
+        for(size_t numOut : {N, N/3, 2*N + 1}){
+            systematic_resampler<dynamic_parts,1,double>::arrayInt a1(numOut), a2(numOut);
+            systematic_resampler<dynamic_parts,1,double> serial;
+            par_systematic_resampler<dynamic_parts,1,double> parallel(nthreads);
+            REQUIRE(parallel.getNumThreads() == nthreads);
+            serial.setSeed(8);
+            parallel.setSeed(8);
+            serial.resampIndices(logWts, a1);
+            parallel.resampIndices(logWts, a2);
+            for(size_t i = 0; i < numOut; ++i)
+                REQUIRE(a1[i] == a2[i]);
+        }
+    }
+}
+
+
+TEST_CASE("parallel stratified resampling is reproducible for a fixed seed and thread count", "[resamplers]")
+{
+    const size_t N = 5000;
+    par_stratif_resampler<dynamic_parts,1,double>::arrayFloat logWts(N);
+    for(size_t i = 0; i < N; ++i)
+        logWts[i] = std::cos(.1*i);
+
+    par_stratif_resampler<dynamic_parts,1,double>::arrayInt a1(N), a2(N);
+    par_stratif_resampler<dynamic_parts,1,double> r1(3), r2(3);
+    r1.setSeed(9);
+    r2.setSeed(9);
+    r1.resampIndices(logWts, a1);
+    r2.resampIndices(logWts, a2);
+    for(size_t i = 0; i < N; ++i){
+        REQUIRE(a1[i] == a2[i]);
+        if(i > 0)
+            REQUIRE(a1[i] >= a1[i-1]);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("parallel resamplers pick the same ancestors for any number of threads", "[resamplers]",
+                   (par_stratif_resampler<dynamic_parts,1,double>), (par_systematic_resampler<dynamic_parts,1,double>),
+                   (par_metropolis_resampler<dynamic_parts,1,double>), (par_rejection_resampler<dynamic_parts,1,double>),
+                   (par_stratif_resampler<dynamic_parts,1,double,rvsamp::philox4x32>))
+{
+    // a few blocks, and the last one is short
+    const size_t N = 3*par_rbase<dynamic_parts,1,double>::block_size + 77;
+    typename TestType::arrayFloat logWts(N);
+    for(size_t i = 0; i < N; ++i)
+        logWts[i] = std::sin(.01*i);
+
+    typename TestType::arrayInt a1(N), a2(N);
+    TestType serial;
+    REQUIRE(serial.getNumThreads() == 1);
+    serial.setSeed(11);
+    serial.resampIndices(logWts, a1);
+    for(unsigned int nthreads : {2u, 3u, 5u}){
+        // (the Metropolis resampler takes the number of steps first)
+        auto make = [&]{
+            if constexpr(std::is_same<TestType, par_metropolis_resampler<dynamic_parts,1,double>>::value)
+                return TestType(serial.getNumSteps(), nthreads);
+            else
+                return TestType(nthreads);
+        };
+        TestType r(make());
+        REQUIRE(r.getNumThreads() == nthreads);
+        r.setSeed(11);
+        r.resampIndices(logWts, a2);
+        for(size_t i = 0; i < N; ++i)
+            REQUIRE(a1[i] == a2[i]);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("Metropolis and rejection resampling give each particle N times its weight on average", "[resamplers]",
+                   (par_metropolis_resampler<dynamic_parts,1,double>), (par_rejection_resampler<dynamic_parts,1,double>),
+                   (par_metropolis_resampler<dynamic_parts,1,double,rvsamp::philox4x32>))
+{
+    // weights grow linearly, and one particle has none
+    const size_t N = 50;
+    const size_t reps = 2000;
+    typename TestType::arrayFloat logWts(N);
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        w[i] = i == 3 ? 0.0 : 1.0 + i;
+        logWts[i] = std::log(w[i]);
+        sum += w[i];
+    }
+
+    // enough Metropolis steps that the bias is far below the Monte Carlo error
+    TestType r(2);
+    r.setSeed(10);
+    if constexpr(std::is_same<TestType, par_metropolis_resampler<dynamic_parts,1,double>>::value ||
+                 std::is_same<TestType, par_metropolis_resampler<dynamic_parts,1,double,rvsamp::philox4x32>>::value){
+        r.setNumSteps(50);
+        REQUIRE(r.getNumSteps() == 50);
+    }
+
+    std::vector<double> meanCounts(N, 0.0);
+    typename TestType::arrayInt ancestors(N);
+    for(size_t rep = 0; rep < reps; ++rep){
+        r.resampIndices(logWts, ancestors);
+        for(auto a : ancestors)
+            meanCounts[a] += 1.0 / reps;
+    }
+    for(size_t i = 0; i < N; ++i)
+        REQUIRE(std::abs(meanCounts[i] - N*w[i]/sum) < .15);
+    REQUIRE(meanCounts[3] == 0.0);
+}
+
+
+TEST_CASE("rejection resampling needs at least one particle with weight", "[resamplers]")
+{
+    par_rejection_resampler<dynamic_parts,1,double>::arrayFloat logWts(10, -std::numeric_limits<double>::infinity());
+    par_rejection_resampler<dynamic_parts,1,double>::arrayInt ancestors(10);
+    par_rejection_resampler<dynamic_parts,1,double> r(1);
+    REQUIRE_THROWS_AS(r.resampIndices(logWts, ancestors), std::invalid_argument);
+}
+
+
+TEST_CASE("rejection resampling offspring counts have multinomial variance", "[resamplers]")
+{
+    // every count is Binomial(N, p_k), so its variance is N p_k (1 - p_k)
+    const size_t N = 20;
+    const size_t reps = 20000;
+    par_rejection_resampler<dynamic_parts,1,double>::arrayFloat logWts(N);
+    std::vector<double> p(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        p[i] = 1.0 + i;
+        logWts[i] = std::log(p[i]);
+        sum += p[i];
+    }
+    for(auto &pk : p)
+        pk /= sum;
+
+    par_rejection_resampler<dynamic_parts,1,double> r(2);
+    r.setSeed(13);
+    par_rejection_resampler<dynamic_parts,1,double>::arrayInt ancestors(N);
+    std::vector<double> counts(N), meanCounts(N, 0.0), meanSqCounts(N, 0.0);
+    for(size_t rep = 0; rep < reps; ++rep){
+        std::fill(counts.begin(), counts.end(), 0.0);
+        r.resampIndices(logWts, ancestors);
+        for(auto a : ancestors)
+            counts[a] += 1.0;
+        for(size_t k = 0; k < N; ++k){
+            meanCounts[k] += counts[k] / reps;
+            meanSqCounts[k] += counts[k] * counts[k] / reps;
+        }
+    }
+    for(size_t k = 0; k < N; ++k){
+        double var = meanSqCounts[k] - meanCounts[k] * meanCounts[k];
+        double expected = N * p[k] * (1.0 - p[k]);
+        REQUIRE(std::abs(var - expected) < .1 * expected);
+    }
+}
+
+
+TEMPLATE_TEST_CASE("sorted-uniform multinomial resamplers give sorted ancestors N times their weight on average", "[resamplers]",
+                   (mn_resamp_fast1<dynamic_parts,1,double>), (mn_sorted_resampler<dynamic_parts,1,double>),
+                   (mn_sorted_resampler<dynamic_parts,1,double,rvsamp::philox4x32>))
+{
+    // weights grow linearly, one particle has none, and so does the last one
+    const size_t N = 50;
+    const size_t reps = 2000;
+    typename TestType::arrayFloat logWts(N);
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        w[i] = i == 3 || i == N-1 ? 0.0 : 1.0 + i;
+        logWts[i] = std::log(w[i]);
+        sum += w[i];
+    }
+
+    TestType r;
+    r.setSeed(11);
+    std::vector<double> meanCounts(N, 0.0);
+    typename TestType::arrayInt ancestors(N);
+    for(size_t rep = 0; rep < reps; ++rep){
+        r.resampIndices(logWts, ancestors);
+        for(size_t i = 0; i < N; ++i){
+            REQUIRE(ancestors[i] < N);
+            if(i > 0)
+                REQUIRE(ancestors[i] >= ancestors[i-1]);
+            meanCounts[ancestors[i]] += 1.0 / reps;
+        }
+    }
+    for(size_t i = 0; i < N; ++i)
+        REQUIRE(std::abs(meanCounts[i] - N*w[i]/sum) < .15);
+    REQUIRE(meanCounts[3] == 0.0);
+    REQUIRE(meanCounts[N-1] == 0.0);
+}
+
+
+TEST_CASE("residual resampling fills every slot even when the residuals round down", "[resamplers]")
+{
+    // the residuals should add up to a whole number, but in floating point they often fall just short
+    const size_t N = 7;
+    resid_resampler<dynamic_parts,1,double>::arrayFloat logWts(N);
+    resid_resampler<dynamic_parts,1,double>::arrayInt ancestors(N);
+    resid_resampler<dynamic_parts,1,double> r;
+    r.setSeed(12);
+    for(size_t rep = 0; rep < 500; ++rep){
+        for(size_t i = 0; i < N; ++i)
+            logWts[i] = std::sin(.37*rep + 1.3*i);
+        std::fill(ancestors.begin(), ancestors.end(), N);
+        r.resampIndices(logWts, ancestors);
+        for(size_t i = 0; i < N; ++i)
+            REQUIRE(ancestors[i] < N);
+    }
+}
+
+
+TEST_CASE("Hilbert resampling is systematic resampling along the curve", "[resamplers]")
+{
+    // in one dimension the curve just sorts the states (up to the 2^16 cell grid)
+    const size_t N = 1000;
+    using r1_t = hilbert_resampler<dynamic_parts,1,double>;
+    r1_t::arrayVec parts(N);
+    r1_t::arrayFloat logWts(N);
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        parts[i](0) = std::sin(7.0*i);
+        w[i] = i % 5 == 0 ? 0.0 : 1.0 + parts[i](0);
+        logWts[i] = std::log(w[i]);
+        sum += w[i];
+    }
+    r1_t::arrayInt ancestors(N);
+    r1_t r1;
+    r1.setSeed(13);
+    r1.resampIndices(parts, logWts, ancestors);
+    std::vector<size_t> counts(N, 0);
+    for(size_t i = 0; i < N; ++i){
+        if(i > 0)
+            REQUIRE(parts[ancestors[i]](0) >= parts[ancestors[i-1]](0) - 1e-4);
+        counts[ancestors[i]]++;
+    }
+    for(size_t i = 0; i < N; ++i){
+        REQUIRE(std::abs(counts[i] - N*w[i]/sum) < 2.0);
+        if(w[i] == 0.0)
+            REQUIRE(counts[i] == 0);
+    }
+
+    // in two dimensions, equal weights give every particle exactly one child,
+    // and the children come out in curve order (so neighbours stay close)
+    using r2_t = hilbert_resampler<dynamic_parts,2,double>;
+    using ssv2 = Eigen::Matrix<double,2,1>;
+    r2_t::arrayVec grid(N);
+    r2_t::arrayFloat flat(N, 0.0);
+    for(size_t i = 0; i < N; ++i)
+        grid[i] = ssv2(std::cos(3.0*i), std::sin(5.0*i));
+    r2_t::arrayVec orig = grid;
+    r2_t r2;
+    r2.setSeed(14);
+    r2.resampLogWts(grid, flat);
+    double pathLength(0.0), origLength(0.0);
+    for(size_t i = 1; i < N; ++i){
+        pathLength += (grid[i] - grid[i-1]).norm();
+        origLength += (orig[i] - orig[i-1]).norm();
+    }
+    REQUIRE(pathLength < .25*origLength);
+    std::sort(grid.begin(), grid.end(), [](const ssv2 &a, const ssv2 &b) { return a(0) < b(0); });
+    std::sort(orig.begin(), orig.end(), [](const ssv2 &a, const ssv2 &b) { return a(0) < b(0); });
+    for(size_t i = 0; i < N; ++i)
+        REQUIRE(grid[i] == orig[i]);
+}
+
+
+TEMPLATE_TEST_CASE("resamplers keep their scratch space on the heap for a fixed number of particles", "[resamplers]",
+                   (mn_resampler<100000,4,double>), (resid_resampler<100000,4,double>),
+                   (mn_resamp_fast1<100000,4,double>), (par_systematic_resampler<100000,4,double>),
+                   (mn_resampler_rbpf<100000,4,hmm<2,1,double>,double>))
+{
+    // a filter that owns one of these shouldn't grow with the number of particles
+    REQUIRE(sizeof(TestType) < 100000);
+}
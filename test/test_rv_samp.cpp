@@ -1,6 +1,17 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
 #include <pf/rv_samp.h>
+#include <pf/soa_particles.h>
 
 #define bigdim 2
 #define smalldim 1
@@ -51,3 +62,439 @@ TEST_CASE_METHOD(SampFixture, "UniformTest", "[samplers]")
     REQUIRE(-2.0 < m_us2.sample());
     REQUIRE( m_us2.sample() < -1.0);
 }
+
+
+TEST_CASE("alias table draws each index in proportion to its weight", "[samplers]")
+{
+    // one weight is zero, and the rest are uneven
+    const size_t N = 10;
+    const size_t draws = 200000;
+    std::vector<double> w(N);
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        w[i] = i == 4 ? 0.0 : (i + 1.0)*(i + 1.0);
+        sum += w[i];
+    }
+
+    rvsamp::alias_table<double> table;
+    std::mt19937 gen(1);
+    for(bool fromLogs : {false, true}){
+        if(fromLogs){
+            std::vector<double> logWts(N);
+            for(size_t i = 0; i < N; ++i)
+                logWts[i] = std::log(w[i]) - 700.0; // would underflow if exponentiated as is
+            table.setLogWeights(logWts);
+        }else{
+            table.setWeights(w);
+        }
+        REQUIRE(table.size() == N);
+
+        std::vector<double> freqs(N, 0.0);
+        for(size_t d = 0; d < draws; ++d)
+            freqs[table.draw(gen)] += 1.0 / draws;
+        for(size_t i = 0; i < N; ++i)
+            REQUIRE(std::abs(freqs[i] - w[i]/sum) < .005);
+        REQUIRE(freqs[4] == 0.0);
+    }
+
+    REQUIRE_THROWS_AS(table.setWeights(std::vector<double>(N, 0.0)), std::invalid_argument);
+}
+
+
+TEST_CASE("k_gen draws the same distribution with either backend", "[samplers]")
+{
+    const size_t N = 20;
+    const size_t reps = 2000;
+    std::array<double, N> logWts;
+    double sum(0.0);
+    for(size_t i = 0; i < N; ++i){
+        logWts[i] = std::sin(1.0*i);
+        sum += std::exp(logWts[i]);
+    }
+
+    for(bool useAlias : {false, true}){
+        rvsamp::k_gen<N, double> kGen(useAlias);
+        kGen.setSeed(2);
+        std::array<unsigned int, N> ks;
+        std::vector<double> meanCounts(N, 0.0);
+        for(size_t rep = 0; rep < reps; ++rep){
+            kGen.sample(logWts, ks);
+            for(auto k : ks)
+                meanCounts[k] += 1.0 / reps;
+        }
+        for(size_t i = 0; i < N; ++i)
+            REQUIRE(std::abs(meanCounts[i] - N*std::exp(logWts[i])/sum) < .15);
+    }
+}
+
+
+TEST_CASE("philox4x32 matches the reference test vectors", "[samplers]")
+{
+    using P = rvsamp::philox4x32;
+    using ctr_t = std::array<std::uint32_t, 4>;
+    using key_t = std::array<std::uint32_t, 2>;
+    REQUIRE(P::block(ctr_t{0, 0, 0, 0}, key_t{0, 0}) == ctr_t{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+    REQUIRE(P::block(ctr_t{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, key_t{0xffffffff, 0xffffffff}) 
+            == ctr_t{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+    REQUIRE(P::block(ctr_t{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, key_t{0xa4093822, 0x299f31d0})
+            == ctr_t{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+
+    // the stream is the blocks for counters 0, 1, 2, ... in order
+    P gen(0x299f31d0a4093822ull, 0x0370734413198a2eull);
+    const ctr_t first = P::block(ctr_t{0, 0, 0x13198a2e, 0x03707344}, key_t{0xa4093822, 0x299f31d0});
+    const ctr_t second = P::block(ctr_t{1, 0, 0x13198a2e, 0x03707344}, key_t{0xa4093822, 0x299f31d0});
+    for(int i = 0; i < 4; ++i)
+        REQUIRE(gen() == first[i]);
+    for(int i = 0; i < 4; ++i)
+        REQUIRE(gen() == second[i]);
+}
+
+
+TEST_CASE("philox4x32 jumps ahead and splits into streams", "[samplers]")
+{
+    rvsamp::philox4x32 stepped(42, 7);
+    for(unsigned long long skip : {0ull, 1ull, 3ull, 4ull, 9ull, 1000ull}){
+        rvsamp::philox4x32 jumped = stepped;
+        for(unsigned long long i = 0; i < skip; ++i)
+            stepped();
+        jumped.discard(skip);
+        REQUIRE(jumped == stepped);
+        REQUIRE(jumped() == stepped());
+    }
+
+    // a substream is the same as seeding with that stream, and neighbouring streams share nothing
+    rvsamp::philox4x32 a(42, 0), b = a.substream(1), c(42, 1);
+    REQUIRE(b == c);
+    std::vector<std::uint32_t> fromA(1000), fromB(1000);
+    for(size_t i = 0; i < fromA.size(); ++i){
+        fromA[i] = a();
+        fromB[i] = b();
+    }
+    std::sort(fromA.begin(), fromA.end());
+    std::sort(fromB.begin(), fromB.end());
+    std::vector<std::uint32_t> shared;
+    std::set_intersection(fromA.begin(), fromA.end(), fromB.begin(), fromB.end(), std::back_inserter(shared));
+    REQUIRE(shared.empty());
+
+    // and it works with the standard distributions
+    rvsamp::philox4x32 gen(3);
+    std::uniform_real_distribution<double> u;
+    double mean(0.0);
+    for(int i = 0; i < 10000; ++i)
+        mean += u(gen) / 10000;
+    REQUIRE(std::abs(mean - .5) < .01);
+}
+
+
+TEST_CASE("samplers built back to back get different streams", "[samplers]")
+{
+    std::vector<rvsamp::UnivNormSampler<double>> samplers(8);
+    std::vector<double> draws;
+    for(auto &s : samplers)
+        draws.push_back(s.sample());
+    std::sort(draws.begin(), draws.end());
+    REQUIRE(std::adjacent_find(draws.begin(), draws.end()) == draws.end());
+    REQUIRE(rvsamp::fresh_seed() != rvsamp::fresh_seed());
+}
+
+
+TEST_CASE("samplers on philox4x32 reproduce a (seed, stream) pair exactly", "[samplers]")
+{
+    rvsamp::UnivNormSampler<double, rvsamp::philox4x32> s1, s2;
+    s1.setSeed(99, 5);
+    s2.setSeed(99, 5);
+    double mean(0.0), sumSq(0.0);
+    for(int i = 0; i < 10000; ++i){
+        double z = s1.sample();
+        REQUIRE(z == s2.sample());
+        mean += z / 10000;
+        sumSq += z * z / 10000;
+    }
+    REQUIRE(std::abs(mean) < .05);
+    REQUIRE(std::abs(sumSq - 1.0) < .05);
+
+    s2.setSeed(99, 6);
+    s1.setSeed(99, 5);
+    REQUIRE(s1.sample() != s2.sample());
+}
+
+
+TEMPLATE_TEST_CASE("fill_std_normal matches the standard normal's moments and tails", "[samplers]",
+                   (rvsamp::UnivNormSampler<double>), (rvsamp::UnivNormSampler<float>),
+                   (rvsamp::UnivNormSampler<double, rvsamp::philox4x32>), (rvsamp::UnivNormSampler<double, std::mt19937_64>))
+{
+    using float_t = decltype(TestType().sample());
+    const size_t n = 200003; // not a whole number of blocks
+    std::vector<float_t> draws(n + 1, float_t(-99));
+    TestType s(1.0, 2.0);
+    s.setSeed(3);
+    s.fill(draws.data(), n);
+    REQUIRE(draws[n] == float_t(-99));
+
+    double mean(0.0), var(0.0), kurt(0.0), beyond2(0.0);
+    for(size_t i = 0; i < n; ++i){
+        double z = (draws[i] - 1.0) / 2.0;
+        REQUIRE(std::isfinite(z));
+        mean += z / n;
+        var += z * z / n;
+        kurt += z * z * z * z / n;
+        beyond2 += (std::abs(z) > 2.0) / static_cast<double>(n);
+    }
+    REQUIRE(std::abs(mean) < .01);
+    REQUIRE(std::abs(var - 1.0) < .01);
+    REQUIRE(std::abs(kurt - 3.0) < .05);
+    REQUIRE(std::abs(beyond2 - .0455) < .002);
+
+    // the same seed gives the same draws
+    std::vector<float_t> again(n);
+    s.setSeed(3);
+    s.fill(again.data(), n);
+    REQUIRE(std::equal(again.begin(), again.end(), draws.begin()));
+}
+
+
+TEST_CASE("MVNSampler::sampleMany matches the mean and covariance", "[samplers]")
+{
+    Eigen::Vector3d mean(1.0, -2.0, .5);
+    Eigen::Matrix3d cov;
+    cov << 2.0, .6, -.3,
+           .6, 1.0, .2,
+           -.3, .2, .5;
+    rvsamp::MVNSampler<3, double> s(mean, cov);
+    s.setSeed(4);
+
+    const Eigen::Index n = 100000;
+    Eigen::Matrix<double, 3, Eigen::Dynamic> draws(3, n);
+    s.sampleMany(draws);
+    Eigen::Vector3d sampleMean = draws.rowwise().mean();
+    Eigen::Matrix<double, 3, Eigen::Dynamic> centered = draws.colwise() - sampleMean;
+    Eigen::Matrix3d sampleCov = centered * centered.transpose() / (n - 1);
+    REQUIRE((sampleMean - mean).cwiseAbs().maxCoeff() < .02);
+    REQUIRE((sampleCov - cov).cwiseAbs().maxCoeff() < .03);
+
+    // so do blocks of a bigger matrix, contiguous or not
+    Eigen::Matrix<double, 4, Eigen::Dynamic> big = Eigen::Matrix<double, 4, Eigen::Dynamic>::Zero(4, 10);
+    s.sampleMany(big.topRows<3>().middleCols(2, 5));
+    REQUIRE(big.leftCols(2).isZero());
+    REQUIRE(big.rightCols(3).isZero());
+    REQUIRE(big.row(3).isZero());
+    REQUIRE((big.topRows<3>().middleCols(2, 5).array() != 0.0).all());
+}
+
+
+TEST_CASE("MVNSampler keeps a Cholesky factor that rank one updates track", "[samplers]")
+{
+    using samp_t = rvsamp::MVNSampler<4, double>;
+    samp_t::Mat A;
+    A << 2.0, .3, .1, 0.0,
+         .3, 1.5, -.2, .4,
+         .1, -.2, 1.0, .1,
+         0.0, .4, .1, .8;
+    samp_t::Vec v(.5, -1.0, .25, .75);
+
+    samp_t chol, eig;
+    chol.setCovarChol(A);
+    eig.setCovar(A);
+    for(double sigma : {1.0, .3, -.2}){
+        A += sigma * v * v.transpose();
+        chol.rankUpdate(v, sigma);
+        eig.rankUpdate(v, sigma);
+    }
+
+    // both should now draw from N(0, A)
+    const Eigen::Index n = 200000;
+    for(samp_t *s : {&chol, &eig}){
+        s->setSeed(5);
+        samp_t::Mats draws(4, n);
+        s->sampleMany(draws);
+        samp_t::Mat sampleCov = draws * draws.transpose() / n;
+        REQUIRE((sampleCov - A).cwiseAbs().maxCoeff() < .03);
+        REQUIRE(draws.rowwise().mean().cwiseAbs().maxCoeff() < .01);
+    }
+
+    // a downdate that removes more variance than there is fails loudly
+    REQUIRE_THROWS_AS(chol.rankUpdate(samp_t::Vec::UnitX(), -1e3), std::invalid_argument);
+    samp_t::Mat notPD = samp_t::Mat::Identity();
+    notPD(3,3) = -1.0;
+    REQUIRE_THROWS_AS(chol.setCovarChol(notPD), std::invalid_argument);
+}
+
+
+TEST_CASE("MVNSampler::sampleMany writes straight into soa_particles blocks", "[samplers]")
+{
+    Eigen::Vector2d mean(3.0, -1.0);
+    Eigen::Matrix2d L;
+    L << 1.0, 0.0,
+         .5, 2.0;
+    rvsamp::MVNSampler<2, double> s;
+    s.setMean(mean);
+    s.setCholFactor(L);
+    s.setSeed(6);
+
+    soa_particles<dynamic_parts, 2, double> parts(50001);
+    s.sampleMany(parts.map().middleCols(1, 50000));
+    auto draws = parts.map().middleCols(1, 50000);
+    REQUIRE(parts.map().col(0).isZero());
+
+    Eigen::Vector2d sampleMean = draws.rowwise().mean();
+    Eigen::Matrix<double, 2, Eigen::Dynamic> centered = draws.colwise() - sampleMean;
+    Eigen::Matrix2d sampleCov = centered * centered.transpose() / (draws.cols() - 1);
+    REQUIRE((sampleMean - mean).cwiseAbs().maxCoeff() < .03);
+    REQUIRE((sampleCov - L * L.transpose()).cwiseAbs().maxCoeff() < .06);
+
+    // one dimensional particles take the other overload
+    rvsamp::MVNSampler<1, double> s1;
+    s1.setCovarChol(Eigen::Matrix<double, 1, 1>::Constant(4.0));
+    soa_particles<dynamic_parts, 1, double> parts1(50000);
+    s1.sampleMany(parts1.map().middleCols(0, 50000));
+    REQUIRE(std::abs(parts1.map().squaredNorm() / 50000 - 4.0) < .1);
+}
+
+
+TEST_CASE("TruncUnivNormSampler matches the truncated normal's moments in every region", "[samplers]")
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    auto phi = [](double x){ return std::isinf(x) ? 0.0 : std::exp(-.5*x*x) / std::sqrt(2*M_PI); };
+    auto Phi = [](double x){ return .5*std::erfc(-x / std::sqrt(2.0)); };
+
+    const double mu(1.0), sigma(2.0);
+    // around the mode, narrow, one sided near the mode, far tail, a narrow window in the far tail, the other tail
+    const std::vector<std::array<double, 2>> bounds = {{-1.0, 5.0}, {1.2, 1.4}, {1.4, inf}, {11.0, inf}, {17.0, 18.0}, {-inf, -7.0}};
+    for(const auto &lu : bounds){
+        const double a = (lu[0] - mu) / sigma, b = (lu[1] - mu) / sigma;
+        const double Z = a > 0 ? Phi(-a) - Phi(-b) : Phi(b) - Phi(a);
+        const double m = (phi(a) - phi(b)) / Z;
+        const double aphia = std::isinf(a) ? 0.0 : a*phi(a), bphib = std::isinf(b) ? 0.0 : b*phi(b);
+        const double mean = mu + sigma*m;
+        const double var = sigma*sigma*(1 + (aphia - bphib)/Z - m*m);
+
+        rvsamp::TruncUnivNormSampler<double> s(mu, sigma, lu[0], lu[1]);
+        s.setSeed(8);
+        const size_t n = 100000;
+        std::vector<double> draws(n);
+        for(size_t i = 0; i < n/2; ++i)
+            draws[i] = s.sample();
+        s.fill(draws.data() + n/2, n - n/2);
+
+        for(bool bulk : {false, true}){
+            const auto first = draws.begin() + bulk*n/2, last = first + n/2;
+            double sampleMean(0.0), sampleVar(0.0);
+            for(auto it = first; it != last; ++it)
+                sampleMean += *it / (n/2);
+            for(auto it = first; it != last; ++it)
+                sampleVar += (*it - sampleMean)*(*it - sampleMean) / (n/2);
+            INFO("bounds " << lu[0] << ", " << lu[1] << (bulk ? " with fill()" : " with sample()"));
+            REQUIRE(lu[0] <= *std::min_element(first, last));
+            REQUIRE(*std::max_element(first, last) <= lu[1]);
+            REQUIRE(std::abs(sampleMean - mean) < 5*std::sqrt(var / (n/2)));
+            REQUIRE(std::abs(sampleVar / var - 1.0) < .03);
+        }
+    }
+
+    REQUIRE_THROWS_AS(rvsamp::TruncUnivNormSampler<double>(0.0, 1.0, 2.0, 1.0), std::invalid_argument);
+}
+
+
+TEST_CASE("samplers draw from a different parameter for every element of an array", "[samplers]")
+{
+    // k interleaved groups, each with its own parameters, so that neighbouring elements always differ
+    const size_t k = 6, per = 40000, n = k*per;
+    auto groupMoments = [&](const auto *draws, size_t g){
+        double mean(0.0), var(0.0);
+        for(size_t i = g; i < n; i += k)
+            mean += static_cast<double>(draws[i]) / per;
+        for(size_t i = g; i < n; i += k)
+            var += (draws[i] - mean)*(draws[i] - mean) / per;
+        return std::array<double, 2>{mean, var};
+    };
+    auto close = [](double x, double target, double sd){ return std::abs(x - target) < 5*sd + 1e-9; };
+
+    SECTION("Poisson"){
+        const std::array<double, k> lambdas{.5, 3.0, 9.9, 10.0, 50.0, 1000.0};
+        std::vector<double> lambda(n);
+        std::vector<int> draws(n);
+        for(size_t i = 0; i < n; ++i)
+            lambda[i] = lambdas[i % k];
+        rvsamp::PoissonSampler<double, int> s;
+        s.setSeed(9);
+        s.sample(lambda.data(), draws.data(), n);
+        for(size_t g = 0; g < k; ++g){
+            auto m = groupMoments(draws.data(), g);
+            INFO("lambda = " << lambdas[g]);
+            REQUIRE(close(m[0], lambdas[g], std::sqrt(lambdas[g] / per)));
+            REQUIRE(std::abs(m[1] / lambdas[g] - 1.0) < .04);
+        }
+    }
+
+    SECTION("Gamma"){
+        const std::array<double, k> alphas{.3, 1.0, 2.5, 20.0, .05, 7.0};
+        const std::array<double, k> betas{2.0, .5, 1.0, .1, 3.0, 1.5};
+        std::vector<double> alpha(n), beta(n), draws(n);
+        for(size_t i = 0; i < n; ++i){
+            alpha[i] = alphas[i % k];
+            beta[i] = betas[i % k];
+        }
+        rvsamp::UnivGammaSampler<double> s;
+        s.setSeed(10);
+        s.sample(alpha.data(), beta.data(), draws.data(), n);
+        REQUIRE(*std::min_element(draws.begin(), draws.end()) >= 0.0);
+        for(size_t g = 0; g < k; ++g){
+            const double mean = alphas[g]*betas[g], var = alphas[g]*betas[g]*betas[g];
+            auto m = groupMoments(draws.data(), g);
+            INFO("alpha = " << alphas[g]);
+            REQUIRE(close(m[0], mean, std::sqrt(var / per)));
+            REQUIRE(std::abs(m[1] / var - 1.0) < (alphas[g] < .1 ? .25 : .06));
+        }
+    }
+
+    SECTION("Bernoulli"){
+        const std::array<double, k> ps{0.0, .01, .3, .5, .9, 1.0};
+        std::vector<double> p(n);
+        std::vector<int> draws(n);
+        for(size_t i = 0; i < n; ++i)
+            p[i] = ps[i % k];
+        rvsamp::BernSampler<double, int> s;
+        s.setSeed(11);
+        s.sample(p.data(), draws.data(), n);
+        for(size_t g = 0; g < k; ++g){
+            auto m = groupMoments(draws.data(), g);
+            INFO("p = " << ps[g]);
+            REQUIRE(close(m[0], ps[g], std::sqrt(ps[g]*(1 - ps[g]) / per)));
+        }
+
+        // setP used to be ignored by sample()
+        s.setP(1.0);
+        REQUIRE(s.sample() == 1);
+        s.setP(0.0);
+        REQUIRE(s.sample() == 0);
+    }
+
+    SECTION("normal and log-normal"){
+        const std::array<double, k> mus{-3.0, 0.0, .5, 2.0, 10.0, -1.0};
+        const std::array<double, k> sigmas{.1, 1.0, .5, 2.0, .3, .7};
+        std::vector<double> mu(n), sigma(n), draws(n);
+        for(size_t i = 0; i < n; ++i){
+            mu[i] = mus[i % k];
+            sigma[i] = sigmas[i % k];
+        }
+        rvsamp::UnivNormSampler<double> s;
+        s.setSeed(12);
+        s.sample(mu.data(), sigma.data(), draws.data(), n);
+        for(size_t g = 0; g < k; ++g){
+            auto m = groupMoments(draws.data(), g);
+            REQUIRE(close(m[0], mus[g], sigmas[g] / std::sqrt(per)));
+            REQUIRE(std::abs(m[1] / (sigmas[g]*sigmas[g]) - 1.0) < .04);
+        }
+
+        rvsamp::UnivLogNormSampler<double> ls;
+        ls.setSeed(13);
+        ls.sample(mu.data(), sigma.data(), draws.data(), n);
+        for(double &x : draws)
+            x = std::log(x);
+        for(size_t g = 0; g < k; ++g){
+            auto m = groupMoments(draws.data(), g);
+            REQUIRE(close(m[0], mus[g], sigmas[g] / std::sqrt(per)));
+            REQUIRE(std::abs(m[1] / (sigmas[g]*sigmas[g]) - 1.0) < .04);
+        }
+    }
+}
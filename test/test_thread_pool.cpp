@@ -0,0 +1,136 @@
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <pf/filter_core.h>
+#include <pf/thread_pool.h>
+
+
+TEST_CASE("parallel_for covers every index exactly once", "[thread_pool]")
+{
+    for(unsigned int nthreads = 1; nthreads <= 4; ++nthreads){
+
+        thread_pool pool(nthreads);
+        REQUIRE(pool.size() == nthreads);
+
+        std::vector<int> hits(1001, 0);
+        std::vector<unsigned int> owner(1001, 99);
+        pool.parallel_for(hits.size(), [&](size_t first, size_t last, unsigned int w){
+            for(size_t i = first; i < last; ++i){
+                hits[i]++;
+                owner[i] = w;
+            }
+        });
+        for(size_t i = 0; i < hits.size(); ++i){
+            REQUIRE(hits[i] == 1);
+            REQUIRE(owner[i] < nthreads);
+        }
+
+        // chunks are contiguous and in worker order
+        for(size_t i = 1; i < owner.size(); ++i)
+            REQUIRE(owner[i-1] <= owner[i]);
+    }
+}
+
+
+TEST_CASE("run calls every worker and reports its index", "[thread_pool]")
+{
+    thread_pool pool(3);
+    std::atomic<int> total(0);
+    std::vector<unsigned int> seen(3, 99);
+    for(int rep = 0; rep < 50; ++rep){
+        pool.run([&](unsigned int w){
+            seen[w] = thread_pool::this_worker();
+            total += 1;
+        });
+    }
+    REQUIRE(total == 150);
+    for(unsigned int w = 0; w < 3; ++w)
+        REQUIRE(seen[w] == w);
+}
+
+
+TEST_CASE("exceptions thrown by workers reach the caller", "[thread_pool]")
+{
+    thread_pool pool(2);
+    REQUIRE_THROWS_AS(pool.run([](unsigned int w){ if(w == 1) throw std::runtime_error("oops"); }), 
+                      std::runtime_error);
+
+    // still usable afterwards
+    int calls(0);
+    pool.parallel_for(1, [&](size_t, size_t, unsigned int){ calls++; });
+    REQUIRE(calls == 1);
+}
+
+
+TEST_CASE("parallel_normalize agrees with a serial normalization", "[thread_pool]")
+{
+    // the first chunk has nothing but zero weights
+    std::vector<double> logWts(1001);
+    for(size_t i = 0; i < logWts.size(); ++i)
+        logWts[i] = i < 100 ? -std::numeric_limits<double>::infinity() : std::sin(.1*i) - 1000.0;
+
+    double sum(0.0), sum2(0.0);
+    std::vector<double> expected(logWts.size());
+    for(size_t i = 0; i < logWts.size(); ++i){
+        expected[i] = std::exp(logWts[i] + 1000.0);
+        sum += expected[i];
+        sum2 += expected[i]*expected[i];
+    }
+
+    for(unsigned int nthreads = 1; nthreads <= 4; ++nthreads){
+
+        thread_pool pool(nthreads);
+        std::vector<lse_partial<double>> pieces;
+        std::vector<double> normWts(logWts.size(), -1.0);
+        lse_partial<double> lse = parallel_normalize(pool, pieces, logWts.data(), normWts.data(), logWts.size());
+        REQUIRE(lse.logSumExp() == Approx(std::log(sum) - 1000.0));
+        REQUIRE(lse.ess() == Approx(sum*sum/sum2));
+        for(size_t i = 0; i < logWts.size(); ++i)
+            REQUIRE(normWts[i] == Approx(expected[i]/sum).margin(1e-15));
+    }
+}
+
+
+TEST_CASE("FilterCore expectations and the resampling decision", "[thread_pool]")
+{
+    using ssv = Eigen::Matrix<double, 1, 1>;
+    using Mat = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>;
+
+    const size_t N = 300;
+    std::vector<double, Eigen::aligned_allocator<double>> logWts(N);
+    std::vector<ssv> parts(N);
+    double sum(0.0), numer(0.0);
+    for(size_t i = 0; i < N; ++i){
+        logWts[i] = std::cos(.3*i);
+        parts[i] = ssv::Constant(.01*i);
+        sum += std::exp(logWts[i]);
+        numer += parts[i](0) * std::exp(logWts[i]);
+    }
+
+    std::vector<std::function<const Mat(const ssv&)>> fs;
+    fs.push_back([](const ssv &x) -> const Mat { return x; });
+
+    for(unsigned int nthreads = 1; nthreads <= 3; ++nthreads){
+
+        // resample every other time point, and only if the ESS is below half of N
+        FilterCore<dynamic_parts, ssv, double> core(2, nthreads, N);
+        core.setESSThreshold(.5);
+        REQUIRE(core.getNumThreads() == nthreads);
+        REQUIRE(core.weigh(logWts).logSumExp() == Approx(std::log(sum)));
+        core.expect(fs, [&](const auto &h, size_t i) { return h(parts[i]); });
+        REQUIRE(core.getExpectations().size() == 1);
+        REQUIRE(core.getExpectations()[0](0,0) == Approx(numer/sum));
+        REQUIRE(core.getESS() > N/2);
+        REQUIRE_FALSE(core.resampleDue(1));
+        REQUIRE_FALSE(core.resampleDue(0));
+
+        core.setESSThreshold(1.0);
+        REQUIRE(core.resampleDue(1));
+        REQUIRE_FALSE(core.resampleDue(0));
+    }
+}